@@ -0,0 +1,511 @@
+#include "stdafx.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "lib_gpu.h"
+#include "nvidia_interface.h"
+#include "nvidia_simple_api.h"
+
+/**
+ * Benchmarks for the library, run against the simulated driver so results
+ * don't depend on the hardware or driver installed.
+ *
+ * Every result is written as one JSON object per line, for example
+ *   {"benchmark":"poll","gpus":4,"latency_us":50,"samples":1000,"mean_ns":...}
+ */
+
+using namespace lib_gpu;
+using Clock = std::chrono::steady_clock;
+
+struct BenchmarkOptions
+{
+    unsigned gpus = 4;
+    unsigned latencyUs = 50;
+    unsigned iterations = 1000;
+    unsigned maxThreads = 64;
+    std::chrono::milliseconds duration{ 500 };
+    std::string output;
+};
+
+typedef std::vector<std::pair<std::string, double>> BenchmarkValues;
+
+// Keeps the compiler from optimizing away the calls being measured
+static volatile float benchmark_sink;
+
+#pragma region Helpers
+
+double elapsedNanoseconds(Clock::time_point start, Clock::time_point end)
+{
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+void report(std::ostream& out, const std::string& name, const BenchmarkOptions& options, const BenchmarkValues& values)
+{
+    out << "{\"benchmark\":\"" << name << "\""
+        << ",\"gpus\":" << options.gpus
+        << ",\"latency_us\":" << options.latencyUs;
+    for (const auto& value : values) {
+        out << ",\"" << value.first << "\":" << value.second;
+    }
+    out << "}" << std::endl;
+}
+
+/**
+ * Summarize per-call timings as mean, min, max and percentiles, all in
+ * nanoseconds.
+ */
+BenchmarkValues summarize(std::vector<double> samples)
+{
+    if (samples.empty()) {
+        return{ { "samples", 0 } };
+    }
+
+    std::sort(samples.begin(), samples.end());
+    auto sum = 0.0;
+    for (const auto sample : samples) {
+        sum += sample;
+    }
+
+    const auto percentile = [&](double p) {
+        const auto index = static_cast<size_t>(p * (samples.size() - 1));
+        return samples[index];
+    };
+
+    return{
+        { "samples", static_cast<double>(samples.size()) },
+        { "mean_ns", sum / samples.size() },
+        { "min_ns", samples.front() },
+        { "p50_ns", percentile(0.50) },
+        { "p99_ns", percentile(0.99) },
+        { "max_ns", samples.back() },
+    };
+}
+
+/**
+ * Time `iterations` batches of `batch` calls to `function`, and return the
+ * mean time per call of every batch. Batching keeps the clock overhead out of
+ * the results for calls that only take a few nanoseconds.
+ */
+template <typename F>
+std::vector<double> measure(unsigned iterations, unsigned batch, F function)
+{
+    std::vector<double> samples;
+    samples.reserve(iterations);
+
+    for (auto i = 0u; i < iterations; i++) {
+        const auto start = Clock::now();
+        for (auto j = 0u; j < batch; j++) {
+            function();
+        }
+        samples.push_back(elapsedNanoseconds(start, Clock::now()) / batch);
+    }
+
+    return samples;
+}
+
+/**
+ * Run `threads` threads calling `function` with their index for `duration`,
+ * and return the total number of calls and the calls per second.
+ */
+template <typename F>
+BenchmarkValues measureThroughput(unsigned threads, std::chrono::milliseconds duration, F function)
+{
+    std::atomic<bool> running(true);
+    std::atomic<unsigned long long> calls(0);
+    std::vector<std::thread> workers;
+
+    const auto start = Clock::now();
+    for (auto i = 0u; i < threads; i++) {
+        workers.emplace_back([&, i] {
+            auto count = 0ull;
+            while (running.load(std::memory_order_relaxed)) {
+                function(i, count);
+                count++;
+            }
+            calls += count;
+        });
+    }
+
+    std::this_thread::sleep_for(duration);
+    running = false;
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    const auto seconds = elapsedNanoseconds(start, Clock::now()) / 1e9;
+
+    return{
+        { "threads", static_cast<double>(threads) },
+        { "calls", static_cast<double>(calls.load()) },
+        { "calls_per_sec", calls.load() / seconds },
+    };
+}
+
+BenchmarkValues withValues(BenchmarkValues values, const BenchmarkValues& extra)
+{
+    values.insert(values.begin(), extra.begin(), extra.end());
+    return values;
+}
+
+/**
+ * The options as reported for a benchmark that runs on `gpus` GPUs rather
+ * than the number asked for.
+ */
+BenchmarkOptions withGpus(BenchmarkOptions options, unsigned gpus)
+{
+    options.gpus = gpus;
+    return options;
+}
+
+#pragma endregion
+
+#pragma region Benchmarks
+
+bool benchmarkPoll(std::ostream& out, const BenchmarkOptions& options)
+{
+    if (!init_library_with_simulation(options.gpus, options.latencyUs)) {
+        return false;
+    }
+
+    NvidiaApi api;
+    const auto gpu = api.getGPU(0);
+    if (!gpu || !gpu->poll()) {
+        return false;
+    }
+
+    report(out, "poll", options, summarize(measure(options.iterations, 1, [&] { gpu->poll(); })));
+    report(out, "poll_clocks_usage", options, summarize(measure(options.iterations, 1, [&] {
+        gpu->poll(GPU_DATASET_FIELD_CURRENT_CLOCKS | GPU_DATASET_FIELD_USAGE);
+    })));
+
+    // The same polls with call statistics on, followed by the statistics
+    NvidiaApi::resetCallStats();
+    NvidiaApi::setCallStatsEnabled(true);
+    report(out, "poll_call_stats", options, summarize(measure(options.iterations, 1, [&] { gpu->poll(); })));
+    NvidiaApi::setCallStatsEnabled(false);
+
+    for (auto i = 0u; i < NVIDIA_FUNCTION_COUNT; i++) {
+        const auto function = static_cast<NVIDIA_FUNCTION>(i);
+        NvidiaCallStats stats;
+        if (!NvidiaApi::getCallStats(function, stats) || stats.calls == 0) {
+            continue;
+        }
+
+        out << "{\"call_stats\":\"" << get_function_name(function) << "\""
+            << ",\"calls\":" << stats.calls
+            << ",\"errors\":" << stats.errors
+            << ",\"mean_ns\":" << static_cast<double>(stats.totalLatencyNs) / stats.calls
+            << ",\"histogram\":[";
+        for (auto j = 0u; j < NVIDIA_CALL_LATENCY_BUCKETS; j++) {
+            out << (j > 0 ? "," : "") << stats.latencyHistogram[j];
+        }
+        out << "]}" << std::endl;
+    }
+    return true;
+}
+
+bool benchmarkGetters(std::ostream& out, const BenchmarkOptions& options)
+{
+    if (!init_library_with_simulation(options.gpus, options.latencyUs)) {
+        return false;
+    }
+
+    NvidiaApi api;
+    const auto gpu = api.getGPU(0);
+    if (!gpu || !gpu->poll()) {
+        return false;
+    }
+
+    const auto batch = 1000u;
+    GpuClocks clocks;
+    GpuUsage usage;
+    GpuOverclockProfile profile;
+
+    report(out, "get_clocks", options, summarize(measure(options.iterations, batch, [&] {
+        benchmark_sink = gpu->getClocks()->coreClock;
+    })));
+    report(out, "get_clocks_out", options, summarize(measure(options.iterations, batch, [&] {
+        gpu->getClocks(clocks);
+        benchmark_sink = clocks.coreClock;
+    })));
+    report(out, "get_overclock_profile", options, summarize(measure(options.iterations, batch, [&] {
+        benchmark_sink = gpu->getOverclockProfile()->coreOverclock.currentValue;
+    })));
+    report(out, "get_overclock_profile_out", options, summarize(measure(options.iterations, batch, [&] {
+        gpu->getOverclockProfile(profile);
+        benchmark_sink = profile.coreOverclock.currentValue;
+    })));
+    report(out, "get_usage", options, summarize(measure(options.iterations, batch, [&] {
+        benchmark_sink = gpu->getUsage()->coreUsage;
+    })));
+    report(out, "get_usage_out", options, summarize(measure(options.iterations, batch, [&] {
+        gpu->getUsage(usage);
+        benchmark_sink = usage.coreUsage;
+    })));
+    report(out, "get_serial_number", options, summarize(measure(options.iterations, batch, [&] {
+        benchmark_sink = static_cast<float>(gpu->getSerialNumber().size());
+    })));
+    report(out, "get_snapshot", options, summarize(measure(options.iterations, batch, [&] {
+        benchmark_sink = gpu->getSnapshot().getTemperature();
+    })));
+    return true;
+}
+
+bool benchmarkSetOverclock(std::ostream& out, const BenchmarkOptions& options)
+{
+    if (!init_library_with_simulation(options.gpus, options.latencyUs)) {
+        return false;
+    }
+
+    NvidiaApi api;
+    const auto gpu = api.getGPU(0);
+    if (!gpu || !gpu->poll()) {
+        return false;
+    }
+
+    // Alternate between two values, so every call really changes something
+    auto toggle = false;
+    auto failures = 0u;
+    auto samples = measure((std::min)(options.iterations, 200u), 1, [&] {
+        GpuOverclockDefinitionMap overclock;
+        overclock[GPU_OVERCLOCK_SETTING_AREA_CORE] = toggle ? 100.0f : 50.0f;
+        toggle = !toggle;
+        if (!gpu->setOverclock(overclock)) {
+            failures++;
+        }
+    });
+
+    report(out, "set_overclock", options, withValues(summarize(std::move(samples)), {
+        { "failures", static_cast<double>(failures) },
+    }));
+    return true;
+}
+
+bool benchmarkPollAll(std::ostream& out, const BenchmarkOptions& options)
+{
+    for (auto gpus = 1u; gpus <= NVIDIA_MAX_PHYSICAL_GPUS && gpus <= (std::max)(options.gpus, 16u); gpus *= 2) {
+        if (!init_library_with_simulation(gpus, options.latencyUs)) {
+            return false;
+        }
+
+        NvidiaApi api;
+        if (api.getGPUCount() != gpus) {
+            return false;
+        }
+
+        // The first call starts the worker threads
+        api.pollAll();
+
+        report(out, "poll_all", withGpus(options, gpus), summarize(measure(options.iterations, 1, [&] { api.pollAll(); })));
+    }
+
+    return true;
+}
+
+bool benchmarkHistory(std::ostream& out, const BenchmarkOptions& options)
+{
+    // Filled with made up samples, 20 per second, since polling for real
+    // would take far too long.
+    const auto sampleCount = 4096u;
+    GpuHistoryConfig config;
+    config.capacity[GPU_HISTORY_RESOLUTION_RAW] = sampleCount;
+    GpuHistory history(config);
+
+    for (auto i = 0u; i < sampleCount; i++) {
+        GpuSample sample = {};
+        sample.timestamp = i * 50000000ull;
+        sample.coreClock = 1500.0f + i % 100;
+        sample.temperature = 60.0f + i % 10;
+        history.record(sample);
+    }
+
+    GpuSampleAggregate aggregate;
+    report(out, "history_aggregate_raw", options, withValues(summarize(measure(options.iterations, 1, [&] {
+        history.aggregate(GPU_HISTORY_RESOLUTION_RAW, 0, ULLONG_MAX, aggregate);
+        benchmark_sink = aggregate.mean[GPU_SAMPLE_VALUE_CORE_CLOCK];
+    })), {
+        { "history_samples", static_cast<double>(sampleCount) },
+    }));
+    report(out, "history_aggregate_seconds", options, summarize(measure(options.iterations, 1, [&] {
+        history.aggregate(GPU_HISTORY_RESOLUTION_SECOND, 0, ULLONG_MAX, aggregate);
+        benchmark_sink = aggregate.mean[GPU_SAMPLE_VALUE_CORE_CLOCK];
+    })));
+
+    std::vector<GpuSample> samples;
+    history.getSamples(0, ULLONG_MAX, samples);
+    GpuSampleArchive archive;
+    auto next = 0u;
+    report(out, "archive_append", options, summarize(measure(options.iterations, 1, [&] {
+        archive.append(samples[next++ % sampleCount]);
+    })));
+
+    // Decoding a whole window of the same samples as the raw aggregate above
+    GpuSampleArchive window;
+    for (const auto& sample : samples) {
+        window.append(sample);
+    }
+    std::vector<GpuSample> decoded;
+    report(out, "archive_decode", options, withValues(summarize(measure(options.iterations, 1, [&] {
+        window.getSamples(0, ULLONG_MAX, decoded);
+        benchmark_sink = decoded.back().coreClock;
+    })), {
+        { "archive_samples", static_cast<double>(window.getSampleCount()) },
+        { "archive_bytes", static_cast<double>(window.getMemoryUsage()) },
+        { "raw_bytes", static_cast<double>(sampleCount * sizeof(GpuSample)) },
+    }));
+    return true;
+}
+
+bool benchmarkSimpleApi(std::ostream& out, const BenchmarkOptions& options)
+{
+    // The simple API keeps its GPUs for the lifetime of the process, so this
+    // runs against a single simulated setup.
+    if (!init_library_with_simulation(options.gpus, options.latencyUs) || !nvidia_simple_api::init_simple_api()) {
+        return false;
+    }
+
+    const auto gpuCount = nvidia_simple_api::get_gpu_count();
+
+    for (auto threads = 1u; threads <= options.maxThreads; threads *= 2) {
+        report(out, "simple_api_get_clocks", withGpus(options, gpuCount), measureThroughput(threads, options.duration, [&](unsigned i, unsigned long long count) {
+            benchmark_sink = nvidia_simple_api::get_clocks((i + static_cast<unsigned>(count)) % gpuCount).coreClock;
+        }));
+    }
+
+    return true;
+}
+
+bool benchmarkSimpleApiScaling(std::ostream& out, const BenchmarkOptions& options)
+{
+    // Runs on the GPUs benchmarkSimpleApi set up. The readers want data no
+    // older than a millisecond, so they keep polling the GPUs themselves.
+    // Each thread sticks to one GPU, and the calls per second should grow
+    // with both threads and GPUs.
+    const auto gpuCount = nvidia_simple_api::get_gpu_count();
+    if (gpuCount == 0) {
+        return false;
+    }
+    const auto maxAgeUs = 1000u;
+
+    for (auto gpus = 1u; ; gpus = (std::min)(gpus * 2, gpuCount)) {
+        for (auto threads = gpus; threads <= options.maxThreads; threads *= 2) {
+            report(out, "simple_api_scaling", withGpus(options, gpus), withValues(measureThroughput(threads, options.duration, [&](unsigned i, unsigned long long) {
+                benchmark_sink = nvidia_simple_api::get_usages_max_age(i % gpus, maxAgeUs, nullptr).coreUsage;
+            }), {
+                { "max_age_us", static_cast<double>(maxAgeUs) },
+            }));
+        }
+
+        if (gpus == gpuCount) {
+            break;
+        }
+    }
+
+    // Readers of GPU 0 take whatever data it has, while another thread keeps
+    // polling GPU 1 as fast as the driver allows. The GPUs' poll state is on
+    // cache lines of its own, so those polls shouldn't slow the readers down.
+    if (gpuCount < 2) {
+        return true;
+    }
+    auto neighbourOptions = withGpus(options, 2);
+    neighbourOptions.latencyUs = 0;
+    set_simulation_latency(neighbourOptions.latencyUs);
+    for (auto neighbourPolls = 0u; neighbourPolls <= 1; neighbourPolls++) {
+        std::atomic<bool> stop{ false };
+        std::thread neighbour([&] {
+            while (neighbourPolls && !stop.load(std::memory_order_relaxed)) {
+                benchmark_sink = nvidia_simple_api::get_usages_max_age(1, 0, nullptr).coreUsage;
+            }
+        });
+
+        for (auto threads = 1u; threads <= options.maxThreads; threads *= 2) {
+            report(out, "simple_api_neighbour_polls", neighbourOptions, withValues(measureThroughput(threads, options.duration, [&](unsigned, unsigned long long) {
+                benchmark_sink = nvidia_simple_api::get_usages_max_age(0, UINT_MAX, nullptr).coreUsage;
+            }), {
+                { "neighbour_polls", static_cast<double>(neighbourPolls) },
+            }));
+        }
+
+        stop = true;
+        neighbour.join();
+    }
+    set_simulation_latency(options.latencyUs);
+
+    return true;
+}
+
+#pragma endregion
+
+bool parseOptions(int argc, char** argv, BenchmarkOptions& options)
+{
+    for (auto i = 1; i < argc; i++) {
+        const auto arg = std::string(argv[i]);
+        if (i + 1 >= argc) {
+            return false;
+        }
+
+        const auto value = std::string(argv[++i]);
+        if (arg == "--output") {
+            options.output = value;
+            continue;
+        }
+
+        const auto number = static_cast<unsigned>(std::stoul(value));
+        if (arg == "--gpus") {
+            options.gpus = number;
+        } else if (arg == "--latency-us") {
+            options.latencyUs = number;
+        } else if (arg == "--iterations") {
+            options.iterations = number;
+        } else if (arg == "--max-threads") {
+            options.maxThreads = number;
+        } else if (arg == "--duration-ms") {
+            options.duration = std::chrono::milliseconds(number);
+        } else {
+            return false;
+        }
+    }
+
+    return options.gpus > 0 && options.gpus <= NVIDIA_MAX_PHYSICAL_GPUS && options.iterations > 0;
+}
+
+int main(int argc, char** argv)
+{
+    BenchmarkOptions options;
+    try {
+        if (!parseOptions(argc, argv, options)) {
+            std::cerr << "Usage: Benchmark [--gpus N] [--latency-us N] [--iterations N] "
+                << "[--max-threads N] [--duration-ms N] [--output file]" << std::endl;
+            return -1;
+        }
+    }
+    catch (std::logic_error) {
+        std::cerr << "Invalid number" << std::endl;
+        return -1;
+    }
+
+    std::ofstream fout;
+    if (!options.output.empty()) {
+        fout.open(options.output, std::ofstream::trunc);
+        if (fout.fail()) {
+            return -1;
+        }
+    }
+    auto& out = options.output.empty() ? std::cout : fout;
+
+    const auto success = benchmarkPoll(out, options)
+        && benchmarkGetters(out, options)
+        && benchmarkSetOverclock(out, options)
+        && benchmarkPollAll(out, options)
+        && benchmarkHistory(out, options)
+        && benchmarkSimpleApi(out, options)
+        && benchmarkSimpleApiScaling(out, options);
+
+    return success ? 0 : 1;
+}
\ No newline at end of file
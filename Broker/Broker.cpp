@@ -0,0 +1,128 @@
+#include "stdafx.h"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "lib_gpu.h"
+#include "nvidia_interface.h"
+#include "GpuBroker.h"
+
+/**
+ * Owns the driver for every process on the machine. Clients connect to the
+ * pipe through GpuBrokerClient, or the simple API's connect_broker(), and
+ * never load the driver themselves.
+ *
+ *   Broker [--pipe name] [--simulate N] [--latency-us N] [--stats-s N]
+ */
+
+using namespace lib_gpu;
+
+struct BrokerOptions
+{
+    std::string pipeName = GPU_BROKER_PIPE_NAME;
+    /// Serve this many simulated GPUs instead of the real ones
+    unsigned simulatedGpus = 0;
+    unsigned latencyUs = 0;
+    /// How often to print statistics, never if 0
+    std::chrono::seconds statsInterval{ 0 };
+};
+
+static std::atomic<bool> broker_stopping(false);
+
+BOOL WINAPI stopBroker(DWORD)
+{
+    broker_stopping = true;
+    return TRUE;
+}
+
+bool parseOptions(int argc, char** argv, BrokerOptions& options)
+{
+    for (auto i = 1; i < argc; i++) {
+        const auto arg = std::string(argv[i]);
+        if (i + 1 >= argc) {
+            return false;
+        }
+
+        const auto value = std::string(argv[++i]);
+        if (arg == "--pipe") {
+            options.pipeName = value;
+            continue;
+        }
+
+        const auto number = std::stoul(value);
+        if (arg == "--simulate") {
+            options.simulatedGpus = static_cast<unsigned>(number);
+        } else if (arg == "--latency-us") {
+            options.latencyUs = static_cast<unsigned>(number);
+        } else if (arg == "--stats-s") {
+            options.statsInterval = std::chrono::seconds(number);
+        } else {
+            return false;
+        }
+    }
+
+    return options.simulatedGpus <= NVIDIA_MAX_PHYSICAL_GPUS;
+}
+
+void printStats(const GpuBrokerStats& stats)
+{
+    std::cout << stats.messages << " messages, " << stats.requests << " requests in " << stats.batches << " batches, "
+        << stats.polls << " polls, " << stats.coalescedPolls << " poll requests coalesced" << std::endl;
+}
+
+int serve(const BrokerOptions& options)
+{
+    const auto initialized = options.simulatedGpus > 0 ?
+        init_library_with_simulation(options.simulatedGpus, options.latencyUs) : init_library();
+    if (!initialized) {
+        std::cerr << "Couldn't load the driver" << std::endl;
+        return -1;
+    }
+
+    NvidiaApi api;
+    // Keeps the data fresh, so snapshot requests don't wait on the driver
+    api.startScheduler();
+
+    GpuBrokerServer server;
+    if (!server.start(api, options.pipeName)) {
+        std::cerr << "Couldn't serve on " << options.pipeName << ", is another broker running?" << std::endl;
+        return -1;
+    }
+
+    std::cout << "Serving " << api.getGPUCount() << " GPUs on " << options.pipeName
+        << ", press Ctrl+C to stop" << std::endl;
+    SetConsoleCtrlHandler(stopBroker, TRUE);
+
+    auto lastStats = std::chrono::steady_clock::now();
+    while (!broker_stopping) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        const auto now = std::chrono::steady_clock::now();
+        if (options.statsInterval.count() > 0 && now - lastStats >= options.statsInterval) {
+            printStats(server.getStats());
+            lastStats = now;
+        }
+    }
+
+    SetConsoleCtrlHandler(stopBroker, FALSE);
+    server.stop();
+    printStats(server.getStats());
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    BrokerOptions options;
+    try {
+        if (!parseOptions(argc, argv, options)) {
+            std::cerr << "Usage: Broker [--pipe name] [--simulate N] [--latency-us N] [--stats-s N]" << std::endl;
+            return -1;
+        }
+    }
+    catch (std::logic_error) {
+        std::cerr << "Invalid number" << std::endl;
+        return -1;
+    }
+
+    return serve(options);
+}
\ No newline at end of file
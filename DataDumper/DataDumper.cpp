@@ -1,10 +1,16 @@
 #include "stdafx.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <thread>
 #include "lib_gpu.h"
 #include "nvidia_interface.h"
 #include "nvidia_simple_api.h"
 #include "nvidia_interface_datatype_dumpers.h"
+#include "StreamWriter.h"
 
 using namespace lib_gpu;
 using namespace lib_gpu::nvidia_simple_api;
@@ -20,7 +26,7 @@ int debug()
     GpuClocks clocks = get_clocks(0);
     GpuClocks clocks1 = get_clocks(1);
     GpuUsage usages = get_usages(0);
-    auto api = NvidiaApi();
+    NvidiaApi api;
     auto gpu = api.getGPU(0);
     gpu->poll();
     bool success = false;
@@ -124,7 +130,7 @@ int dump()
     memset(buffer, 0, 1024);
 
     init_library();
-    auto api = NvidiaApi();
+    NvidiaApi api;
 
     auto separator = std::string(72, '=');
     auto fout = std::ofstream{ "gpu_dump.txt", std::ofstream::trunc };
@@ -205,12 +211,159 @@ int dump()
     return 0;
 }
 
+struct StreamOptions
+{
+    std::chrono::milliseconds interval{ 100 };
+    /// How long to log for, 0 to log until stopped with Ctrl+C
+    std::chrono::seconds duration{ 0 };
+    /// Log this many simulated GPUs instead of the real ones
+    unsigned simulatedGpus = 0;
+    StreamWriterConfig writer;
+};
+
+static std::atomic<bool> stream_stopping(false);
+
+BOOL WINAPI stopStream(DWORD)
+{
+    stream_stopping = true;
+    return TRUE;
+}
+
+bool parseStreamOptions(int argc, char** argv, StreamOptions& options)
+{
+    for (auto i = 2; i < argc; i++) {
+        const auto arg = std::string(argv[i]);
+        if (i + 1 >= argc) {
+            return false;
+        }
+
+        const auto value = std::string(argv[++i]);
+        if (arg == "--output") {
+            options.writer.prefix = value;
+            continue;
+        }
+
+        const auto number = std::stoul(value);
+        if (arg == "--interval-ms") {
+            options.interval = std::chrono::milliseconds(number);
+        } else if (arg == "--duration-s") {
+            options.duration = std::chrono::seconds(number);
+        } else if (arg == "--rotate-mb") {
+            options.writer.rotateBytes = number * 1024ull * 1024;
+        } else if (arg == "--rotate-minutes") {
+            options.writer.rotateInterval = std::chrono::minutes(number);
+        } else if (arg == "--simulate") {
+            options.simulatedGpus = static_cast<unsigned>(number);
+        } else {
+            return false;
+        }
+    }
+
+    return options.interval.count() > 0 && options.simulatedGpus <= NVIDIA_MAX_PHYSICAL_GPUS;
+}
+
+// Format one CSV line for the sample, returning its length
+int formatSample(char* record, size_t size, long long time, unsigned gpu, const GpuSample& sample)
+{
+    return std::snprintf(record, size, "%lld,%u,%u,%g,%g,%g,%g,%g,%g,%g,%g,%g,%g,%g,%g,%g\n",
+        time, gpu, sample.changedMetrics,
+        sample.coreClock, sample.memoryClock, sample.shaderClock,
+        sample.coreUsage, sample.fbUsage, sample.vidUsage, sample.busUsage,
+        sample.temperature, sample.voltage, sample.powerLimit, sample.thermalLimit,
+        sample.coreOverclock, sample.memoryOverclock);
+}
+
+/**
+ * Poll every GPU at a fixed interval and log their samples as CSV, one line
+ * per GPU per poll. The polling thread only formats each line into the
+ * writer's buffer; the writer thread does the file I/O and the rotation.
+ */
+int stream(StreamOptions options)
+{
+    if (!(options.simulatedGpus > 0 ? init_library_with_simulation(options.simulatedGpus, 0) : init_library())) {
+        return -1;
+    }
+    NvidiaApi api;
+    const auto gpus = api.getGPUCount();
+
+    options.writer.header = "time_ms,gpu,changed_metrics,core_clock,memory_clock,shader_clock,"
+        "core_usage,fb_usage,vid_usage,bus_usage,temperature,voltage,power_limit,thermal_limit,"
+        "core_overclock,memory_overclock\n";
+    StreamWriter writer(options.writer);
+    if (!writer.start()) {
+        return -1;
+    }
+    SetConsoleCtrlHandler(stopStream, TRUE);
+
+    const auto started = std::chrono::steady_clock::now();
+    auto next = started;
+    auto polls = 0ull;
+    auto formatTime = std::chrono::nanoseconds(0);
+    while (!stream_stopping && writer.isHealthy() &&
+        (options.duration.count() == 0 || std::chrono::steady_clock::now() - started < options.duration)) {
+        api.pollAll();
+        polls++;
+
+        const auto formatStart = std::chrono::steady_clock::now();
+        const auto time = static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        for (auto i = 0u; i < gpus; i++) {
+            GpuSample sample;
+            if (!api.getGPU(i)->getSample(sample)) {
+                continue;
+            }
+
+            char record[512];
+            const auto length = formatSample(record, sizeof(record), time, i, sample);
+            if (length > 0 && static_cast<size_t>(length) < sizeof(record)) {
+                writer.write(record, length);
+            }
+        }
+        formatTime += std::chrono::steady_clock::now() - formatStart;
+
+        // Skip the polls there wasn't time for rather than trying to catch up
+        next += options.interval;
+        const auto now = std::chrono::steady_clock::now();
+        if (next < now) {
+            next = now;
+        }
+        std::this_thread::sleep_until(next);
+    }
+
+    writer.stop();
+    SetConsoleCtrlHandler(stopStream, FALSE);
+
+    const auto stats = writer.getStats();
+    const auto elapsed = std::chrono::steady_clock::now() - started;
+    const auto busy = formatTime + stats.busyTime;
+    std::cout << "Logged " << polls << " polls of " << gpus << " GPUs: "
+        << stats.records << " records, " << stats.bytes << " bytes in " << stats.files << " files" << std::endl
+        << stats.dropped << " records dropped because writing fell behind" << std::endl
+        << "Logging took " << 100.0 * busy.count() / std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()
+        << "% of one core, not counting the polls" << std::endl;
+    return writer.isHealthy() ? 0 : -1;
+}
+
 int main(int argc, char** argv)
 {
     bool dumper = true;
     if (argc > 1) {
         if (std::string(argv[1]) == "debug") {
             dumper = false;
+        } else if (std::string(argv[1]) == "stream") {
+            StreamOptions options;
+            try {
+                if (!parseStreamOptions(argc, argv, options)) {
+                    std::cerr << "Usage: DataDumper stream [--interval-ms N] [--duration-s N] [--output prefix] "
+                        << "[--rotate-mb N] [--rotate-minutes N] [--simulate N]" << std::endl;
+                    return -1;
+                }
+            }
+            catch (std::logic_error) {
+                std::cerr << "Invalid number" << std::endl;
+                return -1;
+            }
+            return stream(options);
         }
     }
 
@@ -0,0 +1,143 @@
+#include "stdafx.h"
+#include "StreamWriter.h"
+#include <cstdio>
+
+StreamWriter::StreamWriter(const StreamWriterConfig& config) : config(config), bufferLimit(2 * config.bufferSize)
+{
+    this->buffer.reserve(this->bufferLimit);
+    this->spareBuffer.reserve(this->bufferLimit);
+}
+
+StreamWriter::~StreamWriter()
+{
+    this->stop();
+}
+
+bool StreamWriter::start()
+{
+    if (this->thread.joinable() || !this->openNextFile()) {
+        return false;
+    }
+
+    this->thread = std::thread(&StreamWriter::run, this);
+    return true;
+}
+
+void StreamWriter::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->thread.joinable()) {
+            return;
+        }
+        this->stopping = true;
+    }
+
+    this->bufferReady.notify_one();
+    this->thread.join();
+    this->file.close();
+}
+
+bool StreamWriter::write(const char* record, size_t size)
+{
+    auto full = false;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        // The writer thread is still busy with the previous buffer, so it has
+        // fallen a whole buffer behind. Dropping keeps the caller's latency
+        // and memory bounded, which matters more than any single record.
+        if (size > this->bufferLimit - this->buffer.size()) {
+            this->stats.dropped++;
+            return false;
+        }
+
+        this->buffer.insert(this->buffer.end(), record, record + size);
+        this->stats.records++;
+        full = this->buffer.size() >= this->config.bufferSize;
+    }
+
+    if (full) {
+        this->bufferReady.notify_one();
+    }
+    return true;
+}
+
+bool StreamWriter::isHealthy() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return !this->failed;
+}
+
+StreamWriterStats StreamWriter::getStats() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->stats;
+}
+
+void StreamWriter::run()
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->bufferReady.wait_for(lock, this->config.flushInterval, [this] {
+            return this->stopping || this->buffer.size() >= this->config.bufferSize;
+        });
+        const auto stopping = this->stopping;
+
+        if (!this->buffer.empty()) {
+            // The spare buffer is empty and keeps its capacity, so swapping
+            // lets write() carry on without allocating while this writes.
+            std::swap(this->buffer, this->spareBuffer);
+            lock.unlock();
+
+            const auto start = std::chrono::steady_clock::now();
+            const auto success = this->writeBuffer(this->spareBuffer);
+            const auto size = this->spareBuffer.size();
+            this->spareBuffer.clear();
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+
+            lock.lock();
+            this->stats.bytes += size;
+            this->stats.busyTime += elapsed;
+            this->failed = this->failed || !success;
+        }
+
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+bool StreamWriter::openNextFile()
+{
+    unsigned number;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        number = this->stats.files++;
+    }
+
+    char name[512];
+    std::snprintf(name, sizeof(name), "%s_%04u.csv", this->config.prefix.c_str(), number);
+
+    this->file.close();
+    this->file.clear();
+    this->file.open(name, std::ofstream::binary | std::ofstream::trunc);
+    this->file.write(this->config.header.data(), this->config.header.size());
+    this->fileBytes = this->config.header.size();
+    this->fileOpened = std::chrono::steady_clock::now();
+    return !this->file.fail();
+}
+
+bool StreamWriter::writeBuffer(const std::vector<char>& data)
+{
+    const auto tooLarge = this->config.rotateBytes > 0 && this->fileBytes >= this->config.rotateBytes;
+    const auto tooOld = this->config.rotateInterval.count() > 0 &&
+        std::chrono::steady_clock::now() - this->fileOpened >= this->config.rotateInterval;
+    if ((tooLarge || tooOld) && !this->openNextFile()) {
+        return false;
+    }
+
+    this->file.write(data.data(), data.size());
+    this->file.flush();
+    this->fileBytes += data.size();
+    return !this->file.fail();
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct StreamWriterConfig
+{
+    /// Files are named `<prefix>_<number>.csv`
+    std::string prefix = "gpu_stream";
+    /// Written at the start of every file
+    std::string header;
+    /// The size records are gathered up to before they're handed to the writer thread.
+    /// Records are dropped once two buffers' worth is waiting on the writer thread.
+    size_t bufferSize = 1024 * 1024;
+    /// Start a new file once the current one is this large, 0 for no limit
+    unsigned long long rotateBytes = 64ull * 1024 * 1024;
+    /// Start a new file once the current one is this old, 0 for no limit
+    std::chrono::seconds rotateInterval{ 3600 };
+    /// How long records may sit in the buffer before they're written anyway
+    std::chrono::milliseconds flushInterval{ 1000 };
+};
+
+struct StreamWriterStats
+{
+    unsigned long long records;
+    /// Records dropped because the writer thread fell behind
+    unsigned long long dropped;
+    unsigned long long bytes;
+    unsigned files;
+    /// Time the writer thread spent writing files
+    std::chrono::nanoseconds busyTime;
+};
+
+/**
+ * Writes records to a series of rotated files from a background thread.
+ *
+ * write() only copies the record into a large buffer, which the writer
+ * thread swaps out and writes in one go once it's full or has waited for
+ * long enough. Files are only rotated between buffers, so a record never
+ * spans two files, and a file can go past `rotateBytes` by up to a buffer.
+ */
+class StreamWriter
+{
+public:
+    explicit StreamWriter(const StreamWriterConfig& config);
+    ~StreamWriter();
+
+    /**
+     * Open the first file and start the writer thread.
+     */
+    bool start();
+    /**
+     * Write whatever is still buffered, then stop the writer thread and close
+     * the file.
+     */
+    void stop();
+    /**
+     * Queue a whole record, including its line ending. Returns false if the
+     * record was dropped because the buffer is full, which happens when the
+     * writer thread is stuck on a slow or blocked file.
+     */
+    bool write(const char* record, size_t size);
+    /**
+     * Returns false once writing to a file has failed.
+     */
+    bool isHealthy() const;
+    StreamWriterStats getStats() const;
+
+private:
+    const StreamWriterConfig config;
+    std::thread thread;
+    mutable std::mutex mutex;
+    std::condition_variable bufferReady;
+    std::vector<char> buffer;
+    std::vector<char> spareBuffer;
+    // write() never lets the buffer grow past this, so it never allocates
+    const size_t bufferLimit;
+    bool stopping = false;
+    bool failed = false;
+    StreamWriterStats stats = {};
+
+    // Only touched by the writer thread once it's running
+    std::ofstream file;
+    unsigned long long fileBytes = 0;
+    std::chrono::steady_clock::time_point fileOpened;
+
+    void run();
+    bool openNextFile();
+    bool writeBuffer(const std::vector<char>& data);
+};
\ No newline at end of file
@@ -0,0 +1,2265 @@
+#include "stdafx.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "lib_gpu.h"
+#include "nvidia_interface.h"
+#include "nvidia_simple_api.h"
+#include "GpuBroker.h"
+#include "GpuSharedTelemetry.h"
+#include "StreamWriter.h"
+
+/**
+ * Tests for the library, run against the simulated driver so they don't
+ * depend on the hardware or driver installed.
+ *
+ * Every failed check is printed along with where it is, and every test as it
+ * passes or fails. The exit code is the number of failed tests.
+ */
+
+using namespace lib_gpu;
+
+static unsigned failed_checks = 0;
+
+#pragma region Helpers
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+#define CHECK_EQUAL(expected, actual) checkEqual((expected), (actual), #actual, __FILE__, __LINE__)
+
+bool check(bool passed, const char* condition, const char* file, int line)
+{
+    if (!passed) {
+        std::cerr << file << "(" << line << "): " << condition << " failed" << std::endl;
+        failed_checks++;
+    }
+    return passed;
+}
+
+template <typename T, typename U>
+bool checkEqual(const T& expected, const U& actual, const char* expression, const char* file, int line)
+{
+    if (!(expected == actual)) {
+        std::cerr << file << "(" << line << "): " << expression << " is " << actual << ", expected " << expected << std::endl;
+        failed_checks++;
+        return false;
+    }
+    return true;
+}
+
+// Only for structs without padding, such as the ones made of floats
+template <typename T>
+bool sameBytes(const T& a, const T& b)
+{
+    return memcmp(&a, &b, sizeof(T)) == 0;
+}
+
+bool sameSetting(const GpuOverclockSetting& a, const GpuOverclockSetting& b)
+{
+    return a.editable == b.editable && a.currentValue == b.currentValue && a.minValue == b.minValue && a.maxValue == b.maxValue;
+}
+
+bool sameProfile(const GpuOverclockProfile& a, const GpuOverclockProfile& b)
+{
+    return sameSetting(a.coreOverclock, b.coreOverclock) && sameSetting(a.memoryOverclock, b.memoryOverclock) &&
+        sameSetting(a.shaderOverclock, b.shaderOverclock) && sameSetting(a.overvolt, b.overvolt) &&
+        sameSetting(a.powerLimit, b.powerLimit) && sameSetting(a.thermalLimit, b.thermalLimit) &&
+        a.thermalLimitPriority.editable == b.thermalLimitPriority.editable && a.thermalLimitPriority.value == b.thermalLimitPriority.value;
+}
+
+bool sameValues(const GpuSnapshot& a, const GpuSnapshot& b)
+{
+    return a.valid == b.valid && a.version == b.version && a.voltage == b.voltage && a.temperature == b.temperature &&
+        sameBytes(a.clocks, b.clocks) && sameBytes(a.defaultClocks, b.defaultClocks) &&
+        sameBytes(a.baseClocks, b.baseClocks) && sameBytes(a.boostClocks, b.boostClocks) &&
+        sameBytes(a.usage, b.usage) && sameProfile(a.overclockProfile, b.overclockProfile) &&
+        a.changedMetrics == b.changedMetrics;
+}
+
+/**
+ * Start over with `gpus` fresh simulated GPUs, with the call stats enabled.
+ */
+void resetSimulation(unsigned gpus, unsigned latencyUs = 0)
+{
+    init_library_with_simulation(gpus, latencyUs);
+    NvidiaApi::setCallStatsEnabled(true);
+    NvidiaApi::resetCallStats();
+}
+
+UINT64 callCount(NVIDIA_FUNCTION function)
+{
+    NvidiaCallStats stats;
+    return NvidiaApi::getCallStats(function, stats) ? stats.calls : 0;
+}
+
+UINT64 totalCallCount()
+{
+    UINT64 calls = 0;
+    for (auto function = 0u; function < NVIDIA_FUNCTION_COUNT; function++) {
+        calls += callCount(static_cast<NVIDIA_FUNCTION>(function));
+    }
+    return calls;
+}
+
+typedef std::vector<std::pair<NVIDIA_FUNCTION, UINT64>> ExpectedCalls;
+
+/**
+ * Check that exactly the calls in `expected` were made since the call stats
+ * were last reset, and nothing else.
+ */
+void checkCalls(const ExpectedCalls& expected)
+{
+    for (auto function = 0u; function < NVIDIA_FUNCTION_COUNT; function++) {
+        UINT64 calls = 0;
+        for (const auto& call : expected) {
+            if (call.first == function) {
+                calls = call.second;
+            }
+        }
+        if (!CHECK_EQUAL(calls, callCount(static_cast<NVIDIA_FUNCTION>(function)))) {
+            std::cerr << "  for " << get_function_name(static_cast<NVIDIA_FUNCTION>(function)) << std::endl;
+        }
+    }
+}
+
+// How long to wait for something that should happen, such as a callback
+// running, and how long to make sure something that shouldn't doesn't
+const auto CALLBACK_TIMEOUT = std::chrono::milliseconds(2000);
+const auto CALLBACK_QUIET_TIME = std::chrono::milliseconds(50);
+
+template <typename F>
+bool waitUntil(F condition, std::chrono::milliseconds timeout = CALLBACK_TIMEOUT)
+{
+    const auto end = std::chrono::steady_clock::now() + timeout;
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() >= end) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+#pragma endregion
+
+#pragma region Polling
+
+// Everything the first poll of a GPU loads
+const ExpectedCalls FULL_POLL_CALLS = {
+    { NVIDIA_FUNCTION_GetAllClockFrequencies, 3 },
+    { NVIDIA_FUNCTION_GetDynamicPStates, 1 },
+    { NVIDIA_FUNCTION_GetPstates20, 1 },
+    { NVIDIA_FUNCTION_GpuClientPowerPoliciesGetInfo, 1 },
+    { NVIDIA_FUNCTION_GpuClientPowerPoliciesGetStatus, 1 },
+    { NVIDIA_FUNCTION_GpuGetVoltageDomainsStatus, 1 },
+    { NVIDIA_FUNCTION_GpuGetThermalSettings, 1 },
+    { NVIDIA_FUNCTION_GpuClientThermalPoliciesGetInfo, 1 },
+    { NVIDIA_FUNCTION_GpuClientThermalPoliciesGetStatus, 1 },
+};
+
+void testFirstPollLoadsEverything()
+{
+    resetSimulation(1);
+    NvidiaApi api;
+    const auto gpu = api.getGPU(0);
+    NvidiaApi::resetCallStats();
+
+    // There's nothing to carry the other fields over from yet
+    auto driverCalls = 0u;
+    CHECK(gpu->poll(GPU_DATASET_FIELD_TEMPERATURE, driverCalls));
+    checkCalls(FULL_POLL_CALLS);
+    CHECK_EQUAL(11u, driverCalls);
+}
+
+void testPollFieldCalls()
+{
+    struct FieldCalls
+    {
+        unsigned fields;
+        ExpectedCalls calls;
+    };
+    const std::vector<FieldCalls> cases = {
+        { GPU_DATASET_FIELD_CURRENT_CLOCKS, { { NVIDIA_FUNCTION_GetAllClockFrequencies, 1 } } },
+        { GPU_DATASET_FIELD_USAGE, { { NVIDIA_FUNCTION_GetDynamicPStates, 1 } } },
+        { GPU_DATASET_FIELD_PSTATES20, { { NVIDIA_FUNCTION_GetPstates20, 1 } } },
+        { GPU_DATASET_FIELD_POWER_POLICIES, { { NVIDIA_FUNCTION_GpuClientPowerPoliciesGetStatus, 1 } } },
+        { GPU_DATASET_FIELD_VOLTAGE, { { NVIDIA_FUNCTION_GpuGetVoltageDomainsStatus, 1 } } },
+        { GPU_DATASET_FIELD_TEMPERATURE, { { NVIDIA_FUNCTION_GpuGetThermalSettings, 1 } } },
+        { GPU_DATASET_FIELD_THERMAL_POLICIES, { { NVIDIA_FUNCTION_GpuClientThermalPoliciesGetStatus, 1 } } },
+        { GPU_DATASET_FIELD_CURRENT_CLOCKS | GPU_DATASET_FIELD_TEMPERATURE, {
+            { NVIDIA_FUNCTION_GetAllClockFrequencies, 1 },
+            { NVIDIA_FUNCTION_GpuGetThermalSettings, 1 } } },
+        // The static parts are only loaded once they've been invalidated
+        { GPU_DATASET_FIELD_STATIC, {} },
+        { GPU_DATASET_FIELD_ALL, {
+            { NVIDIA_FUNCTION_GetAllClockFrequencies, 1 },
+            { NVIDIA_FUNCTION_GetDynamicPStates, 1 },
+            { NVIDIA_FUNCTION_GetPstates20, 1 },
+            { NVIDIA_FUNCTION_GpuClientPowerPoliciesGetStatus, 1 },
+            { NVIDIA_FUNCTION_GpuGetVoltageDomainsStatus, 1 },
+            { NVIDIA_FUNCTION_GpuGetThermalSettings, 1 },
+            { NVIDIA_FUNCTION_GpuClientThermalPoliciesGetStatus, 1 } } },
+    };
+
+    resetSimulation(1);
+    NvidiaApi api;
+    const auto gpu = api.getGPU(0);
+    CHECK(gpu->poll());
+
+    for (const auto& fieldCalls : cases) {
+        NvidiaApi::resetCallStats();
+        auto driverCalls = 0u;
+        if (!CHECK(gpu->poll(fieldCalls.fields, driverCalls))) {
+            continue;
+        }
+        checkCalls(fieldCalls.calls);
+        CHECK_EQUAL(totalCallCount(), driverCalls);
+    }
+}
+
+void testStaticReload()
+{
+    resetSimulation(1);
+    NvidiaApi api;
+    const auto gpu = api.getGPU(0);
+    CHECK(gpu->poll());
+
+    // The static parts come along with whatever is polled next, and
+    // pstates20 with them for the overclock ranges
+    gpu->invalidateStaticData();
+    NvidiaApi::resetCallStats();
+    auto driverCalls = 0u;
+    CHECK(gpu->poll(GPU_DATASET_FIELD_TEMPERATURE, driverCalls));
+    checkCalls({
+        { NVIDIA_FUNCTION_GetAllClockFrequencies, 2 },
+        { NVIDIA_FUNCTION_GetPstates20, 1 },
+        { NVIDIA_FUNCTION_GpuClientPowerPoliciesGetInfo, 1 },
+        { NVIDIA_FUNCTION_GpuGetThermalSettings, 1 },
+        { NVIDIA_FUNCTION_GpuClientThermalPoliciesGetInfo, 1 },
+    });
+    CHECK_EQUAL(6u, driverCalls);
+
+    // Only once
+    NvidiaApi::resetCallStats();
+    CHECK(gpu->poll(GPU_DATASET_FIELD_TEMPERATURE));
+    checkCalls({ { NVIDIA_FUNCTION_GpuGetThermalSettings, 1 } });
+
+    // Overclocking reloads them by itself, since the ranges can depend on
+    // the new limits
+    GpuOverclockDefinitionMap overclock;
+    overclock[GPU_OVERCLOCK_SETTING_AREA_CORE] = 100;
+    NvidiaApi::resetCallStats();
+    CHECK(gpu->setOverclock(overclock));
+    CHECK_EQUAL(1u, callCount(NVIDIA_FUNCTION_SetPstates20));
+    CHECK_EQUAL(1u, callCount(NVIDIA_FUNCTION_GpuClientPowerPoliciesGetInfo));
+    CHECK_EQUAL(1u, callCount(NVIDIA_FUNCTION_GpuClientThermalPoliciesGetInfo));
+    NvidiaApi::resetCallStats();
+    driverCalls = 0;
+    CHECK(gpu->poll(GPU_DATASET_FIELD_TEMPERATURE, driverCalls));
+    CHECK_EQUAL(1u, driverCalls);
+}
+
+void testCarriedOverFields()
+{
+    resetSimulation(1);
+    NvidiaApi api;
+    const auto gpu = api.getGPU(0);
+    CHECK(gpu->poll());
+    const auto before = gpu->getSnapshot();
+    GpuSnapshot beforeValues;
+    CHECK(before.getValues(beforeValues));
+
+    // Make sure the poll times can tell the polls apart
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    CHECK(gpu->poll(GPU_DATASET_FIELD_TEMPERATURE));
+    const auto after = gpu->getSnapshot();
+    GpuSnapshot afterValues;
+    CHECK(after.getValues(afterValues));
+
+    // The fields that weren't polled keep their values and poll times
+    CHECK(sameBytes(beforeValues.clocks, afterValues.clocks));
+    CHECK(sameBytes(beforeValues.baseClocks, afterValues.baseClocks));
+    CHECK(sameBytes(beforeValues.boostClocks, afterValues.boostClocks));
+    CHECK(sameBytes(beforeValues.usage, afterValues.usage));
+    CHECK(sameProfile(beforeValues.overclockProfile, afterValues.overclockProfile));
+    CHECK_EQUAL(beforeValues.voltage, afterValues.voltage);
+    const auto carriedOver = GPU_DATASET_FIELD_ALL & ~(GPU_DATASET_FIELD_TEMPERATURE | GPU_DATASET_FIELD_STATIC);
+    for (auto field = 1u; field < GPU_DATASET_FIELD_ALL; field <<= 1) {
+        if (field & carriedOver) {
+            CHECK(after.getPollTime(field) == before.getPollTime(field));
+        } else {
+            CHECK(after.getPollTime(field) > before.getPollTime(field));
+        }
+    }
+
+    // While still counting as a new version
+    CHECK_EQUAL(before.getVersion() + 1, after.getVersion());
+    CHECK_EQUAL(after.getVersion(), gpu->getSampleVersion());
+    CHECK(gpu->getPollTime(carriedOver) == before.getPollTime(carriedOver));
+}
+
+#pragma endregion
+
+#pragma region Change detection
+
+const unsigned ALL_METRICS = (1u << GPU_METRIC_COUNT) - 1;
+
+bool metricChanged(const std::shared_ptr<NvidiaGPU>& gpu, GPU_METRIC metric)
+{
+    return (gpu->getChangedMetrics() & (1u << metric)) != 0;
+}
+
+/**
+ * Set the core overclock, which only ever changes when it's set, and return
+ * whether the poll that follows reported it as changed.
+ */
+bool setCoreOverclock(const std::shared_ptr<NvidiaGPU>& gpu, float value)
+{
+    GpuOverclockDefinitionMap overclock;
+    overclock[GPU_OVERCLOCK_SETTING_AREA_CORE] = value;
+    CHECK(gpu->setOverclock(overclock));
+    CHECK_EQUAL(value, gpu->getSnapshot().getMetric(GPU_METRIC_CORE_OVERCLOCK));
+    return metricChanged(gpu, GPU_METRIC_CORE_OVERCLOCK);
+}
+
+void testChangedMetrics()
+{
+    resetSimulation(1);
+    NvidiaApi api;
+    const auto gpu = api.getGPU(0);
+
+    // Without a previous poll everything counts as changed, whatever was polled
+    CHECK(gpu->poll(GPU_DATASET_FIELD_TEMPERATURE));
+    CHECK_EQUAL(ALL_METRICS, gpu->getChangedMetrics());
+    CHECK_EQUAL(ALL_METRICS, gpu->getSnapshot().getChangedMetrics());
+    GpuSample sample;
+    CHECK(gpu->getSample(sample));
+    CHECK_EQUAL(ALL_METRICS, sample.changedMetrics);
+
+    // After that only what was polled can change, and does whenever its
+    // value does with the default threshold
+    for (auto i = 0; i < 8; i++) {
+        const auto before = gpu->getTemperature();
+        CHECK(gpu->poll(GPU_DATASET_FIELD_TEMPERATURE));
+        const auto changed = gpu->getTemperature() != before;
+        CHECK_EQUAL(changed ? 1u << GPU_METRIC_TEMPERATURE : 0u, gpu->getChangedMetrics());
+    }
+
+    CHECK(!gpu->setChangeThreshold(GPU_METRIC_COUNT, 1));
+    CHECK(!gpu->setChangeThreshold(GPU_METRIC_TEMPERATURE, -1));
+    CHECK(!gpu->setChangeThreshold(GPU_METRIC_TEMPERATURE, std::numeric_limits<float>::quiet_NaN()));
+}
+
+void testChangeThreshold()
+{
+    resetSimulation(1);
+    NvidiaApi api;
+    const auto gpu = api.getGPU(0);
+    CHECK(gpu->poll());
+    CHECK(gpu->setChangeThreshold(GPU_METRIC_CORE_OVERCLOCK, 10));
+
+    // Changes are measured from the value last reported, not the last one
+    // polled, so moving back and forth within the threshold isn't reported
+    CHECK(!setCoreOverclock(gpu, 5));
+    CHECK(!setCoreOverclock(gpu, 0));
+    CHECK(!setCoreOverclock(gpu, 9));
+    CHECK(!setCoreOverclock(gpu, -9));
+    CHECK(setCoreOverclock(gpu, 10));
+    CHECK(!setCoreOverclock(gpu, 15));
+    CHECK(!setCoreOverclock(gpu, 5));
+    CHECK(setCoreOverclock(gpu, 0));
+    CHECK(!metricChanged(gpu, GPU_METRIC_MEMORY_OVERCLOCK));
+
+    // Back to reporting every change
+    CHECK(gpu->setChangeThreshold(GPU_METRIC_CORE_OVERCLOCK, 0));
+    CHECK(setCoreOverclock(gpu, 1));
+    CHECK(!setCoreOverclock(gpu, 1));
+}
+
+void testChangeThresholdDrift()
+{
+    resetSimulation(1);
+    NvidiaApi api;
+    const auto gpu = api.getGPU(0);
+    CHECK(gpu->poll());
+    CHECK(gpu->setChangeThreshold(GPU_METRIC_CORE_OVERCLOCK, 10));
+
+    // No single step reaches the threshold, but every fourth adds up to it
+    for (auto step = 1; step <= 12; step++) {
+        const auto reported = setCoreOverclock(gpu, 3.0f * step);
+        if (!CHECK_EQUAL(step % 4 == 0, reported)) {
+            std::cerr << "  at step " << step << std::endl;
+        }
+    }
+}
+
+#pragma endregion
+
+#pragma region Backends
+
+NV_STATUS standInLifecycle()
+{
+    return NVAPI_OK;
+}
+
+NV_STATUS standInGetPhysicalGPUHandles(NV_PHYSICAL_GPU_HANDLE* handle_buf, unsigned long* handle_count)
+{
+    static int gpu;
+    handle_buf[0] = &gpu;
+    *handle_count = 1;
+    return NVAPI_OK;
+}
+
+NV_STATUS standInGetGPUIDFromPhysicalGPU(NV_PHYSICAL_GPU_HANDLE handle, unsigned long* gpu_id)
+{
+    *gpu_id = 0x100;
+    return NVAPI_OK;
+}
+
+// A driver that can only start up and find its one GPU
+void* standInQuery(UINT32 id)
+{
+    if (id == get_function_id(NVIDIA_FUNCTION_NvidiaInit) || id == get_function_id(NVIDIA_FUNCTION_NvidiaUnload)) {
+        return reinterpret_cast<void*>(&standInLifecycle);
+    }
+    if (id == get_function_id(NVIDIA_FUNCTION_GetPhysicalGPUHandles)) {
+        return reinterpret_cast<void*>(&standInGetPhysicalGPUHandles);
+    }
+    if (id == get_function_id(NVIDIA_FUNCTION_GetGPUIDFromPhysicalGPU)) {
+        return reinterpret_cast<void*>(&standInGetGPUIDFromPhysicalGPU);
+    }
+    return nullptr;
+}
+
+void testMissingEntryPoints()
+{
+    CHECK(init_library_with_backend(standInQuery));
+    CHECK(is_function_available(NVIDIA_FUNCTION_NvidiaInit));
+    CHECK(is_function_available(NVIDIA_FUNCTION_GetPhysicalGPUHandles));
+    CHECK(!is_function_available(NVIDIA_FUNCTION_GpuGetThermalSettings));
+    CHECK(!is_function_available(NVIDIA_FUNCTION_COUNT));
+
+    // Entry points the backend left unresolved get a stub instead of a null
+    // pointer to call
+    NV_PHYSICAL_GPU_HANDLE handles[NVIDIA_MAX_PHYSICAL_GPUS];
+    unsigned long count = 0;
+    CHECK_EQUAL(NVAPI_OK, NVIDIA_RAW_GetPhysicalGPUHandles(handles, &count));
+    NVIDIA_GPU_THERMAL_SETTINGS_V2 settings;
+    ZERO_STRUCT(settings);
+    CHECK_EQUAL(NVAPI_NO_IMPLEMENTATION, NVIDIA_RAW_GpuGetThermalSettings(handles[0], NVIDIA_THERMAL_TARGET_ALL, &settings));
+
+    // Which the GPUs report as failed polls
+    {
+        NvidiaApi api;
+        if (CHECK_EQUAL(1u, api.getGPUCount())) {
+            const auto gpu = api.getGPU(0);
+            CHECK_EQUAL(0x100ul, gpu->getGPUID());
+            CHECK(!gpu->poll());
+            GpuSnapshot values;
+            CHECK(!gpu->getValues(values));
+        }
+    }
+
+    // A backend that can't even start up isn't loaded
+    CHECK(!init_library_with_backend([](UINT32) -> void* { return nullptr; }));
+    CHECK(!is_function_available(NVIDIA_FUNCTION_NvidiaInit));
+}
+
+#pragma endregion
+
+#pragma region Capture and replay
+
+void testCaptureReplay()
+{
+    const char* const path = "lib_gpu_tests_capture.trace";
+
+    struct CapturedGPU
+    {
+        unsigned long GPUID;
+        std::string name;
+        GpuSnapshot values;
+    };
+    std::vector<CapturedGPU> captured;
+
+    // Everything from loading the GPUs on goes through the capture
+    resetSimulation(2);
+    CHECK(!start_call_capture(nullptr));
+    CHECK(start_call_capture(path));
+    CHECK(!start_call_capture(path));
+    {
+        NvidiaApi api;
+        for (auto i = 0u; i < api.getGPUCount(); i++) {
+            const auto gpu = api.getGPU(i);
+            CapturedGPU capturedGPU = { gpu->getGPUID(), gpu->getName() };
+            CHECK(gpu->poll() && gpu->getValues(capturedGPU.values));
+            captured.push_back(capturedGPU);
+        }
+    }
+    stop_call_capture();
+    CHECK_EQUAL(2u, captured.size());
+
+    // Replaying needs neither the simulation nor a driver to get the same data
+    CHECK(init_library_with_replay(path, false));
+    {
+        NvidiaApi api;
+        if (CHECK_EQUAL(captured.size(), api.getGPUCount())) {
+            for (auto i = 0u; i < captured.size(); i++) {
+                const auto gpu = api.getGPU(i);
+                GpuSnapshot values;
+                CHECK(gpu->poll() && gpu->getValues(values));
+                CHECK_EQUAL(captured[i].GPUID, gpu->getGPUID());
+                CHECK_EQUAL(captured[i].name, gpu->getName());
+                CHECK(sameValues(captured[i].values, values));
+            }
+        }
+    }
+    std::remove(path);
+}
+
+#pragma endregion
+
+#pragma region Scheduler
+
+/**
+ * Wait for the scheduler to be between polls, and return its stats along
+ * with the driver calls made in total.
+ */
+GpuSchedulerStats settledSchedulerStats(const NvidiaApi& api, UINT64& totalCalls)
+{
+    GpuSchedulerStats stats;
+    for (auto attempt = 0; attempt < 100; attempt++) {
+        const auto before = totalCallCount();
+        stats = api.getSchedulerStats();
+        totalCalls = totalCallCount();
+        if (before == totalCalls && stats.driverCalls == totalCalls) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(3));
+    }
+    return stats;
+}
+
+void testSchedulerIntervals()
+{
+    resetSimulation(1);
+    NvidiaApi api;
+    const auto gpu = api.getGPU(0);
+    CHECK(gpu->poll());
+    // The simulated voltage wobbles by less than this, so it looks stable
+    CHECK(gpu->setChangeThreshold(GPU_METRIC_VOLTAGE, 1));
+
+    const auto slow = std::chrono::milliseconds(60000);
+    const auto fast = std::chrono::milliseconds(50);
+    const auto backedOff = std::chrono::milliseconds(400);
+    NvidiaApi::resetCallStats();
+    CHECK(api.startScheduler({
+        { GPU_DATASET_FIELD_CURRENT_CLOCKS, slow, slow },
+        { GPU_DATASET_FIELD_USAGE, slow, slow },
+        { GPU_DATASET_FIELD_PSTATES20, slow, slow },
+        { GPU_DATASET_FIELD_POWER_POLICIES, slow, slow },
+        { GPU_DATASET_FIELD_THERMAL_POLICIES, slow, slow },
+        { GPU_DATASET_FIELD_TEMPERATURE, fast, backedOff },
+        { GPU_DATASET_FIELD_VOLTAGE, fast, backedOff },
+    }));
+    CHECK(!api.startScheduler());
+
+    // The changing temperature stays at its fastest interval, while the
+    // stable voltage backs off: 0, 50, 150, 350 and 750ms for the first
+    // second's worth of temperature polls. How long that takes depends on
+    // the machine, so only the order of the counts is checked.
+    const auto schedulerTimeout = std::chrono::milliseconds(20000);
+    CHECK(waitUntil([] { return callCount(NVIDIA_FUNCTION_GpuGetThermalSettings) >= 20; }, schedulerTimeout));
+    const auto voltageCalls = callCount(NVIDIA_FUNCTION_GpuGetVoltageDomainsStatus);
+    const auto temperatureCalls = callCount(NVIDIA_FUNCTION_GpuGetThermalSettings);
+    CHECK(voltageCalls >= 2);
+    CHECK(voltageCalls < temperatureCalls / 2);
+
+    // Everything is due on the first tick, and the slow fields not again.
+    // The static fields aren't scheduled at all.
+    CHECK_EQUAL(1u, callCount(NVIDIA_FUNCTION_GetAllClockFrequencies));
+    CHECK_EQUAL(1u, callCount(NVIDIA_FUNCTION_GetDynamicPStates));
+    CHECK_EQUAL(1u, callCount(NVIDIA_FUNCTION_GetPstates20));
+    CHECK_EQUAL(1u, callCount(NVIDIA_FUNCTION_GpuClientPowerPoliciesGetStatus));
+    CHECK_EQUAL(1u, callCount(NVIDIA_FUNCTION_GpuClientThermalPoliciesGetStatus));
+    CHECK_EQUAL(0u, callCount(NVIDIA_FUNCTION_GpuClientPowerPoliciesGetInfo));
+    CHECK_EQUAL(0u, callCount(NVIDIA_FUNCTION_GpuClientThermalPoliciesGetInfo));
+
+    UINT64 totalCalls;
+    const auto stats = settledSchedulerStats(api, totalCalls);
+    CHECK_EQUAL(totalCalls, stats.driverCalls);
+    CHECK(stats.polls >= temperatureCalls);
+    CHECK(stats.fixedRateDriverCalls > stats.driverCalls);
+
+    // Once the voltage starts changing it's back to the fastest interval,
+    // after at most one backed off wait. By the time there have been another
+    // second's worth of temperature polls, most of them came with a voltage
+    // poll, where a voltage still backing off would have had about 3.
+    CHECK(gpu->setChangeThreshold(GPU_METRIC_VOLTAGE, 0));
+    NvidiaApi::resetCallStats();
+    CHECK(waitUntil([] { return callCount(NVIDIA_FUNCTION_GpuGetThermalSettings) >= 20; }, schedulerTimeout));
+    CHECK(callCount(NVIDIA_FUNCTION_GpuGetVoltageDomainsStatus) >= 8);
+
+    api.stopScheduler();
+    CHECK(!api.isSchedulerRunning());
+    CHECK_EQUAL(0u, api.getSchedulerStats().driverCalls);
+    NvidiaApi::resetCallStats();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK_EQUAL(0u, totalCallCount());
+}
+
+#pragma endregion
+
+#pragma region Subscriptions
+
+void testSubscriptionEdges()
+{
+    resetSimulation(2);
+    NvidiaApi api;
+    const auto gpu = api.getGPU(1);
+    CHECK_EQUAL(0u, api.subscribe(2, GPU_METRIC_TEMPERATURE, [](float) { return true; }, [](unsigned, GPU_METRIC, float) {}));
+    CHECK_EQUAL(0u, api.subscribe(1, GPU_METRIC_COUNT, [](float) { return true; }, [](unsigned, GPU_METRIC, float) {}));
+
+    std::atomic<bool> matching{ false };
+    std::atomic<unsigned> calls{ 0 };
+    std::atomic<unsigned> wrongCalls{ 0 };
+    std::atomic<float> lastValue{ 0 };
+    const auto id = api.subscribe(1, GPU_METRIC_TEMPERATURE, [&](float) { return matching.load(); },
+        [&](unsigned gpuIndex, GPU_METRIC metric, float value) {
+            if (gpuIndex != 1 || metric != GPU_METRIC_TEMPERATURE) {
+                wrongCalls++;
+            }
+            lastValue = value;
+            calls++;
+        });
+    CHECK(id != 0);
+
+    // Nothing while the predicate doesn't match, or for the other GPU
+    CHECK(gpu->poll());
+    matching = true;
+    CHECK(api.getGPU(0)->poll());
+    std::this_thread::sleep_for(CALLBACK_QUIET_TIME);
+    CHECK_EQUAL(0u, calls.load());
+
+    // Once when it starts matching, however many polls it keeps matching for
+    CHECK(gpu->poll(GPU_DATASET_FIELD_TEMPERATURE));
+    CHECK(waitUntil([&] { return calls == 1; }));
+    CHECK_EQUAL(gpu->getTemperature(), lastValue.load());
+    CHECK(gpu->poll());
+    CHECK(gpu->poll(GPU_DATASET_FIELD_USAGE));
+    std::this_thread::sleep_for(CALLBACK_QUIET_TIME);
+    CHECK_EQUAL(1u, calls.load());
+
+    // And again once it has stopped matching in between
+    matching = false;
+    CHECK(gpu->poll());
+    matching = true;
+    CHECK(gpu->poll());
+    CHECK(waitUntil([&] { return calls == 2; }));
+
+    // The threshold conditions are strict
+    std::atomic<unsigned> thresholdCalls{ 0 };
+    const auto countThreshold = [&](unsigned, GPU_METRIC, float) { thresholdCalls++; };
+    const auto temperature = gpu->getTemperature();
+    CHECK(api.subscribe(1, GPU_METRIC_TEMPERATURE, GPU_METRIC_CONDITION_ABOVE, temperature - 1, countThreshold) != 0);
+    CHECK(api.subscribe(1, GPU_METRIC_TEMPERATURE, GPU_METRIC_CONDITION_BELOW, temperature + 1, countThreshold) != 0);
+    CHECK(api.subscribe(1, GPU_METRIC_TEMPERATURE, GPU_METRIC_CONDITION_ABOVE, 1000, countThreshold) != 0);
+    CHECK(gpu->poll(GPU_DATASET_FIELD_VOLTAGE));
+    CHECK(waitUntil([&] { return thresholdCalls == 2; }));
+    std::this_thread::sleep_for(CALLBACK_QUIET_TIME);
+    CHECK_EQUAL(2u, thresholdCalls.load());
+    CHECK_EQUAL(0u, wrongCalls.load());
+
+    CHECK(api.unsubscribe(id));
+    CHECK(!api.unsubscribe(id));
+}
+
+void testUnsubscribeWaitsForCallback()
+{
+    resetSimulation(1);
+    NvidiaApi api;
+    const auto gpu = api.getGPU(0);
+
+    // A slow callback, and one queued behind it
+    std::atomic<bool> matching{ true };
+    std::atomic<bool> started{ false };
+    std::atomic<bool> finished{ false };
+    std::atomic<unsigned> calls{ 0 };
+    std::atomic<unsigned> queuedCalls{ 0 };
+    const auto slow = api.subscribe(0, GPU_METRIC_TEMPERATURE, [&](float) { return matching.load(); },
+        [&](unsigned, GPU_METRIC, float) {
+            calls++;
+            started = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            finished = true;
+        });
+    const auto queued = api.subscribe(0, GPU_METRIC_VOLTAGE, [](float) { return true; },
+        [&](unsigned, GPU_METRIC, float) { queuedCalls++; });
+    CHECK(gpu->poll());
+    CHECK(waitUntil([&] { return started.load(); }));
+
+    // Removing a queued callback drops it, and removing a running one waits for it
+    CHECK(api.unsubscribe(queued));
+    CHECK(api.unsubscribe(slow));
+    CHECK(finished.load());
+
+    matching = false;
+    CHECK(gpu->poll());
+    matching = true;
+    CHECK(gpu->poll());
+    std::this_thread::sleep_for(CALLBACK_QUIET_TIME);
+    CHECK_EQUAL(1u, calls.load());
+    CHECK_EQUAL(0u, queuedCalls.load());
+}
+
+void testUnsubscribeFromCallback()
+{
+    resetSimulation(1);
+    NvidiaApi api;
+    const auto gpu = api.getGPU(0);
+
+    std::atomic<bool> matching{ true };
+    std::atomic<unsigned> id{ 0 };
+    std::atomic<unsigned> calls{ 0 };
+    std::atomic<bool> unsubscribed{ false };
+    id = api.subscribe(0, GPU_METRIC_TEMPERATURE, [&](float) { return matching.load(); },
+        [&](unsigned, GPU_METRIC, float) {
+            calls++;
+            unsubscribed = api.unsubscribe(id);
+        });
+    CHECK(gpu->poll());
+    CHECK(waitUntil([&] { return unsubscribed.load(); }));
+
+    matching = false;
+    CHECK(gpu->poll());
+    matching = true;
+    CHECK(gpu->poll());
+    std::this_thread::sleep_for(CALLBACK_QUIET_TIME);
+    CHECK_EQUAL(1u, calls.load());
+    CHECK(!api.unsubscribe(id));
+}
+
+/**
+ * A stuck callback holds up the dispatch thread, not polling. The queue
+ * behind it keeps only the newest notifications once it's full.
+ */
+void testSubscriptionQueueFull()
+{
+    const auto queueLimit = 1024u;
+    const auto notifications = queueLimit + 500;
+
+    resetSimulation(1);
+    NvidiaApi api;
+    const auto gpu = api.getGPU(0);
+
+    std::mutex gateMutex;
+    std::condition_variable gateCondition;
+    auto gateOpen = false;
+    std::atomic<bool> blocked{ false };
+    CHECK(api.subscribe(0, GPU_METRIC_VOLTAGE, [](float) { return true; }, [&](unsigned, GPU_METRIC, float) {
+        blocked = true;
+        std::unique_lock<std::mutex> lock(gateMutex);
+        gateCondition.wait(lock, [&] { return gateOpen; });
+    }) != 0);
+    CHECK(gpu->poll());
+    CHECK(waitUntil([&] { return blocked.load(); }));
+
+    // Matches every other poll, so every other poll queues a notification
+    auto evaluations = 0u;
+    std::atomic<unsigned> calls{ 0 };
+    CHECK(api.subscribe(0, GPU_METRIC_TEMPERATURE, [&](float) { return evaluations++ % 2 == 1; },
+        [&](unsigned, GPU_METRIC, float) { calls++; }) != 0);
+    for (auto i = 0u; i < 2 * notifications; i++) {
+        CHECK(gpu->poll(GPU_DATASET_FIELD_TEMPERATURE));
+    }
+    CHECK_EQUAL(0u, calls.load());
+
+    {
+        std::lock_guard<std::mutex> lock(gateMutex);
+        gateOpen = true;
+    }
+    gateCondition.notify_all();
+    CHECK(waitUntil([&] { return calls >= queueLimit; }));
+    std::this_thread::sleep_for(CALLBACK_QUIET_TIME);
+    CHECK_EQUAL(queueLimit, calls.load());
+}
+
+#pragma endregion
+
+#pragma region Concurrency
+
+// How long the stress tests keep their threads going
+const std::chrono::milliseconds STRESS_DURATION(500);
+
+/**
+ * Poll, read and overclock the same GPUs from many threads at once. The
+ * checks catch torn reads and data going back in time, while building with
+ * a race detector, like -fsanitize=thread, catches the races themselves.
+ */
+void testConcurrentPollReadOverclock()
+{
+    resetSimulation(2, 20);
+    NvidiaApi api;
+    CHECK(api.enableHistory());
+
+    std::atomic<bool> stopping{ false };
+    std::atomic<unsigned> failedPolls{ 0 };
+    std::atomic<unsigned> failedOverclocks{ 0 };
+    std::atomic<unsigned> tornReads{ 0 };
+    std::atomic<unsigned> backwardReads{ 0 };
+    std::atomic<unsigned> reads{ 0 };
+    std::vector<std::thread> threads;
+
+    for (auto i = 0u; i < api.getGPUCount(); i++) {
+        const auto gpu = api.getGPU(i);
+
+        // Full polls, and partial ones sharing polls in flight
+        threads.emplace_back([&, gpu] {
+            while (!stopping) {
+                if (!gpu->poll()) {
+                    failedPolls++;
+                }
+            }
+        });
+        threads.emplace_back([&, gpu] {
+            while (!stopping) {
+                if (!gpu->poll(std::chrono::milliseconds(1), GPU_DATASET_FIELD_TEMPERATURE | GPU_DATASET_FIELD_USAGE)) {
+                    failedPolls++;
+                }
+            }
+        });
+
+        for (auto reader = 0; reader < 2; reader++) {
+            threads.emplace_back([&, gpu] {
+                unsigned long long lastVersion = 0;
+                unsigned long long lastTimestamp = 0;
+                std::vector<GpuSample> samples;
+                while (!stopping) {
+                    // Values of the same version have to be the same, however
+                    // they were read
+                    GpuSnapshot values;
+                    if (!gpu->getValues(values)) {
+                        continue;
+                    }
+                    GpuSnapshot pinned;
+                    if (gpu->getSnapshot().getValues(pinned) && pinned.version == values.version && !sameValues(pinned, values)) {
+                        tornReads++;
+                    }
+
+                    GpuSample sample;
+                    if (values.version < lastVersion || !gpu->getSample(sample) || sample.timestamp < lastTimestamp) {
+                        backwardReads++;
+                    }
+                    lastVersion = values.version;
+                    lastTimestamp = sample.timestamp;
+
+                    samples.clear();
+                    gpu->getHistory()->getSamples(0, ULLONG_MAX, samples);
+                    for (auto j = 1u; j < samples.size(); j++) {
+                        if (samples[j].timestamp < samples[j - 1].timestamp) {
+                            backwardReads++;
+                        }
+                    }
+                    reads++;
+                }
+            });
+        }
+
+        threads.emplace_back([&, gpu] {
+            auto step = 0u;
+            while (!stopping) {
+                GpuOverclockDefinitionMap overclock;
+                overclock[GPU_OVERCLOCK_SETTING_AREA_CORE] = (step++ % 2) ? 50.0f : 100.0f;
+                if (!gpu->setOverclock(overclock)) {
+                    failedOverclocks++;
+                }
+            }
+        });
+    }
+
+    threads.emplace_back([&] {
+        while (!stopping) {
+            api.pollAll(GPU_DATASET_FIELD_CURRENT_CLOCKS);
+        }
+    });
+
+    std::this_thread::sleep_for(STRESS_DURATION);
+    stopping = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    CHECK(reads > 0);
+    CHECK_EQUAL(0u, failedPolls.load());
+    CHECK_EQUAL(0u, failedOverclocks.load());
+    CHECK_EQUAL(0u, tornReads.load());
+    CHECK_EQUAL(0u, backwardReads.load());
+
+    // The last overclock is what the GPU ends up with
+    for (auto i = 0u; i < api.getGPUCount(); i++) {
+        const auto gpu = api.getGPU(i);
+        CHECK(gpu->poll());
+        GpuOverclockProfile profile;
+        CHECK(gpu->getOverclockProfile(profile));
+        CHECK(profile.coreOverclock.currentValue == 50.0f || profile.coreOverclock.currentValue == 100.0f);
+    }
+}
+
+/**
+ * Threads asking for data older than their max age at the same time share
+ * one poll between them, and those arriving while it's in flight get its
+ * result instead of polling again.
+ */
+void testSharedPolls()
+{
+    const auto maxAge = std::chrono::milliseconds(200);
+    const auto pollers = 8u;
+
+    resetSimulation(1);
+    NvidiaApi api;
+    const auto gpu = api.getGPU(0);
+    CHECK(gpu->poll());
+    const auto version = gpu->getSampleVersion();
+
+    // Slow enough that every poller arrives while the first poll is in flight
+    set_simulation_latency(50000);
+    std::this_thread::sleep_for(maxAge + std::chrono::milliseconds(50));
+    NvidiaApi::resetCallStats();
+
+    std::atomic<unsigned> failedPolls{ 0 };
+    std::vector<std::chrono::steady_clock::time_point> pollTimes(pollers);
+    std::vector<std::thread> threads;
+    for (auto i = 0u; i < pollers; i++) {
+        threads.emplace_back([&, i] {
+            if (!gpu->poll(maxAge, GPU_DATASET_FIELD_TEMPERATURE)) {
+                failedPolls++;
+            }
+            pollTimes[i] = gpu->getPollTime(GPU_DATASET_FIELD_TEMPERATURE);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    set_simulation_latency(0);
+
+    CHECK_EQUAL(0u, failedPolls.load());
+    checkCalls({ { NVIDIA_FUNCTION_GpuGetThermalSettings, 1 } });
+    CHECK_EQUAL(version + 1, gpu->getSampleVersion());
+    for (const auto& pollTime : pollTimes) {
+        CHECK(pollTime == pollTimes[0]);
+    }
+
+    // Which is fresh enough for whoever asks next
+    NvidiaApi::resetCallStats();
+    CHECK(gpu->poll(maxAge, GPU_DATASET_FIELD_TEMPERATURE));
+    CHECK_EQUAL(0u, totalCallCount());
+}
+
+/**
+ * A sample whose values can all be told from its timestamp, so that a
+ * reader can tell whether it's whole.
+ */
+GpuSample makeHistorySample(unsigned long long timestamp)
+{
+    GpuSample sample = {};
+    sample.timestamp = timestamp;
+    sample.coreClock = static_cast<float>(timestamp % 1000);
+    sample.temperature = static_cast<float>(timestamp % 100);
+    sample.coreUsage = static_cast<float>(timestamp % 10);
+    sample.changedMetrics = static_cast<unsigned>(timestamp);
+    return sample;
+}
+
+bool isWholeHistorySample(const GpuSample& sample)
+{
+    const auto expected = makeHistorySample(sample.timestamp);
+    return sample.coreClock == expected.coreClock && sample.temperature == expected.temperature &&
+        sample.coreUsage == expected.coreUsage && sample.changedMetrics == expected.changedMetrics;
+}
+
+void testHistoryRing()
+{
+    GpuHistoryConfig config;
+    config.capacity[GPU_HISTORY_RESOLUTION_RAW] = 64;
+    GpuHistory history(config);
+
+    // Only the latest samples are kept
+    for (auto timestamp = 1ull; timestamp <= 1000; timestamp++) {
+        history.record(makeHistorySample(timestamp));
+    }
+    std::vector<GpuSample> samples;
+    CHECK_EQUAL(64u, history.getSamples(0, ULLONG_MAX, samples));
+    CHECK_EQUAL(937ull, samples.front().timestamp);
+    CHECK_EQUAL(1000ull, samples.back().timestamp);
+    samples.clear();
+    CHECK_EQUAL(11u, history.getSamples(990, 2000, samples));
+
+    GpuSampleAggregate aggregate;
+    CHECK(history.aggregate(GPU_HISTORY_RESOLUTION_RAW, 0, ULLONG_MAX, aggregate));
+    CHECK_EQUAL(64u, aggregate.count);
+}
+
+/**
+ * Read the history while the writer keeps lapping its ring buffer. Every
+ * sample read has to be one the writer wrote whole, and in order.
+ */
+void testConcurrentHistory()
+{
+    GpuHistoryConfig config;
+    config.capacity[GPU_HISTORY_RESOLUTION_RAW] = 64;
+    GpuHistory history(config);
+
+    std::atomic<bool> stopping{ false };
+    std::thread writer([&] {
+        for (auto timestamp = 1ull; !stopping; timestamp++) {
+            history.record(makeHistorySample(timestamp));
+        }
+    });
+
+    auto reads = 0u;
+    auto tornSamples = 0u;
+    auto misorderedSamples = 0u;
+    auto badAggregates = 0u;
+    std::vector<GpuSample> samples;
+    const auto end = std::chrono::steady_clock::now() + STRESS_DURATION;
+    while (std::chrono::steady_clock::now() < end) {
+        samples.clear();
+        if (history.getSamples(0, ULLONG_MAX, samples) > config.capacity[GPU_HISTORY_RESOLUTION_RAW]) {
+            misorderedSamples++;
+        }
+        for (auto i = 0u; i < samples.size(); i++) {
+            if (!isWholeHistorySample(samples[i])) {
+                tornSamples++;
+            }
+            if (i > 0 && samples[i].timestamp != samples[i - 1].timestamp + 1) {
+                misorderedSamples++;
+            }
+        }
+
+        GpuSampleAggregate aggregate;
+        if (history.aggregate(GPU_HISTORY_RESOLUTION_RAW, 0, ULLONG_MAX, aggregate) &&
+            (aggregate.count > config.capacity[GPU_HISTORY_RESOLUTION_RAW] || aggregate.firstTimestamp > aggregate.lastTimestamp)) {
+            badAggregates++;
+        }
+        reads++;
+    }
+    stopping = true;
+    writer.join();
+
+    CHECK(reads > 0);
+    CHECK_EQUAL(0u, tornSamples);
+    CHECK_EQUAL(0u, misorderedSamples);
+    CHECK_EQUAL(0u, badAggregates);
+}
+
+#pragma endregion
+
+#pragma region Simple API
+
+// The simple API keeps the GPUs it found first for good, so every test using
+// it has to simulate the same number
+const unsigned SIMPLE_API_GPUS = 2;
+// How old data the getters without a max age take
+const auto SIMPLE_API_DEFAULT_MAX_AGE = std::chrono::milliseconds(250);
+
+void resetSimpleApi(unsigned latencyUs = 0)
+{
+    resetSimulation(SIMPLE_API_GPUS, latencyUs);
+    CHECK(nvidia_simple_api::init_simple_api());
+    CHECK_EQUAL(SIMPLE_API_GPUS, nvidia_simple_api::get_gpu_count());
+}
+
+long long microsecondsBetween(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+}
+
+void testMaxAgeFreshData()
+{
+    resetSimpleApi();
+    const auto temperature = nvidia_simple_api::get_temperature_max_age(0, 0, nullptr);
+    NvidiaApi::resetCallStats();
+
+    unsigned age = UINT_MAX;
+    CHECK_EQUAL(temperature, nvidia_simple_api::get_temperature_max_age(0, 1000000, &age));
+    CHECK(age < 1000000);
+    CHECK_EQUAL(0ull, totalCallCount());
+}
+
+void testMaxAgeStaleFields()
+{
+    resetSimpleApi();
+    GpuSnapshot snapshot;
+    CHECK(nvidia_simple_api::get_snapshot_max_age(0, 0, &snapshot, nullptr));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    // Only the fields a getter reads are polled once they're too old, while
+    // the others stay as they were
+    NvidiaApi::resetCallStats();
+    nvidia_simple_api::get_temperature_max_age(0, 1000, nullptr);
+    checkCalls({ { NVIDIA_FUNCTION_GpuGetThermalSettings, 1 } });
+
+    NvidiaApi::resetCallStats();
+    nvidia_simple_api::get_usages_max_age(0, 1000, nullptr);
+    nvidia_simple_api::get_clocks_max_age(0, 1000, nullptr);
+    checkCalls({ { NVIDIA_FUNCTION_GetDynamicPStates, 1 }, { NVIDIA_FUNCTION_GetAllClockFrequencies, 1 } });
+
+    NvidiaApi::resetCallStats();
+    nvidia_simple_api::get_voltage_max_age(0, 1000000, nullptr);
+    CHECK_EQUAL(0ull, totalCallCount());
+    nvidia_simple_api::get_voltage_max_age(0, 1000, nullptr);
+    checkCalls({ { NVIDIA_FUNCTION_GpuGetVoltageDomainsStatus, 1 } });
+}
+
+void testMaxAgeReportedAge()
+{
+    const auto latency = std::chrono::milliseconds(10);
+    resetSimpleApi(static_cast<unsigned>(std::chrono::microseconds(latency).count()));
+
+    // The poll time is taken before the driver is called, so the age covers
+    // the call that read the value
+    unsigned age = UINT_MAX;
+    const auto pollStart = std::chrono::steady_clock::now();
+    nvidia_simple_api::get_temperature_max_age(0, 0, &age);
+    const auto pollEnd = std::chrono::steady_clock::now();
+    CHECK(age >= std::chrono::microseconds(latency).count());
+    CHECK(age <= microsecondsBetween(pollStart, pollEnd));
+
+    // Data returned without polling is at least as old as the poll that
+    // last read it
+    set_simulation_latency(0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    const auto readStart = std::chrono::steady_clock::now();
+    nvidia_simple_api::get_temperature_max_age(0, 1000000, &age);
+    const auto readEnd = std::chrono::steady_clock::now();
+    CHECK(age >= microsecondsBetween(pollEnd, readStart));
+    CHECK(age <= microsecondsBetween(pollStart, readEnd));
+
+    // There's no age without data
+    nvidia_simple_api::get_temperature_max_age(SIMPLE_API_GPUS, 0, &age);
+    CHECK_EQUAL(static_cast<unsigned>(UINT_MAX), age);
+}
+
+void testGetSnapshot()
+{
+    resetSimpleApi();
+    GpuSnapshot snapshot;
+    CHECK(nvidia_simple_api::get_snapshot_max_age(0, 0, &snapshot, nullptr));
+
+    // Fresh enough for the getters without a max age, which return the same
+    // poll piece by piece
+    NvidiaApi::resetCallStats();
+    CHECK(nvidia_simple_api::get_snapshot(0, &snapshot));
+    CHECK(snapshot.valid);
+    CHECK_EQUAL(nvidia_simple_api::getGPUID(0), snapshot.GPUID);
+    CHECK_EQUAL(nvidia_simple_api::get_temperature(0), snapshot.temperature);
+    CHECK_EQUAL(nvidia_simple_api::get_voltage(0), snapshot.voltage);
+    CHECK(sameBytes(nvidia_simple_api::get_clocks(0), snapshot.clocks));
+    CHECK(sameBytes(nvidia_simple_api::get_usages(0), snapshot.usage));
+    CHECK(sameProfile(nvidia_simple_api::get_overclock_profile(0), snapshot.overclockProfile));
+    CHECK_EQUAL(0ull, totalCallCount());
+
+    CHECK(!nvidia_simple_api::get_snapshot(SIMPLE_API_GPUS, &snapshot));
+    CHECK(!snapshot.valid);
+    CHECK(!nvidia_simple_api::get_snapshot(0, nullptr));
+}
+
+void testGetAllSnapshots()
+{
+    resetSimpleApi();
+    GpuSnapshot snapshots[SIMPLE_API_GPUS + 1];
+    CHECK_EQUAL(SIMPLE_API_GPUS, nvidia_simple_api::get_all_snapshots(snapshots, SIMPLE_API_GPUS + 1));
+    for (auto i = 0u; i < SIMPLE_API_GPUS; i++) {
+        CHECK(snapshots[i].valid);
+        CHECK_EQUAL(nvidia_simple_api::getGPUID(i), snapshots[i].GPUID);
+    }
+    CHECK_EQUAL(1u, nvidia_simple_api::get_all_snapshots(snapshots, 1));
+    CHECK_EQUAL(0u, nvidia_simple_api::get_all_snapshots(nullptr, SIMPLE_API_GPUS));
+
+    // Only the first GPU is stale, but the second is polled along with it
+    std::this_thread::sleep_for(SIMPLE_API_DEFAULT_MAX_AGE + std::chrono::milliseconds(50));
+    CHECK(nvidia_simple_api::get_snapshot_max_age(1, 0, &snapshots[1], nullptr));
+    unsigned long long versions[SIMPLE_API_GPUS];
+    for (auto i = 0u; i < SIMPLE_API_GPUS; i++) {
+        CHECK(nvidia_simple_api::get_snapshot_max_age(i, UINT_MAX, &snapshots[i], nullptr));
+        versions[i] = snapshots[i].version;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    CHECK_EQUAL(SIMPLE_API_GPUS, nvidia_simple_api::get_all_snapshots(snapshots, SIMPLE_API_GPUS));
+    const auto end = std::chrono::steady_clock::now();
+    for (auto i = 0u; i < SIMPLE_API_GPUS; i++) {
+        CHECK_EQUAL(versions[i] + 1, snapshots[i].version);
+        GpuSample sample;
+        CHECK(nvidia_simple_api::get_sample(i, &sample));
+        const auto timestamp = std::chrono::nanoseconds(sample.timestamp);
+        CHECK(timestamp >= start.time_since_epoch() && timestamp <= end.time_since_epoch());
+    }
+
+    // And neither is polled again while they're fresh, which they only
+    // aren't if this thread was held up for longer than they stay fresh
+    NvidiaApi::resetCallStats();
+    CHECK_EQUAL(SIMPLE_API_GPUS, nvidia_simple_api::get_all_snapshots(snapshots, SIMPLE_API_GPUS));
+    if (std::chrono::steady_clock::now() - end < SIMPLE_API_DEFAULT_MAX_AGE) {
+        CHECK_EQUAL(0ull, totalCallCount());
+        for (auto i = 0u; i < SIMPLE_API_GPUS; i++) {
+            CHECK_EQUAL(versions[i] + 1, snapshots[i].version);
+        }
+    }
+}
+
+// Thermal settings calls that are in flight, and the most there have been
+static std::mutex rendezvous_mutex;
+static std::condition_variable rendezvous_changed;
+static unsigned rendezvous_calls = 0;
+static unsigned rendezvous_most_calls = 0;
+
+// Waits for a call for every GPU to be in flight at once, which never
+// happens if their polls take turns
+NV_STATUS rendezvousGpuGetThermalSettings(NV_PHYSICAL_GPU_HANDLE handle, NVIDIA_THERMAL_TARGET sensor_index, NVIDIA_GPU_THERMAL_SETTINGS_V2* thermal_settings)
+{
+    std::unique_lock<std::mutex> lock(rendezvous_mutex);
+    rendezvous_most_calls = (std::max)(rendezvous_most_calls, ++rendezvous_calls);
+    rendezvous_changed.notify_all();
+    rendezvous_changed.wait_for(lock, CALLBACK_TIMEOUT, [] { return rendezvous_most_calls >= SIMPLE_API_GPUS; });
+    rendezvous_calls--;
+    return NVAPI_OK;
+}
+
+void* rendezvousQuery(UINT32 id)
+{
+    if (id == get_function_id(NVIDIA_FUNCTION_GpuGetThermalSettings)) {
+        return reinterpret_cast<void*>(&rendezvousGpuGetThermalSettings);
+    }
+    return standInQuery(id);
+}
+
+/**
+ * Stale getters for different GPUs poll at the same time, rather than one
+ * waiting for the other's poll to finish.
+ */
+void testMaxAgeConcurrentGPUs()
+{
+    resetSimpleApi();
+    for (auto i = 0u; i < SIMPLE_API_GPUS; i++) {
+        nvidia_simple_api::get_temperature_max_age(i, 0, nullptr);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    // The simple API keeps the GPUs it has, which now poll the driver that
+    // only lets their calls through together
+    CHECK(init_library_with_backend(rendezvousQuery));
+    NvidiaApi::setCallStatsEnabled(true);
+    NvidiaApi::resetCallStats();
+    rendezvous_most_calls = 0;
+    std::vector<std::thread> threads;
+    for (auto i = 0u; i < SIMPLE_API_GPUS; i++) {
+        threads.emplace_back([i] {
+            nvidia_simple_api::get_temperature_max_age(i, 1000, nullptr);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    checkCalls({ { NVIDIA_FUNCTION_GpuGetThermalSettings, SIMPLE_API_GPUS } });
+    CHECK_EQUAL(SIMPLE_API_GPUS, rendezvous_most_calls);
+    resetSimulation(SIMPLE_API_GPUS);
+}
+
+#pragma endregion
+
+#pragma region Sample archive
+
+const unsigned long long NANOSECONDS_PER_MILLISECOND = 1000000ull;
+
+/**
+ * Samples a second apart give or take some jitter, with values that stay the
+ * same, drift a little, or are all over the place, like the real ones do.
+ * Timestamps are whole milliseconds, which is what the archive keeps.
+ */
+std::vector<GpuSample> makeArchiveSamples(size_t count, std::mt19937& random)
+{
+    std::uniform_int_distribution<int> jitter(-20, 20);
+    std::uniform_real_distribution<float> noise(0.0f, 100.0f);
+    std::vector<GpuSample> samples;
+    auto timestamp = 1000000ull;
+    for (size_t i = 0; i < count; i++) {
+        timestamp += 1000 + jitter(random);
+        GpuSample sample = {};
+        sample.timestamp = timestamp * NANOSECONDS_PER_MILLISECOND;
+        sample.changedMetrics = static_cast<unsigned>(i % 7);
+        sample.coreClock = 1500.0f + static_cast<float>(i % 13) * 13.5f;
+        sample.memoryClock = 3500.0f;
+        sample.coreUsage = noise(random);
+        sample.temperature = 60.0f + static_cast<float>(i % 20) * 0.5f;
+        sample.voltage = noise(random) / 100.0f;
+        sample.powerLimit = 100.0f;
+        sample.coreOverclock = i < count / 2 ? 0.0f : 100.0f;
+        samples.push_back(sample);
+    }
+    return samples;
+}
+
+/**
+ * Check that the archive gives back exactly `expected`, bit for bit.
+ */
+void checkArchiveSamples(const std::vector<GpuSample>& expected, const std::vector<GpuSample>& actual)
+{
+    if (!CHECK_EQUAL(expected.size(), actual.size())) {
+        return;
+    }
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (!CHECK(sameBytes(expected[i], actual[i]))) {
+            std::cerr << "  at sample " << i << std::endl;
+            return;
+        }
+    }
+}
+
+void testArchiveRoundTrip()
+{
+    std::mt19937 random(1);
+    const auto samples = makeArchiveSamples(2000, random);
+    GpuSampleArchiveConfig config;
+    config.blockSize = 256;
+    GpuSampleArchive archive(config);
+    for (const auto& sample : samples) {
+        archive.append(sample);
+    }
+
+    // The samples span many sealed blocks as well as the open one
+    CHECK_EQUAL(samples.size(), archive.getSampleCount());
+    CHECK(archive.getMemoryUsage() > 10 * config.blockSize);
+    CHECK(archive.getMemoryUsage() < samples.size() * sizeof(GpuSample) / 2);
+    std::vector<GpuSample> decoded;
+    CHECK_EQUAL(samples.size(), archive.getSamples(0, ULLONG_MAX, decoded));
+    checkArchiveSamples(samples, decoded);
+}
+
+void testArchiveTimestampGaps()
+{
+    // Gaps that need the widest delta-of-delta code both ways, and one
+    // too large for any code, which starts a new block
+    const unsigned long long gaps[] = { 1, 1, 1, 100, 1, 5000, 1, 1ull << 20, 1, 1, (1ull << 30) + 7, 3,
+        1ull << 31, 2, (1ull << 32) + 5, 1, 1, 0, 0, 1 };
+    std::vector<GpuSample> samples;
+    auto timestamp = 0ull;
+    auto value = 0.0f;
+    for (const auto gap : gaps) {
+        timestamp += gap;
+        GpuSample sample = {};
+        sample.timestamp = timestamp * NANOSECONDS_PER_MILLISECOND;
+        sample.temperature = value;
+        value += 0.25f;
+        samples.push_back(sample);
+    }
+
+    GpuSampleArchive archive;
+    for (const auto& sample : samples) {
+        archive.append(sample);
+    }
+    std::vector<GpuSample> decoded;
+    archive.getSamples(0, ULLONG_MAX, decoded);
+    checkArchiveSamples(samples, decoded);
+    CHECK_EQUAL(2 * GpuSampleArchiveConfig().blockSize, archive.getMemoryUsage());
+}
+
+void testArchiveMaxBytes()
+{
+    std::mt19937 random(2);
+    const auto samples = makeArchiveSamples(5000, random);
+    GpuSampleArchiveConfig config;
+    config.blockSize = 256;
+    config.maxBytes = 4 * config.blockSize;
+    GpuSampleArchive archive(config);
+    for (const auto& sample : samples) {
+        archive.append(sample);
+    }
+
+    // Only the newest blocks are kept, and what's left is the newest samples
+    CHECK_EQUAL(config.maxBytes, archive.getMemoryUsage());
+    const auto kept = archive.getSampleCount();
+    CHECK(kept > 0 && kept < samples.size());
+    std::vector<GpuSample> decoded;
+    CHECK_EQUAL(kept, archive.getSamples(0, ULLONG_MAX, decoded));
+    checkArchiveSamples(std::vector<GpuSample>(samples.end() - kept, samples.end()), decoded);
+}
+
+void testArchiveWindows()
+{
+    std::mt19937 random(3);
+    const auto samples = makeArchiveSamples(1000, random);
+    GpuSampleArchiveConfig config;
+    config.blockSize = 256;
+    GpuSampleArchive archive(config);
+    for (const auto& sample : samples) {
+        archive.append(sample);
+    }
+
+    const auto first = samples.front().timestamp;
+    const auto last = samples.back().timestamp;
+    std::uniform_int_distribution<unsigned long long> point(first - 5000 * NANOSECONDS_PER_MILLISECOND,
+        last + 5000 * NANOSECONDS_PER_MILLISECOND);
+    std::vector<std::pair<unsigned long long, unsigned long long>> windows = {
+        { 0, ULLONG_MAX }, { first, first }, { last, last }, { first + 1, last - 1 },
+        { samples[10].timestamp, samples[500].timestamp }, { 0, first - 1 }, { last + 1, ULLONG_MAX },
+    };
+    for (auto i = 0; i < 200; i++) {
+        const auto a = point(random);
+        const auto b = point(random);
+        windows.emplace_back((std::min)(a, b), (std::max)(a, b));
+    }
+
+    std::vector<GpuSample> decoded;
+    for (const auto& window : windows) {
+        std::vector<GpuSample> expected;
+        for (const auto& sample : samples) {
+            if (sample.timestamp >= window.first && sample.timestamp <= window.second) {
+                expected.push_back(sample);
+            }
+        }
+        CHECK_EQUAL(expected.size(), archive.getSamples(window.first, window.second, decoded));
+        checkArchiveSamples(expected, decoded);
+    }
+    CHECK_EQUAL(0u, archive.getSamples(last, first, decoded));
+}
+
+#pragma endregion
+
+#pragma region Column log
+
+struct ColumnLogRow
+{
+    unsigned long gpuId;
+    GpuSample sample;
+};
+
+/**
+ * Rows of two GPUs taking turns, with values going both up and down so the
+ * deltas are both positive and negative.
+ */
+std::vector<ColumnLogRow> makeColumnLogRows(size_t count)
+{
+    std::mt19937 random(4);
+    const auto samples = makeArchiveSamples(count, random);
+    std::vector<ColumnLogRow> rows;
+    for (size_t i = 0; i < count; i++) {
+        ColumnLogRow row = { i % 2 ? 0x200ul : 0x100ul, samples[i] };
+        row.sample.memoryOverclock = (i % 3 == 0) ? -250.5f : 125.0f;
+        rows.push_back(row);
+    }
+    return rows;
+}
+
+/**
+ * Write `rows` to a log at `path` in blocks of `blockRows`, giving the writer
+ * thread the time to write each block so none are dropped.
+ */
+bool writeColumnLog(const char* path, const std::vector<ColumnLogRow>& rows, unsigned blockRows)
+{
+    GpuColumnLogWriter writer(blockRows);
+    if (!CHECK(writer.open(path))) {
+        return false;
+    }
+    for (size_t i = 0; i < rows.size(); i++) {
+        CHECK(writer.append(rows[i].gpuId, rows[i].sample));
+        if (i % blockRows == blockRows - 1) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    }
+    CHECK_EQUAL(0ull, writer.getDroppedRows());
+    return CHECK(writer.close()) && CHECK(!writer.append(0, GpuSample{}));
+}
+
+/**
+ * The rows block `index` holds: its share of `rows`, grouped by GPU.
+ */
+std::vector<ColumnLogRow> columnLogBlockRows(const std::vector<ColumnLogRow>& rows, unsigned blockRows, unsigned index)
+{
+    const auto begin = rows.begin() + (std::min)(rows.size(), static_cast<size_t>(index) * blockRows);
+    const auto end = rows.begin() + (std::min)(rows.size(), static_cast<size_t>(index + 1) * blockRows);
+    std::vector<ColumnLogRow> blockRowsOf(begin, end);
+    std::stable_sort(blockRowsOf.begin(), blockRowsOf.end(), [](const ColumnLogRow& a, const ColumnLogRow& b) {
+        return a.gpuId < b.gpuId;
+    });
+    return blockRowsOf;
+}
+
+void checkColumnLogBlock(const GpuColumnLogBlock& block, const std::vector<ColumnLogRow>& expected)
+{
+    std::vector<GpuSample> samples;
+    std::vector<unsigned long> gpuIds;
+    if (!CHECK_EQUAL(expected.size(), block.getRowCount()) || !CHECK(block.decodeSamples(samples, &gpuIds))) {
+        return;
+    }
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (!CHECK(sameBytes(expected[i].sample, samples[i]) && expected[i].gpuId == gpuIds[i])) {
+            std::cerr << "  at row " << i << std::endl;
+            return;
+        }
+    }
+}
+
+std::vector<char> readFile(const char* path)
+{
+    std::ifstream file(path, std::ifstream::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+void writeFile(const char* path, const std::vector<char>& data, size_t size)
+{
+    std::ofstream file(path, std::ofstream::binary | std::ofstream::trunc);
+    file.write(data.data(), (std::min)(size, data.size()));
+}
+
+void testColumnLogRoundTrip()
+{
+    const char* const path = "lib_gpu_tests_column.log";
+    const auto blockRows = 100u;
+    const auto rows = makeColumnLogRows(450);
+    if (!writeColumnLog(path, rows, blockRows)) {
+        return;
+    }
+
+    GpuColumnLogReader reader;
+    if (!CHECK(reader.open(path)) || !CHECK_EQUAL(5u, reader.getBlockCount())) {
+        return;
+    }
+    for (auto i = 0u; i < reader.getBlockCount(); i++) {
+        GpuColumnLogBlock block;
+        CHECK(reader.getBlock(i, block));
+        const auto expected = columnLogBlockRows(rows, blockRows, i);
+        checkColumnLogBlock(block, expected);
+
+        // Each block has the range of every column, and the exact timestamp range
+        for (auto column = 0u; column < GPU_LOG_COLUMN_COUNT; column++) {
+            auto min = std::numeric_limits<double>::max();
+            auto max = std::numeric_limits<double>::lowest();
+            for (const auto& row : expected) {
+                double value;
+                if (column == GPU_LOG_COLUMN_TIMESTAMP) {
+                    value = static_cast<double>(row.sample.timestamp);
+                } else if (column == GPU_LOG_COLUMN_GPU_ID) {
+                    value = row.gpuId;
+                } else if (column == GPU_LOG_COLUMN_CHANGED_METRICS) {
+                    value = row.sample.changedMetrics;
+                } else {
+                    value = (&row.sample.coreClock)[column - GPU_LOG_COLUMN_FIRST_VALUE];
+                }
+                min = (std::min)(min, value);
+                max = (std::max)(max, value);
+            }
+            CHECK_EQUAL(min, block.getMin(static_cast<GPU_LOG_COLUMN>(column)));
+            CHECK_EQUAL(max, block.getMax(static_cast<GPU_LOG_COLUMN>(column)));
+        }
+        const auto timestamps = std::minmax_element(expected.begin(), expected.end(), [](const ColumnLogRow& a, const ColumnLogRow& b) {
+            return a.sample.timestamp < b.sample.timestamp;
+        });
+        CHECK_EQUAL(timestamps.first->sample.timestamp, block.getFirstTimestamp());
+        CHECK_EQUAL(timestamps.second->sample.timestamp, block.getLastTimestamp());
+
+        // Columns only decode as their own type
+        std::vector<unsigned long long> integers(block.getRowCount());
+        std::vector<float> floats(block.getRowCount());
+        CHECK(block.decode(GPU_LOG_COLUMN_GPU_ID, integers.data()) && integers[0] == expected[0].gpuId);
+        CHECK(block.decode(GPU_LOG_COLUMN_FIRST_VALUE, floats.data()) && floats[0] == expected[0].sample.coreClock);
+        CHECK(!block.decode(GPU_LOG_COLUMN_TIMESTAMP, floats.data()));
+        CHECK(!block.decode(GPU_LOG_COLUMN_FIRST_VALUE, integers.data()));
+    }
+
+    // Only the blocks overlapping the window are found
+    const auto from = rows[150].sample.timestamp;
+    const auto to = rows[250].sample.timestamp;
+    const auto found = reader.findBlocks(from, to);
+    CHECK_EQUAL(2u, found.size());
+    for (const auto& block : found) {
+        CHECK(block.getFirstTimestamp() <= to && block.getLastTimestamp() >= from);
+    }
+    CHECK(reader.findBlocks(rows.back().sample.timestamp + 1, ULLONG_MAX).empty());
+    reader.close();
+
+    // A closed log whose trailer, index or header doesn't hold up isn't read
+    const auto data = readFile(path);
+    GpuLogTrailer trailer;
+    std::memcpy(&trailer, data.data() + data.size() - sizeof(trailer), sizeof(trailer));
+    const auto corrupt = [&](size_t offset, UINT32 value) {
+        auto corrupted = data;
+        std::memcpy(corrupted.data() + offset, &value, sizeof(value));
+        writeFile(path, corrupted, corrupted.size());
+        return !reader.open(path);
+    };
+    const auto trailerOffset = data.size() - sizeof(trailer);
+    const auto firstEntry = static_cast<size_t>(trailer.indexOffset);
+    CHECK(corrupt(trailerOffset + offsetof(GpuLogTrailer, indexOffset), static_cast<UINT32>(trailer.indexOffset + 4)));
+    CHECK(corrupt(trailerOffset + offsetof(GpuLogTrailer, blockCount), trailer.blockCount + 1));
+    CHECK(corrupt(firstEntry + offsetof(GpuLogIndexEntry, offset), 12));
+    CHECK(corrupt(firstEntry + offsetof(GpuLogIndexEntry, rowCount), blockRows + 1));
+    CHECK(corrupt(offsetof(GpuLogFileHeader, version), GPU_LOG_VERSION + 1));
+    CHECK(corrupt(sizeof(GpuLogFileHeader) + offsetof(GpuLogBlockHeader, magic), 0));
+    std::remove(path);
+}
+
+/**
+ * A log that was never closed has no index or trailer, and its last block
+ * may be cut short. It's read up to the last whole block.
+ */
+void testColumnLogRecovery()
+{
+    const char* const path = "lib_gpu_tests_column.log";
+    const char* const truncatedPath = "lib_gpu_tests_truncated.log";
+    const auto blockRows = 100u;
+    const auto rows = makeColumnLogRows(350);
+    if (!writeColumnLog(path, rows, blockRows)) {
+        return;
+    }
+
+    const auto data = readFile(path);
+    GpuLogTrailer trailer;
+    std::memcpy(&trailer, data.data() + data.size() - sizeof(trailer), sizeof(trailer));
+    if (!CHECK_EQUAL(4u, trailer.blockCount)) {
+        return;
+    }
+    std::vector<GpuLogIndexEntry> index(trailer.blockCount);
+    std::memcpy(index.data(), data.data() + trailer.indexOffset, index.size() * sizeof(GpuLogIndexEntry));
+
+    struct Truncation
+    {
+        UINT64 size;
+        unsigned wholeBlocks;
+    };
+    const Truncation truncations[] = {
+        // Without the index and trailer, every block is still whole
+        { trailer.indexOffset, 4 },
+        { index[3].offset, 3 },
+        // In the middle of a block's columns, and of its header
+        { index[2].offset + sizeof(GpuLogBlockHeader) + 10, 2 },
+        { index[2].offset + 4, 2 },
+        { index[1].offset - 1, 0 },
+        { sizeof(GpuLogFileHeader), 0 },
+    };
+    for (const auto& truncation : truncations) {
+        writeFile(truncatedPath, data, static_cast<size_t>(truncation.size));
+        GpuColumnLogReader reader;
+        if (!CHECK(reader.open(truncatedPath)) || !CHECK_EQUAL(truncation.wholeBlocks, reader.getBlockCount())) {
+            continue;
+        }
+        for (auto i = 0u; i < reader.getBlockCount(); i++) {
+            GpuColumnLogBlock block;
+            CHECK(reader.getBlock(i, block));
+            const auto expected = columnLogBlockRows(rows, blockRows, i);
+            checkColumnLogBlock(block, expected);
+            CHECK_EQUAL(index[i].firstTimestamp, block.getFirstTimestamp());
+            CHECK_EQUAL(index[i].lastTimestamp, block.getLastTimestamp());
+        }
+    }
+
+    // Too short for even the file header
+    writeFile(truncatedPath, data, sizeof(GpuLogFileHeader) - 1);
+    GpuColumnLogReader reader;
+    CHECK(!reader.open(truncatedPath));
+    std::remove(path);
+    std::remove(truncatedPath);
+}
+
+#pragma endregion
+
+#pragma region Stream writer
+
+const char* const TEST_STREAM_PREFIX = "lib_gpu_tests_stream";
+
+std::string streamFileName(unsigned number)
+{
+    char name[64];
+    std::snprintf(name, sizeof(name), "%s_%04u.csv", TEST_STREAM_PREFIX, number);
+    return name;
+}
+
+std::string readStreamFile(unsigned number)
+{
+    const auto data = readFile(streamFileName(number).c_str());
+    return std::string(data.begin(), data.end());
+}
+
+void removeStreamFiles(unsigned count)
+{
+    for (auto i = 0u; i < count; i++) {
+        std::remove(streamFileName(i).c_str());
+    }
+}
+
+void testStreamWriterDrops()
+{
+    StreamWriterConfig config;
+    config.prefix = TEST_STREAM_PREFIX;
+    config.header = "a,b\n";
+    config.bufferSize = 16;
+    config.rotateBytes = 0;
+    config.rotateInterval = std::chrono::seconds(0);
+    const std::string record = "1234,5678\n";
+
+    // Without the writer thread running nothing is taken off the buffer, so
+    // it fills up as if the writer was stuck on a slow file
+    std::string written;
+    {
+        StreamWriter writer(config);
+        CHECK(writer.write(record.data(), record.size()));
+        CHECK(writer.write(record.data(), record.size()));
+        CHECK(writer.write(record.data(), record.size()));
+        written = record + record + record;
+
+        // Two buffers' worth is waiting now, so anything more is dropped
+        CHECK(!writer.write(record.data(), record.size()));
+        CHECK(!writer.write(record.data(), record.size()));
+        CHECK(writer.write("2\n", 2));
+        written += "2\n";
+        CHECK(!writer.write("3\n", 2));
+
+        auto stats = writer.getStats();
+        CHECK_EQUAL(4ull, stats.records);
+        CHECK_EQUAL(3ull, stats.dropped);
+
+        // Everything that wasn't dropped is still written
+        CHECK(writer.start());
+        writer.stop();
+        CHECK(writer.isHealthy());
+        stats = writer.getStats();
+        CHECK_EQUAL(static_cast<unsigned long long>(written.size()), stats.bytes);
+        CHECK_EQUAL(1u, stats.files);
+    }
+    CHECK(config.header + written == readStreamFile(0));
+    removeStreamFiles(1);
+}
+
+void testStreamWriterRotation()
+{
+    StreamWriterConfig config;
+    config.prefix = TEST_STREAM_PREFIX;
+    config.header = "a,b\n";
+    config.bufferSize = 1024;
+    // Any buffer written after the header goes past this
+    config.rotateBytes = config.header.size() + 1;
+    config.rotateInterval = std::chrono::seconds(0);
+    config.flushInterval = std::chrono::milliseconds(10);
+    const char* const records[] = { "1,2\n", "3,4\n", "5,6\n" };
+    const auto fileCount = static_cast<unsigned>(sizeof(records) / sizeof(records[0]));
+    removeStreamFiles(fileCount + 1);
+
+    StreamWriter writer(config);
+    CHECK(writer.start());
+    auto bytes = 0ull;
+    for (const auto record : records) {
+        const auto size = std::strlen(record);
+        CHECK(writer.write(record, size));
+        bytes += size;
+        // Wait for each record to be flushed on its own, so each one ends up
+        // in a file of its own
+        CHECK(waitUntil([&] { return writer.getStats().bytes == bytes; }));
+    }
+    writer.stop();
+    CHECK(writer.isHealthy());
+    CHECK_EQUAL(fileCount, writer.getStats().files);
+
+    for (auto i = 0u; i < fileCount; i++) {
+        if (!CHECK(config.header + records[i] == readStreamFile(i))) {
+            std::cerr << "  in " << streamFileName(i) << std::endl;
+        }
+    }
+    CHECK(!std::ifstream(streamFileName(fileCount)).is_open());
+    removeStreamFiles(fileCount);
+}
+
+#pragma endregion
+
+#pragma region Broker
+
+// Only the tests' own server listens here, and the tests talk to it through handle()
+const char* const TEST_BROKER_PIPE_NAME = "\\\\.\\pipe\\lib_gpu_tests";
+// Long enough for messages sent after it to be queued while the worker polls
+// Long enough for the worker to stay busy with a poll while the test queues
+// up more messages, which it doesn't have to wait for
+const unsigned BROKER_CALL_LATENCY_US = 50000;
+
+GpuBrokerMessageHeader brokerHeader(size_t count)
+{
+    return { GPU_BROKER_MAGIC, GPU_BROKER_VERSION, static_cast<UINT16>(count), static_cast<UINT32>(count * sizeof(GpuBrokerRequest)) };
+}
+
+std::vector<char> brokerMessage(const GpuBrokerMessageHeader& header, const std::vector<GpuBrokerRequest>& requests)
+{
+    std::vector<char> message(sizeof(header) + requests.size() * sizeof(GpuBrokerRequest));
+    memcpy(message.data(), &header, sizeof(header));
+    if (!requests.empty()) {
+        memcpy(message.data() + sizeof(header), requests.data(), requests.size() * sizeof(GpuBrokerRequest));
+    }
+    return message;
+}
+
+std::vector<char> brokerMessage(const std::vector<GpuBrokerRequest>& requests)
+{
+    return brokerMessage(brokerHeader(requests.size()), requests);
+}
+
+/**
+ * Read a response message the way GpuBrokerClient does, failing on anything
+ * out of place.
+ */
+bool readBrokerResults(const std::vector<char>& message, std::vector<GpuBrokerResult>& results)
+{
+    GpuBrokerMessageHeader header;
+    if (message.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, message.data(), sizeof(header));
+    if (header.magic != GPU_BROKER_MAGIC || header.version != GPU_BROKER_VERSION || header.size != message.size() - sizeof(header)) {
+        return false;
+    }
+
+    results.assign(header.count, GpuBrokerResult{});
+    auto offset = sizeof(header);
+    for (auto& result : results) {
+        GpuBrokerResponse response;
+        if (offset + sizeof(response) > message.size()) {
+            return false;
+        }
+        memcpy(&response, message.data() + offset, sizeof(response));
+        offset += sizeof(response);
+
+        result.status = static_cast<GPU_BROKER_STATUS>(response.status);
+        result.value = response.value;
+        const auto hasRecord = response.status == GPU_BROKER_STATUS_OK &&
+            (response.type == GPU_BROKER_REQUEST_POLL || response.type == GPU_BROKER_REQUEST_SNAPSHOT);
+        if (hasRecord) {
+            if (offset + sizeof(result.record) > message.size()) {
+                return false;
+            }
+            memcpy(&result.record, message.data() + offset, sizeof(result.record));
+            offset += sizeof(result.record);
+        }
+    }
+    return offset == message.size();
+}
+
+/**
+ * Send each message from its own thread, in order. The first message's poll
+ * keeps the worker busy while the rest queue up one by one, so they're
+ * answered together in the next batch. Calls take no time from then on.
+ */
+void handleBatched(GpuBrokerServer& server, const std::vector<std::vector<char>>& messages,
+    std::vector<std::vector<char>>& responses, std::vector<bool>& handled)
+{
+    responses.assign(messages.size(), std::vector<char>());
+    std::vector<char> results(messages.size(), 0);
+    std::vector<std::thread> threads;
+    const auto callsBefore = totalCallCount();
+    for (size_t i = 0; i < messages.size(); i++) {
+        threads.emplace_back([&, i] {
+            results[i] = server.handle(messages[i], responses[i]);
+        });
+        // The worker is busy once the first poll reached the driver
+        if (i == 0) {
+            CHECK(waitUntil([&] { return totalCallCount() > callsBefore; }));
+        } else {
+            CHECK(waitUntil([&] { return server.getStats().queuedMessages == i; }));
+        }
+    }
+    set_simulation_latency(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    handled.assign(results.begin(), results.end());
+}
+
+void testBrokerCoalescesPolls()
+{
+    resetSimulation(1, BROKER_CALL_LATENCY_US);
+    NvidiaApi api;
+    GpuBrokerServer server;
+    CHECK(server.start(api, TEST_BROKER_PIPE_NAME));
+
+    const auto first = brokerMessage({ { GPU_BROKER_REQUEST_POLL, 0, 0, 0 } });
+    const auto pollAndSnapshot = brokerMessage({ { GPU_BROKER_REQUEST_POLL, 0, 0, 0 }, { GPU_BROKER_REQUEST_SNAPSHOT, 0, 0, 0 } });
+    std::vector<std::vector<char>> responses;
+    std::vector<bool> handled;
+    handleBatched(server, { first, pollAndSnapshot, pollAndSnapshot, pollAndSnapshot, pollAndSnapshot }, responses, handled);
+    server.stop();
+
+    // The four messages that came in during the first poll share a single one
+    const auto stats = server.getStats();
+    CHECK_EQUAL(5u, stats.messages);
+    CHECK_EQUAL(9u, stats.requests);
+    CHECK_EQUAL(2u, stats.batches);
+    CHECK_EQUAL(2u, stats.polls);
+    CHECK_EQUAL(3u, stats.coalescedPolls);
+    CHECK_EQUAL(2u, callCount(NVIDIA_FUNCTION_GpuGetThermalSettings));
+
+    std::vector<GpuBrokerResult> firstResults;
+    CHECK(handled[0] && readBrokerResults(responses[0], firstResults));
+    CHECK(firstResults.size() == 1 && firstResults[0].status == GPU_BROKER_STATUS_OK);
+
+    std::vector<GpuBrokerResult> expected;
+    for (size_t i = 1; i < responses.size(); i++) {
+        std::vector<GpuBrokerResult> results;
+        if (!CHECK(handled[i] && readBrokerResults(responses[i], results)) || !CHECK_EQUAL(2u, results.size())) {
+            continue;
+        }
+        CHECK_EQUAL(GPU_BROKER_STATUS_OK, results[0].status);
+        CHECK_EQUAL(GPU_BROKER_STATUS_OK, results[1].status);
+        // Every response reads the data of the same poll
+        CHECK(sameValues(results[0].record.snapshot, results[1].record.snapshot));
+        if (expected.empty()) {
+            expected = results;
+            CHECK(results[0].record.snapshot.version != firstResults[0].record.snapshot.version);
+        } else {
+            CHECK(sameValues(expected[0].record.snapshot, results[0].record.snapshot));
+            CHECK_EQUAL(expected[0].record.sample.timestamp, results[0].record.sample.timestamp);
+        }
+    }
+}
+
+void testBrokerOverclockOrder()
+{
+    resetSimulation(1, BROKER_CALL_LATENCY_US);
+    NvidiaApi api;
+    GpuBrokerServer server;
+    CHECK(server.start(api, TEST_BROKER_PIPE_NAME));
+
+    const auto area = static_cast<UINT32>(GPU_OVERCLOCK_SETTING_AREA_CORE);
+    const auto first = brokerMessage({ { GPU_BROKER_REQUEST_POLL, 0, 0, 0 } });
+    const auto overclock = brokerMessage({ { GPU_BROKER_REQUEST_SET_OVERCLOCK, 0, area, 100.0f },
+        { GPU_BROKER_REQUEST_SET_OVERCLOCK, 0, area, 50.0f } });
+    const auto overclockAndPoll = brokerMessage({ { GPU_BROKER_REQUEST_SET_OVERCLOCK, 0, area, 75.0f },
+        { GPU_BROKER_REQUEST_POLL, 0, 0, 0 } });
+    const auto snapshot = brokerMessage({ { GPU_BROKER_REQUEST_SNAPSHOT, 0, 0, 0 } });
+    std::vector<std::vector<char>> responses;
+    std::vector<bool> handled;
+    handleBatched(server, { first, overclock, overclockAndPoll, snapshot }, responses, handled);
+    server.stop();
+
+    CHECK_EQUAL(2u, server.getStats().batches);
+    // Each message's overclocks are applied at once
+    CHECK_EQUAL(2u, callCount(NVIDIA_FUNCTION_SetPstates20));
+
+    std::vector<GpuBrokerResult> results;
+    CHECK(handled[1] && readBrokerResults(responses[1], results));
+    CHECK(results.size() == 2 && results[0].status == GPU_BROKER_STATUS_OK && results[1].status == GPU_BROKER_STATUS_OK);
+
+    // The overclocks went in the order the messages came in, and before the polls
+    for (auto i = 2u; i < 4; i++) {
+        CHECK(handled[i] && readBrokerResults(responses[i], results));
+        if (CHECK(!results.empty() && results.back().status == GPU_BROKER_STATUS_OK)) {
+            CHECK_EQUAL(75.0f, results.back().record.snapshot.overclockProfile.coreOverclock.currentValue);
+        }
+    }
+    GpuOverclockProfile profile;
+    CHECK(api.getGPU(0)->getOverclockProfile(profile));
+    CHECK_EQUAL(75.0f, profile.coreOverclock.currentValue);
+}
+
+void testBrokerMalformedMessages()
+{
+    resetSimulation(1);
+    NvidiaApi api;
+    GpuBrokerServer server;
+    const auto poll = std::vector<GpuBrokerRequest>{ { GPU_BROKER_REQUEST_POLL, 0, 0, 0 } };
+    std::vector<char> response;
+    CHECK(!server.handle(brokerMessage(poll), response));
+    CHECK(server.start(api, TEST_BROKER_PIPE_NAME));
+    NvidiaApi::resetCallStats();
+
+    auto badMagic = brokerHeader(1);
+    badMagic.magic = ~GPU_BROKER_MAGIC;
+    auto badVersion = brokerHeader(1);
+    badVersion.version = GPU_BROKER_VERSION + 1;
+    auto badSize = brokerHeader(1);
+    badSize.size += 1;
+    const auto tooMany = std::vector<GpuBrokerRequest>(GPU_BROKER_MAX_REQUESTS + 1, poll[0]);
+    auto truncated = brokerMessage(poll);
+    truncated.pop_back();
+    auto tooLong = brokerMessage(poll);
+    tooLong.push_back(0);
+    const std::vector<std::vector<char>> malformed = {
+        std::vector<char>(),
+        std::vector<char>(sizeof(GpuBrokerMessageHeader) - 1, 0),
+        brokerMessage(badMagic, poll),
+        brokerMessage(badVersion, poll),
+        brokerMessage(badSize, poll),
+        brokerMessage(tooMany),
+        truncated,
+        tooLong,
+    };
+    for (const auto& message : malformed) {
+        response.assign(4, 'x');
+        CHECK(!server.handle(message, response));
+        CHECK(response.empty());
+    }
+    CHECK_EQUAL(0u, server.getStats().messages);
+    CHECK_EQUAL(0u, totalCallCount());
+
+    // None of them got in the way of the server
+    std::vector<GpuBrokerResult> results;
+    CHECK(server.handle(brokerMessage(poll), response));
+    CHECK(readBrokerResults(response, results));
+    CHECK(results.size() == 1 && results[0].status == GPU_BROKER_STATUS_OK);
+    CHECK(server.handle(brokerMessage({}), response));
+    CHECK(readBrokerResults(response, results) && results.empty());
+    CHECK_EQUAL(2u, server.getStats().messages);
+
+    server.stop();
+    CHECK(!server.handle(brokerMessage(poll), response));
+}
+
+void testBrokerInvalidRequests()
+{
+    resetSimulation(2);
+    NvidiaApi api;
+    GpuBrokerServer server;
+    CHECK(server.start(api, TEST_BROKER_PIPE_NAME));
+
+    const auto core = static_cast<UINT32>(GPU_OVERCLOCK_SETTING_AREA_CORE);
+    const auto message = brokerMessage({
+        { GPU_BROKER_REQUEST_GPU_COUNT, 0, 0, 0 },
+        { GPU_BROKER_REQUEST_POLL, 1, 0, 0 },
+        { GPU_BROKER_REQUEST_POLL, 2, 0, 0 },
+        { GPU_BROKER_REQUEST_SNAPSHOT, NVIDIA_MAX_PHYSICAL_GPUS, 0, 0 },
+        { GPU_BROKER_REQUEST_SNAPSHOT, USHRT_MAX, 0, 0 },
+        { GPU_BROKER_REQUEST_SET_OVERCLOCK, 2, core, 100.0f },
+        { GPU_BROKER_REQUEST_SET_OVERCLOCK, 0, GPU_OVERCLOCK_SETTING_AREA_THERMAL_LIMIT + 1, 100.0f },
+        { 0, 0, 0, 0 },
+        { GPU_BROKER_REQUEST_SET_OVERCLOCK + 1, 0, 0, 0 },
+        { GPU_BROKER_REQUEST_SET_OVERCLOCK, 0, core, 100.0f },
+        { GPU_BROKER_REQUEST_SET_OVERCLOCK, 0, core, 50.0f },
+    });
+    std::vector<char> response;
+    std::vector<GpuBrokerResult> results;
+    CHECK(server.handle(message, response));
+    server.stop();
+
+    // The invalid requests are answered without records, and don't stop the valid ones
+    if (CHECK(readBrokerResults(response, results)) && CHECK_EQUAL(11u, results.size())) {
+        CHECK_EQUAL(GPU_BROKER_STATUS_OK, results[0].status);
+        CHECK_EQUAL(2u, results[0].value);
+        CHECK_EQUAL(GPU_BROKER_STATUS_OK, results[1].status);
+        CHECK(results[1].record.snapshot.valid);
+        for (auto i = 2u; i < 9; i++) {
+            CHECK_EQUAL(GPU_BROKER_STATUS_INVALID, results[i].status);
+        }
+        CHECK_EQUAL(GPU_BROKER_STATUS_OK, results[9].status);
+        CHECK_EQUAL(GPU_BROKER_STATUS_OK, results[10].status);
+    }
+
+    // The last overclock of an area in a message wins
+    GpuOverclockProfile profile;
+    CHECK(api.getGPU(0)->getOverclockProfile(profile));
+    CHECK_EQUAL(50.0f, profile.coreOverclock.currentValue);
+    CHECK(api.getGPU(1)->getOverclockProfile(profile));
+    CHECK_EQUAL(0.0f, profile.coreOverclock.currentValue);
+    CHECK_EQUAL(1u, server.getStats().polls);
+}
+
+#pragma endregion
+
+#pragma region Shared telemetry
+
+// Only the tests publish here
+const char* const TEST_TELEMETRY_NAME = "Local\\lib_gpu_tests_telemetry";
+const auto TELEMETRY_INTERVAL = std::chrono::milliseconds(5);
+
+/**
+ * Read a GPU's record once the publisher has published `version` of it.
+ */
+bool waitForTelemetry(const GpuSharedTelemetryReader& reader, unsigned index, unsigned long long version,
+    GpuSharedTelemetryRecord& record)
+{
+    for (auto attempt = 0; attempt < 200; attempt++) {
+        if (reader.read(index, record) && record.snapshot.version >= version) {
+            return true;
+        }
+        std::this_thread::sleep_for(TELEMETRY_INTERVAL);
+    }
+    return false;
+}
+
+void testSharedTelemetry()
+{
+    resetSimulation(2);
+    NvidiaApi api;
+    GpuSharedTelemetryReader reader;
+    CHECK(!reader.open(TEST_TELEMETRY_NAME));
+
+    GpuSharedTelemetryPublisher publisher;
+    CHECK(publisher.start(api, TELEMETRY_INTERVAL, TEST_TELEMETRY_NAME));
+    GpuSharedTelemetryPublisher second;
+    CHECK(!second.start(api, TELEMETRY_INTERVAL, TEST_TELEMETRY_NAME));
+    CHECK(reader.open(TEST_TELEMETRY_NAME));
+    CHECK_EQUAL(2u, reader.getGPUCount());
+
+    // Nothing is published before the first poll
+    GpuSharedTelemetryRecord record;
+    CHECK(!reader.read(0, record));
+    CHECK(!reader.read(2, record));
+
+    for (auto i = 0u; i < api.getGPUCount(); i++) {
+        const auto gpu = api.getGPU(i);
+        CHECK(gpu->poll());
+        GpuSnapshot values;
+        GpuSample sample;
+        CHECK(gpu->getValues(values) && gpu->getSample(sample));
+        if (!CHECK(waitForTelemetry(reader, i, values.version, record))) {
+            continue;
+        }
+        CHECK(sameValues(values, record.snapshot));
+        CHECK_EQUAL(gpu->getGPUID(), record.snapshot.GPUID);
+        CHECK_EQUAL(sample.timestamp, record.sample.timestamp);
+        CHECK_EQUAL(gpu->getName(), std::string(record.name));
+    }
+    CHECK(reader.getPublisherAge() < std::chrono::milliseconds(1000));
+
+    // The data outlives the publisher, and the segment is free for another
+    publisher.stop();
+    CHECK(reader.read(1, record));
+    CHECK(second.start(api, TELEMETRY_INTERVAL, TEST_TELEMETRY_NAME));
+    second.stop();
+}
+
+/**
+ * A publisher taking over from one that died in the middle of writing a
+ * slot must not let readers see the half written record.
+ */
+void testSharedTelemetryTakeover()
+{
+    resetSimulation(2);
+    NvidiaApi api;
+
+    const auto mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0,
+        sizeof(GpuSharedTelemetrySegment), TEST_TELEMETRY_NAME);
+    const auto segment = mapping ? static_cast<GpuSharedTelemetrySegment*>(
+        MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(GpuSharedTelemetrySegment))) : nullptr;
+    if (!CHECK(segment != nullptr)) {
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        return;
+    }
+
+    // The dead publisher published GPU 1, and was writing GPU 0. Its thread
+    // ends while holding the mutex, which abandons it.
+    const auto oldGPUID = 1234u;
+    std::memset(&segment->slots[0].record, 0xFF, sizeof(GpuSharedTelemetryRecord));
+    segment->slots[0].sequence = 3;
+    segment->slots[1].record = GpuSharedTelemetryRecord{};
+    segment->slots[1].record.snapshot.valid = true;
+    segment->slots[1].record.snapshot.GPUID = oldGPUID;
+    segment->slots[1].sequence = 2;
+    HANDLE role = nullptr;
+    std::thread([&] {
+        role = CreateMutexA(nullptr, FALSE, (std::string(TEST_TELEMETRY_NAME) + GPU_SHARED_TELEMETRY_MUTEX_SUFFIX).c_str());
+        WaitForSingleObject(role, 0);
+    }).join();
+
+    GpuSharedTelemetryPublisher publisher;
+    CHECK(publisher.start(api, TELEMETRY_INTERVAL, TEST_TELEMETRY_NAME));
+    GpuSharedTelemetryReader reader;
+    CHECK(reader.open(TEST_TELEMETRY_NAME));
+
+    // The half written slot is unpublished, and the whole one still readable
+    GpuSharedTelemetryRecord record;
+    CHECK(!reader.read(0, record));
+    CHECK(reader.read(1, record) && record.snapshot.GPUID == oldGPUID);
+
+    // Until the new publisher replaces them
+    for (auto i = 0u; i < api.getGPUCount(); i++) {
+        const auto gpu = api.getGPU(i);
+        CHECK(gpu->poll());
+        if (CHECK(waitForTelemetry(reader, i, gpu->getSampleVersion(), record))) {
+            CHECK(record.snapshot.valid);
+            CHECK_EQUAL(gpu->getGPUID(), record.snapshot.GPUID);
+        }
+    }
+
+    publisher.stop();
+    reader.close();
+    UnmapViewOfFile(segment);
+    CloseHandle(mapping);
+    if (role) {
+        CloseHandle(role);
+    }
+}
+
+#pragma endregion
+
+struct Test
+{
+    const char* name;
+    void(*run)();
+};
+
+const Test TESTS[] = {
+    { "first poll loads everything", testFirstPollLoadsEverything },
+    { "poll(fields) driver calls", testPollFieldCalls },
+    { "static data reload", testStaticReload },
+    { "carried over fields", testCarriedOverFields },
+    { "changed metrics", testChangedMetrics },
+    { "change threshold", testChangeThreshold },
+    { "change threshold drift", testChangeThresholdDrift },
+    { "missing entry points", testMissingEntryPoints },
+    { "capture and replay", testCaptureReplay },
+    { "scheduler intervals", testSchedulerIntervals },
+    { "subscription edges", testSubscriptionEdges },
+    { "unsubscribe waits for callback", testUnsubscribeWaitsForCallback },
+    { "unsubscribe from callback", testUnsubscribeFromCallback },
+    { "subscription queue full", testSubscriptionQueueFull },
+    { "concurrent poll, read and overclock", testConcurrentPollReadOverclock },
+    { "shared polls", testSharedPolls },
+    { "history ring", testHistoryRing },
+    { "concurrent history", testConcurrentHistory },
+    { "get snapshot", testGetSnapshot },
+    { "get all snapshots", testGetAllSnapshots },
+    { "max age fresh data", testMaxAgeFreshData },
+    { "max age stale fields", testMaxAgeStaleFields },
+    { "max age reported age", testMaxAgeReportedAge },
+    { "max age concurrent GPUs", testMaxAgeConcurrentGPUs },
+    { "archive round trip", testArchiveRoundTrip },
+    { "archive timestamp gaps", testArchiveTimestampGaps },
+    { "archive max bytes", testArchiveMaxBytes },
+    { "archive windows", testArchiveWindows },
+    { "column log round trip", testColumnLogRoundTrip },
+    { "column log recovery", testColumnLogRecovery },
+    { "stream writer drops", testStreamWriterDrops },
+    { "stream writer rotation", testStreamWriterRotation },
+    { "broker coalesces polls", testBrokerCoalescesPolls },
+    { "broker overclock order", testBrokerOverclockOrder },
+    { "broker malformed messages", testBrokerMalformedMessages },
+    { "broker invalid requests", testBrokerInvalidRequests },
+    { "shared telemetry", testSharedTelemetry },
+    { "shared telemetry takeover", testSharedTelemetryTakeover },
+};
+
+int main()
+{
+    auto failedTests = 0;
+    for (const auto& test : TESTS) {
+        const auto failedBefore = failed_checks;
+        test.run();
+        const auto passed = failed_checks == failedBefore;
+        std::cout << (passed ? "PASS " : "FAIL ") << test.name << std::endl;
+        if (!passed) {
+            failedTests++;
+        }
+    }
+
+    return failedTests;
+}
\ No newline at end of file
@@ -0,0 +1,631 @@
+#include "pch.h"
+#include "GpuBroker.h"
+#include "NvidiaApi.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+
+namespace lib_gpu {
+
+const DWORD BROKER_PIPE_BUFFER_SIZE = 64 * 1024;
+// How long a client waits for the broker to have a pipe instance free
+const DWORD BROKER_CONNECT_TIMEOUT_MS = 1000;
+
+#pragma region Messages
+
+bool hasRecord(const GpuBrokerResponse& response)
+{
+    return response.status == GPU_BROKER_STATUS_OK &&
+        (response.type == GPU_BROKER_REQUEST_POLL || response.type == GPU_BROKER_REQUEST_SNAPSHOT);
+}
+
+// The most a response to `count` requests can take, not counting the header
+size_t maxResponseSize(unsigned count)
+{
+    return count * (sizeof(GpuBrokerResponse) + sizeof(GpuSharedTelemetryRecord));
+}
+
+bool isValidRequestHeader(const GpuBrokerMessageHeader& header)
+{
+    return header.magic == GPU_BROKER_MAGIC && header.version == GPU_BROKER_VERSION &&
+        header.count <= GPU_BROKER_MAX_REQUESTS && header.size == header.count * sizeof(GpuBrokerRequest);
+}
+
+template <typename T>
+void appendBytes(std::vector<char>& buffer, const T& value)
+{
+    const auto bytes = reinterpret_cast<const char*>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+#pragma endregion
+
+#pragma region Pipe I/O
+
+HANDLE createBrokerPipe(const std::string& name, bool first)
+{
+    return CreateNamedPipeA(name.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+        PIPE_UNLIMITED_INSTANCES, BROKER_PIPE_BUFFER_SIZE, BROKER_PIPE_BUFFER_SIZE, 0, nullptr);
+}
+
+// Finish an overlapped operation on the server's end of a pipe, cancelling it
+// if `stopEvent` is set first
+bool completeOverlapped(HANDLE pipe, OVERLAPPED& overlapped, HANDLE stopEvent, BOOL started, DWORD& transferred)
+{
+    if (!started && GetLastError() != ERROR_IO_PENDING) {
+        return false;
+    }
+
+    HANDLE events[] = { overlapped.hEvent, stopEvent };
+    if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0) {
+        CancelIo(pipe);
+        // The operation has to be done with the OVERLAPPED before it goes away
+        GetOverlappedResult(pipe, &overlapped, &transferred, TRUE);
+        return false;
+    }
+    return GetOverlappedResult(pipe, &overlapped, &transferred, FALSE) != FALSE;
+}
+
+bool transferOverlapped(HANDLE pipe, HANDLE event, HANDLE stopEvent, char* data, size_t size, bool write)
+{
+    for (size_t done = 0; done < size;) {
+        OVERLAPPED overlapped = {};
+        overlapped.hEvent = event;
+        const auto remaining = static_cast<DWORD>(size - done);
+        const auto started = write ?
+            WriteFile(pipe, data + done, remaining, nullptr, &overlapped) :
+            ReadFile(pipe, data + done, remaining, nullptr, &overlapped);
+
+        DWORD transferred = 0;
+        if (!completeOverlapped(pipe, overlapped, stopEvent, started, transferred) || transferred == 0) {
+            return false;
+        }
+        done += transferred;
+    }
+    return true;
+}
+
+bool transferBlocking(HANDLE pipe, char* data, size_t size, bool write)
+{
+    for (size_t done = 0; done < size;) {
+        const auto remaining = static_cast<DWORD>(size - done);
+        DWORD transferred = 0;
+        const auto success = write ?
+            WriteFile(pipe, data + done, remaining, &transferred, nullptr) :
+            ReadFile(pipe, data + done, remaining, &transferred, nullptr);
+        if (!success || transferred == 0) {
+            return false;
+        }
+        done += transferred;
+    }
+    return true;
+}
+
+#pragma endregion
+
+#pragma region GpuBrokerServer
+
+GpuBrokerServer::GpuBrokerServer() : stopEvent(nullptr)
+{
+}
+
+GpuBrokerServer::~GpuBrokerServer()
+{
+    this->stop();
+}
+
+bool GpuBrokerServer::start(NvidiaApi& api, const std::string& pipeName)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->worker.joinable() || api.getGPUCount() == 0) {
+        return false;
+    }
+
+    // Creating the first instance here fails if another broker has the pipe
+    const auto pipe = createBrokerPipe(pipeName, true);
+    if (pipe == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    this->stopEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    if (!this->stopEvent) {
+        CloseHandle(pipe);
+        return false;
+    }
+
+    this->api = &api;
+    this->pipeName = pipeName;
+    this->stopping = false;
+    this->worker = std::thread(&GpuBrokerServer::work, this);
+    this->listener = std::thread(&GpuBrokerServer::listen, this, pipe);
+    return true;
+}
+
+void GpuBrokerServer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->worker.joinable()) {
+            return;
+        }
+    }
+
+    // The clients may be waiting on the worker, so it goes last
+    SetEvent(this->stopEvent);
+    this->listener.join();
+    for (auto& client : this->clients) {
+        client.thread.join();
+    }
+    this->clients.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->workReady.notify_one();
+    this->worker.join();
+
+    CloseHandle(this->stopEvent);
+    this->stopEvent = nullptr;
+}
+
+bool GpuBrokerServer::isRunning() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->worker.joinable();
+}
+
+bool GpuBrokerServer::handle(const std::vector<char>& request, std::vector<char>& response)
+{
+    Pending pending = { &request, &response, false, false };
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (!this->worker.joinable() || this->stopping) {
+        return false;
+    }
+
+    this->queue.push_back(&pending);
+    this->workReady.notify_one();
+    this->workDone.wait(lock, [&pending] { return pending.done; });
+    return pending.valid;
+}
+
+GpuBrokerStats GpuBrokerServer::getStats() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto stats = this->stats;
+    stats.queuedMessages = this->queue.size();
+    return stats;
+}
+
+void GpuBrokerServer::listen(HANDLE firstPipe)
+{
+    const auto connectEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    auto pipe = firstPipe;
+
+    while (connectEvent && WaitForSingleObject(this->stopEvent, 0) != WAIT_OBJECT_0) {
+        for (auto client = this->clients.begin(); client != this->clients.end();) {
+            if (client->finished) {
+                client->thread.join();
+                client = this->clients.erase(client);
+            } else {
+                ++client;
+            }
+        }
+
+        if (pipe == INVALID_HANDLE_VALUE) {
+            pipe = createBrokerPipe(this->pipeName, false);
+        }
+        if (pipe == INVALID_HANDLE_VALUE) {
+            // Most likely out of resources, which waiting for clients to
+            // disconnect might fix
+            WaitForSingleObject(this->stopEvent, BROKER_CONNECT_TIMEOUT_MS);
+            continue;
+        }
+
+        OVERLAPPED overlapped = {};
+        overlapped.hEvent = connectEvent;
+        const auto started = ConnectNamedPipe(pipe, &overlapped);
+        // A client that connected between creating the pipe and waiting for
+        // one doesn't signal the event
+        DWORD transferred = 0;
+        const auto connected = (!started && GetLastError() == ERROR_PIPE_CONNECTED) ||
+            completeOverlapped(pipe, overlapped, this->stopEvent, started, transferred);
+        if (!connected) {
+            CloseHandle(pipe);
+            pipe = INVALID_HANDLE_VALUE;
+            continue;
+        }
+
+        this->clients.emplace_back();
+        auto& client = this->clients.back();
+        client.thread = std::thread(&GpuBrokerServer::serve, this, pipe, &client.finished);
+        pipe = INVALID_HANDLE_VALUE;
+    }
+
+    if (pipe != INVALID_HANDLE_VALUE) {
+        CloseHandle(pipe);
+    }
+    if (connectEvent) {
+        CloseHandle(connectEvent);
+    }
+}
+
+void GpuBrokerServer::serve(HANDLE pipe, std::atomic<bool>* finished)
+{
+    const auto event = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    std::vector<char> request;
+    std::vector<char> response;
+
+    while (event) {
+        GpuBrokerMessageHeader header;
+        if (!transferOverlapped(pipe, event, this->stopEvent, reinterpret_cast<char*>(&header), sizeof(header), false) ||
+            !isValidRequestHeader(header)) {
+            break;
+        }
+
+        request.resize(sizeof(header) + header.size);
+        std::memcpy(request.data(), &header, sizeof(header));
+        if (!transferOverlapped(pipe, event, this->stopEvent, request.data() + sizeof(header), header.size, false) ||
+            !this->handle(request, response) ||
+            !transferOverlapped(pipe, event, this->stopEvent, response.data(), response.size(), true)) {
+            break;
+        }
+    }
+
+    if (event) {
+        CloseHandle(event);
+    }
+    DisconnectNamedPipe(pipe);
+    CloseHandle(pipe);
+    *finished = true;
+}
+
+void GpuBrokerServer::work()
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->workReady.wait(lock, [this] { return this->stopping || !this->queue.empty(); });
+        if (this->queue.empty()) {
+            return;
+        }
+
+        // Everything that came in during the previous batch goes in this one
+        std::vector<Pending*> batch;
+        batch.swap(this->queue);
+        lock.unlock();
+
+        this->process(batch);
+
+        lock.lock();
+        for (const auto pending : batch) {
+            pending->done = true;
+        }
+        this->workDone.notify_all();
+    }
+}
+
+void GpuBrokerServer::process(const std::vector<Pending*>& batch)
+{
+    const auto gpuCount = (std::min)(this->api->getGPUCount(), static_cast<unsigned>(NVIDIA_MAX_PHYSICAL_GPUS));
+    std::vector<std::vector<UINT16>> statuses(batch.size());
+    // How many requests want each GPU polled, and whether that poll worked
+    std::array<unsigned, NVIDIA_MAX_PHYSICAL_GPUS> pollRequests = {};
+    std::array<bool, NVIDIA_MAX_PHYSICAL_GPUS> polled = {};
+    GpuBrokerStats batchStats = {};
+
+    // Overclock in the order the requests came in, and gather the polls
+    for (size_t i = 0; i < batch.size(); i++) {
+        const auto& message = *batch[i]->request;
+        GpuBrokerMessageHeader header;
+        if (message.size() < sizeof(header)) {
+            continue;
+        }
+        std::memcpy(&header, message.data(), sizeof(header));
+        if (!isValidRequestHeader(header) || message.size() != sizeof(header) + header.size) {
+            continue;
+        }
+
+        batch[i]->valid = true;
+        batchStats.messages++;
+        batchStats.requests += header.count;
+        const auto requests = reinterpret_cast<const GpuBrokerRequest*>(message.data() + sizeof(header));
+        statuses[i].assign(header.count, GPU_BROKER_STATUS_OK);
+        // A message's overclocks of a GPU are applied together, like a
+        // GpuOverclockDefinitionMap passed to NvidiaGPU::setOverclock()
+        std::array<GpuOverclockDefinitionMap, NVIDIA_MAX_PHYSICAL_GPUS> overclocks;
+        for (auto j = 0u; j < header.count; j++) {
+            const auto& request = requests[j];
+            if (request.type == GPU_BROKER_REQUEST_GPU_COUNT) {
+                continue;
+            }
+            if (request.gpuIndex >= gpuCount || request.type < GPU_BROKER_REQUEST_GPU_COUNT ||
+                request.type > GPU_BROKER_REQUEST_SET_OVERCLOCK ||
+                (request.type == GPU_BROKER_REQUEST_SET_OVERCLOCK && request.area > GPU_OVERCLOCK_SETTING_AREA_THERMAL_LIMIT)) {
+                statuses[i][j] = GPU_BROKER_STATUS_INVALID;
+                continue;
+            }
+
+            if (request.type == GPU_BROKER_REQUEST_POLL ||
+                (request.type == GPU_BROKER_REQUEST_SNAPSHOT && this->api->getGPU(request.gpuIndex)->getSampleVersion() == 0)) {
+                pollRequests[request.gpuIndex]++;
+            } else if (request.type == GPU_BROKER_REQUEST_SET_OVERCLOCK) {
+                overclocks[request.gpuIndex][static_cast<GPU_OVERCLOCK_SETTING_AREA>(request.area)] = request.delta;
+            }
+        }
+
+        for (auto gpuIndex = 0u; gpuIndex < gpuCount; gpuIndex++) {
+            if (overclocks[gpuIndex].empty() || this->api->getGPU(gpuIndex)->setOverclock(overclocks[gpuIndex])) {
+                continue;
+            }
+            for (auto j = 0u; j < header.count; j++) {
+                const auto& request = requests[j];
+                if (request.type == GPU_BROKER_REQUEST_SET_OVERCLOCK && request.gpuIndex == gpuIndex &&
+                    statuses[i][j] == GPU_BROKER_STATUS_OK) {
+                    statuses[i][j] = GPU_BROKER_STATUS_FAILED;
+                }
+            }
+        }
+    }
+
+    for (auto gpuIndex = 0u; gpuIndex < gpuCount; gpuIndex++) {
+        if (pollRequests[gpuIndex] > 0) {
+            polled[gpuIndex] = this->api->getGPU(gpuIndex)->poll();
+            batchStats.polls++;
+            batchStats.coalescedPolls += pollRequests[gpuIndex] - 1;
+        }
+    }
+
+    // Every response for a GPU reads the same snapshot
+    std::array<GpuSharedTelemetryRecord, NVIDIA_MAX_PHYSICAL_GPUS> records;
+    std::array<bool, NVIDIA_MAX_PHYSICAL_GPUS> recorded = {};
+    for (size_t i = 0; i < batch.size(); i++) {
+        auto& response = *batch[i]->response;
+        response.clear();
+        if (!batch[i]->valid) {
+            continue;
+        }
+
+        const auto& message = *batch[i]->request;
+        const auto requests = reinterpret_cast<const GpuBrokerRequest*>(message.data() + sizeof(GpuBrokerMessageHeader));
+        const auto count = static_cast<UINT16>(statuses[i].size());
+        appendBytes(response, GpuBrokerMessageHeader{ GPU_BROKER_MAGIC, GPU_BROKER_VERSION, count, 0 });
+
+        for (auto j = 0u; j < count; j++) {
+            const auto& request = requests[j];
+            GpuBrokerResponse result = { request.type, statuses[i][j], 0 };
+            if (request.type == GPU_BROKER_REQUEST_GPU_COUNT) {
+                result.value = gpuCount;
+            } else if (result.status == GPU_BROKER_STATUS_OK) {
+                result.value = request.gpuIndex;
+            }
+
+            const auto wantsRecord = request.type == GPU_BROKER_REQUEST_POLL || request.type == GPU_BROKER_REQUEST_SNAPSHOT;
+            if (wantsRecord && result.status == GPU_BROKER_STATUS_OK) {
+                const auto gpuIndex = request.gpuIndex;
+                if (!recorded[gpuIndex]) {
+                    const auto gpu = this->api->getGPU(gpuIndex);
+                    const auto snapshot = gpu->getSnapshot();
+                    if (snapshot.isValid()) {
+                        fillTelemetryRecord(*gpu, snapshot, records[gpuIndex]);
+                        recorded[gpuIndex] = true;
+                    }
+                }
+                const auto failed = !recorded[gpuIndex] || (request.type == GPU_BROKER_REQUEST_POLL && !polled[gpuIndex]);
+                result.status = failed ? GPU_BROKER_STATUS_FAILED : GPU_BROKER_STATUS_OK;
+            }
+
+            appendBytes(response, result);
+            if (hasRecord(result)) {
+                appendBytes(response, records[request.gpuIndex]);
+            }
+        }
+
+        const auto size = static_cast<UINT32>(response.size() - sizeof(GpuBrokerMessageHeader));
+        std::memcpy(response.data() + offsetof(GpuBrokerMessageHeader, size), &size, sizeof(size));
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stats.messages += batchStats.messages;
+    this->stats.requests += batchStats.requests;
+    this->stats.batches++;
+    this->stats.polls += batchStats.polls;
+    this->stats.coalescedPolls += batchStats.coalescedPolls;
+}
+
+#pragma endregion
+
+#pragma region GpuBrokerClient
+
+GpuBrokerClient::GpuBrokerClient() : pipe(INVALID_HANDLE_VALUE)
+{
+}
+
+GpuBrokerClient::~GpuBrokerClient()
+{
+    this->disconnect();
+}
+
+bool GpuBrokerClient::connect(const std::string& pipeName)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->disconnectLocked();
+    this->pipeName = pipeName;
+    return this->connectLocked();
+}
+
+void GpuBrokerClient::disconnect()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->disconnectLocked();
+}
+
+bool GpuBrokerClient::isConnected() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->pipe != INVALID_HANDLE_VALUE;
+}
+
+bool GpuBrokerClient::send(const std::vector<GpuBrokerRequest>& requests, std::vector<GpuBrokerResult>& results)
+{
+    if (requests.size() > GPU_BROKER_MAX_REQUESTS) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->pipeName.empty()) {
+        return false;
+    }
+
+    if (this->pipe == INVALID_HANDLE_VALUE && !this->connectLocked()) {
+        return false;
+    }
+    if (this->exchangeLocked(requests, results)) {
+        return true;
+    }
+
+    // A broker that restarted since the last message shows up as a broken
+    // pipe, so try once more on a new connection
+    this->disconnectLocked();
+    return this->connectLocked() && this->exchangeLocked(requests, results);
+}
+
+unsigned GpuBrokerClient::getGPUCount()
+{
+    std::vector<GpuBrokerResult> results;
+    const auto success = this->send({ { GPU_BROKER_REQUEST_GPU_COUNT, 0, 0, 0 } }, results);
+    return success ? results[0].value : 0;
+}
+
+bool GpuBrokerClient::poll(unsigned gpuIndex, GpuSharedTelemetryRecord& record)
+{
+    std::vector<GpuBrokerResult> results;
+    const GpuBrokerRequest request = { GPU_BROKER_REQUEST_POLL, static_cast<UINT16>(gpuIndex), 0, 0 };
+    if (gpuIndex >= NVIDIA_MAX_PHYSICAL_GPUS || !this->send({ request }, results) || results[0].status != GPU_BROKER_STATUS_OK) {
+        return false;
+    }
+
+    record = results[0].record;
+    return true;
+}
+
+bool GpuBrokerClient::getSnapshot(unsigned gpuIndex, GpuSharedTelemetryRecord& record)
+{
+    std::vector<GpuBrokerResult> results;
+    const GpuBrokerRequest request = { GPU_BROKER_REQUEST_SNAPSHOT, static_cast<UINT16>(gpuIndex), 0, 0 };
+    if (gpuIndex >= NVIDIA_MAX_PHYSICAL_GPUS || !this->send({ request }, results) || results[0].status != GPU_BROKER_STATUS_OK) {
+        return false;
+    }
+
+    record = results[0].record;
+    return true;
+}
+
+bool GpuBrokerClient::getSnapshots(std::vector<GpuSharedTelemetryRecord>& records)
+{
+    // Asking for every possible GPU along with the count saves a round trip,
+    // the ones past the count just come back invalid
+    std::vector<GpuBrokerRequest> requests = { { GPU_BROKER_REQUEST_GPU_COUNT, 0, 0, 0 } };
+    for (auto i = 0u; i < NVIDIA_MAX_PHYSICAL_GPUS; i++) {
+        requests.push_back({ GPU_BROKER_REQUEST_SNAPSHOT, static_cast<UINT16>(i), 0, 0 });
+    }
+
+    std::vector<GpuBrokerResult> results;
+    if (!this->send(requests, results)) {
+        return false;
+    }
+
+    const auto count = (std::min)(results[0].value, static_cast<unsigned>(NVIDIA_MAX_PHYSICAL_GPUS));
+    records.clear();
+    for (auto i = 0u; i < count; i++) {
+        records.push_back(results[i + 1].record);
+    }
+    return true;
+}
+
+bool GpuBrokerClient::setOverclock(unsigned gpuIndex, const GpuOverclockDefinitionMap& overclockDefinitions)
+{
+    if (gpuIndex >= NVIDIA_MAX_PHYSICAL_GPUS) {
+        return false;
+    }
+
+    std::vector<GpuBrokerRequest> requests;
+    for (const auto& definition : overclockDefinitions) {
+        requests.push_back({ GPU_BROKER_REQUEST_SET_OVERCLOCK, static_cast<UINT16>(gpuIndex),
+            static_cast<UINT32>(definition.first), definition.second });
+    }
+
+    std::vector<GpuBrokerResult> results;
+    return this->send(requests, results) && std::all_of(results.begin(), results.end(), [](const GpuBrokerResult& result) {
+        return result.status == GPU_BROKER_STATUS_OK;
+    });
+}
+
+bool GpuBrokerClient::connectLocked()
+{
+    this->pipe = CreateFileA(this->pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (this->pipe == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PIPE_BUSY &&
+        WaitNamedPipeA(this->pipeName.c_str(), BROKER_CONNECT_TIMEOUT_MS)) {
+        this->pipe = CreateFileA(this->pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+    }
+    return this->pipe != INVALID_HANDLE_VALUE;
+}
+
+void GpuBrokerClient::disconnectLocked()
+{
+    if (this->pipe != INVALID_HANDLE_VALUE) {
+        CloseHandle(this->pipe);
+    }
+    this->pipe = INVALID_HANDLE_VALUE;
+}
+
+bool GpuBrokerClient::exchangeLocked(const std::vector<GpuBrokerRequest>& requests, std::vector<GpuBrokerResult>& results)
+{
+    const auto count = static_cast<UINT16>(requests.size());
+    this->buffer.clear();
+    appendBytes(this->buffer, GpuBrokerMessageHeader{ GPU_BROKER_MAGIC, GPU_BROKER_VERSION, count,
+        static_cast<UINT32>(count * sizeof(GpuBrokerRequest)) });
+    for (const auto& request : requests) {
+        appendBytes(this->buffer, request);
+    }
+
+    GpuBrokerMessageHeader header;
+    if (!transferBlocking(this->pipe, this->buffer.data(), this->buffer.size(), true) ||
+        !transferBlocking(this->pipe, reinterpret_cast<char*>(&header), sizeof(header), false) ||
+        header.magic != GPU_BROKER_MAGIC || header.version != GPU_BROKER_VERSION ||
+        header.count != count || header.size > maxResponseSize(count)) {
+        return false;
+    }
+
+    this->buffer.resize(header.size);
+    if (!transferBlocking(this->pipe, this->buffer.data(), header.size, false)) {
+        return false;
+    }
+
+    results.assign(count, GpuBrokerResult{});
+    size_t offset = 0;
+    for (auto& result : results) {
+        GpuBrokerResponse response;
+        if (offset + sizeof(response) > this->buffer.size()) {
+            return false;
+        }
+        std::memcpy(&response, this->buffer.data() + offset, sizeof(response));
+        offset += sizeof(response);
+
+        result.status = static_cast<GPU_BROKER_STATUS>(response.status);
+        result.value = response.value;
+        if (hasRecord(response)) {
+            if (offset + sizeof(result.record) > this->buffer.size()) {
+                return false;
+            }
+            std::memcpy(&result.record, this->buffer.data() + offset, sizeof(result.record));
+            offset += sizeof(result.record);
+        }
+    }
+    return offset == this->buffer.size();
+}
+
+#pragma endregion
+
+}
\ No newline at end of file
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "helpers.h"
+#include "GpuDatatypes.h"
+#include "GpuSharedTelemetry.h"
+#include "NvidiaGPU.h"
+
+namespace lib_gpu {
+
+class NvidiaApi;
+
+/// The pipe the broker listens on if it isn't given another name
+const char* const GPU_BROKER_PIPE_NAME = "\\\\.\\pipe\\lib_gpu_broker";
+
+#pragma region Protocol
+
+/**
+ * Clients talk to the broker over a named pipe in messages, each a header
+ * followed by up to GPU_BROKER_MAX_REQUESTS fixed size requests. The broker
+ * answers every message with a header followed by a response per request, in
+ * the same order. Responses to GPU_BROKER_REQUEST_POLL and _SNAPSHOT that
+ * succeeded are followed by the GpuSharedTelemetryRecord of the GPU.
+ *
+ * Both ends run on the same machine, so everything is in its native layout.
+ */
+const UINT32 GPU_BROKER_MAGIC = 0x4B524247u; // "GBRK"
+const UINT16 GPU_BROKER_VERSION = 1;
+const unsigned GPU_BROKER_MAX_REQUESTS = 1024;
+
+enum GPU_BROKER_REQUEST
+{
+    /// The number of GPUs, in the response's value
+    GPU_BROKER_REQUEST_GPU_COUNT = 1,
+    /// Poll the GPU and return the new data
+    GPU_BROKER_REQUEST_POLL,
+    /// Return the latest data without polling, unless the GPU was never polled
+    GPU_BROKER_REQUEST_SNAPSHOT,
+    /**
+     * Set `delta` for the GPU_OVERCLOCK_SETTING_AREA `area`. All of a
+     * message's overclocks of a GPU are applied at once, and succeed or fail
+     * together.
+     */
+    GPU_BROKER_REQUEST_SET_OVERCLOCK
+};
+
+enum GPU_BROKER_STATUS
+{
+    GPU_BROKER_STATUS_OK,
+    /// The driver call failed
+    GPU_BROKER_STATUS_FAILED,
+    /// Unknown request type, GPU index or overclock area
+    GPU_BROKER_STATUS_INVALID
+};
+
+#pragma pack(push, 4)
+struct GpuBrokerMessageHeader
+{
+    UINT32 magic;
+    UINT16 version;
+    UINT16 count;
+    /// The size of the rest of the message in bytes
+    UINT32 size;
+};
+
+struct GpuBrokerRequest
+{
+    UINT16 type;
+    UINT16 gpuIndex;
+    UINT32 area;
+    float delta;
+};
+
+struct GpuBrokerResponse
+{
+    UINT16 type;
+    UINT16 status;
+    UINT32 value;
+};
+#pragma pack(pop)
+
+#pragma endregion
+
+struct GpuBrokerStats
+{
+    /// Messages answered, and the requests in them
+    unsigned long long messages;
+    unsigned long long requests;
+    /// Rounds of the worker, each answering every message that came in during the previous one
+    unsigned long long batches;
+    /// Polls made, and poll requests answered by a poll made for another request
+    unsigned long long polls;
+    unsigned long long coalescedPolls;
+    /// Messages waiting for the worker when the stats were taken
+    unsigned long long queuedMessages;
+};
+
+struct GpuBrokerResult
+{
+    GPU_BROKER_STATUS status;
+    unsigned value;
+    /// Only filled in for successful polls and snapshots
+    GpuSharedTelemetryRecord record;
+};
+
+#pragma warning(disable: 4251)
+/**
+ * Serves the GPUs of an NvidiaApi to other processes over a named pipe, so
+ * that a single process owns the driver.
+ *
+ * Each client gets a thread reading its messages, but only a single worker
+ * thread touches the GPUs. The worker takes every message that arrived while
+ * it was busy and answers them together: overclocks are applied message by
+ * message in the order they came in, then every GPU that was asked to poll
+ * is polled once, however many clients asked, and the data is sent back to
+ * all of them.
+ */
+class NVLIB_EXPORTED GpuBrokerServer
+{
+public:
+    GpuBrokerServer();
+    ~GpuBrokerServer();
+
+    /**
+     * Start serving. The API has to outlive the server, or at least stop().
+     */
+    bool start(NvidiaApi& api, const std::string& pipeName = GPU_BROKER_PIPE_NAME);
+    void stop();
+    bool isRunning() const;
+
+    /**
+     * Answer a message as if it came in over the pipe, blocking until the
+     * worker has. Returns false if the server isn't running or the message
+     * is malformed.
+     */
+    bool handle(const std::vector<char>& request, std::vector<char>& response);
+    GpuBrokerStats getStats() const;
+
+private:
+    struct Client
+    {
+        std::thread thread;
+        std::atomic<bool> finished{ false };
+    };
+    struct Pending
+    {
+        const std::vector<char>* request;
+        std::vector<char>* response;
+        bool valid;
+        bool done;
+    };
+
+    NvidiaApi* api = nullptr;
+    std::string pipeName;
+    /// Set to make the listener and clients give up on pipe operations
+    HANDLE stopEvent;
+    std::thread listener;
+    /// Only touched by the listener, and by stop() once it's joined
+    std::list<Client> clients;
+    std::thread worker;
+
+    mutable std::mutex mutex;
+    std::condition_variable workReady;
+    std::condition_variable workDone;
+    std::vector<Pending*> queue;
+    GpuBrokerStats stats = {};
+    bool stopping = false;
+
+    void listen(HANDLE firstPipe);
+    void serve(HANDLE pipe, std::atomic<bool>* finished);
+    void work();
+    void process(const std::vector<Pending*>& batch);
+};
+
+/**
+ * Talks to a GpuBrokerServer in another process. Safe to use from several
+ * threads, which take turns on the pipe.
+ */
+class NVLIB_EXPORTED GpuBrokerClient
+{
+public:
+    GpuBrokerClient();
+    ~GpuBrokerClient();
+
+    bool connect(const std::string& pipeName = GPU_BROKER_PIPE_NAME);
+    void disconnect();
+    bool isConnected() const;
+
+    /**
+     * Send the requests in one message and wait for the results, one per
+     * request. If the broker went away since the last message, this connects
+     * again first.
+     */
+    bool send(const std::vector<GpuBrokerRequest>& requests, std::vector<GpuBrokerResult>& results);
+
+    unsigned getGPUCount();
+    bool poll(unsigned gpuIndex, GpuSharedTelemetryRecord& record);
+    bool getSnapshot(unsigned gpuIndex, GpuSharedTelemetryRecord& record);
+    /**
+     * Get the latest data of every GPU in a single message, entry N being
+     * GPU index N. GPUs that couldn't be read have their snapshot's `valid`
+     * flag cleared.
+     */
+    bool getSnapshots(std::vector<GpuSharedTelemetryRecord>& records);
+    bool setOverclock(unsigned gpuIndex, const GpuOverclockDefinitionMap& overclockDefinitions);
+
+private:
+    HANDLE pipe;
+    std::string pipeName;
+    std::vector<char> buffer;
+    mutable std::mutex mutex;
+
+    bool connectLocked();
+    void disconnectLocked();
+    bool exchangeLocked(const std::vector<GpuBrokerRequest>& requests, std::vector<GpuBrokerResult>& results);
+};
+#pragma warning(default: 4251)
+
+}
\ No newline at end of file
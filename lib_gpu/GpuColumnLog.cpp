@@ -0,0 +1,594 @@
+#include "pch.h"
+#include "GpuColumnLog.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+namespace lib_gpu {
+
+static_assert(sizeof(GpuLogFileHeader) == 16, "The file header should have no padding");
+static_assert(sizeof(GpuLogColumnHeader) == 24, "The column header should have no padding");
+static_assert(sizeof(GpuLogBlockHeader) == 8 + GPU_LOG_COLUMN_COUNT * sizeof(GpuLogColumnHeader), "The block header should have no padding");
+static_assert(sizeof(GpuLogIndexEntry) == 32, "The index entry should have no padding");
+static_assert(sizeof(GpuLogTrailer) == 16, "The trailer should have no padding");
+
+// Blocks are padded to keep the headers and the index aligned in the
+// mapped file, which matters on ARM
+const size_t BLOCK_ALIGNMENT = 8;
+static_assert(sizeof(GpuLogFileHeader) % BLOCK_ALIGNMENT == 0, "Blocks should start aligned");
+static_assert(sizeof(GpuLogBlockHeader) % BLOCK_ALIGNMENT == 0, "Columns should start aligned");
+
+#pragma region Column encoding
+
+bool isIntegerColumn(unsigned column)
+{
+    return column < GPU_LOG_COLUMN_FIRST_VALUE;
+}
+
+// A column of a row, with floats as their bits
+UINT64 columnValue(unsigned long gpuId, const GpuSample& sample, unsigned column)
+{
+    switch (column) {
+    case GPU_LOG_COLUMN_TIMESTAMP:
+        return sample.timestamp;
+    case GPU_LOG_COLUMN_GPU_ID:
+        return gpuId;
+    case GPU_LOG_COLUMN_CHANGED_METRICS:
+        return sample.changedMetrics;
+    default:
+        UINT32 bits;
+        std::memcpy(&bits, &sample.coreClock + (column - GPU_LOG_COLUMN_FIRST_VALUE), sizeof(bits));
+        return bits;
+    }
+}
+
+double columnNumber(unsigned column, UINT64 value)
+{
+    if (isIntegerColumn(column)) {
+        return static_cast<double>(value);
+    }
+
+    const auto bits = static_cast<UINT32>(value);
+    float number;
+    std::memcpy(&number, &bits, sizeof(number));
+    return number;
+}
+
+UINT64 zigzag(UINT64 delta)
+{
+    return (delta << 1) ^ static_cast<UINT64>(static_cast<INT64>(delta) >> 63);
+}
+
+UINT64 alignBlock(UINT64 size)
+{
+    return (size + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+}
+
+UINT64 unzigzag(UINT64 value)
+{
+    return (value >> 1) ^ (0 - (value & 1));
+}
+
+void writeVarint(std::vector<unsigned char>& out, UINT64 value)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<unsigned char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<unsigned char>(value));
+}
+
+// Decode `count` deltas between `data` and `end`, returning false if they
+// run past the end.
+template <typename F>
+bool readDeltas(const unsigned char* data, const unsigned char* end, unsigned count, F output)
+{
+    UINT64 previous = 0;
+    for (auto row = 0u; row < count; row++) {
+        UINT64 value = 0;
+        auto shift = 0u;
+        while (true) {
+            if (data == end || shift >= 64) {
+                return false;
+            }
+            const auto byte = *data++;
+            value |= static_cast<UINT64>(byte & 0x7F) << shift;
+            shift += 7;
+            if (!(byte & 0x80)) {
+                break;
+            }
+        }
+
+        previous += unzigzag(value);
+        output(row, previous);
+    }
+    return true;
+}
+
+#pragma endregion
+
+#pragma region GpuColumnLogWriter
+
+GpuColumnLogWriter::GpuColumnLogWriter(unsigned blockRows) : blockRows((std::max)(blockRows, 1u))
+{
+}
+
+GpuColumnLogWriter::~GpuColumnLogWriter()
+{
+    this->close();
+}
+
+bool GpuColumnLogWriter::open(const std::string& path)
+{
+    std::lock_guard<std::mutex> fileLock(this->fileMutex);
+    if (this->thread.joinable()) {
+        return false;
+    }
+
+    this->file.clear();
+    this->file.open(path, std::ofstream::binary | std::ofstream::trunc);
+    if (this->file.fail()) {
+        return false;
+    }
+
+    GpuLogFileHeader header = {};
+    header.magic = GPU_LOG_FILE_MAGIC;
+    header.version = GPU_LOG_VERSION;
+    header.columnCount = GPU_LOG_COLUMN_COUNT;
+    this->file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    this->file.flush();
+    if (this->file.fail()) {
+        this->file.close();
+        return false;
+    }
+
+    this->index.clear();
+    this->offset = sizeof(header);
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        // Rows carry on into the other buffer while a block is being written,
+        // up to a second block's worth
+        this->rows.clear();
+        this->rows.reserve(2 * this->blockRows);
+        this->pendingRows.clear();
+        this->pendingRows.reserve(2 * this->blockRows);
+        this->blockPending = false;
+        this->stopping = false;
+        this->failed = false;
+        this->dropped = 0;
+        this->opened = true;
+    }
+
+    this->thread = std::thread(&GpuColumnLogWriter::run, this);
+    return true;
+}
+
+bool GpuColumnLogWriter::append(unsigned long gpuId, const GpuSample& sample)
+{
+    auto full = false;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->opened) {
+            return false;
+        }
+        if (this->rows.size() >= 2 * this->blockRows) {
+            this->dropped++;
+            return false;
+        }
+
+        this->rows.push_back(Row{ gpuId, sample });
+        if (this->rows.size() >= this->blockRows && !this->blockPending) {
+            std::swap(this->rows, this->pendingRows);
+            this->blockPending = true;
+            full = true;
+        }
+        if (this->failed) {
+            return false;
+        }
+    }
+
+    if (full) {
+        this->blockReady.notify_one();
+    }
+    return true;
+}
+
+bool GpuColumnLogWriter::close()
+{
+    std::lock_guard<std::mutex> fileLock(this->fileMutex);
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->opened) {
+            return false;
+        }
+        this->opened = false;
+        this->stopping = true;
+    }
+
+    // Once the writer thread is done nothing else touches the log, since
+    // append() stopped taking rows above
+    this->blockReady.notify_one();
+    this->thread.join();
+    if (!this->rows.empty()) {
+        this->failed = !this->writeBlock(this->rows) || this->failed;
+    }
+
+    GpuLogTrailer trailer = {};
+    trailer.indexOffset = this->offset;
+    trailer.blockCount = static_cast<UINT32>(this->index.size());
+    trailer.magic = GPU_LOG_INDEX_MAGIC;
+    this->file.write(reinterpret_cast<const char*>(this->index.data()), this->index.size() * sizeof(GpuLogIndexEntry));
+    this->file.write(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+    this->file.close();
+
+    return !this->failed && !this->file.fail();
+}
+
+bool GpuColumnLogWriter::isOpen() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->opened;
+}
+
+unsigned long long GpuColumnLogWriter::getDroppedRows() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->dropped;
+}
+
+void GpuColumnLogWriter::run()
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->blockReady.wait(lock, [this] {
+            return this->stopping || this->blockPending;
+        });
+
+        if (this->blockPending) {
+            lock.unlock();
+            const auto success = this->writeBlock(this->pendingRows);
+            lock.lock();
+            this->failed = this->failed || !success;
+            this->blockPending = false;
+            // A whole block may have piled up while this one was written
+            if (this->rows.size() >= this->blockRows && !this->stopping) {
+                std::swap(this->rows, this->pendingRows);
+                this->blockPending = true;
+            }
+        } else if (this->stopping) {
+            return;
+        }
+    }
+}
+
+// Encodes and writes `block`, leaving it empty. Must only be called by the
+// thread that owns the file.
+bool GpuColumnLogWriter::writeBlock(std::vector<Row>& block)
+{
+    // Consecutive rows of the same GPU are much closer to each other than to
+    // those of other GPUs, so their deltas are smaller.
+    std::stable_sort(block.begin(), block.end(), [](const Row& a, const Row& b) {
+        return a.gpuId < b.gpuId;
+    });
+
+    GpuLogBlockHeader header = {};
+    header.magic = GPU_LOG_BLOCK_MAGIC;
+    header.rowCount = static_cast<UINT32>(block.size());
+
+    this->encoded.clear();
+    this->encoded.reserve(block.size() * GPU_LOG_COLUMN_COUNT * 2);
+    for (auto column = 0u; column < GPU_LOG_COLUMN_COUNT; column++) {
+        auto& columnHeader = header.columns[column];
+        const auto start = this->encoded.size();
+        UINT64 previous = 0;
+        for (const auto& row : block) {
+            const auto value = columnValue(row.gpuId, row.sample, column);
+            const auto number = columnNumber(column, value);
+            if (&row == &block.front()) {
+                columnHeader.min = number;
+                columnHeader.max = number;
+            } else {
+                columnHeader.min = (std::min)(columnHeader.min, number);
+                columnHeader.max = (std::max)(columnHeader.max, number);
+            }
+
+            writeVarint(this->encoded, zigzag(value - previous));
+            previous = value;
+        }
+
+        columnHeader.encoding = GPU_LOG_ENCODING_DELTA_VARINT;
+        columnHeader.size = static_cast<UINT32>(this->encoded.size() - start);
+    }
+    this->encoded.resize(static_cast<size_t>(alignBlock(this->encoded.size())), 0);
+
+    GpuLogIndexEntry entry = {};
+    entry.offset = this->offset;
+    entry.rowCount = header.rowCount;
+    const auto timestamps = std::minmax_element(block.begin(), block.end(), [](const Row& a, const Row& b) {
+        return a.sample.timestamp < b.sample.timestamp;
+    });
+    entry.firstTimestamp = timestamps.first->sample.timestamp;
+    entry.lastTimestamp = timestamps.second->sample.timestamp;
+
+    this->file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    this->file.write(reinterpret_cast<const char*>(this->encoded.data()), this->encoded.size());
+    this->offset += sizeof(header) + this->encoded.size();
+    this->file.flush();
+    this->index.push_back(entry);
+    block.clear();
+    return !this->file.fail();
+}
+
+#pragma endregion
+
+#pragma region GpuColumnLogReader
+
+unsigned GpuColumnLogBlock::getRowCount() const
+{
+    return this->header->rowCount;
+}
+
+unsigned long long GpuColumnLogBlock::getFirstTimestamp() const
+{
+    return this->entry->firstTimestamp;
+}
+
+unsigned long long GpuColumnLogBlock::getLastTimestamp() const
+{
+    return this->entry->lastTimestamp;
+}
+
+double GpuColumnLogBlock::getMin(GPU_LOG_COLUMN column) const
+{
+    return column < GPU_LOG_COLUMN_COUNT ? this->header->columns[column].min : 0.0;
+}
+
+double GpuColumnLogBlock::getMax(GPU_LOG_COLUMN column) const
+{
+    return column < GPU_LOG_COLUMN_COUNT ? this->header->columns[column].max : 0.0;
+}
+
+bool GpuColumnLogBlock::decode(GPU_LOG_COLUMN column, unsigned long long* values) const
+{
+    if (!values || column >= GPU_LOG_COLUMN_COUNT || !isIntegerColumn(column)) {
+        return false;
+    }
+
+    const auto data = this->columns[column];
+    return readDeltas(data, data + this->header->columns[column].size, this->header->rowCount, [values](unsigned row, UINT64 value) {
+        values[row] = value;
+    });
+}
+
+bool GpuColumnLogBlock::decode(GPU_LOG_COLUMN column, float* values) const
+{
+    if (!values || column >= GPU_LOG_COLUMN_COUNT || isIntegerColumn(column)) {
+        return false;
+    }
+
+    const auto data = this->columns[column];
+    return readDeltas(data, data + this->header->columns[column].size, this->header->rowCount, [values](unsigned row, UINT64 value) {
+        const auto bits = static_cast<UINT32>(value);
+        std::memcpy(&values[row], &bits, sizeof(bits));
+    });
+}
+
+bool GpuColumnLogBlock::decodeSamples(std::vector<GpuSample>& samples, std::vector<unsigned long>* gpuIds) const
+{
+    const auto first = samples.size();
+    const auto count = this->header->rowCount;
+    samples.resize(first + count);
+    if (gpuIds) {
+        gpuIds->resize(first + count);
+    }
+
+    const auto rows = &samples[first];
+    const auto decodeColumn = [this, count](unsigned column, auto output) {
+        const auto data = this->columns[column];
+        return readDeltas(data, data + this->header->columns[column].size, count, output);
+    };
+
+    auto success = decodeColumn(GPU_LOG_COLUMN_TIMESTAMP, [rows](unsigned row, UINT64 value) {
+        rows[row].timestamp = value;
+    }) && decodeColumn(GPU_LOG_COLUMN_CHANGED_METRICS, [rows](unsigned row, UINT64 value) {
+        rows[row].changedMetrics = static_cast<unsigned>(value);
+    });
+    if (success && gpuIds) {
+        const auto ids = &(*gpuIds)[first];
+        success = decodeColumn(GPU_LOG_COLUMN_GPU_ID, [ids](unsigned row, UINT64 value) {
+            ids[row] = static_cast<unsigned long>(value);
+        });
+    }
+    for (auto value = 0u; success && value < GPU_SAMPLE_VALUE_COUNT; value++) {
+        success = decodeColumn(GPU_LOG_COLUMN_FIRST_VALUE + value, [rows, value](unsigned row, UINT64 bits) {
+            const auto floatBits = static_cast<UINT32>(bits);
+            std::memcpy(&rows[row].coreClock + value, &floatBits, sizeof(floatBits));
+        });
+    }
+
+    if (!success) {
+        samples.resize(first);
+        if (gpuIds) {
+            gpuIds->resize(first);
+        }
+    }
+    return success;
+}
+
+// The size of the block at `offset`, including its padding, or 0 if there's
+// no whole block between there and `end`
+UINT64 checkBlock(const unsigned char* data, UINT64 offset, UINT64 end)
+{
+    if (offset < sizeof(GpuLogFileHeader) || offset % BLOCK_ALIGNMENT != 0 || offset > end ||
+        end - offset < sizeof(GpuLogBlockHeader)) {
+        return 0;
+    }
+
+    const auto header = reinterpret_cast<const GpuLogBlockHeader*>(data + offset);
+    auto size = static_cast<UINT64>(sizeof(GpuLogBlockHeader));
+    for (const auto& column : header->columns) {
+        if (column.encoding != GPU_LOG_ENCODING_DELTA_VARINT) {
+            return 0;
+        }
+        size += column.size;
+    }
+    size = alignBlock(size);
+    return header->magic == GPU_LOG_BLOCK_MAGIC && size <= end - offset ? size : 0;
+}
+
+GpuColumnLogReader::GpuColumnLogReader() : file(INVALID_HANDLE_VALUE), mapping(nullptr)
+{
+}
+
+GpuColumnLogReader::~GpuColumnLogReader()
+{
+    this->close();
+}
+
+bool GpuColumnLogReader::open(const std::string& path)
+{
+    this->close();
+
+    this->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER fileSize;
+    if (this->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(this->file, &fileSize) ||
+        static_cast<UINT64>(fileSize.QuadPart) < sizeof(GpuLogFileHeader) ||
+        static_cast<UINT64>(fileSize.QuadPart) > SIZE_MAX) {
+        this->close();
+        return false;
+    }
+
+    this->mapping = CreateFileMappingA(this->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    this->data = this->mapping ? static_cast<const unsigned char*>(MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+    if (!this->data) {
+        this->close();
+        return false;
+    }
+    this->size = static_cast<UINT64>(fileSize.QuadPart);
+
+    // Check everything the blocks will rely on up front, so they don't have
+    // to check anything but the varints.
+    const auto header = reinterpret_cast<const GpuLogFileHeader*>(this->data);
+    if (header->magic != GPU_LOG_FILE_MAGIC || header->version != GPU_LOG_VERSION || header->columnCount != GPU_LOG_COLUMN_COUNT) {
+        this->close();
+        return false;
+    }
+
+    const auto trailer = reinterpret_cast<const GpuLogTrailer*>(this->data + this->size - sizeof(GpuLogTrailer));
+    const auto indexEnd = this->size - sizeof(GpuLogTrailer);
+    const auto closed = this->size >= sizeof(GpuLogFileHeader) + sizeof(GpuLogTrailer) && trailer->magic == GPU_LOG_INDEX_MAGIC;
+    if (!closed) {
+        return this->recoverIndex();
+    }
+
+    auto valid = trailer->indexOffset >= sizeof(GpuLogFileHeader) && trailer->indexOffset % BLOCK_ALIGNMENT == 0 && trailer->indexOffset <= indexEnd &&
+        (indexEnd - trailer->indexOffset) / sizeof(GpuLogIndexEntry) >= trailer->blockCount;
+
+    const auto index = reinterpret_cast<const GpuLogIndexEntry*>(this->data + (valid ? trailer->indexOffset : 0));
+    for (auto i = 0u; valid && i < trailer->blockCount; i++) {
+        const auto& entry = index[i];
+        valid = checkBlock(this->data, entry.offset, trailer->indexOffset) > 0 &&
+            reinterpret_cast<const GpuLogBlockHeader*>(this->data + entry.offset)->rowCount == entry.rowCount;
+    }
+
+    if (!valid) {
+        this->close();
+        return false;
+    }
+
+    this->index = index;
+    this->blockCount = trailer->blockCount;
+    return true;
+}
+
+// Follows the blocks from the header, as a log that wasn't closed has no
+// index. The writer flushes whole blocks, so only the last one can be cut
+// short, and it's left out along with anything after it.
+bool GpuColumnLogReader::recoverIndex()
+{
+    auto offset = static_cast<UINT64>(sizeof(GpuLogFileHeader));
+    while (const auto blockSize = checkBlock(this->data, offset, this->size)) {
+        const auto header = reinterpret_cast<const GpuLogBlockHeader*>(this->data + offset);
+        const auto timestamps = reinterpret_cast<const unsigned char*>(header + 1);
+
+        // The block header only has a rounded timestamp range, so the exact
+        // one has to be decoded, which also checks the column is whole.
+        GpuLogIndexEntry entry = {};
+        entry.offset = offset;
+        entry.rowCount = header->rowCount;
+        entry.firstTimestamp = ULLONG_MAX;
+        const auto decoded = readDeltas(timestamps, timestamps + header->columns[GPU_LOG_COLUMN_TIMESTAMP].size, header->rowCount, [&entry](unsigned, UINT64 timestamp) {
+            entry.firstTimestamp = (std::min)(entry.firstTimestamp, timestamp);
+            entry.lastTimestamp = (std::max)(entry.lastTimestamp, timestamp);
+        });
+        if (!decoded || header->rowCount == 0) {
+            break;
+        }
+
+        this->recoveredIndex.push_back(entry);
+        offset += blockSize;
+    }
+
+    this->index = this->recoveredIndex.data();
+    this->blockCount = static_cast<unsigned>(this->recoveredIndex.size());
+    return true;
+}
+
+void GpuColumnLogReader::close()
+{
+    if (this->data) {
+        UnmapViewOfFile(this->data);
+    }
+    if (this->mapping) {
+        CloseHandle(this->mapping);
+    }
+    if (this->file != INVALID_HANDLE_VALUE) {
+        CloseHandle(this->file);
+    }
+
+    this->file = INVALID_HANDLE_VALUE;
+    this->mapping = nullptr;
+    this->data = nullptr;
+    this->size = 0;
+    this->index = nullptr;
+    this->blockCount = 0;
+    this->recoveredIndex.clear();
+}
+
+unsigned GpuColumnLogReader::getBlockCount() const
+{
+    return this->blockCount;
+}
+
+bool GpuColumnLogReader::getBlock(unsigned index, GpuColumnLogBlock& block) const
+{
+    if (index >= this->blockCount) {
+        return false;
+    }
+
+    block.entry = &this->index[index];
+    block.header = reinterpret_cast<const GpuLogBlockHeader*>(this->data + block.entry->offset);
+    auto column = reinterpret_cast<const unsigned char*>(block.header + 1);
+    for (auto i = 0u; i < GPU_LOG_COLUMN_COUNT; i++) {
+        block.columns[i] = column;
+        column += block.header->columns[i].size;
+    }
+    return true;
+}
+
+std::vector<GpuColumnLogBlock> GpuColumnLogReader::findBlocks(unsigned long long from, unsigned long long to) const
+{
+    std::vector<GpuColumnLogBlock> blocks;
+    for (auto i = 0u; i < this->blockCount; i++) {
+        const auto& entry = this->index[i];
+        if (entry.firstTimestamp <= to && entry.lastTimestamp >= from) {
+            blocks.emplace_back();
+            this->getBlock(i, blocks.back());
+        }
+    }
+    return blocks;
+}
+
+#pragma endregion
+
+}
\ No newline at end of file
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "helpers.h"
+#include "GpuDatatypes.h"
+
+namespace lib_gpu {
+
+/**
+ * The columns of a GPU log, the fields of GpuSample plus the ID of the GPU
+ * it came from. The values are in GPU_SAMPLE_VALUE order, so
+ * `GPU_LOG_COLUMN_FIRST_VALUE + value` is the column of a GPU_SAMPLE_VALUE.
+ */
+enum GPU_LOG_COLUMN
+{
+    GPU_LOG_COLUMN_TIMESTAMP,
+    GPU_LOG_COLUMN_GPU_ID,
+    GPU_LOG_COLUMN_CHANGED_METRICS,
+    GPU_LOG_COLUMN_FIRST_VALUE,
+    GPU_LOG_COLUMN_COUNT = GPU_LOG_COLUMN_FIRST_VALUE + GPU_SAMPLE_VALUE_COUNT
+};
+
+#pragma region File format
+
+/**
+ * A log file is a header, a series of blocks and an index of the blocks,
+ * followed by a trailer pointing at the index. Everything is little endian.
+ * The index and the trailer are only written when the log is closed, so the
+ * blocks of a log that wasn't are found by following them from the header.
+ *
+ * Each block holds up to a few thousand rows, grouped by GPU and in time
+ * order within each GPU. The block header has the minimum and maximum of
+ * every column, so a reader can skip blocks without decoding them, followed
+ * by the encoded columns one after the other, padded to 8 bytes. Every
+ * column is encoded as the zigzagged difference from the previous row as a
+ * varint, taking the bits of the float values as integers, so a value that
+ * doesn't change takes one byte.
+ */
+const UINT64 GPU_LOG_FILE_MAGIC = 0x3130474F4C555047ull; // "GPULOG01"
+const UINT32 GPU_LOG_BLOCK_MAGIC = 0x4B4C4247u; // "GBLK"
+const UINT32 GPU_LOG_INDEX_MAGIC = 0x58444947u; // "GIDX"
+const UINT32 GPU_LOG_VERSION = 1;
+
+enum GPU_LOG_ENCODING
+{
+    GPU_LOG_ENCODING_DELTA_VARINT = 1
+};
+
+#pragma pack(push, 8)
+struct GpuLogFileHeader
+{
+    UINT64 magic;
+    UINT32 version;
+    UINT32 columnCount;
+};
+
+struct GpuLogColumnHeader
+{
+    UINT32 encoding;
+    /// The size of the encoded column in bytes
+    UINT32 size;
+    /// The timestamp range is only approximate, see GpuLogIndexEntry
+    double min;
+    double max;
+};
+
+struct GpuLogBlockHeader
+{
+    UINT32 magic;
+    UINT32 rowCount;
+    GpuLogColumnHeader columns[GPU_LOG_COLUMN_COUNT];
+};
+
+struct GpuLogIndexEntry
+{
+    /// From the start of the file to the block header
+    UINT64 offset;
+    UINT32 rowCount;
+    UINT32 reserved;
+    UINT64 firstTimestamp;
+    UINT64 lastTimestamp;
+};
+
+struct GpuLogTrailer
+{
+    UINT64 indexOffset;
+    UINT32 blockCount;
+    UINT32 magic;
+};
+#pragma pack(pop)
+
+#pragma endregion
+
+#pragma warning(disable: 4251)
+/**
+ * Writes samples to a log file in the format above.
+ *
+ * Rows are gathered until there are enough for a block, which is handed to a
+ * writer thread to encode and write, so appending only ever copies a row. If
+ * the writer thread falls a whole block behind, rows are dropped rather than
+ * holding up the pollers. Every block is flushed once it's written, so
+ * GpuColumnLogReader can read up to the last whole block of a log that
+ * was never closed.
+ */
+class NVLIB_EXPORTED GpuColumnLogWriter
+{
+public:
+    explicit GpuColumnLogWriter(unsigned blockRows = 4096);
+    ~GpuColumnLogWriter();
+
+    bool open(const std::string& path);
+    /**
+     * Add a row. Safe to call from several threads at once. Returns false if
+     * the log isn't open, writing it has failed or the row was dropped.
+     */
+    bool append(unsigned long gpuId, const GpuSample& sample);
+    /**
+     * Wait for the writer thread, write the last block and the index, and
+     * close the file.
+     */
+    bool close();
+    bool isOpen() const;
+    /**
+     * The rows dropped since the log was opened because the writer thread
+     * fell behind.
+     */
+    unsigned long long getDroppedRows() const;
+
+private:
+    struct Row
+    {
+        unsigned long gpuId;
+        GpuSample sample;
+    };
+
+    const unsigned blockRows;
+    // Serializes open() and close()
+    std::mutex fileMutex;
+    mutable std::mutex mutex;
+    std::condition_variable blockReady;
+    std::thread thread;
+    bool opened = false;
+    bool stopping = false;
+    bool failed = false;
+    unsigned long long dropped = 0;
+    std::vector<Row> rows;
+    // Owned by the writer thread while blockPending is set
+    std::vector<Row> pendingRows;
+    bool blockPending = false;
+
+    // Only touched by the writer thread while it's running
+    std::ofstream file;
+    std::vector<GpuLogIndexEntry> index;
+    std::vector<unsigned char> encoded;
+    UINT64 offset = 0;
+
+    void run();
+    bool writeBlock(std::vector<Row>& block);
+};
+
+/**
+ * A block of a log file, read straight from the mapped file.
+ */
+class NVLIB_EXPORTED GpuColumnLogBlock
+{
+public:
+    unsigned getRowCount() const;
+    unsigned long long getFirstTimestamp() const;
+    unsigned long long getLastTimestamp() const;
+    double getMin(GPU_LOG_COLUMN column) const;
+    double getMax(GPU_LOG_COLUMN column) const;
+
+    /**
+     * Decode a column into `values`, which has to have room for a value per
+     * row. Integer columns are only decoded into integers, and the value
+     * columns only into floats. Returns false on a mismatch or corrupt data.
+     */
+    bool decode(GPU_LOG_COLUMN column, unsigned long long* values) const;
+    bool decode(GPU_LOG_COLUMN column, float* values) const;
+    /**
+     * Decode every column and add the rows to `samples`, along with their
+     * GPU IDs if `gpuIds` isn't null.
+     */
+    bool decodeSamples(std::vector<GpuSample>& samples, std::vector<unsigned long>* gpuIds = nullptr) const;
+
+private:
+    friend class GpuColumnLogReader;
+
+    const GpuLogBlockHeader* header = nullptr;
+    const GpuLogIndexEntry* entry = nullptr;
+    const unsigned char* columns[GPU_LOG_COLUMN_COUNT] = {};
+};
+
+/**
+ * Reads a log file through a read-only mapping of it, without copying any
+ * of it. Blocks are looked up through the index, and only decoded when asked.
+ * A log without an index, because its writer never closed it, is indexed by
+ * following its blocks up to the first one that was cut short.
+ */
+class NVLIB_EXPORTED GpuColumnLogReader
+{
+public:
+    GpuColumnLogReader();
+    ~GpuColumnLogReader();
+
+    /**
+     * Map a file and check its header, index and block headers.
+     */
+    bool open(const std::string& path);
+    void close();
+
+    unsigned getBlockCount() const;
+    bool getBlock(unsigned index, GpuColumnLogBlock& block) const;
+    /**
+     * Get the blocks with rows in the window, in nanoseconds, oldest first.
+     */
+    std::vector<GpuColumnLogBlock> findBlocks(unsigned long long from, unsigned long long to) const;
+
+private:
+    HANDLE file;
+    HANDLE mapping;
+    const unsigned char* data = nullptr;
+    UINT64 size = 0;
+    const GpuLogIndexEntry* index = nullptr;
+    unsigned blockCount = 0;
+    // The index of a log that wasn't closed
+    std::vector<GpuLogIndexEntry> recoveredIndex;
+
+    bool recoverIndex();
+};
+#pragma warning(default: 4251)
+
+}
\ No newline at end of file
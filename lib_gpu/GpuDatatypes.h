@@ -18,6 +18,79 @@ extern "C" {
         GPU_OVERCLOCK_SETTING_AREA_THERMAL_LIMIT,
     };
 
+    /**
+     * The parts of the GPU dataset that can be refreshed by a poll.
+     *
+     * The values are bit flags and can be combined to refresh several parts
+     * at once. Each part costs one driver call.
+     *
+     * The GPU_DATASET_FIELD_STATIC parts, the info half of the power and
+     * thermal policies and the overclock ranges in the pstates hardly ever
+     * change. They're loaded by the first poll and then only reloaded after
+     * an overclock, a failed poll or an explicit
+     * NvidiaGPU::invalidateStaticData(), however they're requested. The
+     * overclocks themselves are part of GPU_DATASET_FIELD_PSTATES20 and are
+     * polled like everything else, as other tools can change them.
+     */
+    enum GPU_DATASET_FIELD
+    {
+        GPU_DATASET_FIELD_CURRENT_CLOCKS = 1 << 0,
+        GPU_DATASET_FIELD_BASE_CLOCKS = 1 << 1,
+        GPU_DATASET_FIELD_BOOST_CLOCKS = 1 << 2,
+        GPU_DATASET_FIELD_USAGE = 1 << 3,
+        GPU_DATASET_FIELD_PSTATES20 = 1 << 4,
+        GPU_DATASET_FIELD_POWER_POLICIES = 1 << 5,
+        GPU_DATASET_FIELD_VOLTAGE = 1 << 6,
+        GPU_DATASET_FIELD_TEMPERATURE = 1 << 7,
+        GPU_DATASET_FIELD_THERMAL_POLICIES = 1 << 8,
+        GPU_DATASET_FIELD_ALL = (1 << 9) - 1,
+        GPU_DATASET_FIELD_STATIC = GPU_DATASET_FIELD_BASE_CLOCKS | GPU_DATASET_FIELD_BOOST_CLOCKS
+    };
+
+    /**
+     * The individual values a poll can report changes for.
+     *
+     * Each metric is a single value, and has the bit `1 << metric` in the
+     * changed-metrics masks. The clocks are the unadjusted values reported by
+     * the driver, the overclocks are the current deltas.
+     */
+    enum GPU_METRIC
+    {
+        GPU_METRIC_CORE_CLOCK,
+        GPU_METRIC_MEMORY_CLOCK,
+        GPU_METRIC_SHADER_CLOCK,
+        GPU_METRIC_BASE_CORE_CLOCK,
+        GPU_METRIC_BASE_MEMORY_CLOCK,
+        GPU_METRIC_BASE_SHADER_CLOCK,
+        GPU_METRIC_BOOST_CORE_CLOCK,
+        GPU_METRIC_BOOST_MEMORY_CLOCK,
+        GPU_METRIC_BOOST_SHADER_CLOCK,
+        GPU_METRIC_CORE_USAGE,
+        GPU_METRIC_FB_USAGE,
+        GPU_METRIC_VID_USAGE,
+        GPU_METRIC_BUS_USAGE,
+        GPU_METRIC_TEMPERATURE,
+        GPU_METRIC_VOLTAGE,
+        GPU_METRIC_POWER_LIMIT,
+        GPU_METRIC_THERMAL_LIMIT,
+        GPU_METRIC_THERMAL_LIMIT_PRIORITY,
+        GPU_METRIC_CORE_OVERCLOCK,
+        GPU_METRIC_MEMORY_OVERCLOCK,
+        GPU_METRIC_SHADER_OVERCLOCK,
+        GPU_METRIC_OVERVOLT,
+        GPU_METRIC_COUNT
+    };
+
+    /**
+     * When a threshold subscription triggers, comparing the metric's value
+     * to the subscription's threshold.
+     */
+    enum GPU_METRIC_CONDITION
+    {
+        GPU_METRIC_CONDITION_ABOVE,
+        GPU_METRIC_CONDITION_BELOW,
+    };
+
     struct GpuOverclockSetting
     {
         bool editable;
@@ -65,6 +138,123 @@ extern "C" {
         float memoryClock;
         float shaderClock;
     };
+
+    /**
+     * Every value the API provides for a GPU, all taken from the same poll.
+     */
+    struct GpuSnapshot
+    {
+        /// False if the GPU couldn't be polled, in which case the other values are zeroed
+        bool valid;
+        unsigned long GPUID;
+        /// Increases with every poll of the GPU
+        unsigned long long version;
+        float voltage;
+        float temperature;
+        GpuClocks clocks;
+        GpuClocks defaultClocks;
+        GpuClocks baseClocks;
+        GpuClocks boostClocks;
+        GpuUsage usage;
+        GpuOverclockProfile overclockProfile;
+        /// The GPU_METRIC bits for the values that changed in this poll
+        unsigned changedMetrics;
+    };
+
+    /**
+     * The most used values from a single poll, packed into one 64 byte cache
+     * line. Much cheaper to copy and keep around than a GpuSnapshot, which
+     * makes it the record to use for collecting history.
+     */
+    struct GpuSample
+    {
+        /// When the poll started, in nanoseconds on std::chrono::steady_clock
+        unsigned long long timestamp;
+        /// The GPU_METRIC bits for the values that changed in this poll
+        unsigned changedMetrics;
+        float coreClock;
+        float memoryClock;
+        float shaderClock;
+        float coreUsage;
+        float fbUsage;
+        float vidUsage;
+        float busUsage;
+        float temperature;
+        float voltage;
+        /// The current power and thermal limits from the overclock profile
+        float powerLimit;
+        float thermalLimit;
+        /// The current core and memory overclocks
+        float coreOverclock;
+        float memoryOverclock;
+    };
+
+    /**
+     * The values in a GpuSample, in the order they appear in it. Used to
+     * index the arrays of GpuSampleAggregate.
+     */
+    enum GPU_SAMPLE_VALUE
+    {
+        GPU_SAMPLE_VALUE_CORE_CLOCK,
+        GPU_SAMPLE_VALUE_MEMORY_CLOCK,
+        GPU_SAMPLE_VALUE_SHADER_CLOCK,
+        GPU_SAMPLE_VALUE_CORE_USAGE,
+        GPU_SAMPLE_VALUE_FB_USAGE,
+        GPU_SAMPLE_VALUE_VID_USAGE,
+        GPU_SAMPLE_VALUE_BUS_USAGE,
+        GPU_SAMPLE_VALUE_TEMPERATURE,
+        GPU_SAMPLE_VALUE_VOLTAGE,
+        GPU_SAMPLE_VALUE_POWER_LIMIT,
+        GPU_SAMPLE_VALUE_THERMAL_LIMIT,
+        GPU_SAMPLE_VALUE_CORE_OVERCLOCK,
+        GPU_SAMPLE_VALUE_MEMORY_OVERCLOCK,
+        GPU_SAMPLE_VALUE_COUNT
+    };
+
+    /**
+     * The resolutions the GPU history keeps samples at. Everything but RAW
+     * is a rollup of the samples in each period.
+     */
+    enum GPU_HISTORY_RESOLUTION
+    {
+        GPU_HISTORY_RESOLUTION_RAW,
+        GPU_HISTORY_RESOLUTION_SECOND,
+        GPU_HISTORY_RESOLUTION_TEN_SECONDS,
+        GPU_HISTORY_RESOLUTION_MINUTE,
+        GPU_HISTORY_RESOLUTION_COUNT
+    };
+
+    /**
+     * Statistics for each value over a number of samples, either a single
+     * rollup period or a queried window.
+     */
+    struct GpuSampleAggregate
+    {
+        /// The timestamps of the first and last sample included
+        unsigned long long firstTimestamp;
+        unsigned long long lastTimestamp;
+        /// The number of samples included, 0 if there were none
+        unsigned count;
+        float min[GPU_SAMPLE_VALUE_COUNT];
+        float max[GPU_SAMPLE_VALUE_COUNT];
+        float mean[GPU_SAMPLE_VALUE_COUNT];
+        /// The values of the last sample
+        float last[GPU_SAMPLE_VALUE_COUNT];
+    };
+
+    /**
+     * How much polling the adaptive poll scheduler did, next to what polling
+     * every part of every GPU at its fastest interval would have cost.
+     */
+    struct GpuSchedulerStats
+    {
+        /// Polls made by the scheduler, each refreshing the parts of one GPU that were due
+        unsigned long long polls;
+        /// Driver calls made by those polls
+        unsigned long long driverCalls;
+        /// Driver calls fixed-rate polling would have made in the same time
+        unsigned long long fixedRateDriverCalls;
+    };
 #ifdef __cplusplus
 }
 }
@@ -0,0 +1,451 @@
+#include "pch.h"
+#include "GpuHistory.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+
+// The aggregation kernels use SSE2 where it's available, which is always the
+// case on x64, and fall back to plain loops elsewhere.
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define GPU_HISTORY_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace lib_gpu {
+
+// The kernels treat a GpuSample as 16 float lanes, 4 SSE registers. The
+// timestamp and changed-metrics mask occupy the first three lanes, and are
+// kept out of the statistics.
+const unsigned SAMPLE_LANES = 16;
+const unsigned FIRST_VALUE_LANE = 3;
+
+static_assert(sizeof(GpuSample) == SAMPLE_LANES * sizeof(float), "GpuSample should be exactly 16 lanes");
+static_assert(offsetof(GpuSample, coreClock) == FIRST_VALUE_LANE * sizeof(float), "The values should start at the fourth lane");
+static_assert(offsetof(GpuSample, memoryOverclock) == (FIRST_VALUE_LANE + GPU_SAMPLE_VALUE_COUNT - 1) * sizeof(float),
+    "The values should be in GPU_SAMPLE_VALUE order");
+
+// Samples summed as floats before adding them to the double totals
+const size_t SUM_BLOCK_SIZE = 256;
+
+const unsigned long long NANOSECONDS_PER_SECOND = 1000000000ull;
+// The length of each rollup period, indexed by GPU_HISTORY_RESOLUTION - 1
+const std::array<unsigned long long, GPU_HISTORY_RESOLUTION_COUNT - 1> rollup_periods = { {
+    NANOSECONDS_PER_SECOND,
+    10 * NANOSECONDS_PER_SECOND,
+    60 * NANOSECONDS_PER_SECOND
+} };
+
+#pragma region Aggregation kernels
+
+// Running statistics for every lane of a number of samples
+struct SampleStatistics
+{
+    float min[SAMPLE_LANES];
+    float max[SAMPLE_LANES];
+    double sum[SAMPLE_LANES];
+    float last[SAMPLE_LANES];
+    unsigned count;
+    unsigned long long firstTimestamp;
+    unsigned long long lastTimestamp;
+};
+
+void resetStatistics(SampleStatistics& statistics)
+{
+    std::fill(std::begin(statistics.min), std::end(statistics.min), std::numeric_limits<float>::infinity());
+    std::fill(std::begin(statistics.max), std::end(statistics.max), -std::numeric_limits<float>::infinity());
+    std::fill(std::begin(statistics.sum), std::end(statistics.sum), 0.0);
+    std::fill(std::begin(statistics.last), std::end(statistics.last), 0.0f);
+    statistics.count = 0;
+    statistics.firstTimestamp = 0;
+    statistics.lastTimestamp = 0;
+}
+
+void accumulateSamples(SampleStatistics& statistics, const GpuSample* samples, size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+
+#ifdef GPU_HISTORY_SSE2
+    // The timestamp bits could look like denormals, which would slow down
+    // every operation on them, so they're zeroed before anything else.
+    const auto valueMask = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+
+    __m128 minimum[4];
+    __m128 maximum[4];
+    __m128d sum[8];
+    for (auto k = 0; k < 4; k++) {
+        minimum[k] = _mm_loadu_ps(statistics.min + 4 * k);
+        maximum[k] = _mm_loadu_ps(statistics.max + 4 * k);
+        sum[2 * k] = _mm_loadu_pd(statistics.sum + 4 * k);
+        sum[2 * k + 1] = _mm_loadu_pd(statistics.sum + 4 * k + 2);
+    }
+
+    // The sums are kept as floats for a block of samples at a time, and only
+    // added to the double totals at the end of each block. That saves two
+    // conversions per register and sample, without losing much precision.
+    for (size_t block = 0; block < count; block += SUM_BLOCK_SIZE) {
+        const auto blockEnd = (std::min)(count, block + SUM_BLOCK_SIZE);
+        __m128 blockSum[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+
+        for (auto i = block; i < blockEnd; i++) {
+            const auto lanes = reinterpret_cast<const float*>(samples + i);
+            for (auto k = 0; k < 4; k++) {
+                auto values = _mm_loadu_ps(lanes + 4 * k);
+                if (k == 0) {
+                    values = _mm_and_ps(values, valueMask);
+                }
+                minimum[k] = _mm_min_ps(minimum[k], values);
+                maximum[k] = _mm_max_ps(maximum[k], values);
+                blockSum[k] = _mm_add_ps(blockSum[k], values);
+            }
+        }
+
+        for (auto k = 0; k < 4; k++) {
+            sum[2 * k] = _mm_add_pd(sum[2 * k], _mm_cvtps_pd(blockSum[k]));
+            sum[2 * k + 1] = _mm_add_pd(sum[2 * k + 1], _mm_cvtps_pd(_mm_movehl_ps(blockSum[k], blockSum[k])));
+        }
+    }
+
+    for (auto k = 0; k < 4; k++) {
+        _mm_storeu_ps(statistics.min + 4 * k, minimum[k]);
+        _mm_storeu_ps(statistics.max + 4 * k, maximum[k]);
+        _mm_storeu_pd(statistics.sum + 4 * k, sum[2 * k]);
+        _mm_storeu_pd(statistics.sum + 4 * k + 2, sum[2 * k + 1]);
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        const auto lanes = reinterpret_cast<const float*>(samples + i);
+        for (auto lane = FIRST_VALUE_LANE; lane < SAMPLE_LANES; lane++) {
+            statistics.min[lane] = (std::min)(statistics.min[lane], lanes[lane]);
+            statistics.max[lane] = (std::max)(statistics.max[lane], lanes[lane]);
+            statistics.sum[lane] += lanes[lane];
+        }
+    }
+#endif
+
+    if (statistics.count == 0) {
+        statistics.firstTimestamp = samples[0].timestamp;
+    }
+    statistics.count += static_cast<unsigned>(count);
+    statistics.lastTimestamp = samples[count - 1].timestamp;
+    memcpy(statistics.last, &samples[count - 1], sizeof(GpuSample));
+}
+
+GpuSampleAggregate toAggregate(const SampleStatistics& statistics)
+{
+    GpuSampleAggregate aggregate = {};
+    aggregate.firstTimestamp = statistics.firstTimestamp;
+    aggregate.lastTimestamp = statistics.lastTimestamp;
+    aggregate.count = statistics.count;
+    if (statistics.count == 0) {
+        return aggregate;
+    }
+
+    for (auto value = 0u; value < GPU_SAMPLE_VALUE_COUNT; value++) {
+        const auto lane = FIRST_VALUE_LANE + value;
+        aggregate.min[value] = statistics.min[lane];
+        aggregate.max[value] = statistics.max[lane];
+        aggregate.mean[value] = static_cast<float>(statistics.sum[lane] / statistics.count);
+        aggregate.last[value] = statistics.last[lane];
+    }
+    return aggregate;
+}
+
+/**
+ * Combines rollups into a single aggregate. There are few enough of them that
+ * this doesn't need the vector kernels.
+ */
+class AggregateCombiner
+{
+public:
+    AggregateCombiner() : total(), sums()
+    {
+    }
+
+    void add(const GpuSampleAggregate* aggregates, size_t count)
+    {
+        for (size_t i = 0; i < count; i++) {
+            const auto& aggregate = aggregates[i];
+            if (aggregate.count == 0) {
+                continue;
+            }
+
+            if (this->total.count == 0) {
+                this->total = aggregate;
+            } else {
+                this->total.count += aggregate.count;
+                this->total.lastTimestamp = aggregate.lastTimestamp;
+                for (auto value = 0u; value < GPU_SAMPLE_VALUE_COUNT; value++) {
+                    this->total.min[value] = (std::min)(this->total.min[value], aggregate.min[value]);
+                    this->total.max[value] = (std::max)(this->total.max[value], aggregate.max[value]);
+                    this->total.last[value] = aggregate.last[value];
+                }
+            }
+
+            for (auto value = 0u; value < GPU_SAMPLE_VALUE_COUNT; value++) {
+                this->sums[value] += static_cast<double>(aggregate.mean[value]) * aggregate.count;
+            }
+        }
+    }
+
+    GpuSampleAggregate get() const
+    {
+        auto result = this->total;
+        for (auto value = 0u; value < GPU_SAMPLE_VALUE_COUNT && result.count > 0; value++) {
+            result.mean[value] = static_cast<float>(this->sums[value] / result.count);
+        }
+        return result;
+    }
+
+private:
+    GpuSampleAggregate total;
+    std::array<double, GPU_SAMPLE_VALUE_COUNT> sums;
+};
+
+#pragma endregion
+
+#pragma region Ring buffers
+
+unsigned long long recordTimestamp(const GpuSample& sample)
+{
+    return sample.timestamp;
+}
+
+unsigned long long recordTimestamp(const GpuSampleAggregate& aggregate)
+{
+    return aggregate.firstTimestamp;
+}
+
+/**
+ * A fixed size ring buffer of records in timestamp order, with a single
+ * writer and any number of readers.
+ *
+ * The writer never waits. It overwrites the slot after the newest record
+ * while writing, so there's one slot more than the capacity, and readers
+ * never read that slot. If the writer has gone on to overwrite something a
+ * reader read in the meantime, the reader has to discard what it read and
+ * start over.
+ *
+ * Records are stored as words copied with relaxed atomics, so a reader
+ * racing the writer gets a torn copy to discard rather than a data race.
+ */
+template <typename T>
+class GpuHistory::Ring
+{
+public:
+    explicit Ring(size_t capacity) : slots(capacity + 1)
+    {
+    }
+
+    void push(const T& record)
+    {
+        const auto head = this->head.load(std::memory_order_relaxed);
+        // The slot was the oldest record before the previous push moved the
+        // head past it. The fence makes sure a reader that sees any of the
+        // new record also sees that head when it checks what it read.
+        std::atomic_thread_fence(std::memory_order_release);
+        this->store(static_cast<size_t>(head % this->slots.size()), record);
+        this->head.store(head + 1, std::memory_order_release);
+    }
+
+    /**
+     * Call `reader(records, count)` for each contiguous run of records with
+     * a timestamp in the window, oldest first. Returns false if the writer
+     * overwrote any of them while they were being read.
+     */
+    template <typename F>
+    bool read(unsigned long long from, unsigned long long to, F reader) const
+    {
+        const auto size = static_cast<unsigned long long>(this->slots.size());
+        const auto head = this->head.load(std::memory_order_acquire);
+        const auto oldest = head >= size ? head - size + 1 : 0;
+
+        const auto first = this->findFirst(oldest, head, [from](unsigned long long timestamp) { return timestamp >= from; });
+        const auto last = this->findFirst(first, head, [to](unsigned long long timestamp) { return timestamp > to; });
+
+        std::array<T, READ_BATCH> batch;
+        for (auto index = first; index < last;) {
+            const auto offset = static_cast<size_t>(index % size);
+            const auto count = static_cast<size_t>((std::min)({ last - index, size - offset, static_cast<unsigned long long>(READ_BATCH) }));
+            for (auto i = 0u; i < count; i++) {
+                this->load(offset + i, batch[i]);
+            }
+            reader(batch.data(), count);
+            index += count;
+        }
+
+        // The records are intact if the writer hasn't got to any of their
+        // slots, the earliest being the one after the newest record.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return first == last || first + size > this->head.load(std::memory_order_relaxed);
+    }
+
+private:
+    static_assert(sizeof(T) % sizeof(UINT32) == 0, "Records should be whole words");
+    static const size_t SLOT_WORDS = sizeof(T) / sizeof(UINT32);
+    // Records are copied out this many at a time before they're handed to the reader
+    static const size_t READ_BATCH = 32;
+
+    std::vector<std::array<std::atomic<UINT32>, SLOT_WORDS>> slots;
+    // The total number of records ever written
+    std::atomic<unsigned long long> head{ 0 };
+
+    void store(size_t offset, const T& record)
+    {
+        UINT32 words[SLOT_WORDS];
+        std::memcpy(words, &record, sizeof(record));
+        auto& slot = this->slots[offset];
+        for (auto i = 0u; i < SLOT_WORDS; i++) {
+            slot[i].store(words[i], std::memory_order_relaxed);
+        }
+    }
+
+    void load(size_t offset, T& record) const
+    {
+        UINT32 words[SLOT_WORDS];
+        const auto& slot = this->slots[offset];
+        for (auto i = 0u; i < SLOT_WORDS; i++) {
+            words[i] = slot[i].load(std::memory_order_relaxed);
+        }
+        std::memcpy(&record, words, sizeof(record));
+    }
+
+    // The first index in [begin, end) whose timestamp satisfies `predicate`,
+    // which has to be false for all earlier indices and true for all later ones
+    template <typename F>
+    unsigned long long findFirst(unsigned long long begin, unsigned long long end, F predicate) const
+    {
+        while (begin < end) {
+            const auto middle = begin + (end - begin) / 2;
+            T record;
+            this->load(static_cast<size_t>(middle % this->slots.size()), record);
+            if (predicate(recordTimestamp(record))) {
+                end = middle;
+            } else {
+                begin = middle + 1;
+            }
+        }
+        return begin;
+    }
+};
+
+#pragma endregion
+
+struct GpuHistory::Rollup
+{
+    // The period the statistics are for, the timestamp divided by the period length
+    unsigned long long period = 0;
+    SampleStatistics statistics;
+};
+
+GpuHistory::GpuHistory(const GpuHistoryConfig& config)
+{
+    this->samples = std::make_unique<Ring<GpuSample>>(config.capacity[GPU_HISTORY_RESOLUTION_RAW]);
+    for (auto i = 0u; i < this->rollups.size(); i++) {
+        this->rollups[i] = std::make_unique<Ring<GpuSampleAggregate>>(config.capacity[i + 1]);
+        this->openRollups[i] = std::make_unique<Rollup>();
+        resetStatistics(this->openRollups[i]->statistics);
+    }
+
+    if (config.archiveBytes > 0) {
+        GpuSampleArchiveConfig archiveConfig;
+        archiveConfig.blockSize = config.archiveBlockSize;
+        archiveConfig.maxBytes = config.archiveBytes;
+        this->archive = std::make_unique<GpuSampleArchive>(archiveConfig);
+    }
+}
+
+GpuHistory::~GpuHistory()
+{
+}
+
+void GpuHistory::record(const GpuSample& sample)
+{
+    this->samples->push(sample);
+
+    for (auto i = 0u; i < this->rollups.size(); i++) {
+        auto& rollup = *this->openRollups[i];
+        const auto period = sample.timestamp / rollup_periods[i];
+        if (rollup.statistics.count > 0 && period != rollup.period) {
+            this->rollups[i]->push(toAggregate(rollup.statistics));
+            resetStatistics(rollup.statistics);
+        }
+
+        rollup.period = period;
+        accumulateSamples(rollup.statistics, &sample, 1);
+    }
+
+    if (this->archive) {
+        this->archive->append(sample);
+    }
+}
+
+size_t GpuHistory::getSamples(unsigned long long from, unsigned long long to, std::vector<GpuSample>& samples) const
+{
+    do {
+        samples.clear();
+    } while (!this->samples->read(from, to, [&](const GpuSample* records, size_t count) {
+        samples.insert(samples.end(), records, records + count);
+    }));
+
+    return samples.size();
+}
+
+size_t GpuHistory::getRollups(GPU_HISTORY_RESOLUTION resolution, unsigned long long from, unsigned long long to,
+    std::vector<GpuSampleAggregate>& rollups) const
+{
+    rollups.clear();
+    if (resolution == GPU_HISTORY_RESOLUTION_RAW) {
+        std::vector<GpuSample> samples;
+        this->getSamples(from, to, samples);
+        for (const auto& sample : samples) {
+            SampleStatistics statistics;
+            resetStatistics(statistics);
+            accumulateSamples(statistics, &sample, 1);
+            rollups.push_back(toAggregate(statistics));
+        }
+    } else if (resolution < GPU_HISTORY_RESOLUTION_COUNT) {
+        do {
+            rollups.clear();
+        } while (!this->rollups[resolution - 1]->read(from, to, [&](const GpuSampleAggregate* records, size_t count) {
+            rollups.insert(rollups.end(), records, records + count);
+        }));
+    }
+
+    return rollups.size();
+}
+
+bool GpuHistory::aggregate(GPU_HISTORY_RESOLUTION resolution, unsigned long long from, unsigned long long to,
+    GpuSampleAggregate& result) const
+{
+    if (resolution == GPU_HISTORY_RESOLUTION_RAW) {
+        SampleStatistics statistics;
+        do {
+            resetStatistics(statistics);
+        } while (!this->samples->read(from, to, [&](const GpuSample* records, size_t count) {
+            accumulateSamples(statistics, records, count);
+        }));
+        result = toAggregate(statistics);
+    } else if (resolution < GPU_HISTORY_RESOLUTION_COUNT) {
+        AggregateCombiner combiner;
+        while (!this->rollups[resolution - 1]->read(from, to, [&](const GpuSampleAggregate* records, size_t count) {
+            combiner.add(records, count);
+        })) {
+            combiner = AggregateCombiner();
+        }
+        result = combiner.get();
+    } else {
+        return false;
+    }
+
+    return result.count > 0;
+}
+
+const GpuSampleArchive* GpuHistory::getArchive() const
+{
+    return this->archive.get();
+}
+
+}
\ No newline at end of file
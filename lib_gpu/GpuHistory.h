@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "helpers.h"
+#include "GpuDatatypes.h"
+#include "GpuSampleArchive.h"
+
+namespace lib_gpu {
+
+/**
+ * How many records the history keeps at each resolution, indexed by
+ * GPU_HISTORY_RESOLUTION. All the memory is allocated up front.
+ *
+ * The defaults keep about 17 minutes of raw samples at 1 per second, an hour
+ * of per-second and six hours of per-10-second rollups, and a day of
+ * per-minute ones.
+ *
+ * Every sample can also be kept in a compressed archive, which holds days of
+ * them in the memory the raw ring buffer takes for minutes.
+ */
+struct GpuHistoryConfig
+{
+    std::array<size_t, GPU_HISTORY_RESOLUTION_COUNT> capacity = { { 1024, 3600, 2160, 1440 } };
+    /// The memory for the archive, 0 to not keep one
+    size_t archiveBytes = 0;
+    size_t archiveBlockSize = GpuSampleArchiveConfig().blockSize;
+};
+
+#pragma warning(disable: 4251)
+/**
+ * A bounded history of the samples of a single GPU, kept at several
+ * resolutions at once.
+ *
+ * Every sample is added to the raw ring buffer and to the open period of each
+ * rollup, which is closed and added to its own ring buffer once a sample for
+ * a later period comes in. There's a single writer, the thread polling the
+ * GPU, which never waits for readers. Readers don't take any locks either;
+ * they check afterwards whether the writer overwrote anything they read, and
+ * start over if it did.
+ *
+ * Timestamps are those of GpuSample, nanoseconds on std::chrono::steady_clock.
+ * Windows include both ends.
+ */
+class NVLIB_EXPORTED GpuHistory
+{
+public:
+    explicit GpuHistory(const GpuHistoryConfig& config = GpuHistoryConfig());
+    ~GpuHistory();
+
+    /**
+     * Add a sample, which must not be older than the previous one. Only one
+     * thread at a time may call this.
+     */
+    void record(const GpuSample& sample);
+
+    /**
+     * Get the raw samples in the window, oldest first. Returns the number
+     * of samples.
+     */
+    size_t getSamples(unsigned long long from, unsigned long long to, std::vector<GpuSample>& samples) const;
+    /**
+     * Get the closed rollup periods that start in the window, oldest first.
+     * For the RAW resolution, every sample is its own period.
+     */
+    size_t getRollups(GPU_HISTORY_RESOLUTION resolution, unsigned long long from, unsigned long long to,
+        std::vector<GpuSampleAggregate>& rollups) const;
+    /**
+     * Combine everything recorded in the window at the given resolution into
+     * one set of statistics. Returns false if there's nothing in it.
+     */
+    bool aggregate(GPU_HISTORY_RESOLUTION resolution, unsigned long long from, unsigned long long to,
+        GpuSampleAggregate& result) const;
+
+    /**
+     * The compressed archive of every sample, or nullptr if it isn't kept.
+     */
+    const GpuSampleArchive* getArchive() const;
+
+private:
+    template <typename T>
+    class Ring;
+    struct Rollup;
+
+    std::unique_ptr<Ring<GpuSample>> samples;
+    std::array<std::unique_ptr<Ring<GpuSampleAggregate>>, GPU_HISTORY_RESOLUTION_COUNT - 1> rollups;
+    // Only touched by the writer
+    std::array<std::unique_ptr<Rollup>, GPU_HISTORY_RESOLUTION_COUNT - 1> openRollups;
+    std::unique_ptr<GpuSampleArchive> archive;
+};
+#pragma warning(default: 4251)
+
+}
\ No newline at end of file
@@ -0,0 +1,425 @@
+#include "pch.h"
+#include "GpuSampleArchive.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace lib_gpu {
+
+// Everything after the timestamp is packed as 32 bit words, the changed
+// metrics mask followed by the float values.
+const unsigned SAMPLE_WORDS = 14;
+
+static_assert(offsetof(GpuSample, changedMetrics) == sizeof(unsigned long long), "The words should follow the timestamp");
+static_assert(sizeof(GpuSample) == sizeof(unsigned long long) + SAMPLE_WORDS * sizeof(UINT32), "GpuSample should be exactly 14 words after the timestamp");
+
+const unsigned long long NANOSECONDS_PER_MILLISECOND = 1000000ull;
+
+// The most bits a sample after the first can take up: the longest timestamp
+// code, and a new window with all 32 bits for every word
+const size_t MAX_SAMPLE_BITS = 4 + 32 + SAMPLE_WORDS * (2 + 5 + 5 + 32);
+// A block has to fit the first sample, which is stored as is
+const size_t MIN_BLOCK_SIZE = (MAX_SAMPLE_BITS + 7) / 8;
+// Marks that a word has no window of meaningful bits to reuse yet
+const unsigned NO_WINDOW = 32;
+
+#pragma region Bit packing
+
+unsigned leadingZeros(UINT32 value)
+{
+    auto count = 0u;
+    if (!(value & 0xFFFF0000u)) { count += 16; value <<= 16; }
+    if (!(value & 0xFF000000u)) { count += 8; value <<= 8; }
+    if (!(value & 0xF0000000u)) { count += 4; value <<= 4; }
+    if (!(value & 0xC0000000u)) { count += 2; value <<= 2; }
+    if (!(value & 0x80000000u)) { count += 1; }
+    return count;
+}
+
+unsigned trailingZeros(UINT32 value)
+{
+    auto count = 0u;
+    if (!(value & 0x0000FFFFu)) { count += 16; value >>= 16; }
+    if (!(value & 0x000000FFu)) { count += 8; value >>= 8; }
+    if (!(value & 0x0000000Fu)) { count += 4; value >>= 4; }
+    if (!(value & 0x00000003u)) { count += 2; value >>= 2; }
+    if (!(value & 0x00000001u)) { count += 1; }
+    return count;
+}
+
+void splitSample(const GpuSample& sample, UINT32 (&words)[SAMPLE_WORDS])
+{
+    std::memcpy(words, &sample.changedMetrics, sizeof(words));
+}
+
+void joinSample(const UINT32 (&words)[SAMPLE_WORDS], GpuSample& sample)
+{
+    std::memcpy(&sample.changedMetrics, words, sizeof(words));
+}
+
+// Writes bits most significant first into a zeroed buffer
+class BitWriter
+{
+public:
+    BitWriter(std::vector<unsigned char>& bytes, size_t& position) : bytes(bytes), position(position)
+    {
+    }
+
+    void write(unsigned long long value, unsigned count)
+    {
+        while (count > 0) {
+            const auto offset = static_cast<unsigned>(this->position & 7);
+            const auto bits = (std::min)(8 - offset, count);
+            const auto chunk = static_cast<unsigned>(value >> (count - bits)) & ((1u << bits) - 1);
+            this->bytes[this->position >> 3] |= static_cast<unsigned char>(chunk << (8 - offset - bits));
+            this->position += bits;
+            count -= bits;
+        }
+    }
+
+private:
+    std::vector<unsigned char>& bytes;
+    size_t& position;
+};
+
+class BitReader
+{
+public:
+    explicit BitReader(const std::vector<unsigned char>& bytes) : bytes(bytes)
+    {
+    }
+
+    unsigned long long read(unsigned count)
+    {
+        auto value = 0ull;
+        while (count > 0) {
+            const auto offset = static_cast<unsigned>(this->position & 7);
+            const auto bits = (std::min)(8 - offset, count);
+            const auto chunk = (this->bytes[this->position >> 3] >> (8 - offset - bits)) & ((1u << bits) - 1);
+            value = (value << bits) | chunk;
+            this->position += bits;
+            count -= bits;
+        }
+        return value;
+    }
+
+    bool readBit()
+    {
+        return this->read(1) != 0;
+    }
+
+private:
+    const std::vector<unsigned char>& bytes;
+    size_t position = 0;
+};
+
+#pragma endregion
+
+#pragma region Blocks
+
+/**
+ * A block of samples. The first sample's timestamp is kept in the header and
+ * its words are stored as is, every later sample is encoded against the one
+ * before it. Timestamps are in milliseconds.
+ */
+struct GpuSampleArchive::Block
+{
+    unsigned long long firstTimestamp = 0;
+    unsigned long long lastTimestamp = 0;
+    unsigned count = 0;
+    size_t bitCount = 0;
+    std::vector<unsigned char> bytes;
+
+    /**
+     * Decode the samples with a timestamp in the window, in nanoseconds,
+     * and add them to `samples`.
+     */
+    void decode(unsigned long long from, unsigned long long to, std::vector<GpuSample>& samples) const;
+};
+
+// The widths the difference between consecutive timestamp deltas is stored
+// with, after a prefix of as many 1 bits as its position in here. A single 0
+// bit means the delta didn't change, and the prefix of the last width has no
+// 0 bit to end it.
+const unsigned delta_of_delta_widths[] = { 7, 9, 12, 32 };
+const unsigned DELTA_OF_DELTA_CODES = sizeof(delta_of_delta_widths) / sizeof(delta_of_delta_widths[0]);
+
+long long readDeltaOfDelta(BitReader& reader)
+{
+    auto code = 0u;
+    while (code < DELTA_OF_DELTA_CODES && reader.readBit()) {
+        code++;
+    }
+    if (code == 0) {
+        return 0;
+    }
+
+    const auto width = delta_of_delta_widths[code - 1];
+    const auto value = reader.read(width);
+    // Sign extend from the top bit of the width
+    const auto sign = 1ull << (width - 1);
+    return static_cast<long long>((value ^ sign) - sign);
+}
+
+// Returns false if the value doesn't fit in any of the widths
+bool writeDeltaOfDelta(BitWriter& writer, long long value)
+{
+    if (value == 0) {
+        writer.write(0, 1);
+        return true;
+    }
+
+    for (auto code = 1u; code <= DELTA_OF_DELTA_CODES; code++) {
+        const auto width = delta_of_delta_widths[code - 1];
+        const auto limit = 1ll << (width - 1);
+        if (value >= -limit && value < limit) {
+            // The prefix is `code` 1 bits, then a 0 bit unless it's the last code
+            if (code < DELTA_OF_DELTA_CODES) {
+                writer.write(((1ull << code) - 1) << 1, code + 1);
+            } else {
+                writer.write((1ull << code) - 1, code);
+            }
+            writer.write(static_cast<unsigned long long>(value) & ((1ull << width) - 1), width);
+            return true;
+        }
+    }
+    return false;
+}
+
+void GpuSampleArchive::Block::decode(unsigned long long from, unsigned long long to, std::vector<GpuSample>& samples) const
+{
+    BitReader reader(this->bytes);
+    UINT32 words[SAMPLE_WORDS];
+    unsigned leading[SAMPLE_WORDS] = {};
+    unsigned length[SAMPLE_WORDS] = {};
+    auto timestamp = this->firstTimestamp;
+    auto delta = 0ll;
+
+    for (auto i = 0u; i < this->count; i++) {
+        if (i == 0) {
+            for (auto& word : words) {
+                word = static_cast<UINT32>(reader.read(32));
+            }
+        } else {
+            delta += readDeltaOfDelta(reader);
+            timestamp += delta;
+            for (auto w = 0u; w < SAMPLE_WORDS; w++) {
+                if (!reader.readBit()) {
+                    continue;
+                }
+                if (reader.readBit()) {
+                    leading[w] = static_cast<unsigned>(reader.read(5));
+                    length[w] = static_cast<unsigned>(reader.read(5)) + 1;
+                }
+                const auto trailing = 32 - leading[w] - length[w];
+                words[w] ^= static_cast<UINT32>(reader.read(length[w]) << trailing);
+            }
+        }
+
+        const auto nanoseconds = timestamp * NANOSECONDS_PER_MILLISECOND;
+        if (nanoseconds > to) {
+            return;
+        }
+        if (nanoseconds >= from) {
+            GpuSample sample;
+            sample.timestamp = nanoseconds;
+            joinSample(words, sample);
+            samples.push_back(sample);
+        }
+    }
+}
+
+/**
+ * Packs samples into the open block, keeping what the next sample is
+ * encoded against.
+ */
+class GpuSampleArchive::Encoder
+{
+public:
+    explicit Encoder(size_t blockSize) : blockSize(blockSize)
+    {
+        this->reset();
+    }
+
+    const Block& getBlock() const
+    {
+        return *this->block;
+    }
+
+    /**
+     * Add a sample to the block. Returns false if the block is full, and the
+     * sample has to go in a new one.
+     */
+    bool append(const GpuSample& sample)
+    {
+        auto& block = *this->block;
+        // Timestamps going backwards would need a negative delta from the
+        // first timestamp, so they're held at the previous one
+        const auto timestamp = (std::max)(sample.timestamp / NANOSECONDS_PER_MILLISECOND, block.lastTimestamp);
+        UINT32 words[SAMPLE_WORDS];
+        splitSample(sample, words);
+
+        BitWriter writer(block.bytes, block.bitCount);
+        if (block.count == 0) {
+            block.firstTimestamp = timestamp;
+            for (auto word : words) {
+                writer.write(word, 32);
+            }
+        } else {
+            if (block.bitCount + MAX_SAMPLE_BITS > block.bytes.size() * 8) {
+                return false;
+            }
+
+            const auto delta = static_cast<long long>(timestamp - block.lastTimestamp);
+            if (!writeDeltaOfDelta(writer, delta - this->delta)) {
+                return false;
+            }
+            this->delta = delta;
+
+            for (auto w = 0u; w < SAMPLE_WORDS; w++) {
+                this->writeWord(writer, w, words[w]);
+            }
+        }
+
+        std::copy(std::begin(words), std::end(words), std::begin(this->words));
+        block.lastTimestamp = timestamp;
+        block.count++;
+        return true;
+    }
+
+    /**
+     * Hand over the block and start a new, empty one.
+     */
+    std::shared_ptr<const Block> seal()
+    {
+        std::shared_ptr<const Block> sealed = std::move(this->block);
+        this->reset();
+        return sealed;
+    }
+
+private:
+    const size_t blockSize;
+    std::unique_ptr<Block> block;
+    long long delta;
+    UINT32 words[SAMPLE_WORDS];
+    // The window of meaningful bits each word was last written with
+    unsigned leading[SAMPLE_WORDS];
+    unsigned trailing[SAMPLE_WORDS];
+
+    void reset()
+    {
+        this->block = std::make_unique<Block>();
+        this->block->bytes.resize(this->blockSize);
+        this->delta = 0;
+        std::fill(std::begin(this->leading), std::end(this->leading), NO_WINDOW);
+        std::fill(std::begin(this->trailing), std::end(this->trailing), NO_WINDOW);
+    }
+
+    // '0' if the word didn't change, '10' and the bits in the previous
+    // window if they fit, otherwise '11', a new window and the bits in it
+    void writeWord(BitWriter& writer, unsigned index, UINT32 word)
+    {
+        const auto difference = word ^ this->words[index];
+        if (difference == 0) {
+            writer.write(0, 1);
+            return;
+        }
+
+        const auto leading = leadingZeros(difference);
+        const auto trailing = trailingZeros(difference);
+        if (this->leading[index] != NO_WINDOW && leading >= this->leading[index] && trailing >= this->trailing[index]) {
+            writer.write(2, 2);
+            writer.write(difference >> this->trailing[index], 32 - this->leading[index] - this->trailing[index]);
+            return;
+        }
+
+        const auto length = 32 - leading - trailing;
+        writer.write(3, 2);
+        writer.write(leading, 5);
+        writer.write(length - 1, 5);
+        writer.write(difference >> trailing, length);
+        this->leading[index] = leading;
+        this->trailing[index] = trailing;
+    }
+};
+
+#pragma endregion
+
+GpuSampleArchive::GpuSampleArchive(const GpuSampleArchiveConfig& config)
+    : config(config), encoder(std::make_unique<Encoder>((std::max)(config.blockSize, MIN_BLOCK_SIZE)))
+{
+}
+
+GpuSampleArchive::~GpuSampleArchive()
+{
+}
+
+void GpuSampleArchive::append(const GpuSample& sample)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (!this->encoder->append(sample)) {
+        this->sealBlock();
+        this->encoder->append(sample);
+    }
+}
+
+void GpuSampleArchive::sealBlock()
+{
+    const auto blockSize = (std::max)(this->config.blockSize, MIN_BLOCK_SIZE);
+    // The open block counts towards the limit too
+    const auto maxSealedBlocks = (std::max)(this->config.maxBytes / blockSize, static_cast<size_t>(1)) - 1;
+
+    auto block = this->encoder->seal();
+    this->sealedSamples += block->count;
+    this->sealedBlocks.push_back(std::move(block));
+    while (this->sealedBlocks.size() > maxSealedBlocks) {
+        this->sealedSamples -= this->sealedBlocks.front()->count;
+        this->sealedBlocks.pop_front();
+    }
+}
+
+size_t GpuSampleArchive::getSamples(unsigned long long from, unsigned long long to, std::vector<GpuSample>& samples) const
+{
+    samples.clear();
+    if (from > to) {
+        return 0;
+    }
+
+    // Sealed blocks never change, so only the open one has to be copied to
+    // decode it without holding the lock.
+    std::vector<std::shared_ptr<const Block>> blocks;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        const auto overlaps = [from, to](const Block& block) {
+            return block.count > 0 && block.firstTimestamp * NANOSECONDS_PER_MILLISECOND <= to &&
+                block.lastTimestamp * NANOSECONDS_PER_MILLISECOND >= from;
+        };
+        for (const auto& block : this->sealedBlocks) {
+            if (overlaps(*block)) {
+                blocks.push_back(block);
+            }
+        }
+        if (overlaps(this->encoder->getBlock())) {
+            blocks.push_back(std::make_shared<const Block>(this->encoder->getBlock()));
+        }
+    }
+
+    for (const auto& block : blocks) {
+        block->decode(from, to, samples);
+    }
+    return samples.size();
+}
+
+size_t GpuSampleArchive::getSampleCount() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->sealedSamples + this->encoder->getBlock().count;
+}
+
+size_t GpuSampleArchive::getMemoryUsage() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return (this->sealedBlocks.size() + 1) * (std::max)(this->config.blockSize, MIN_BLOCK_SIZE);
+}
+
+}
\ No newline at end of file
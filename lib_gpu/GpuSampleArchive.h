@@ -0,0 +1,72 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "helpers.h"
+#include "GpuDatatypes.h"
+
+namespace lib_gpu {
+
+struct GpuSampleArchiveConfig
+{
+    /// The size of each compressed block in bytes
+    size_t blockSize = 4096;
+    /// The most memory the blocks may take up, the oldest are dropped beyond it
+    size_t maxBytes = 16 * 1024 * 1024;
+};
+
+#pragma warning(disable: 4251)
+/**
+ * Compressed long-term storage for the samples of a single GPU, along the
+ * lines of Facebook's Gorilla.
+ *
+ * Samples are packed into fixed size blocks of bits. Timestamps are stored
+ * as the difference between consecutive deltas, which is 0 or close to it
+ * for regular polling, and every value as the XOR with its previous value,
+ * which is 0 for values that didn't change and has few meaningful bits for
+ * ones that changed a little. A block is decoded as a whole, so reading a
+ * range only touches the blocks that overlap it.
+ *
+ * Timestamps are kept with millisecond precision. Appending only locks out
+ * readers while the sample is being packed, readers decode outside the lock.
+ */
+class NVLIB_EXPORTED GpuSampleArchive
+{
+public:
+    explicit GpuSampleArchive(const GpuSampleArchiveConfig& config = GpuSampleArchiveConfig());
+    ~GpuSampleArchive();
+
+    /**
+     * Add a sample, which must not be older than the previous one.
+     */
+    void append(const GpuSample& sample);
+    /**
+     * Decode the samples in the window, oldest first. Timestamps are in
+     * nanoseconds like those of GpuSample, and both ends are included.
+     * Returns the number of samples.
+     */
+    size_t getSamples(unsigned long long from, unsigned long long to, std::vector<GpuSample>& samples) const;
+
+    size_t getSampleCount() const;
+    /**
+     * The memory taken up by the blocks, including the partly filled one.
+     */
+    size_t getMemoryUsage() const;
+
+private:
+    struct Block;
+    class Encoder;
+
+    const GpuSampleArchiveConfig config;
+    std::deque<std::shared_ptr<const Block>> sealedBlocks;
+    std::unique_ptr<Encoder> encoder;
+    size_t sealedSamples = 0;
+    mutable std::mutex mutex;
+
+    void sealBlock();
+};
+#pragma warning(default: 4251)
+
+}
\ No newline at end of file
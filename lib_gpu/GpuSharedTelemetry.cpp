@@ -0,0 +1,272 @@
+#include "pch.h"
+#include "GpuSharedTelemetry.h"
+#include "NvidiaApi.h"
+#include "NvidiaGPU.h"
+#include <cstring>
+#include <vector>
+
+namespace lib_gpu {
+
+// How many times a reader retries a slot the publisher is writing before it
+// starts yielding to let it finish, and before it gives up on a publisher
+// that died in the middle of writing it
+const unsigned SEQUENCE_SPINS = 64;
+const unsigned MAX_SEQUENCE_ATTEMPTS = 4096;
+
+void copyString(char (&destination)[NVIDIA_SHORT_STRING_SIZE], const std::string& source)
+{
+    strncpy_s(destination, NVIDIA_SHORT_STRING_SIZE, source.c_str(), _TRUNCATE);
+}
+
+void fillTelemetryRecord(const NvidiaGPU& gpu, const NvidiaGPUSnapshot& snapshot, GpuSharedTelemetryRecord& record)
+{
+    record = GpuSharedTelemetryRecord{};
+    snapshot.getValues(record.snapshot);
+    record.snapshot.GPUID = gpu.getGPUID();
+    snapshot.getSample(record.sample);
+    copyString(record.name, gpu.getName());
+    copyString(record.serialNumber, gpu.getSerialNumber());
+}
+
+#pragma region GpuSharedTelemetryPublisher
+
+GpuSharedTelemetryPublisher::GpuSharedTelemetryPublisher() : mapping(nullptr)
+{
+}
+
+GpuSharedTelemetryPublisher::~GpuSharedTelemetryPublisher()
+{
+    this->stop();
+}
+
+bool GpuSharedTelemetryPublisher::start(const NvidiaApi& api, std::chrono::milliseconds interval, const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto gpuCount = (std::min)(api.getGPUCount(), static_cast<unsigned>(NVIDIA_MAX_PHYSICAL_GPUS));
+    if (this->thread.joinable() || gpuCount == 0 || interval.count() <= 0) {
+        return false;
+    }
+
+    this->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(GpuSharedTelemetrySegment), name.c_str());
+    this->segment = this->mapping ? static_cast<GpuSharedTelemetrySegment*>(
+        MapViewOfFile(this->mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(GpuSharedTelemetrySegment))) : nullptr;
+    if (!this->segment) {
+        this->unmap();
+        return false;
+    }
+
+    // The publisher thread has to claim the segment before it touches it,
+    // which fails if another publisher, in this process or another, has it
+    std::promise<bool> claimed;
+    auto claim = claimed.get_future();
+    this->stopping = false;
+    this->thread = std::thread(&GpuSharedTelemetryPublisher::run, this, std::cref(api), interval, name + GPU_SHARED_TELEMETRY_MUTEX_SUFFIX,
+        gpuCount, std::move(claimed));
+    if (!claim.get()) {
+        this->thread.join();
+        this->unmap();
+        return false;
+    }
+    return true;
+}
+
+void GpuSharedTelemetryPublisher::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->thread.joinable()) {
+            return;
+        }
+        this->stopping = true;
+    }
+
+    this->stopCondition.notify_one();
+    this->thread.join();
+    this->unmap();
+}
+
+bool GpuSharedTelemetryPublisher::isRunning() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->thread.joinable();
+}
+
+void GpuSharedTelemetryPublisher::run(const NvidiaApi& api, std::chrono::milliseconds interval, const std::string& mutexName,
+    unsigned gpuCount, std::promise<bool> claimed)
+{
+    // The seqlock only works with a single writer per slot, so a segment is
+    // only ever written by the thread holding its named mutex. Windows ties
+    // a mutex to the thread that took it, hence taking it here. An abandoned
+    // mutex means the previous publisher died, and we take over.
+    const auto role = CreateMutexA(nullptr, FALSE, mutexName.c_str());
+    const auto wait = role ? WaitForSingleObject(role, 0) : WAIT_FAILED;
+    if (wait != WAIT_OBJECT_0 && wait != WAIT_ABANDONED) {
+        if (role) {
+            CloseHandle(role);
+        }
+        claimed.set_value(false);
+        return;
+    }
+
+    // The segment may be left over from an earlier publisher that readers
+    // still have open, in which case its data stays readable until it's
+    // replaced. A slot it died in the middle of writing holds a half written
+    // record, so it goes back to unpublished until it's written again.
+    auto& header = this->segment->header;
+    header.version = GPU_SHARED_TELEMETRY_VERSION;
+    header.slotSize = sizeof(GpuSharedTelemetrySlot);
+    header.gpuCount.store(gpuCount, std::memory_order_relaxed);
+    header.heartbeat.store(GetTickCount64(), std::memory_order_relaxed);
+    for (auto& slot : this->segment->slots) {
+        if (slot.sequence.load(std::memory_order_relaxed) & 1) {
+            slot.sequence.store(0, std::memory_order_release);
+        }
+    }
+    header.magic.store(GPU_SHARED_TELEMETRY_MAGIC, std::memory_order_release);
+    claimed.set_value(true);
+
+    std::vector<std::shared_ptr<NvidiaGPU>> gpus;
+    for (auto i = 0u; i < gpuCount; i++) {
+        gpus.push_back(api.getGPU(i));
+    }
+    // The version last published for each GPU
+    std::vector<unsigned long long> versions(gpuCount, 0);
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (!this->stopping) {
+        lock.unlock();
+
+        for (auto i = 0u; i < gpuCount; i++) {
+            const auto snapshot = gpus[i]->getSnapshot();
+            if (!snapshot.isValid() || snapshot.getVersion() == versions[i]) {
+                continue;
+            }
+
+            GpuSharedTelemetryRecord record;
+            fillTelemetryRecord(*gpus[i], snapshot, record);
+
+            auto& slot = this->segment->slots[i];
+            const auto sequence = slot.sequence.load(std::memory_order_relaxed);
+            slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            std::memcpy(&slot.record, &record, sizeof(record));
+            slot.sequence.store(sequence + 2, std::memory_order_release);
+            versions[i] = snapshot.getVersion();
+        }
+        this->segment->header.heartbeat.store(GetTickCount64(), std::memory_order_relaxed);
+
+        lock.lock();
+        this->stopCondition.wait_for(lock, interval, [this] { return this->stopping; });
+    }
+
+    ReleaseMutex(role);
+    CloseHandle(role);
+}
+
+void GpuSharedTelemetryPublisher::unmap()
+{
+    if (this->segment) {
+        UnmapViewOfFile(this->segment);
+    }
+    if (this->mapping) {
+        CloseHandle(this->mapping);
+    }
+    this->segment = nullptr;
+    this->mapping = nullptr;
+}
+
+#pragma endregion
+
+#pragma region GpuSharedTelemetryReader
+
+GpuSharedTelemetryReader::GpuSharedTelemetryReader() : mapping(nullptr)
+{
+}
+
+GpuSharedTelemetryReader::~GpuSharedTelemetryReader()
+{
+    this->close();
+}
+
+bool GpuSharedTelemetryReader::open(const std::string& name)
+{
+    this->close();
+
+    this->mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+    this->segment = this->mapping ? static_cast<const GpuSharedTelemetrySegment*>(
+        MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, sizeof(GpuSharedTelemetrySegment))) : nullptr;
+
+    const auto valid = this->segment &&
+        this->segment->header.magic.load(std::memory_order_acquire) == GPU_SHARED_TELEMETRY_MAGIC &&
+        this->segment->header.version == GPU_SHARED_TELEMETRY_VERSION &&
+        this->segment->header.slotSize == sizeof(GpuSharedTelemetrySlot);
+    if (!valid) {
+        this->close();
+    }
+    return valid;
+}
+
+void GpuSharedTelemetryReader::close()
+{
+    if (this->segment) {
+        UnmapViewOfFile(this->segment);
+    }
+    if (this->mapping) {
+        CloseHandle(this->mapping);
+    }
+    this->segment = nullptr;
+    this->mapping = nullptr;
+}
+
+bool GpuSharedTelemetryReader::isOpen() const
+{
+    return this->segment != nullptr;
+}
+
+unsigned GpuSharedTelemetryReader::getGPUCount() const
+{
+    return this->segment ? this->segment->header.gpuCount.load(std::memory_order_relaxed) : 0;
+}
+
+bool GpuSharedTelemetryReader::read(unsigned index, GpuSharedTelemetryRecord& record) const
+{
+    if (index >= this->getGPUCount()) {
+        return false;
+    }
+
+    const auto& slot = this->segment->slots[index];
+    for (auto attempt = 0u; attempt < MAX_SEQUENCE_ATTEMPTS; attempt++) {
+        const auto before = slot.sequence.load(std::memory_order_acquire);
+        if (before == 0) {
+            return false;
+        }
+
+        if (!(before & 1)) {
+            std::memcpy(&record, &slot.record, sizeof(record));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == before) {
+                return true;
+            }
+        }
+
+        if (attempt >= SEQUENCE_SPINS) {
+            std::this_thread::yield();
+        }
+    }
+    return false;
+}
+
+std::chrono::milliseconds GpuSharedTelemetryReader::getPublisherAge() const
+{
+    if (!this->segment) {
+        return (std::chrono::milliseconds::max)();
+    }
+
+    const auto heartbeat = this->segment->header.heartbeat.load(std::memory_order_relaxed);
+    const auto now = GetTickCount64();
+    return std::chrono::milliseconds(now > heartbeat ? now - heartbeat : 0);
+}
+
+#pragma endregion
+
+}
\ No newline at end of file
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "helpers.h"
+#include "nvidia_interface_datatypes.h"
+#include "GpuDatatypes.h"
+
+namespace lib_gpu {
+
+class NvidiaApi;
+class NvidiaGPU;
+class NvidiaGPUSnapshot;
+
+/// The segment the publisher creates if it isn't given another name
+const char* const GPU_SHARED_TELEMETRY_NAME = "Local\\lib_gpu_telemetry";
+/**
+ * Appended to the segment name for the mutex that only the publisher of a
+ * segment holds. Mutexes and mappings share a namespace, so it can't be the
+ * segment name itself.
+ */
+const char* const GPU_SHARED_TELEMETRY_MUTEX_SUFFIX = "_publisher";
+
+#pragma region Segment layout
+
+/**
+ * The shared memory segment is a header followed by a slot for each of the
+ * NVIDIA_MAX_PHYSICAL_GPUS GPUs, slot N being GPU index N of the publisher.
+ *
+ * Each slot is guarded by a sequence lock. The publisher makes the sequence
+ * odd while it writes the record and even again afterwards; readers copy the
+ * record and start over if the sequence was odd or changed in the meantime.
+ * Readers never write to the segment, so any number of them can read without
+ * slowing down the publisher or each other.
+ */
+const UINT32 GPU_SHARED_TELEMETRY_MAGIC = 0x4D4C5447u; // "GTLM"
+const UINT32 GPU_SHARED_TELEMETRY_VERSION = 1;
+
+struct GpuSharedTelemetryRecord
+{
+    GpuSnapshot snapshot;
+    GpuSample sample;
+    char name[NVIDIA_SHORT_STRING_SIZE];
+    char serialNumber[NVIDIA_SHORT_STRING_SIZE];
+};
+
+/**
+ * Fill in a record from a GPU and a snapshot of its data.
+ */
+void fillTelemetryRecord(const NvidiaGPU& gpu, const NvidiaGPUSnapshot& snapshot, GpuSharedTelemetryRecord& record);
+
+// Slots take up whole cache lines, so a reader of one GPU doesn't share one
+// with the publisher writing the next.
+struct alignas(64) GpuSharedTelemetrySlot
+{
+    std::atomic<UINT32> sequence;
+    GpuSharedTelemetryRecord record;
+};
+
+struct alignas(64) GpuSharedTelemetryHeader
+{
+    /// Only set once the rest of the segment is initialized
+    std::atomic<UINT32> magic;
+    UINT32 version;
+    UINT32 slotSize;
+    std::atomic<UINT32> gpuCount;
+    /// GetTickCount64() when the publisher last checked for new data
+    std::atomic<UINT64> heartbeat;
+};
+
+struct GpuSharedTelemetrySegment
+{
+    GpuSharedTelemetryHeader header;
+    GpuSharedTelemetrySlot slots[NVIDIA_MAX_PHYSICAL_GPUS];
+};
+
+#pragma endregion
+
+#pragma warning(disable: 4251)
+/**
+ * Publishes the latest data of every GPU to a named shared memory segment,
+ * so other processes can read it without loading the driver themselves.
+ *
+ * The publisher doesn't poll; it checks every `interval` for GPUs with a new
+ * poll and copies their data to the segment. Combine it with the sampler or
+ * the scheduler, and stop it before destroying the NvidiaApi.
+ */
+class NVLIB_EXPORTED GpuSharedTelemetryPublisher
+{
+public:
+    GpuSharedTelemetryPublisher();
+    ~GpuSharedTelemetryPublisher();
+
+    /**
+     * Start publishing to the segment `name`. Fails if another publisher,
+     * in this or any other process, is already publishing to it.
+     */
+    bool start(const NvidiaApi& api, std::chrono::milliseconds interval, const std::string& name = GPU_SHARED_TELEMETRY_NAME);
+    void stop();
+    bool isRunning() const;
+
+private:
+    HANDLE mapping;
+    GpuSharedTelemetrySegment* segment = nullptr;
+    std::thread thread;
+    mutable std::mutex mutex;
+    std::condition_variable stopCondition;
+    bool stopping = false;
+
+    void run(const NvidiaApi& api, std::chrono::milliseconds interval, const std::string& mutexName, unsigned gpuCount,
+        std::promise<bool> claimed);
+    void unmap();
+};
+
+/**
+ * Reads what a GpuSharedTelemetryPublisher in another process published.
+ * Reading never calls the driver, and never blocks the publisher.
+ */
+class NVLIB_EXPORTED GpuSharedTelemetryReader
+{
+public:
+    GpuSharedTelemetryReader();
+    ~GpuSharedTelemetryReader();
+
+    /**
+     * Open the segment. Fails if there's no publisher, or it hasn't finished
+     * setting the segment up yet.
+     */
+    bool open(const std::string& name = GPU_SHARED_TELEMETRY_NAME);
+    void close();
+    bool isOpen() const;
+
+    unsigned getGPUCount() const;
+    /**
+     * Copy the latest record of a GPU. Returns false if the index is out of
+     * range or the GPU hasn't been published yet.
+     */
+    bool read(unsigned index, GpuSharedTelemetryRecord& record) const;
+    /**
+     * How long ago the publisher last checked for new data. A publisher that
+     * stopped or died leaves its last data behind, and this keeps growing.
+     */
+    std::chrono::milliseconds getPublisherAge() const;
+
+private:
+    HANDLE mapping;
+    const GpuSharedTelemetrySegment* segment = nullptr;
+};
+#pragma warning(default: 4251)
+
+}
\ No newline at end of file
@@ -1,12 +1,592 @@
 #include "pch.h"
 #include "NvidiaApi.h"
 #include "nvidia_interface.h"
+#include "nvidia_call_stats.h"
 #include <vector>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
 #include "NvidiaGPU.h"
 
 namespace lib_gpu {
 
+// Upper bound on the threads used for polling, the GPUs are mostly waiting
+// on the driver so there's little gain from going wider than this.
+const unsigned MAX_POLL_WORKERS = 8;
+// Callbacks that haven't run yet are dropped, oldest first, beyond this many,
+// so a stuck subscriber can't make the queue grow without bounds.
+const size_t MAX_PENDING_NOTIFICATIONS = 1024;
+// The resolution of the poll scheduler, deadlines are rounded up to whole ticks
+const std::chrono::milliseconds SCHEDULER_TICK(10);
+// Enough for the default intervals to fit in a single turn of the wheel
+const size_t SCHEDULER_WHEEL_SLOTS = 1024;
+
+#pragma region Helpers
+
+// The static fields aren't scheduled at all, the GPUs only reload them when
+// they've been invalidated.
+struct DatasetFieldInfo
+{
+    // The GPU_METRIC bits that tell whether the field is changing
+    unsigned metrics;
+    // The driver calls it takes to refresh the field, 0 for static fields,
+    // which is what polling at a fixed rate is measured by
+    unsigned driverCalls;
+    std::chrono::milliseconds defaultMinInterval;
+    std::chrono::milliseconds defaultMaxInterval;
+};
+
+#define METRIC_BIT(metric) (1u << GPU_METRIC_##metric)
+
+// Indexed by the bit number of the GPU_DATASET_FIELD flag
+const std::array<DatasetFieldInfo, DATASET_FIELD_COUNT> dataset_fields = { {
+    { METRIC_BIT(CORE_CLOCK) | METRIC_BIT(MEMORY_CLOCK) | METRIC_BIT(SHADER_CLOCK), 1,
+        std::chrono::milliseconds(250), std::chrono::milliseconds(2000) },
+    { METRIC_BIT(BASE_CORE_CLOCK) | METRIC_BIT(BASE_MEMORY_CLOCK) | METRIC_BIT(BASE_SHADER_CLOCK), 0,
+        std::chrono::milliseconds(0), std::chrono::milliseconds(0) },
+    { METRIC_BIT(BOOST_CORE_CLOCK) | METRIC_BIT(BOOST_MEMORY_CLOCK) | METRIC_BIT(BOOST_SHADER_CLOCK), 0,
+        std::chrono::milliseconds(0), std::chrono::milliseconds(0) },
+    { METRIC_BIT(CORE_USAGE) | METRIC_BIT(FB_USAGE) | METRIC_BIT(VID_USAGE) | METRIC_BIT(BUS_USAGE), 1,
+        std::chrono::milliseconds(250), std::chrono::milliseconds(2000) },
+    { METRIC_BIT(CORE_OVERCLOCK) | METRIC_BIT(MEMORY_OVERCLOCK) | METRIC_BIT(SHADER_OVERCLOCK) | METRIC_BIT(OVERVOLT), 1,
+        std::chrono::milliseconds(10000), std::chrono::milliseconds(10000) },
+    { METRIC_BIT(POWER_LIMIT), 1,
+        std::chrono::milliseconds(10000), std::chrono::milliseconds(10000) },
+    { METRIC_BIT(VOLTAGE), 1,
+        std::chrono::milliseconds(250), std::chrono::milliseconds(2000) },
+    { METRIC_BIT(TEMPERATURE), 1,
+        std::chrono::milliseconds(1000), std::chrono::milliseconds(1000) },
+    { METRIC_BIT(THERMAL_LIMIT) | METRIC_BIT(THERMAL_LIMIT_PRIORITY), 1,
+        std::chrono::milliseconds(10000), std::chrono::milliseconds(10000) },
+} };
+
+#undef METRIC_BIT
+
+bool isStaticField(unsigned index)
+{
+    return ((1u << index) & GPU_DATASET_FIELD_STATIC) != 0;
+}
+
+unsigned datasetFieldIndex(GPU_DATASET_FIELD field)
+{
+    for (auto i = 0u; i < DATASET_FIELD_COUNT; i++) {
+        if (field == (1u << i)) {
+            return i;
+        }
+    }
+    return DATASET_FIELD_COUNT;
+}
+
+/**
+ * A hashed timer wheel. A timer due at tick T lives in slot T % slot count,
+ * so scheduling one is constant time and each tick only looks at the timers
+ * in a single slot, however many there are in total.
+ */
+class TimerWheel
+{
+public:
+    explicit TimerWheel(size_t slotCount) : slots(slotCount)
+    {
+    }
+
+    unsigned long long getCurrentTick() const
+    {
+        return this->currentTick;
+    }
+
+    // Timers due at or before the current tick fire on the next advance
+    void schedule(unsigned long long tick, unsigned id)
+    {
+        tick = (std::max)(tick, this->currentTick + 1);
+        this->slots[tick % this->slots.size()].push_back(Timer{ tick, id });
+    }
+
+    // Move on to `tick`, adding the IDs of the timers that are due to `due`
+    void advance(unsigned long long tick, std::vector<unsigned>& due)
+    {
+        if (tick <= this->currentTick) {
+            return;
+        }
+
+        // After falling behind by more than a turn of the wheel every slot
+        // has to be looked at, but only once.
+        const auto last = (std::min)(tick, this->currentTick + this->slots.size());
+        for (auto current = this->currentTick + 1; current <= last; current++) {
+            auto& slot = this->slots[current % this->slots.size()];
+            const auto firing = std::partition(slot.begin(), slot.end(), [tick](const Timer& timer) {
+                return timer.tick > tick;
+            });
+            for (auto timer = firing; timer != slot.end(); ++timer) {
+                due.push_back(timer->id);
+            }
+            slot.erase(firing, slot.end());
+        }
+        this->currentTick = tick;
+    }
+
+private:
+    struct Timer
+    {
+        unsigned long long tick;
+        unsigned id;
+    };
+
+    std::vector<std::vector<Timer>> slots;
+    unsigned long long currentTick = 0;
+};
+
+#pragma endregion
+
+/**
+ * Polls a fixed set of GPUs in parallel on a set of long-lived threads.
+ *
+ * The thread calling pollAll() polls GPUs too, so with N GPUs there are at
+ * most N - 1 workers.
+ */
+class NvidiaApi::PollWorkers
+{
+public:
+    PollWorkers(const std::vector<std::shared_ptr<NvidiaGPU>>& gpus) : gpus(gpus), slots(gpus.size())
+    {
+        const auto hardwareThreads = (std::max)(std::thread::hardware_concurrency(), 1u);
+        const auto workerCount = (std::min)({ static_cast<unsigned>(gpus.size()) - 1, hardwareThreads, MAX_POLL_WORKERS });
+
+        for (auto i = 0u; i < workerCount; i++) {
+            this->threads.emplace_back(&PollWorkers::runWorker, this);
+        }
+    }
+
+    ~PollWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->workAvailable.notify_all();
+
+        for (auto& thread : this->threads) {
+            thread.join();
+        }
+    }
+
+    void pollAll(unsigned fields, std::vector<bool>& success)
+    {
+        std::lock_guard<std::mutex> callLock(this->callMutex);
+        unsigned generation;
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            generation = ++this->generation;
+            this->fields = fields;
+            this->remaining = static_cast<unsigned>(this->gpus.size());
+            this->nextClaim = static_cast<unsigned long long>(generation) << 32;
+        }
+        this->workAvailable.notify_all();
+
+        this->pollClaimed(generation, fields);
+
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->workDone.wait(lock, [this] { return this->remaining == 0; });
+        }
+
+        success.resize(this->slots.size());
+        for (auto i = 0u; i < this->slots.size(); i++) {
+            success[i] = this->slots[i].success;
+        }
+    }
+
+private:
+    // Padded to a cache line so workers writing results for neighbouring
+    // GPUs don't contend for the same line.
+    struct GpuSlot
+    {
+        bool success = false;
+        char padding[63];
+    };
+
+    const std::vector<std::shared_ptr<NvidiaGPU>>& gpus;
+    std::vector<GpuSlot> slots;
+    std::vector<std::thread> threads;
+
+    std::mutex callMutex;
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable workDone;
+    bool stopping = false;
+    unsigned generation = 0;
+    unsigned fields = 0;
+    unsigned remaining = 0;
+    // The generation in the upper 32 bits and the next unclaimed GPU index in
+    // the lower ones, so a worker that wakes up late can't claim GPUs in a
+    // later round with the fields of an earlier one.
+    std::atomic<unsigned long long> nextClaim{ 0 };
+
+    void runWorker()
+    {
+        unsigned seenGeneration = 0;
+
+        std::unique_lock<std::mutex> lock(this->mutex);
+        while (true) {
+            this->workAvailable.wait(lock, [&] { return this->stopping || this->generation != seenGeneration; });
+            if (this->stopping) {
+                return;
+            }
+
+            seenGeneration = this->generation;
+            const auto fields = this->fields;
+
+            lock.unlock();
+            this->pollClaimed(seenGeneration, fields);
+            lock.lock();
+        }
+    }
+
+    void pollClaimed(unsigned generation, unsigned fields)
+    {
+        auto polled = 0u;
+        auto index = 0u;
+        while (this->claim(generation, index)) {
+            this->slots[index].success = this->gpus[index]->poll(fields);
+            polled++;
+        }
+
+        if (polled > 0) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->remaining -= polled;
+            if (this->remaining == 0) {
+                this->workDone.notify_all();
+            }
+        }
+    }
+
+    bool claim(unsigned generation, unsigned& index)
+    {
+        auto current = this->nextClaim.load();
+        do {
+            if ((current >> 32) != generation || (current & 0xFFFFFFFF) >= this->gpus.size()) {
+                return false;
+            }
+        } while (!this->nextClaim.compare_exchange_weak(current, current + 1));
+
+        index = static_cast<unsigned>(current & 0xFFFFFFFF);
+        return true;
+    }
+};
+
+/**
+ * Evaluates the subscriptions after every poll, and runs the callbacks of the
+ * ones that trigger on a thread of its own.
+ *
+ * The subscription list is copied on write and swapped in atomically, like
+ * the GPU datasets, so evaluating it after a poll never waits on subscribers
+ * being added or removed.
+ */
+class NvidiaApi::Subscriptions
+{
+public:
+    Subscriptions() : subscriptions(std::make_shared<SubscriptionList>()), dispatcher(&Subscriptions::runDispatcher, this)
+    {
+    }
+
+    ~Subscriptions()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->dispatchMutex);
+            this->stopping = true;
+        }
+        this->notificationAvailable.notify_all();
+        this->dispatcher.join();
+    }
+
+    unsigned add(unsigned gpuIndex, GPU_METRIC metric, GpuMetricPredicate predicate, GpuMetricCallback callback)
+    {
+        std::lock_guard<std::mutex> lock(this->writeMutex);
+        auto subscription = std::make_shared<Subscription>();
+        subscription->id = this->nextId++;
+        subscription->gpuIndex = gpuIndex;
+        subscription->metric = metric;
+        subscription->predicate = std::move(predicate);
+        subscription->callback = std::move(callback);
+
+        auto newList = std::make_shared<SubscriptionList>(*std::atomic_load(&this->subscriptions));
+        newList->push_back(subscription);
+        std::atomic_store(&this->subscriptions, std::shared_ptr<const SubscriptionList>(std::move(newList)));
+        return subscription->id;
+    }
+
+    bool remove(unsigned id)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->writeMutex);
+            auto newList = std::make_shared<SubscriptionList>(*std::atomic_load(&this->subscriptions));
+            const auto found = std::find_if(newList->begin(), newList->end(), [id](const auto& subscription) {
+                return subscription->id == id;
+            });
+            if (found == newList->end()) {
+                return false;
+            }
+
+            (*found)->active = false;
+            newList->erase(found);
+            std::atomic_store(&this->subscriptions, std::shared_ptr<const SubscriptionList>(std::move(newList)));
+        }
+
+        // Queued notifications check the active flag, but the callback might
+        // already be running. Wait for it, unless that's who's calling us.
+        if (std::this_thread::get_id() != this->dispatcher.get_id()) {
+            std::unique_lock<std::mutex> lock(this->dispatchMutex);
+            this->callbackDone.wait(lock, [&] { return this->runningId != id; });
+        }
+        return true;
+    }
+
+    // Called after every successful poll, with the GPU's poll lock held
+    void evaluate(unsigned gpuIndex, const NvidiaGPUSnapshot& snapshot)
+    {
+        const auto subscriptions = std::atomic_load(&this->subscriptions);
+        std::vector<Notification> triggered;
+
+        for (const auto& subscription : *subscriptions) {
+            if (subscription->gpuIndex != gpuIndex) {
+                continue;
+            }
+
+            // Polls of a GPU are serialized, so only one thread at a time
+            // touches the subscriptions for that GPU.
+            const auto value = snapshot.getMetric(subscription->metric);
+            const auto matches = subscription->predicate(value);
+            if (matches && !subscription->matched) {
+                triggered.push_back(Notification{ subscription, value });
+            }
+            subscription->matched = matches;
+        }
+
+        if (triggered.empty()) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->dispatchMutex);
+            for (auto& notification : triggered) {
+                if (this->pending.size() >= MAX_PENDING_NOTIFICATIONS) {
+                    this->pending.pop_front();
+                }
+                this->pending.push_back(std::move(notification));
+            }
+        }
+        this->notificationAvailable.notify_one();
+    }
+
+private:
+    struct Subscription
+    {
+        unsigned id;
+        unsigned gpuIndex;
+        GPU_METRIC metric;
+        GpuMetricPredicate predicate;
+        GpuMetricCallback callback;
+        // Whether the predicate matched in the previous poll
+        bool matched = false;
+        std::atomic<bool> active{ true };
+    };
+
+    struct Notification
+    {
+        std::shared_ptr<Subscription> subscription;
+        float value;
+    };
+
+    typedef std::vector<std::shared_ptr<Subscription>> SubscriptionList;
+
+    std::shared_ptr<const SubscriptionList> subscriptions;
+    std::mutex writeMutex;
+    unsigned nextId = 1;
+
+    std::deque<Notification> pending;
+    std::mutex dispatchMutex;
+    std::condition_variable notificationAvailable;
+    std::condition_variable callbackDone;
+    // The subscription whose callback is running, 0 if none is
+    unsigned runningId = 0;
+    bool stopping = false;
+    std::thread dispatcher;
+
+    void runDispatcher()
+    {
+        std::unique_lock<std::mutex> lock(this->dispatchMutex);
+        while (true) {
+            this->notificationAvailable.wait(lock, [this] { return this->stopping || !this->pending.empty(); });
+            if (this->stopping) {
+                return;
+            }
+
+            auto notification = std::move(this->pending.front());
+            this->pending.pop_front();
+            const auto& subscription = *notification.subscription;
+            if (!subscription.active) {
+                continue;
+            }
+
+            this->runningId = subscription.id;
+            lock.unlock();
+            subscription.callback(subscription.gpuIndex, subscription.metric, notification.value);
+            lock.lock();
+            this->runningId = 0;
+            this->callbackDone.notify_all();
+        }
+    }
+};
+
+/**
+ * Refreshes each field of each GPU on a deadline of its own, adapting the
+ * interval to how much the field's metrics change.
+ *
+ * Every (GPU, field) pair is a timer on a timer wheel. On every tick the
+ * fields that are due are merged into one partial poll per GPU, and the
+ * changed-metrics mask of that poll decides the next interval of each field.
+ */
+class NvidiaApi::PollScheduler
+{
+public:
+    PollScheduler(const std::vector<std::shared_ptr<NvidiaGPU>>& gpus, const std::array<GpuFieldSchedule, DATASET_FIELD_COUNT>& schedules)
+        : gpus(gpus), schedules(schedules), wheel(SCHEDULER_WHEEL_SLOTS),
+        intervals(gpus.size() * DATASET_FIELD_COUNT), start(std::chrono::steady_clock::now())
+    {
+        this->fastestInterval = schedules[0].minInterval;
+        for (auto field = 0u; field < DATASET_FIELD_COUNT; field++) {
+            if (!isStaticField(field)) {
+                this->fastestInterval = (std::min)(this->fastestInterval, schedules[field].minInterval);
+            }
+        }
+
+        // Everything is due on the first tick
+        for (auto id = 0u; id < this->intervals.size(); id++) {
+            const auto field = id % DATASET_FIELD_COUNT;
+            this->intervals[id] = schedules[field].minInterval;
+            if (!isStaticField(field)) {
+                this->wheel.schedule(0, id);
+            }
+        }
+
+        this->thread = std::thread(&PollScheduler::run, this);
+    }
+
+    ~PollScheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->condition.notify_all();
+        this->thread.join();
+    }
+
+    GpuSchedulerStats getStats() const
+    {
+        auto fullPollCalls = 0ull;
+        for (const auto& field : dataset_fields) {
+            fullPollCalls += field.driverCalls;
+        }
+
+        // A fixed-rate poller would have polled everything right away, and
+        // again after every interval since.
+        const auto elapsed = std::chrono::steady_clock::now() - this->start;
+        const auto fixedRatePolls = static_cast<unsigned long long>(elapsed / this->fastestInterval) + 1;
+
+        GpuSchedulerStats stats;
+        stats.polls = this->polls.load();
+        stats.driverCalls = this->driverCalls.load();
+        stats.fixedRateDriverCalls = fixedRatePolls * fullPollCalls * this->gpus.size();
+        return stats;
+    }
+
+private:
+    const std::vector<std::shared_ptr<NvidiaGPU>>& gpus;
+    const std::array<GpuFieldSchedule, DATASET_FIELD_COUNT> schedules;
+    std::chrono::milliseconds fastestInterval;
+
+    // Only touched by the scheduler thread, timer IDs are
+    // gpuIndex * DATASET_FIELD_COUNT + field index
+    TimerWheel wheel;
+    std::vector<std::chrono::milliseconds> intervals;
+
+    const std::chrono::steady_clock::time_point start;
+    std::atomic<unsigned long long> polls{ 0 };
+    std::atomic<unsigned long long> driverCalls{ 0 };
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping = false;
+    std::thread thread;
+
+    void run()
+    {
+        std::vector<unsigned> due;
+        std::vector<unsigned> dueFields(this->gpus.size());
+
+        std::unique_lock<std::mutex> lock(this->mutex);
+        while (true) {
+            const auto nextTick = this->start + SCHEDULER_TICK * (this->wheel.getCurrentTick() + 1);
+            if (this->condition.wait_until(lock, nextTick, [this] { return this->stopping; })) {
+                return;
+            }
+
+            // Don't hold the lock while we're stuck in the driver
+            lock.unlock();
+
+            const auto now = std::chrono::steady_clock::now();
+            this->wheel.advance(static_cast<unsigned long long>((now - this->start) / SCHEDULER_TICK), due);
+            for (const auto id : due) {
+                dueFields[id / DATASET_FIELD_COUNT] |= 1u << (id % DATASET_FIELD_COUNT);
+            }
+            due.clear();
+
+            for (auto i = 0u; i < this->gpus.size(); i++) {
+                if (dueFields[i] != 0) {
+                    this->pollFields(i, dueFields[i]);
+                    dueFields[i] = 0;
+                }
+            }
+
+            lock.lock();
+        }
+    }
+
+    void pollFields(unsigned gpuIndex, unsigned fields)
+    {
+        // Counted by the GPU, as any poll might have to reload the static
+        // data, say after an overclock or a failed poll
+        auto calls = 0u;
+        const auto& gpu = this->gpus[gpuIndex];
+        const auto success = gpu->poll(fields, calls);
+        const auto changed = success ? gpu->getChangedMetrics() : 0;
+
+        for (auto field = 0u; field < DATASET_FIELD_COUNT; field++) {
+            if (!(fields & (1u << field))) {
+                continue;
+            }
+
+            // Back off while the field is stable, and retry failures quickly
+            const auto id = gpuIndex * DATASET_FIELD_COUNT + field;
+            const auto& schedule = this->schedules[field];
+            auto& interval = this->intervals[id];
+            if (!success || (changed & dataset_fields[field].metrics)) {
+                interval = schedule.minInterval;
+            } else {
+                interval = (std::min)(interval * 2, schedule.maxInterval);
+            }
+
+            const auto ticks = (interval + SCHEDULER_TICK - std::chrono::milliseconds(1)) / SCHEDULER_TICK;
+            this->wheel.schedule(this->wheel.getCurrentTick() + ticks, id);
+        }
+
+        this->polls++;
+        this->driverCalls += calls;
+    }
+};
+
 NvidiaApi::NvidiaApi()
 {
     if (!init_library()) {
@@ -17,14 +597,24 @@ NvidiaApi::NvidiaApi()
 
 NvidiaApi::~NvidiaApi()
 {
+    this->stopSampler();
+    this->stopScheduler();
+    this->pollWorkers.reset();
+
+    // The GPUs can outlive us, so they mustn't keep calling into the subscriptions
+    if (this->subscriptions) {
+        for (const auto& gpu : this->gpus) {
+            gpu->setPollListener(nullptr);
+        }
+        this->subscriptions.reset();
+    }
 }
 
 std::vector<NV_PHYSICAL_GPU_HANDLE> load_gpu_handles()
 {
     std::vector<NV_PHYSICAL_GPU_HANDLE> handles(0);
-    const int MAX_HANDLES = 64;
-    NV_PHYSICAL_GPU_HANDLE list[MAX_HANDLES];
-    memset(list, 0, sizeof(NV_PHYSICAL_GPU_HANDLE) * MAX_HANDLES);
+    NV_PHYSICAL_GPU_HANDLE list[NVIDIA_MAX_PHYSICAL_GPUS];
+    memset(list, 0, sizeof(NV_PHYSICAL_GPU_HANDLE) * NVIDIA_MAX_PHYSICAL_GPUS);
     unsigned long count = 0;
 
     if (NVIDIA_RAW_GetPhysicalGPUHandles(list, &count) == NVAPI_OK) {
@@ -75,7 +665,8 @@ bool NvidiaApi::ensureGPUsLoaded() const
             this->gpus.clear();
             for each (NV_PHYSICAL_GPU_HANDLE handle in handles)
             {
-                auto gpu = std::make_shared<NvidiaGPU>(handle);
+                // Not make_shared, which wouldn't allocate it on its own cache lines
+                auto gpu = std::shared_ptr<NvidiaGPU>(new NvidiaGPU(handle));
                 this->gpus.push_back(gpu);
             }
 
@@ -85,4 +676,221 @@ bool NvidiaApi::ensureGPUsLoaded() const
     return this->GPUloaded;
 }
 
+GpuPollResult NvidiaApi::pollAll(unsigned fields)
+{
+    GpuPollResult result{ std::chrono::steady_clock::now() };
+
+    if (this->ensureGPUsLoaded()) {
+        {
+            std::lock_guard<std::mutex> lock(this->pollWorkersMutex);
+            if (!this->pollWorkers) {
+                this->pollWorkers = std::make_unique<PollWorkers>(this->gpus);
+            }
+        }
+
+        this->pollWorkers->pollAll(fields, result.success);
+    }
+
+    return result;
+}
+
+bool NvidiaApi::startSampler(std::chrono::milliseconds interval, unsigned fields)
+{
+    if (!this->ensureGPUsLoaded()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(this->samplerMutex);
+    if (this->samplerThread.joinable()) {
+        return false;
+    }
+
+    this->samplerStopping = false;
+    this->samplerThread = std::thread(&NvidiaApi::runSampler, this, interval, fields);
+    return true;
+}
+
+void NvidiaApi::stopSampler()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->samplerMutex);
+        if (!this->samplerThread.joinable()) {
+            return;
+        }
+        this->samplerStopping = true;
+    }
+
+    this->samplerCondition.notify_all();
+    this->samplerThread.join();
+}
+
+bool NvidiaApi::isSamplerRunning() const
+{
+    std::lock_guard<std::mutex> lock(this->samplerMutex);
+    return this->samplerThread.joinable();
+}
+
+void NvidiaApi::runSampler(std::chrono::milliseconds interval, unsigned fields)
+{
+    auto nextSample = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(this->samplerMutex);
+    while (!this->samplerStopping) {
+        // Don't hold the lock while we're stuck in the driver
+        lock.unlock();
+        this->pollAll(fields);
+        lock.lock();
+
+        // If polling took longer than the interval, we skip the missed samples
+        // instead of trying to catch up.
+        nextSample += interval;
+        const auto now = std::chrono::steady_clock::now();
+        if (nextSample < now) {
+            nextSample = now;
+        }
+
+        this->samplerCondition.wait_until(lock, nextSample, [this] { return this->samplerStopping; });
+    }
+}
+
+bool NvidiaApi::enableHistory(const GpuHistoryConfig& config)
+{
+    if (!this->ensureGPUsLoaded()) {
+        return false;
+    }
+
+    for (const auto& gpu : this->gpus) {
+        gpu->enableHistory(config);
+    }
+    return true;
+}
+
+bool NvidiaApi::setColumnLog(std::shared_ptr<GpuColumnLogWriter> log)
+{
+    if (!this->ensureGPUsLoaded()) {
+        return false;
+    }
+
+    for (const auto& gpu : this->gpus) {
+        gpu->setColumnLog(log);
+    }
+    return true;
+}
+
+bool NvidiaApi::startScheduler(const std::vector<GpuFieldSchedule>& schedules)
+{
+    std::array<GpuFieldSchedule, DATASET_FIELD_COUNT> fieldSchedules;
+    for (auto i = 0u; i < DATASET_FIELD_COUNT; i++) {
+        fieldSchedules[i] = GpuFieldSchedule{
+            static_cast<GPU_DATASET_FIELD>(1u << i), dataset_fields[i].defaultMinInterval, dataset_fields[i].defaultMaxInterval
+        };
+    }
+
+    for (const auto& schedule : schedules) {
+        const auto index = datasetFieldIndex(schedule.field);
+        if (index >= DATASET_FIELD_COUNT || isStaticField(index) ||
+            schedule.minInterval.count() <= 0 || schedule.maxInterval < schedule.minInterval) {
+            return false;
+        }
+        fieldSchedules[index] = schedule;
+    }
+
+    if (!this->ensureGPUsLoaded()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(this->schedulerMutex);
+    if (this->scheduler) {
+        return false;
+    }
+
+    this->scheduler = std::make_unique<PollScheduler>(this->gpus, fieldSchedules);
+    return true;
+}
+
+void NvidiaApi::stopScheduler()
+{
+    std::unique_ptr<PollScheduler> scheduler;
+    {
+        std::lock_guard<std::mutex> lock(this->schedulerMutex);
+        scheduler = std::move(this->scheduler);
+    }
+    // Joins the scheduler thread, outside the lock so getSchedulerStats()
+    // doesn't have to wait for a poll to finish.
+    scheduler.reset();
+}
+
+bool NvidiaApi::isSchedulerRunning() const
+{
+    std::lock_guard<std::mutex> lock(this->schedulerMutex);
+    return this->scheduler != nullptr;
+}
+
+GpuSchedulerStats NvidiaApi::getSchedulerStats() const
+{
+    std::lock_guard<std::mutex> lock(this->schedulerMutex);
+    return this->scheduler ? this->scheduler->getStats() : GpuSchedulerStats{};
+}
+
+void NvidiaApi::setCallStatsEnabled(bool enabled)
+{
+    nvidia_enable_call_stats(enabled);
+}
+
+bool NvidiaApi::getCallStats(NVIDIA_FUNCTION function, NvidiaCallStats& stats)
+{
+    return nvidia_get_call_stats(function, stats);
+}
+
+void NvidiaApi::resetCallStats()
+{
+    nvidia_reset_call_stats();
+}
+
+unsigned NvidiaApi::subscribe(unsigned gpuIndex, GPU_METRIC metric, GpuMetricPredicate predicate, GpuMetricCallback callback)
+{
+    if (!this->ensureGPUsLoaded() || gpuIndex >= this->gpus.size() || metric >= GPU_METRIC_COUNT || !predicate || !callback) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(this->subscriptionsMutex);
+    if (!this->subscriptions) {
+        this->subscriptions = std::make_unique<Subscriptions>();
+
+        const auto subscriptions = this->subscriptions.get();
+        for (auto i = 0u; i < this->gpus.size(); i++) {
+            this->gpus[i]->setPollListener([subscriptions, i](const NvidiaGPUSnapshot& snapshot) {
+                subscriptions->evaluate(i, snapshot);
+            });
+        }
+    }
+
+    return this->subscriptions->add(gpuIndex, metric, std::move(predicate), std::move(callback));
+}
+
+unsigned NvidiaApi::subscribe(unsigned gpuIndex, GPU_METRIC metric, GPU_METRIC_CONDITION condition, float threshold, GpuMetricCallback callback)
+{
+    switch (condition) {
+    case GPU_METRIC_CONDITION_ABOVE:
+        return this->subscribe(gpuIndex, metric, [threshold](float value) { return value > threshold; }, std::move(callback));
+    case GPU_METRIC_CONDITION_BELOW:
+        return this->subscribe(gpuIndex, metric, [threshold](float value) { return value < threshold; }, std::move(callback));
+    default:
+        return 0;
+    }
+}
+
+bool NvidiaApi::unsubscribe(unsigned subscription)
+{
+    // The subscriptions live as long as we do once created, and removing one
+    // can wait for a callback that might itself be subscribing, so don't hold
+    // the lock for the removal.
+    Subscriptions* subscriptions;
+    {
+        std::lock_guard<std::mutex> lock(this->subscriptionsMutex);
+        subscriptions = this->subscriptions.get();
+    }
+    return subscriptions && subscriptions->remove(subscription);
+}
+
 }
\ No newline at end of file
@@ -1,12 +1,46 @@
 #pragma once
 #include <vector>
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
 
 #include "helpers.h"
+#include "GpuDatatypes.h"
 #include "NvidiaGpu.h"
+#include "nvidia_interface.h"
 
 namespace lib_gpu {
 
+#pragma warning(disable: 4251)
+struct GpuPollResult
+{
+    /// When the poll was started, shared by all the GPUs
+    std::chrono::steady_clock::time_point timestamp;
+    /// Whether the poll succeeded for each GPU, indexed like getGPU()
+    std::vector<bool> success;
+};
+
+/**
+ * How often the poll scheduler refreshes one part of a GPU's dataset.
+ *
+ * The interval starts out at `minInterval`, doubles after every poll where
+ * none of the part's metrics changed, up to `maxInterval`, and drops back to
+ * `minInterval` as soon as one does. Make them equal for a fixed rate.
+ */
+struct GpuFieldSchedule
+{
+    GPU_DATASET_FIELD field;
+    std::chrono::milliseconds minInterval;
+    std::chrono::milliseconds maxInterval;
+};
+
+typedef std::function<bool(float value)> GpuMetricPredicate;
+typedef std::function<void(unsigned gpuIndex, GPU_METRIC metric, float value)> GpuMetricCallback;
+#pragma warning(default: 4251)
+
 class NVLIB_EXPORTED NvidiaApi
 {
 public:
@@ -15,10 +49,116 @@ public:
     unsigned getGPUCount() const;
     unsigned getIndexForGPUID(unsigned long GPUID) const;
     std::shared_ptr<NvidiaGPU> getGPU(unsigned index) const;
+
+    /**
+     * Poll all GPUs concurrently and wait until they're all done.
+     *
+     * The polls are spread over a small internal pool of worker threads,
+     * so this takes about as long as the slowest GPU rather than the sum of
+     * all of them. `fields` works like for NvidiaGPU::poll.
+     */
+    GpuPollResult pollAll(unsigned fields = GPU_DATASET_FIELD_ALL);
+
+    /**
+     * Start polling every GPU in the background at the given interval.
+     *
+     * While the sampler runs, the GPU getters return the latest sample
+     * without you having to call `poll()` yourself. `fields` is a combination
+     * of GPU_DATASET_FIELD flags to refresh on each sample. Returns false if
+     * the sampler is already running or there are no GPUs.
+     */
+    bool startSampler(std::chrono::milliseconds interval, unsigned fields = GPU_DATASET_FIELD_ALL);
+    void stopSampler();
+    bool isSamplerRunning() const;
+
+    /**
+     * Start refreshing every part of every GPU's dataset in the background,
+     * each at its own adaptive interval.
+     *
+     * By default the clocks, usage and voltage are refreshed every 250ms while
+     * they're changing and back off to every 2s while they're stable, the
+     * temperature every second, and the overclocks and the power and thermal
+     * policies every 10s.
+     * The static fields aren't scheduled, see GPU_DATASET_FIELD_STATIC.
+     * `schedules` overrides the defaults for individual fields. Returns false
+     * if the scheduler is already running, there are no GPUs or a schedule
+     * is invalid.
+     */
+    bool startScheduler(const std::vector<GpuFieldSchedule>& schedules = {});
+    void stopScheduler();
+    bool isSchedulerRunning() const;
+    /**
+     * How many driver calls the running scheduler has made, and how many
+     * polling every field at the fastest scheduled interval would have made.
+     * All zeroes if the scheduler isn't running.
+     */
+    GpuSchedulerStats getSchedulerStats() const;
+
+    /**
+     * Keep a history for every GPU, see NvidiaGPU::enableHistory. The
+     * history only grows when the GPUs are polled, so combine it with the
+     * sampler or the scheduler.
+     */
+    bool enableHistory(const GpuHistoryConfig& config = GpuHistoryConfig());
+    /**
+     * Log the samples of every GPU to `log`, see NvidiaGPU::setColumnLog.
+     * Like the history, it only grows when the GPUs are polled.
+     */
+    bool setColumnLog(std::shared_ptr<GpuColumnLogWriter> log);
+
+    /**
+     * Statistics for the driver calls made through the library.
+     *
+     * Collecting them is off by default, and costs one branch per call while
+     * it's off. The statistics are shared by the whole process, and cover
+     * every call since the last reset.
+     */
+    static void setCallStatsEnabled(bool enabled);
+    static bool getCallStats(NVIDIA_FUNCTION function, NvidiaCallStats& stats);
+    static void resetCallStats();
+
+    /**
+     * Call `callback` whenever a metric of a GPU starts matching `predicate`.
+     *
+     * The predicate is evaluated once for every poll of the GPU, however it
+     * was polled, and has to be quick. The callback only runs when the
+     * predicate goes from false to true, and always on a dispatch thread
+     * shared by all subscriptions, so a slow callback doesn't hold up
+     * polling. Returns an ID for unsubscribe(), or 0 on failure.
+     */
+    unsigned subscribe(unsigned gpuIndex, GPU_METRIC metric, GpuMetricPredicate predicate, GpuMetricCallback callback);
+    /**
+     * Subscribe to a metric going above or below `threshold`.
+     */
+    unsigned subscribe(unsigned gpuIndex, GPU_METRIC metric, GPU_METRIC_CONDITION condition, float threshold, GpuMetricCallback callback);
+    /**
+     * Remove a subscription. Once this returns, its callback won't run again,
+     * unless this is called from the callback itself.
+     */
+    bool unsubscribe(unsigned subscription);
 private:
+    class PollWorkers;
+    class Subscriptions;
+    class PollScheduler;
+
 #pragma warning(disable: 4251)
     mutable std::vector<std::shared_ptr<NvidiaGPU>> gpus;
+
+    std::unique_ptr<PollWorkers> pollWorkers;
+    std::mutex pollWorkersMutex;
+
+    std::thread samplerThread;
+    mutable std::mutex samplerMutex;
+    std::condition_variable samplerCondition;
+    bool samplerStopping = false;
+
+    std::unique_ptr<PollScheduler> scheduler;
+    mutable std::mutex schedulerMutex;
+
+    std::unique_ptr<Subscriptions> subscriptions;
+    std::mutex subscriptionsMutex;
 #pragma warning(default: 4251)
+    void runSampler(std::chrono::milliseconds interval, unsigned fields);
     bool ensureGPUsLoaded() const;
     mutable bool GPUloaded = false;
 };
@@ -1,8 +1,15 @@
 #include "pch.h"
 
 #include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <sstream>
 #include <iomanip>
+#include <malloc.h>
+#include <new>
+#include <thread>
 #include "NvidiaGPU.h"
 #include "GpuDatatypes.h"
 #include "nvidia_interface.h"
@@ -21,15 +28,164 @@ struct NvidiaGPUDataset
     NVIDIA_GPU_THERMAL_SETTINGS_V2 thermalSettings;
     NVIDIA_GPU_THERMAL_POLICIES_INFO_V2 thermalPoliciesInfo;
     NVIDIA_GPU_THERMAL_POLICIES_STATUS_V2 thermalPoliciesStatus;
+
+    // The overclock ranges from pstates20, which are taken along with the
+    // static data. The current deltas are polled with the rest of pstates20,
+    // since other tools can change them.
+    GpuOverclockProfile pstateLimits;
+
+    // Values derived from the raw structs, decoded once per poll so the
+    // getters don't have to scan the structs on every call
+    struct
+    {
+        std::array<GpuClocks, NVIDIA_CLOCK_FREQUENCY_TYPE_LAST> clocks;
+        std::array<GpuClocks, NVIDIA_CLOCK_FREQUENCY_TYPE_LAST> compensatedClocks;
+        GpuUsage usage;
+        GpuOverclockProfile overclockProfile;
+        float voltage;
+        float temperature;
+        // The same values again as individual metrics, indexed by GPU_METRIC
+        std::array<float, GPU_METRIC_COUNT> metrics;
+    } decoded;
+
+    // The GPU_METRIC bits for the metrics that changed since the previous dataset
+    unsigned changedMetrics = 0;
+    // The compact version of the decoded values, filled in last
+    GpuSample sample;
+    // Every metric's value as of the last time it was reported as changed,
+    // which is what the change thresholds are measured against
+    std::array<float, GPU_METRIC_COUNT> reportedMetrics;
+
+    // Incremented for every published dataset, so readers can tell samples apart
+    unsigned long long version = 0;
+    // When each part of the dataset was last loaded, indexed by the bit of its GPU_DATASET_FIELD
+    std::array<std::chrono::steady_clock::time_point, DATASET_FIELD_COUNT> pollTimes;
+};
+
+static_assert(sizeof(GpuSample) == 64, "GpuSample should fill exactly one cache line");
+
+// What the getters on the GPU return, taken from each dataset as it's published
+struct NvidiaGPUValueRecord
+{
+    // When the latest poll was made, and when each part of the dataset was
+    // last loaded, indexed by the bit of its GPU_DATASET_FIELD
+    struct PollTimes
+    {
+        std::chrono::steady_clock::time_point latest;
+        std::array<std::chrono::steady_clock::time_point, DATASET_FIELD_COUNT> fields;
+    } pollTimes;
+    GpuSnapshot values;
+    GpuSample sample;
+};
+
+static_assert(sizeof(NvidiaGPUValueRecord) % sizeof(UINT32) == 0, "The value record is copied a word at a time");
+
+// How many times a getter retries the values while a poll is writing them
+// before it starts yielding to let the poll finish
+const unsigned VALUE_READ_SPINS = 64;
+
+void* allocateCacheAligned(size_t size)
+{
+    const auto memory = _aligned_malloc(size, CACHE_LINE_SIZE);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+/**
+ * The latest value record, guarded by a sequence lock so the getters can read
+ * it without taking a lock or a reference to the dataset. Polls are
+ * serialized, which makes the publishing poll its only writer. Every poll
+ * writes the record, so it gets cache lines to itself.
+ */
+struct alignas(CACHE_LINE_SIZE) NvidiaGPUValues
+{
+    static void* operator new(size_t size)
+    {
+        return allocateCacheAligned(size);
+    }
+    static void operator delete(void* memory)
+    {
+        _aligned_free(memory);
+    }
+
+    // Odd while a poll is writing the record, and 0 until the first one is published
+    std::atomic<unsigned> sequence{ 0 };
+    // The record is stored as atomic words, so a getter racing a poll reads
+    // torn words that it then throws away instead of racing on the memory
+    std::array<std::atomic<UINT32>, sizeof(NvidiaGPUValueRecord) / sizeof(UINT32)> words;
+
+    void publish(const NvidiaGPUValueRecord& record)
+    {
+        const auto sequence = this->sequence.load(std::memory_order_relaxed);
+        this->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        const auto data = reinterpret_cast<const char*>(&record);
+        for (auto i = 0u; i < this->words.size(); i++) {
+            UINT32 word;
+            memcpy(&word, data + i * sizeof(UINT32), sizeof(word));
+            this->words[i].store(word, std::memory_order_relaxed);
+        }
+        this->sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    /**
+     * Copy the member of the record at `offset` into `value`. Returns false
+     * and leaves `value` untouched if nothing has been published yet.
+     */
+    template <typename T>
+    bool read(size_t offset, T& value) const
+    {
+        static_assert(alignof(T) >= alignof(UINT32) && sizeof(T) % sizeof(UINT32) == 0, "Only whole words of the record can be read");
+        const auto first = offset / sizeof(UINT32);
+        const auto data = reinterpret_cast<char*>(&value);
+        for (auto attempt = 0u;; attempt++) {
+            const auto before = this->sequence.load(std::memory_order_acquire);
+            if (before == 0) {
+                return false;
+            }
+            if (!(before & 1)) {
+                for (auto i = 0u; i < sizeof(T) / sizeof(UINT32); i++) {
+                    const auto word = this->words[first + i].load(std::memory_order_relaxed);
+                    memcpy(data + i * sizeof(UINT32), &word, sizeof(word));
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (this->sequence.load(std::memory_order_relaxed) == before) {
+                    return true;
+                }
+            }
+
+            if (attempt >= VALUE_READ_SPINS) {
+                std::this_thread::yield();
+            }
+        }
+    }
+};
+
+// Datasets allocated up front for each GPU: the published one, the one being
+// polled into, and one for a reader that's still holding on to an older one
+const size_t DATASET_POOL_SIZE = 3;
+// The pool grows if readers hold on to more datasets than that, up to this
+// size. Beyond it polls allocate datasets that aren't recycled.
+const size_t MAX_DATASET_POOL_SIZE = 8;
+// The dataset field each NVIDIA_CLOCK_FREQUENCY_TYPE is loaded for
+const std::array<GPU_DATASET_FIELD, NVIDIA_CLOCK_FREQUENCY_TYPE_LAST> frequency_fields = {
+    GPU_DATASET_FIELD_CURRENT_CLOCKS,
+    GPU_DATASET_FIELD_BASE_CLOCKS,
+    GPU_DATASET_FIELD_BOOST_CLOCKS
 };
 
 #pragma region Data loading helpers
 template<typename T, typename F>
 bool loadNvidiaStruct(NV_PHYSICAL_GPU_HANDLE const& handle, T* structPtr, NV_STATUS(*loader)(NV_PHYSICAL_GPU_HANDLE, T*), F preparer)
 {
-    UINT32 version = structPtr->version;
-    memset(structPtr, 0, sizeof(T));
-    structPtr->version = version;
+    // The structs are recycled and still hold an older sample. The driver
+    // overwrites everything it reports, so rather than clearing the whole
+    // struct we only reset the header it reads: the version, which is never
+    // changed, and the word after it (flags, count or clock type).
+    static_assert(sizeof(T) >= 2 * sizeof(UINT32), "NVIDIA structs start with a version and a flags word");
+    reinterpret_cast<UINT32*>(structPtr)[1] = 0;
     preparer(structPtr);
     return (*loader)(handle, structPtr) == NVAPI_OK;
 }
@@ -89,6 +245,25 @@ std::string getNvidiaString(NV_PHYSICAL_GPU_HANDLE handle, F function)
     return std::string(name_buf);
 }
 
+std::string loadName(NV_PHYSICAL_GPU_HANDLE handle)
+{
+    return getNvidiaString(handle, NVIDIA_RAW_GetFullName);
+}
+
+std::string loadSerialNumber(NV_PHYSICAL_GPU_HANDLE handle)
+{
+    auto str = getNvidiaString(handle, NVIDIA_RAW_GpuGetSerialNumber);
+
+    auto buf = std::stringstream{};
+    buf << std::hex << std::setfill('0') << std::uppercase;
+    for (auto chr : str) {
+        auto byte = static_cast<uint8_t>(chr);
+        // have to recast to at least 16 bits, otherwise it'll print as letters
+        buf << std::setw(2) << static_cast<uint16_t>(byte);
+    }
+    return buf.str();
+}
+
 GpuOverclockSetting getPowerLimit(const NVIDIA_GPU_POWER_POLICIES_INFO& info, const NVIDIA_GPU_POWER_POLICIES_STATUS& status, unsigned pstate = 0)
 {
     // We make a slightly bold assumption that info and status have the same entries
@@ -298,87 +473,701 @@ bool makeNewThermalStatus(const GpuOverclockDefinitionMap& overclockDefinitions,
     return true;
 }
 
+// The clock and voltage deltas of the best pstate. The power and thermal
+// limits are left default.
+GpuOverclockProfile makePstateProfile(const NVIDIA_GPU_PSTATES20_V2& pstates20)
+{
+    GpuOverclockProfile profile;
+    const auto best_pstate_index = get_best_pstate_index(pstates20);
+    const auto& best_pstate = pstates20.states[best_pstate_index];
+
+    const auto fetcher = [&](auto i) {
+        return GpuOverclockSetting(best_pstate.clocks[i].freq_delta, static_cast<bool>(best_pstate.flags & 1));
+    };
+
+    auto gpu_voltage_domain = UINT_MAX;
+
+    for (auto i = 0u; i < pstates20.clock_count; i++) {
+        const auto& clock = best_pstate.clocks[i];
+        switch (clock.domain) {
+        case NVIDIA_CLOCK_SYSTEM_GPU:
+            profile.coreOverclock = fetcher(i);
+            if (clock.type == 1) {
+                gpu_voltage_domain = clock.voltage_domain;
+            }
+            break;
+        case NVIDIA_CLOCK_SYSTEM_MEMORY:
+            profile.memoryOverclock = fetcher(i);
+            break;
+        case NVIDIA_CLOCK_SYSTEM_SHADER:
+            profile.shaderOverclock = fetcher(i);
+            break;
+        }
+
+    }
+
+    if (gpu_voltage_domain < UINT_MAX) {
+        const auto& over_volt = pstates20.over_volt;
+        for (auto i = 0u; i < over_volt.voltage_count; i++) {
+            if (over_volt.voltages[i].domain == gpu_voltage_domain) {
+                profile.overvolt = GpuOverclockSetting(over_volt.voltages[i].volt_delta, static_cast<bool>(over_volt.voltages[i].flags & 1));
+            }
+        }
+    }
+
+    return profile;
+}
+
+GpuOverclockProfile makeOverclockProfile(const NvidiaGPUDataset& dataset)
+{
+    // The ranges are the cached ones, only the deltas come from the latest pstates20
+    auto profile = dataset.pstateLimits;
+    const auto current = makePstateProfile(dataset.pstates20);
+    profile.coreOverclock.currentValue = current.coreOverclock.currentValue;
+    profile.memoryOverclock.currentValue = current.memoryOverclock.currentValue;
+    profile.shaderOverclock.currentValue = current.shaderOverclock.currentValue;
+    profile.overvolt.currentValue = current.overvolt.currentValue;
+
+    profile.powerLimit = getPowerLimit(dataset.powerPoliciesInfo, dataset.powerPoliciesStatus);
+    auto thermalTuple = getThermalLimit(dataset.thermalPoliciesInfo, dataset.thermalPoliciesStatus);
+    profile.thermalLimit = std::get<0>(thermalTuple);
+    profile.thermalLimitPriority = std::get<1>(thermalTuple);
+
+    return profile;
+}
+
+GpuClocks makeClocks(const NvidiaGPUDataset& dataset, NVIDIA_CLOCK_FREQUENCY_TYPE type, const GpuOverclockProfile* compensationProfile)
+{
+    const auto& dataSource = dataset.frequencies[type];
+
+    auto fetcher = [&](NVIDIA_CLOCK_SYSTEM system) -> float {
+        if (dataSource.entries[system].present) {
+            float compensation = 0;
+            if (compensationProfile) {
+                switch (system) {
+                case NVIDIA_CLOCK_SYSTEM_GPU:
+                    compensation = compensationProfile->coreOverclock.currentValue;
+                    break;
+                case NVIDIA_CLOCK_SYSTEM_MEMORY:
+                    compensation = compensationProfile->memoryOverclock.currentValue;
+                    break;
+                case NVIDIA_CLOCK_SYSTEM_SHADER:
+                    compensation = compensationProfile->shaderOverclock.currentValue;
+                    break;
+                }
+            }
+
+            return dataSource.entries[system].freq / 1000.0f + compensation;
+        }
+        return -1;
+    };
+
+    return GpuClocks{
+        fetcher(NVIDIA_CLOCK_SYSTEM_GPU),
+        fetcher(NVIDIA_CLOCK_SYSTEM_MEMORY),
+        fetcher(NVIDIA_CLOCK_SYSTEM_SHADER)
+    };
+}
+
+float getVoltage(const NVIDIA_GPU_VOLTAGE_DOMAINS_STATUS& status)
+{
+    for (unsigned int i = 0; i < status.count; i++) {
+        if (status.entries[i].voltage_domain == 0) {
+            return status.entries[i].current_voltage / 1'000'000.0f;
+        }
+    }
+    return -1;
+}
+
+float getTemperature(const NVIDIA_GPU_THERMAL_SETTINGS_V2& settings)
+{
+    for (unsigned int i = 0; i < settings.count; i++) {
+        if (settings.sensor[i].target == NVIDIA_THERMAL_TARGET_GPU) {
+            return static_cast<float>(settings.sensor[i].current_temp);
+        }
+    }
+    return -1;
+}
+
+void decodeDataset(NvidiaGPUDataset& dataset)
+{
+    auto& decoded = dataset.decoded;
+    decoded.overclockProfile = makeOverclockProfile(dataset);
+
+    for (auto type = 0u; type < NVIDIA_CLOCK_FREQUENCY_TYPE_LAST; type++) {
+        const auto frequencyType = static_cast<NVIDIA_CLOCK_FREQUENCY_TYPE>(type);
+        decoded.clocks[type] = makeClocks(dataset, frequencyType, nullptr);
+        decoded.compensatedClocks[type] = makeClocks(dataset, frequencyType, &decoded.overclockProfile);
+    }
+
+    decoded.usage = GpuUsage{
+        getUsageForSystem(NVIDIA_DYNAMIC_PSTATES_SYSTEM_GPU, dataset.dynamicPstates),
+        getUsageForSystem(NVIDIA_DYNAMIC_PSTATES_SYSTEM_FB, dataset.dynamicPstates),
+        getUsageForSystem(NVIDIA_DYNAMIC_PSTATES_SYSTEM_VID, dataset.dynamicPstates),
+        getUsageForSystem(NVIDIA_DYNAMIC_PSTATES_SYSTEM_BUS, dataset.dynamicPstates)
+    };
+    decoded.voltage = getVoltage(dataset.voltageDomainsStatus);
+    decoded.temperature = getTemperature(dataset.thermalSettings);
+
+    auto& metrics = decoded.metrics;
+    const std::array<GPU_METRIC, NVIDIA_CLOCK_FREQUENCY_TYPE_LAST> firstClockMetrics = {
+        GPU_METRIC_CORE_CLOCK,
+        GPU_METRIC_BASE_CORE_CLOCK,
+        GPU_METRIC_BOOST_CORE_CLOCK
+    };
+    for (auto type = 0u; type < NVIDIA_CLOCK_FREQUENCY_TYPE_LAST; type++) {
+        metrics[firstClockMetrics[type]] = decoded.clocks[type].coreClock;
+        metrics[firstClockMetrics[type] + 1] = decoded.clocks[type].memoryClock;
+        metrics[firstClockMetrics[type] + 2] = decoded.clocks[type].shaderClock;
+    }
+
+    const auto& profile = decoded.overclockProfile;
+    metrics[GPU_METRIC_CORE_USAGE] = decoded.usage.coreUsage;
+    metrics[GPU_METRIC_FB_USAGE] = decoded.usage.fbUsage;
+    metrics[GPU_METRIC_VID_USAGE] = decoded.usage.vidUsage;
+    metrics[GPU_METRIC_BUS_USAGE] = decoded.usage.busUsage;
+    metrics[GPU_METRIC_TEMPERATURE] = decoded.temperature;
+    metrics[GPU_METRIC_VOLTAGE] = decoded.voltage;
+    metrics[GPU_METRIC_POWER_LIMIT] = profile.powerLimit.currentValue;
+    metrics[GPU_METRIC_THERMAL_LIMIT] = profile.thermalLimit.currentValue;
+    metrics[GPU_METRIC_THERMAL_LIMIT_PRIORITY] = profile.thermalLimitPriority.value ? 1.0f : 0.0f;
+    metrics[GPU_METRIC_CORE_OVERCLOCK] = profile.coreOverclock.currentValue;
+    metrics[GPU_METRIC_MEMORY_OVERCLOCK] = profile.memoryOverclock.currentValue;
+    metrics[GPU_METRIC_SHADER_OVERCLOCK] = profile.shaderOverclock.currentValue;
+    metrics[GPU_METRIC_OVERVOLT] = profile.overvolt.currentValue;
+}
+
+/**
+ * Compare the freshly decoded metrics against the ones last reported, and
+ * update the reported values for the metrics that changed. Without a
+ * previous dataset everything counts as changed.
+ */
+unsigned detectChanges(NvidiaGPUDataset& dataset, bool hasPrevious, const std::array<float, GPU_METRIC_COUNT>& thresholds)
+{
+    auto changed = 0u;
+    for (auto i = 0u; i < GPU_METRIC_COUNT; i++) {
+        const auto value = dataset.decoded.metrics[i];
+        const auto difference = std::fabs(value - dataset.reportedMetrics[i]);
+
+        if (!hasPrevious || (difference > 0 && difference >= thresholds[i])) {
+            changed |= 1u << i;
+            dataset.reportedMetrics[i] = value;
+        }
+    }
+    return changed;
+}
+
+GpuSample makeSample(const NvidiaGPUDataset& dataset, std::chrono::steady_clock::time_point timestamp)
+{
+    const auto& metrics = dataset.decoded.metrics;
+
+    GpuSample sample;
+    sample.timestamp = static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(timestamp.time_since_epoch()).count());
+    sample.changedMetrics = dataset.changedMetrics;
+    sample.coreClock = metrics[GPU_METRIC_CORE_CLOCK];
+    sample.memoryClock = metrics[GPU_METRIC_MEMORY_CLOCK];
+    sample.shaderClock = metrics[GPU_METRIC_SHADER_CLOCK];
+    sample.coreUsage = metrics[GPU_METRIC_CORE_USAGE];
+    sample.fbUsage = metrics[GPU_METRIC_FB_USAGE];
+    sample.vidUsage = metrics[GPU_METRIC_VID_USAGE];
+    sample.busUsage = metrics[GPU_METRIC_BUS_USAGE];
+    sample.temperature = metrics[GPU_METRIC_TEMPERATURE];
+    sample.voltage = metrics[GPU_METRIC_VOLTAGE];
+    sample.powerLimit = metrics[GPU_METRIC_POWER_LIMIT];
+    sample.thermalLimit = metrics[GPU_METRIC_THERMAL_LIMIT];
+    sample.coreOverclock = metrics[GPU_METRIC_CORE_OVERCLOCK];
+    sample.memoryOverclock = metrics[GPU_METRIC_MEMORY_OVERCLOCK];
+    return sample;
+}
+
+/**
+ * Copy the parts of the previous dataset that a poll isn't going to reload,
+ * along with the state needed to detect changes. Everything else is either
+ * loaded or decoded from scratch.
+ */
+void copyUnrefreshed(NvidiaGPUDataset& dataset, const NvidiaGPUDataset& previous, unsigned fields, bool loadStatic)
+{
+    for (auto type = 0u; type < NVIDIA_CLOCK_FREQUENCY_TYPE_LAST; type++) {
+        if (!(fields & frequency_fields[type])) {
+            dataset.frequencies[type] = previous.frequencies[type];
+        }
+    }
+
+    const auto copyIf = [](bool copy, auto& target, const auto& source) {
+        if (copy) {
+            target = source;
+        }
+    };
+    copyIf(!(fields & GPU_DATASET_FIELD_USAGE), dataset.dynamicPstates, previous.dynamicPstates);
+    copyIf(!(fields & GPU_DATASET_FIELD_PSTATES20), dataset.pstates20, previous.pstates20);
+    copyIf(!loadStatic, dataset.pstateLimits, previous.pstateLimits);
+    copyIf(!loadStatic, dataset.powerPoliciesInfo, previous.powerPoliciesInfo);
+    copyIf(!(fields & GPU_DATASET_FIELD_POWER_POLICIES), dataset.powerPoliciesStatus, previous.powerPoliciesStatus);
+    copyIf(!(fields & GPU_DATASET_FIELD_VOLTAGE), dataset.voltageDomainsStatus, previous.voltageDomainsStatus);
+    copyIf(!(fields & GPU_DATASET_FIELD_TEMPERATURE), dataset.thermalSettings, previous.thermalSettings);
+    copyIf(!loadStatic, dataset.thermalPoliciesInfo, previous.thermalPoliciesInfo);
+    copyIf(!(fields & GPU_DATASET_FIELD_THERMAL_POLICIES), dataset.thermalPoliciesStatus, previous.thermalPoliciesStatus);
+
+    dataset.reportedMetrics = previous.reportedMetrics;
+    dataset.pollTimes = previous.pollTimes;
+}
+
+/**
+ * The oldest poll time that's no more than `maxAge` before `now`. Ages
+ * reaching back past the clock's epoch accept any poll time.
+ */
+std::chrono::steady_clock::time_point pollCutoff(std::chrono::steady_clock::time_point now, std::chrono::nanoseconds maxAge)
+{
+    maxAge = (std::max)(maxAge, std::chrono::nanoseconds::zero());
+    if (maxAge >= now.time_since_epoch()) {
+        return (std::chrono::steady_clock::time_point::min)();
+    }
+    return now - std::chrono::duration_cast<std::chrono::steady_clock::duration>(maxAge);
+}
+
+void fillValues(const NvidiaGPUDataset& dataset, GpuSnapshot& values)
+{
+    const auto& decoded = dataset.decoded;
+    values.valid = true;
+    values.version = dataset.version;
+    values.voltage = decoded.voltage;
+    values.temperature = decoded.temperature;
+    values.clocks = decoded.clocks[NVIDIA_CLOCK_FREQUENCY_TYPE_CURRENT];
+    values.defaultClocks = decoded.clocks[NVIDIA_CLOCK_FREQUENCY_TYPE_BASE];
+    values.baseClocks = decoded.compensatedClocks[NVIDIA_CLOCK_FREQUENCY_TYPE_BASE];
+    values.boostClocks = decoded.compensatedClocks[NVIDIA_CLOCK_FREQUENCY_TYPE_BOOST];
+    values.usage = decoded.usage;
+    values.overclockProfile = decoded.overclockProfile;
+    values.changedMetrics = dataset.changedMetrics;
+}
+
+/**
+ * When the oldest of `fields` was last loaded. Without any fields, that's
+ * when the latest poll was made.
+ */
+std::chrono::steady_clock::time_point oldestPollTime(const NvidiaGPUValueRecord::PollTimes& pollTimes, unsigned fields)
+{
+    auto oldest = pollTimes.latest;
+    for (auto bit = 0u; bit < DATASET_FIELD_COUNT; bit++) {
+        if (fields & (1u << bit)) {
+            oldest = (std::min)(oldest, pollTimes.fields[bit]);
+        }
+    }
+    return oldest;
+}
+
+bool isFresh(const NvidiaGPUValues& values, unsigned fields, std::chrono::steady_clock::time_point cutoff)
+{
+    NvidiaGPUValueRecord::PollTimes pollTimes;
+    return values.read(offsetof(NvidiaGPUValueRecord, pollTimes), pollTimes) && oldestPollTime(pollTimes, fields) >= cutoff;
+}
+
+template <typename T>
+std::unique_ptr<T> readValue(const NvidiaGPUValues& values, size_t offset)
+{
+    auto value = std::make_unique<T>();
+    return values.read(offset, *value) ? std::move(value) : nullptr;
+}
+
 #pragma endregion
 
 
-NvidiaGPU::NvidiaGPU(const NV_PHYSICAL_GPU_HANDLE handle) : handle(handle), GPUID(getGPUIDFromHandle(handle))
+NvidiaGPUSnapshot::NvidiaGPUSnapshot(std::shared_ptr<const NvidiaGPUDataset> dataset) : dataset(std::move(dataset))
+{
+}
+
+bool NvidiaGPUSnapshot::isValid() const
+{
+    return this->dataset != nullptr;
+}
+
+unsigned long long NvidiaGPUSnapshot::getVersion() const
+{
+    return this->dataset ? this->dataset->version : 0;
+}
+
+std::chrono::steady_clock::time_point NvidiaGPUSnapshot::getPollTime(unsigned fields) const
+{
+    if (!this->dataset) {
+        return std::chrono::steady_clock::time_point();
+    }
+
+    // Starting from the latest poll, which is all there is to go by without any fields
+    auto oldest = std::chrono::steady_clock::time_point(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(this->dataset->sample.timestamp)));
+    for (auto bit = 0u; bit < DATASET_FIELD_COUNT; bit++) {
+        if (fields & (1u << bit)) {
+            oldest = (std::min)(oldest, this->dataset->pollTimes[bit]);
+        }
+    }
+    return oldest;
+}
+
+float NvidiaGPUSnapshot::getVoltage() const
+{
+    return this->dataset ? this->dataset->decoded.voltage : -1;
+}
+
+float NvidiaGPUSnapshot::getTemperature() const
+{
+    return this->dataset ? this->dataset->decoded.temperature : -1;
+}
+
+bool NvidiaGPUSnapshot::getClocks(GpuClocks& clocks) const
+{
+    return this->getDecoded(clocks, [](const auto& decoded) { return decoded.clocks[NVIDIA_CLOCK_FREQUENCY_TYPE_CURRENT]; });
+}
+
+bool NvidiaGPUSnapshot::getDefaultClocks(GpuClocks& clocks) const
+{
+    return this->getDecoded(clocks, [](const auto& decoded) { return decoded.clocks[NVIDIA_CLOCK_FREQUENCY_TYPE_BASE]; });
+}
+
+bool NvidiaGPUSnapshot::getBaseClocks(GpuClocks& clocks) const
+{
+    return this->getDecoded(clocks, [](const auto& decoded) { return decoded.compensatedClocks[NVIDIA_CLOCK_FREQUENCY_TYPE_BASE]; });
+}
+
+bool NvidiaGPUSnapshot::getBoostClocks(GpuClocks& clocks) const
+{
+    return this->getDecoded(clocks, [](const auto& decoded) { return decoded.compensatedClocks[NVIDIA_CLOCK_FREQUENCY_TYPE_BOOST]; });
+}
+
+bool NvidiaGPUSnapshot::getOverclockProfile(GpuOverclockProfile& profile) const
+{
+    return this->getDecoded(profile, [](const auto& decoded) { return decoded.overclockProfile; });
+}
+
+bool NvidiaGPUSnapshot::getUsage(GpuUsage& usage) const
 {
+    return this->getDecoded(usage, [](const auto& decoded) { return decoded.usage; });
+}
+
+bool NvidiaGPUSnapshot::getSample(GpuSample& sample) const
+{
+    if (!this->dataset) {
+        return false;
+    }
+
+    sample = this->dataset->sample;
+    return true;
+}
+
+bool NvidiaGPUSnapshot::getValues(GpuSnapshot& values) const
+{
+    if (!this->dataset) {
+        return false;
+    }
+
+    fillValues(*this->dataset, values);
+    return true;
+}
+
+unsigned NvidiaGPUSnapshot::getChangedMetrics() const
+{
+    return this->dataset ? this->dataset->changedMetrics : 0;
+}
+
+float NvidiaGPUSnapshot::getMetric(GPU_METRIC metric) const
+{
+    return (this->dataset && metric < GPU_METRIC_COUNT) ? this->dataset->decoded.metrics[metric] : -1;
+}
+
+std::unique_ptr<GpuClocks> NvidiaGPUSnapshot::getClocks() const
+{
+    return this->getDecoded<GpuClocks>(&NvidiaGPUSnapshot::getClocks);
+}
+
+std::unique_ptr<GpuClocks> NvidiaGPUSnapshot::getDefaultClocks() const
+{
+    return this->getDecoded<GpuClocks>(&NvidiaGPUSnapshot::getDefaultClocks);
+}
+
+std::unique_ptr<GpuClocks> NvidiaGPUSnapshot::getBaseClocks() const
+{
+    return this->getDecoded<GpuClocks>(&NvidiaGPUSnapshot::getBaseClocks);
+}
+
+std::unique_ptr<GpuClocks> NvidiaGPUSnapshot::getBoostClocks() const
+{
+    return this->getDecoded<GpuClocks>(&NvidiaGPUSnapshot::getBoostClocks);
+}
+
+std::unique_ptr<GpuOverclockProfile> NvidiaGPUSnapshot::getOverclockProfile() const
+{
+    return this->getDecoded<GpuOverclockProfile>(&NvidiaGPUSnapshot::getOverclockProfile);
+}
+
+std::unique_ptr<GpuUsage> NvidiaGPUSnapshot::getUsage() const
+{
+    return this->getDecoded<GpuUsage>(&NvidiaGPUSnapshot::getUsage);
+}
+
+template <typename T, typename F>
+bool NvidiaGPUSnapshot::getDecoded(T& value, F fetcher) const
+{
+    if (this->dataset) {
+        value = fetcher(this->dataset->decoded);
+        return true;
+    }
+    return false;
+}
+
+template <typename T>
+std::unique_ptr<T> NvidiaGPUSnapshot::getDecoded(bool (NvidiaGPUSnapshot::*getter)(T&) const) const
+{
+    auto value = std::make_unique<T>();
+    return (this->*getter)(*value) ? std::move(value) : nullptr;
+}
+
+
+NvidiaGPU::NvidiaGPU(const NV_PHYSICAL_GPU_HANDLE handle)
+    : handle(handle), GPUID(getGPUIDFromHandle(handle)), name(loadName(handle)), serialNumber(loadSerialNumber(handle)),
+    values(std::make_unique<NvidiaGPUValues>())
+{
+    this->changeThresholds.fill(0);
+
+    for (auto i = 0u; i < DATASET_POOL_SIZE; i++) {
+        this->datasetPool.push_back(std::make_shared<NvidiaGPUDataset>());
+    }
 }
 
 NvidiaGPU::~NvidiaGPU()
 {
 }
 
+void* NvidiaGPU::operator new(size_t size)
+{
+    return allocateCacheAligned(size);
+}
+
+void NvidiaGPU::operator delete(void* memory)
+{
+    _aligned_free(memory);
+}
+
 bool NvidiaGPU::poll()
 {
-    auto newDataset = std::make_unique<NvidiaGPUDataset>();
+    return this->poll(std::chrono::nanoseconds::zero());
+}
+
+bool NvidiaGPU::poll(std::chrono::nanoseconds maxAge, unsigned fields)
+{
+    const auto cutoff = pollCutoff(std::chrono::steady_clock::now(), maxAge);
+    // Fresh data doesn't need the lock at all
+    if (isFresh(*this->values, fields, cutoff)) {
+        return true;
+    }
+
+    std::unique_lock<std::mutex> lock(this->flightMutex);
+    while (this->flight) {
+        // A poll that covers what we asked for settles it either way. Any
+        // other poll might still have refreshed enough, or we start our own
+        // once it's landed.
+        const auto flight = this->flight;
+        const auto joined = flight->start >= cutoff && (flight->fields & fields) == fields;
+        this->flightDone.wait(lock, [&] { return flight->done; });
+        if (joined) {
+            return flight->success;
+        }
+        if (isFresh(*this->values, fields, cutoff)) {
+            return true;
+        }
+    }
+
+    const auto flight = std::make_shared<PollFlight>();
+    flight->start = std::chrono::steady_clock::now();
+    flight->fields = fields;
+    this->flight = flight;
+    lock.unlock();
+
+    const auto land = [&](bool success) {
+        std::lock_guard<std::mutex> landLock(this->flightMutex);
+        flight->success = success;
+        flight->done = true;
+        this->flight = nullptr;
+        this->flightDone.notify_all();
+        return success;
+    };
+    try {
+        return land(this->poll(fields));
+    }
+    catch (...) {
+        // Nobody waiting for us can be left hanging
+        land(false);
+        throw;
+    }
+}
+
+bool NvidiaGPU::poll(unsigned fields)
+{
+    auto driverCalls = 0u;
+    return this->poll(fields, driverCalls);
+}
+
+bool NvidiaGPU::poll(unsigned fields, unsigned& driverCalls)
+{
+    // Pollers are serialized so that partial polls don't lose each others'
+    // updates. Readers never take this lock, they read the values or load the
+    // dataset that was last published.
+    std::lock_guard<std::mutex> lock(this->pollMutex);
+    const auto timestamp = std::chrono::steady_clock::now();
+    const auto oldDataset = this->loadDataset();
+
+    // The parts we don't refresh are carried over from the previous dataset,
+    // so without one we have to load everything. The static parts are only
+    // loaded when they're stale, whether they were asked for or not, and
+    // then pstates20 has to come along for the overclock ranges.
+    if (!oldDataset) {
+        fields = GPU_DATASET_FIELD_ALL;
+    }
+    const auto loadStatic = this->staticDataStale.exchange(false) || !oldDataset;
+    fields = loadStatic ? (fields | GPU_DATASET_FIELD_STATIC | GPU_DATASET_FIELD_PSTATES20) : (fields & ~GPU_DATASET_FIELD_STATIC);
+
+    auto newDataset = this->acquireDataset();
+    if (oldDataset) {
+        copyUnrefreshed(*newDataset, *oldDataset, fields, loadStatic);
+    }
+
+    const auto load = [&driverCalls](bool requested, auto loader) {
+        if (!requested) {
+            return true;
+        }
+        driverCalls++;
+        return loader();
+    };
+    const auto loadIfRequested = [fields, &load](GPU_DATASET_FIELD field, auto loader) {
+        return load((fields & field) != 0, loader);
+    };
+    const auto loadIfStatic = [loadStatic, &load](auto loader) {
+        return load(loadStatic, loader);
+    };
+
     bool frequencySuccess = true;
 
     unsigned int frequencyType = 0;
     for (auto& frequencyStruct : newDataset->frequencies) {
-        if (!loadCLOCK_FREQUENCIES(this->handle, &frequencyStruct, static_cast<NVIDIA_CLOCK_FREQUENCY_TYPE>(frequencyType++))) {
+        const auto type = static_cast<NVIDIA_CLOCK_FREQUENCY_TYPE>(frequencyType++);
+        if (!loadIfRequested(frequency_fields[type], [&] { return loadCLOCK_FREQUENCIES(this->handle, &frequencyStruct, type); })) {
             frequencySuccess = false;
         }
     }
 
     if (frequencySuccess &&
-        loadDYNAMIC_PSTATES(this->handle, &newDataset->dynamicPstates) &&
-        loadGPU_PSTATES20_V2(this->handle, &newDataset->pstates20) &&
-        loadGPU_POWER_POLICIES_INFO(this->handle, &newDataset->powerPoliciesInfo) &&
-        loadGPU_POWER_POLICIES_STATUS(this->handle, &newDataset->powerPoliciesStatus) &&
-        loadGPU_VOLTAGE_DOMAINS_STATUS(this->handle, &newDataset->voltageDomainsStatus) &&
-        loadGPU_THERMAL_SETTINGS_V2(this->handle, &newDataset->thermalSettings) &&
-        loadGPU_THERMAL_POLICIES_INFO_V2(this->handle, &newDataset->thermalPoliciesInfo) &&
-        loadGPU_THERMAL_POLICIES_STATUS_V2(this->handle, &newDataset->thermalPoliciesStatus)
+        loadIfRequested(GPU_DATASET_FIELD_USAGE, [&] { return loadDYNAMIC_PSTATES(this->handle, &newDataset->dynamicPstates); }) &&
+        loadIfRequested(GPU_DATASET_FIELD_PSTATES20, [&] { return loadGPU_PSTATES20_V2(this->handle, &newDataset->pstates20); }) &&
+        loadIfStatic([&] { return loadGPU_POWER_POLICIES_INFO(this->handle, &newDataset->powerPoliciesInfo); }) &&
+        loadIfRequested(GPU_DATASET_FIELD_POWER_POLICIES, [&] { return loadGPU_POWER_POLICIES_STATUS(this->handle, &newDataset->powerPoliciesStatus); }) &&
+        loadIfRequested(GPU_DATASET_FIELD_VOLTAGE, [&] { return loadGPU_VOLTAGE_DOMAINS_STATUS(this->handle, &newDataset->voltageDomainsStatus); }) &&
+        loadIfRequested(GPU_DATASET_FIELD_TEMPERATURE, [&] { return loadGPU_THERMAL_SETTINGS_V2(this->handle, &newDataset->thermalSettings); }) &&
+        loadIfStatic([&] { return loadGPU_THERMAL_POLICIES_INFO_V2(this->handle, &newDataset->thermalPoliciesInfo); }) &&
+        loadIfRequested(GPU_DATASET_FIELD_THERMAL_POLICIES, [&] { return loadGPU_THERMAL_POLICIES_STATUS_V2(this->handle, &newDataset->thermalPoliciesStatus); })
         ) {
-        this->dataset = std::move(newDataset);
+        if (loadStatic) {
+            newDataset->pstateLimits = makePstateProfile(newDataset->pstates20);
+        }
+        decodeDataset(*newDataset);
+        newDataset->changedMetrics = detectChanges(*newDataset, oldDataset != nullptr, this->changeThresholds);
+        newDataset->version = oldDataset ? oldDataset->version + 1 : 1;
+        // The static parts only change when they're invalidated, so every
+        // poll vouches for them
+        const auto refreshed = fields | GPU_DATASET_FIELD_STATIC;
+        for (auto bit = 0u; bit < DATASET_FIELD_COUNT; bit++) {
+            if (refreshed & (1u << bit)) {
+                newDataset->pollTimes[bit] = timestamp;
+            }
+        }
+        newDataset->sample = makeSample(*newDataset, timestamp);
+
+        std::shared_ptr<const NvidiaGPUDataset> published(std::move(newDataset));
+        std::atomic_store(&this->dataset, published);
+        this->publishValues(*published);
+
+        // Polls are serialized, so we're the history's only writer
+        const auto history = std::atomic_load(&this->history);
+        if (history) {
+            history->record(published->sample);
+        }
+        const auto columnLog = std::atomic_load(&this->columnLog);
+        if (columnLog) {
+            columnLog->append(this->GPUID, published->sample);
+        }
+        if (this->pollListener) {
+            this->pollListener(NvidiaGPUSnapshot(std::move(published)));
+        }
         return true;
     }
 
+    // A failing call might mean the driver was reset, in which case the
+    // static data can't be trusted anymore either.
+    this->staticDataStale = true;
     return false;
 }
 
-std::string NvidiaGPU::getName() const
+void NvidiaGPU::publishValues(const NvidiaGPUDataset& dataset)
 {
-    return getNvidiaString(handle, NVIDIA_RAW_GetFullName);
+    NvidiaGPUValueRecord record;
+    record.pollTimes.latest = std::chrono::steady_clock::time_point(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(dataset.sample.timestamp)));
+    record.pollTimes.fields = dataset.pollTimes;
+    fillValues(dataset, record.values);
+    record.values.GPUID = this->GPUID;
+    record.sample = dataset.sample;
+    this->values->publish(record);
 }
 
-std::string NvidiaGPU::getSerialNumber() const
+std::shared_ptr<NvidiaGPUDataset> NvidiaGPU::acquireDataset()
 {
-    auto str = getNvidiaString(handle, NVIDIA_RAW_GpuGetSerialNumber);
+    // A dataset only the pool refers to isn't published or held by any
+    // reader. Nobody else can get hold of it again either, since only the
+    // published dataset is handed out and we're the only poller.
+    for (const auto& dataset : this->datasetPool) {
+        if (dataset.use_count() == 1) {
+            return dataset;
+        }
+    }
 
-    auto buf = std::stringstream{};
-    buf << std::hex << std::setfill('0') << std::uppercase;
-    for (auto chr : str) {
-        auto byte = static_cast<uint8_t>(chr);
-        // have to recast to at least 16 bits, otherwise it'll print as letters
-        buf << std::setw(2) << static_cast<uint16_t>(byte);
+    auto dataset = std::make_shared<NvidiaGPUDataset>();
+    if (this->datasetPool.size() < MAX_DATASET_POOL_SIZE) {
+        this->datasetPool.push_back(dataset);
     }
-    return buf.str();
+    return dataset;
 }
 
-float NvidiaGPU::getVoltage() const
+void NvidiaGPU::enableHistory(const GpuHistoryConfig& config)
 {
-    if (this->dataset) {
-        for (unsigned int i = 0; i < this->dataset->voltageDomainsStatus.count; i++) {
-            if (this->dataset->voltageDomainsStatus.entries[i].voltage_domain == 0) {
-                return this->dataset->voltageDomainsStatus.entries[i].current_voltage / 1'000'000.0f;
-            }
-        }
-    }
-    return -1;
+    std::atomic_store(&this->history, std::make_shared<GpuHistory>(config));
 }
 
-float NvidiaGPU::getTemperature() const
+void NvidiaGPU::disableHistory()
 {
-    if (this->dataset) {
-        for (unsigned int i = 0; i < this->dataset->thermalSettings.count; i++) {
-            if (this->dataset->thermalSettings.sensor[i].target == NVIDIA_THERMAL_TARGET_GPU) {
-                return static_cast<float>(this->dataset->thermalSettings.sensor[i].current_temp);
-            }
-        }
-    }
-    return -1;
+    std::atomic_store(&this->history, std::shared_ptr<GpuHistory>());
+}
+
+std::shared_ptr<const GpuHistory> NvidiaGPU::getHistory() const
+{
+    return std::atomic_load(&this->history);
+}
+
+void NvidiaGPU::setColumnLog(std::shared_ptr<GpuColumnLogWriter> log)
+{
+    std::atomic_store(&this->columnLog, std::move(log));
+}
+
+void NvidiaGPU::invalidateStaticData()
+{
+    this->staticDataStale = true;
+}
+
+std::string NvidiaGPU::getName() const
+{
+    // Only go back to the driver if it failed when the GPU was created
+    return this->name.empty() ? loadName(this->handle) : this->name;
+}
+
+std::string NvidiaGPU::getSerialNumber() const
+{
+    return this->serialNumber.empty() ? loadSerialNumber(this->handle) : this->serialNumber;
 }
 
 unsigned long NvidiaGPU::getGPUID() const
@@ -386,130 +1175,155 @@ unsigned long NvidiaGPU::getGPUID() const
     return this->GPUID;
 }
 
-std::unique_ptr<GpuClocks> NvidiaGPU::getClocks(NVIDIA_CLOCK_FREQUENCY_TYPE type, bool compensateForOverclock) const
+unsigned long long NvidiaGPU::getSampleVersion() const
 {
-    const auto& dataSource = this->dataset->frequencies[type];
-    auto overclockProfile = this->getOverclockProfile();
+    unsigned long long version = 0;
+    this->values->read(offsetof(NvidiaGPUValueRecord, values.version), version);
+    return version;
+}
 
-    auto fetcher = [&](NVIDIA_CLOCK_SYSTEM system) -> float {
-        if (dataSource.entries[system].present) {
-            float compensation = 0;
-            if (compensateForOverclock) {
-                switch (system) {
-                case NVIDIA_CLOCK_SYSTEM_GPU:
-                    compensation = overclockProfile->coreOverclock.currentValue;
-                    break;
-                case NVIDIA_CLOCK_SYSTEM_MEMORY:
-                    compensation = overclockProfile->memoryOverclock.currentValue;
-                    break;
-                case NVIDIA_CLOCK_SYSTEM_SHADER:
-                    compensation = overclockProfile->shaderOverclock.currentValue;
-                    break;
-                }
-            }
+std::chrono::steady_clock::time_point NvidiaGPU::getPollTime(unsigned fields) const
+{
+    NvidiaGPUValueRecord::PollTimes pollTimes;
+    if (!this->values->read(offsetof(NvidiaGPUValueRecord, pollTimes), pollTimes)) {
+        return std::chrono::steady_clock::time_point();
+    }
+    return oldestPollTime(pollTimes, fields);
+}
 
-            return dataSource.entries[system].freq / 1000.0f + compensation;
-        }
-        return -1;
-    };
+NvidiaGPUSnapshot NvidiaGPU::getSnapshot() const
+{
+    return NvidiaGPUSnapshot(this->loadDataset());
+}
 
-    return std::unique_ptr<GpuClocks>{new GpuClocks{
-        fetcher(NVIDIA_CLOCK_SYSTEM_GPU),
-        fetcher(NVIDIA_CLOCK_SYSTEM_MEMORY),
-        fetcher(NVIDIA_CLOCK_SYSTEM_SHADER)
-    }};
+unsigned NvidiaGPU::getChangedMetrics() const
+{
+    unsigned changedMetrics = 0;
+    this->values->read(offsetof(NvidiaGPUValueRecord, values.changedMetrics), changedMetrics);
+    return changedMetrics;
+}
+
+bool NvidiaGPU::setChangeThreshold(GPU_METRIC metric, float threshold)
+{
+    if (metric >= GPU_METRIC_COUNT || !(threshold >= 0)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(this->pollMutex);
+    this->changeThresholds[metric] = threshold;
+    return true;
+}
+
+void NvidiaGPU::setPollListener(GpuPollListener listener)
+{
+    // Taking the poll lock also waits out a listener that's currently running
+    std::lock_guard<std::mutex> lock(this->pollMutex);
+    this->pollListener = std::move(listener);
+}
+
+float NvidiaGPU::getVoltage() const
+{
+    float voltage = -1;
+    this->values->read(offsetof(NvidiaGPUValueRecord, values.voltage), voltage);
+    return voltage;
+}
+
+float NvidiaGPU::getTemperature() const
+{
+    float temperature = -1;
+    this->values->read(offsetof(NvidiaGPUValueRecord, values.temperature), temperature);
+    return temperature;
 }
 
 std::unique_ptr<GpuClocks> NvidiaGPU::getClocks() const
 {
-    return std::move(this->getClocks(NVIDIA_CLOCK_FREQUENCY_TYPE_CURRENT));
+    return readValue<GpuClocks>(*this->values, offsetof(NvidiaGPUValueRecord, values.clocks));
 }
 
 std::unique_ptr<GpuClocks> NvidiaGPU::getDefaultClocks() const
 {
-    return this->getClocks(NVIDIA_CLOCK_FREQUENCY_TYPE_BASE);
+    return readValue<GpuClocks>(*this->values, offsetof(NvidiaGPUValueRecord, values.defaultClocks));
 }
 
 std::unique_ptr<GpuClocks> NvidiaGPU::getBaseClocks() const
 {
-    return this->getClocks(NVIDIA_CLOCK_FREQUENCY_TYPE_BASE, true);
+    return readValue<GpuClocks>(*this->values, offsetof(NvidiaGPUValueRecord, values.baseClocks));
 }
 
 std::unique_ptr<GpuClocks> NvidiaGPU::getBoostClocks() const
 {
-    return this->getClocks(NVIDIA_CLOCK_FREQUENCY_TYPE_BOOST, true);
+    return readValue<GpuClocks>(*this->values, offsetof(NvidiaGPUValueRecord, values.boostClocks));
 }
 
 std::unique_ptr<GpuOverclockProfile> NvidiaGPU::getOverclockProfile() const
 {
-    auto profile = std::make_unique<GpuOverclockProfile>();
-    const auto best_pstate_index = get_best_pstate_index(this->dataset->pstates20);
-    const auto& best_pstate = this->dataset->pstates20.states[best_pstate_index];
+    return readValue<GpuOverclockProfile>(*this->values, offsetof(NvidiaGPUValueRecord, values.overclockProfile));
+}
 
-    const auto fetcher = [&](auto i) {
-        return GpuOverclockSetting(best_pstate.clocks[i].freq_delta, static_cast<bool>(best_pstate.flags & 1));
-    };
+std::unique_ptr<GpuUsage> NvidiaGPU::getUsage() const
+{
+    return readValue<GpuUsage>(*this->values, offsetof(NvidiaGPUValueRecord, values.usage));
+}
 
-    auto gpu_voltage_domain = UINT_MAX;
+bool NvidiaGPU::getClocks(GpuClocks& clocks) const
+{
+    return this->values->read(offsetof(NvidiaGPUValueRecord, values.clocks), clocks);
+}
 
-    for (auto i = 0u; i < this->dataset->pstates20.clock_count; i++) {
-        const auto& clock = best_pstate.clocks[i];
-        switch (clock.domain) {
-        case NVIDIA_CLOCK_SYSTEM_GPU:
-            profile->coreOverclock = fetcher(i);
-            if (clock.type == 1) {
-                gpu_voltage_domain = clock.voltage_domain;
-            }
-            break;
-        case NVIDIA_CLOCK_SYSTEM_MEMORY:
-            profile->memoryOverclock = fetcher(i);
-            break;
-        case NVIDIA_CLOCK_SYSTEM_SHADER:
-            profile->shaderOverclock = fetcher(i);
-            break;
-        }
+bool NvidiaGPU::getDefaultClocks(GpuClocks& clocks) const
+{
+    return this->values->read(offsetof(NvidiaGPUValueRecord, values.defaultClocks), clocks);
+}
 
-    }
+bool NvidiaGPU::getBaseClocks(GpuClocks& clocks) const
+{
+    return this->values->read(offsetof(NvidiaGPUValueRecord, values.baseClocks), clocks);
+}
 
-    if (gpu_voltage_domain < UINT_MAX) {
-        const auto& over_volt = this->dataset->pstates20.over_volt;
-        for (auto i = 0u; i < over_volt.voltage_count; i++) {
-            if (over_volt.voltages[i].domain == gpu_voltage_domain) {
-                profile->overvolt = GpuOverclockSetting(over_volt.voltages[i].volt_delta, static_cast<bool>(over_volt.voltages[i].flags & 1));
-            }
-        }
-    }
+bool NvidiaGPU::getBoostClocks(GpuClocks& clocks) const
+{
+    return this->values->read(offsetof(NvidiaGPUValueRecord, values.boostClocks), clocks);
+}
 
-    profile->powerLimit = getPowerLimit(this->dataset->powerPoliciesInfo, this->dataset->powerPoliciesStatus);
-    auto thermalTuple = getThermalLimit(this->dataset->thermalPoliciesInfo, this->dataset->thermalPoliciesStatus);
-    profile->thermalLimit = std::get<0>(thermalTuple);
-    profile->thermalLimitPriority = std::get<1>(thermalTuple);
+bool NvidiaGPU::getOverclockProfile(GpuOverclockProfile& profile) const
+{
+    return this->values->read(offsetof(NvidiaGPUValueRecord, values.overclockProfile), profile);
+}
 
-    return profile;
+bool NvidiaGPU::getUsage(GpuUsage& usage) const
+{
+    return this->values->read(offsetof(NvidiaGPUValueRecord, values.usage), usage);
 }
 
-std::unique_ptr<GpuUsage> NvidiaGPU::getUsage() const
+bool NvidiaGPU::getSample(GpuSample& sample) const
 {
-    if (this->dataset) {
-        return std::unique_ptr<GpuUsage>{new GpuUsage{
-            getUsageForSystem(NVIDIA_DYNAMIC_PSTATES_SYSTEM_GPU, this->dataset->dynamicPstates),
-            getUsageForSystem(NVIDIA_DYNAMIC_PSTATES_SYSTEM_FB, this->dataset->dynamicPstates),
-            getUsageForSystem(NVIDIA_DYNAMIC_PSTATES_SYSTEM_VID, this->dataset->dynamicPstates),
-            getUsageForSystem(NVIDIA_DYNAMIC_PSTATES_SYSTEM_BUS, this->dataset->dynamicPstates)
-        }};
-    }
-    return nullptr;
+    return this->values->read(offsetof(NvidiaGPUValueRecord, sample), sample);
+}
+
+bool NvidiaGPU::getValues(GpuSnapshot& values) const
+{
+    return this->values->read(offsetof(NvidiaGPUValueRecord, values), values);
+}
+
+std::shared_ptr<const NvidiaGPUDataset> NvidiaGPU::loadDataset() const
+{
+    return std::atomic_load(&this->dataset);
 }
 
 bool NvidiaGPU::setOverclock(const GpuOverclockDefinitionMap& overclockDefinitions, const bool prioritizeThermalLimit)
 {
-    if (!this->dataset) {
+    // Overclocks are based on the current profile, so two of them running
+    // at the same time could each undo parts of the other.
+    std::lock_guard<std::mutex> lock(this->overclockMutex);
+
+    if (!this->loadDataset()) {
         if (!this->poll()) {
             return false;
         }
     }
 
-    const auto old_profile = this->getOverclockProfile();
+    const auto dataset = this->loadDataset();
+    const auto& old_profile = dataset->decoded.overclockProfile;
 
     NVIDIA_GPU_PSTATES20_V2 pstates;
     REINIT_NVIDIA_STRUCT(pstates);
@@ -522,7 +1336,7 @@ bool NvidiaGPU::setOverclock(const GpuOverclockDefinitionMap& overclockDefinitio
     auto overclockSuccess = true;
 
     auto loadWithMethod = [&](auto& dataStruct, auto method) {
-        return method(overclockDefinitions, *old_profile, *this->dataset, dataStruct);
+        return method(overclockDefinitions, old_profile, *dataset, dataStruct);
     };
 
     auto overclockIfValid = [&](auto& dataStruct, bool valid, auto rawMethod) {
@@ -533,12 +1347,14 @@ bool NvidiaGPU::setOverclock(const GpuOverclockDefinitionMap& overclockDefinitio
     };
 
     if (loadWithMethod(pstates, makeNewPstates20) && loadWithMethod(powerStatus, makeNewPowerStatus) &&
-        makeNewThermalStatus(overclockDefinitions, *old_profile, thermalStatus, prioritizeThermalLimit)) {
+        makeNewThermalStatus(overclockDefinitions, old_profile, thermalStatus, prioritizeThermalLimit)) {
         overclockIfValid(pstates, (pstates.clock_count > 0 || pstates.over_volt.voltage_count > 0), NVIDIA_RAW_SetPstates20);
         overclockIfValid(powerStatus, powerStatus.count > 0, NVIDIA_RAW_GpuClientPowerPoliciesSetStatus);
         overclockIfValid(thermalStatus, thermalStatus.count > 0, NVIDIA_RAW_GpuClientThermalPoliciesSetStatus);
 
         if (overclockAttempted) {
+            // The overclock ranges can depend on the limits we just changed
+            this->invalidateStaticData();
             this->poll();
         }
 
@@ -3,21 +3,115 @@
 #include "pch.h"
 
 #include <map>
+#include <vector>
+#include <array>
+#include <functional>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include "helpers.h"
 #include "nvidia_interface_datatypes.h"
+#include "GpuDatatypes.h"
+#include "GpuHistory.h"
+#include "GpuColumnLog.h"
 
 namespace lib_gpu {
 
-enum GPU_OVERCLOCK_SETTING_AREA;
 struct NvidiaGPUDataset;
-struct GpuClocks;
-struct GpuOverclockProfile;
-struct GpuUsage;
+struct NvidiaGPUValues;
 
 
+// The number of GPU_DATASET_FIELD flags, each of which has its own poll time
+// and schedule
+const unsigned DATASET_FIELD_COUNT = 9;
+static_assert(GPU_DATASET_FIELD_ALL == (1 << DATASET_FIELD_COUNT) - 1, "Every dataset field needs to be counted");
+// What polls write is kept on cache lines of its own, so polling one GPU
+// doesn't slow down readers of another one
+const size_t CACHE_LINE_SIZE = 64;
+
 #pragma warning(disable: 4251)
 typedef std::map<GPU_OVERCLOCK_SETTING_AREA, float> GpuOverclockDefinitionMap;
+class NvidiaGPUSnapshot;
+typedef std::function<void(const NvidiaGPUSnapshot& snapshot)> GpuPollListener;
+
+/**
+ * A consistent view of the data from a single poll of a GPU.
+ *
+ * The snapshot keeps its data alive and unchanged for as long as you hold on
+ * to it, regardless of any polls happening on other threads, so use it when
+ * several values have to come from the same sample.
+ */
+class NVLIB_EXPORTED NvidiaGPUSnapshot
+{
+public:
+    /**
+     * Whether the snapshot contains data, which it doesn't if the GPU has
+     * never been successfully polled.
+     */
+    bool isValid() const;
+    /**
+     * Increases with every successful poll of the GPU, 0 for invalid snapshots.
+     */
+    unsigned long long getVersion() const;
+    /**
+     * When the oldest of the parts of the dataset given by `fields`, a
+     * combination of GPU_DATASET_FIELD flags, was loaded from the driver. The
+     * static parts count as loaded by every poll, since they only change when
+     * they're invalidated. The clock's epoch for invalid snapshots.
+     */
+    std::chrono::steady_clock::time_point getPollTime(unsigned fields = GPU_DATASET_FIELD_ALL) const;
+
+    float getVoltage() const;
+    float getTemperature() const;
+
+    std::unique_ptr<GpuClocks> getClocks() const;
+    std::unique_ptr<GpuClocks> getDefaultClocks() const;
+    std::unique_ptr<GpuClocks> getBaseClocks() const;
+    std::unique_ptr<GpuClocks> getBoostClocks() const;
+    std::unique_ptr<GpuOverclockProfile> getOverclockProfile() const;
+    std::unique_ptr<GpuUsage> getUsage() const;
+
+    // These versions never allocate. They return false and leave the output
+    // untouched if the snapshot is invalid.
+    bool getClocks(GpuClocks& clocks) const;
+    bool getDefaultClocks(GpuClocks& clocks) const;
+    bool getBaseClocks(GpuClocks& clocks) const;
+    bool getBoostClocks(GpuClocks& clocks) const;
+    bool getOverclockProfile(GpuOverclockProfile& profile) const;
+    bool getUsage(GpuUsage& usage) const;
+    /**
+     * The compact record of the poll, decoded along with everything else.
+     */
+    bool getSample(GpuSample& sample) const;
+    /**
+     * Fill in all the values at once. The GPUID isn't part of the polled
+     * data and is left for the caller to fill in.
+     */
+    bool getValues(GpuSnapshot& values) const;
+
+    /**
+     * The GPU_METRIC bits for the values that changed since the previous
+     * poll, taking the GPU's change thresholds into account. Every bit is set
+     * for the first poll, and none for invalid snapshots.
+     */
+    unsigned getChangedMetrics() const;
+    /**
+     * The value of a single metric, -1 for invalid snapshots or metrics.
+     */
+    float getMetric(GPU_METRIC metric) const;
+
+private:
+    friend class NvidiaGPU;
+    explicit NvidiaGPUSnapshot(std::shared_ptr<const NvidiaGPUDataset> dataset);
+
+    std::shared_ptr<const NvidiaGPUDataset> dataset;
+
+    template <typename T, typename F>
+    bool getDecoded(T& value, F fetcher) const;
+    template <typename T>
+    std::unique_ptr<T> getDecoded(bool (NvidiaGPUSnapshot::*getter)(T&) const) const;
+};
 
 class NVLIB_EXPORTED NvidiaGPU
 {
@@ -25,13 +119,75 @@ public:
     NvidiaGPU(const NV_PHYSICAL_GPU_HANDLE handle);
     ~NvidiaGPU();
 
+    // Allocated on a cache line boundary, which plain new only does for
+    // over-aligned types from C++17 on
+    static void* operator new(size_t size);
+    static void operator delete(void* memory);
+
+    /**
+     * Poll everything. Threads calling this at the same time share a single
+     * poll, as long as it started after they called, see poll(maxAge).
+     */
     bool poll();
+    /**
+     * Make sure the data given by `fields` is no older than `maxAge`, polling
+     * only if it is. Threads asking at the same time share a single poll:
+     * whoever arrives while a poll of at least the same fields is in flight
+     * waits for its result instead of starting another, provided that poll
+     * started no more than `maxAge` before they asked. However many threads
+     * ask, the GPU is polled at most about once per `maxAge`.
+     *
+     * Returns false if the data couldn't be refreshed, including when the
+     * poll it waited for failed.
+     */
+    bool poll(std::chrono::nanoseconds maxAge, unsigned fields = GPU_DATASET_FIELD_ALL);
+    /**
+     * Refresh only the parts of the dataset given by `fields`, a combination
+     * of GPU_DATASET_FIELD flags. The other parts keep the values from the
+     * previous poll. If the GPU hasn't been polled before, everything is
+     * loaded regardless of `fields`.
+     *
+     * The static parts of the dataset, see GPU_DATASET_FIELD_STATIC, are
+     * only loaded when they've been invalidated.
+     */
+    bool poll(unsigned fields);
+    /**
+     * poll(fields), adding the driver calls it made to `driverCalls`. That
+     * includes reloading the static parts, which a poll may do whatever the
+     * fields.
+     */
+    bool poll(unsigned fields, unsigned& driverCalls);
+    /**
+     * Have the next poll reload the static parts of the dataset, for when
+     * something outside the library might have changed them. Overclocking
+     * through setOverclock() does this by itself.
+     */
+    void invalidateStaticData();
 
+    // Both are read once when the GPU is created
     std::string getName() const;
     std::string getSerialNumber() const;
     float getVoltage() const;
     float getTemperature() const;
     unsigned long getGPUID() const;
+    /**
+     * The version of the data the getters currently return. It increases
+     * with every successful poll and is 0 if the GPU has never been polled.
+     */
+    unsigned long long getSampleVersion() const;
+    /**
+     * When the oldest of `fields` was last loaded, see
+     * NvidiaGPUSnapshot::getPollTime(). The clock's epoch if the GPU has
+     * never been polled.
+     */
+    std::chrono::steady_clock::time_point getPollTime(unsigned fields = GPU_DATASET_FIELD_ALL) const;
+    /**
+     * Pin the data from the latest poll. Unlike the getters on the GPU
+     * itself, every value read from the snapshot comes from the same poll.
+     * The getters take no locks, while pinning a snapshot takes the one
+     * guarding the dataset's reference.
+     */
+    NvidiaGPUSnapshot getSnapshot() const;
 
     std::unique_ptr<GpuClocks> getClocks() const;
     std::unique_ptr<GpuClocks> getDefaultClocks() const;
@@ -40,14 +196,100 @@ public:
     std::unique_ptr<GpuOverclockProfile> getOverclockProfile() const;
     std::unique_ptr<GpuUsage> getUsage() const;
 
+    // Allocation-free versions of the getters above, see NvidiaGPUSnapshot
+    bool getClocks(GpuClocks& clocks) const;
+    bool getDefaultClocks(GpuClocks& clocks) const;
+    bool getBaseClocks(GpuClocks& clocks) const;
+    bool getBoostClocks(GpuClocks& clocks) const;
+    bool getOverclockProfile(GpuOverclockProfile& profile) const;
+    bool getUsage(GpuUsage& usage) const;
+    bool getSample(GpuSample& sample) const;
+    /**
+     * Fill in all the values at once, see NvidiaGPUSnapshot::getValues().
+     * Unlike the other getters, these all come from the same poll.
+     */
+    bool getValues(GpuSnapshot& values) const;
+
     bool setOverclock(const GpuOverclockDefinitionMap& overclockDefinitions, const bool prioritizeThermalLimit = false);
 
+    /**
+     * The metrics that changed in the latest poll, see
+     * NvidiaGPUSnapshot::getChangedMetrics().
+     */
+    unsigned getChangedMetrics() const;
+    /**
+     * Only report a metric as changed once it has moved by at least
+     * `threshold` since it was last reported. Slow drifts are still reported
+     * once they add up to the threshold. The default of 0 reports any change.
+     */
+    bool setChangeThreshold(GPU_METRIC metric, float threshold);
+    /**
+     * Call `listener` with the new data after every successful poll. It runs
+     * on the polling thread while further polls of this GPU wait for it, so
+     * it should hand off anything slow. Pass nullptr to remove it.
+     */
+    void setPollListener(GpuPollListener listener);
+
+    /**
+     * Keep a history of the samples of every successful poll, see
+     * GpuHistory. Enabling it again starts over with a new, empty history;
+     * readers holding on to the old one can keep using it.
+     */
+    void enableHistory(const GpuHistoryConfig& config = GpuHistoryConfig());
+    void disableHistory();
+    /**
+     * The history, or nullptr if it isn't enabled.
+     */
+    std::shared_ptr<const GpuHistory> getHistory() const;
+    /**
+     * Append the sample of every successful poll to `log`, with the ID of
+     * this GPU. Pass nullptr to stop.
+     */
+    void setColumnLog(std::shared_ptr<GpuColumnLogWriter> log);
+
 private:
     const NV_PHYSICAL_GPU_HANDLE handle;
     const unsigned long GPUID;
-    std::unique_ptr<NvidiaGPUDataset> dataset;
+    const std::string name;
+    const std::string serialNumber;
+    // The values of the published dataset, which the getters read instead
+    // of loading the dataset
+    std::unique_ptr<NvidiaGPUValues> values;
+    std::mutex overclockMutex;
+    // A poll made through poll(maxAge), which others can wait for
+    struct PollFlight
+    {
+        std::chrono::steady_clock::time_point start;
+        unsigned fields;
+        bool done = false;
+        bool success = false;
+    };
+
+    // Everything from here on is written by polls, so it starts on a cache
+    // line of its own, away from the members the getters read above.
+    // Published datasets are never modified, a poll builds a new one and swaps
+    // it in atomically. Always access it through loadDataset().
+    alignas(CACHE_LINE_SIZE) std::shared_ptr<const NvidiaGPUDataset> dataset;
+    std::mutex pollMutex;
+    std::mutex flightMutex;
+    std::condition_variable flightDone;
+    // The poll in flight, if there is one, guarded by flightMutex
+    std::shared_ptr<PollFlight> flight;
+    // Set when the static parts of the dataset have to be reloaded
+    std::atomic<bool> staticDataStale{ true };
+    // Guarded by pollMutex, since they're only used while polling
+    std::array<float, GPU_METRIC_COUNT> changeThresholds;
+    GpuPollListener pollListener;
+    // Recycled for new polls once nothing but the pool refers to them, also
+    // guarded by pollMutex
+    std::vector<std::shared_ptr<NvidiaGPUDataset>> datasetPool;
+    // Swapped atomically, and only written to by polls
+    std::shared_ptr<GpuHistory> history;
+    std::shared_ptr<GpuColumnLogWriter> columnLog;
 
-    std::unique_ptr<GpuClocks> getClocks(NVIDIA_CLOCK_FREQUENCY_TYPE type, bool compensateForOverclock = false) const;
+    std::shared_ptr<const NvidiaGPUDataset> loadDataset() const;
+    std::shared_ptr<NvidiaGPUDataset> acquireDataset();
+    void publishValues(const NvidiaGPUDataset& dataset);
 };
 #pragma warning(default: 4251)
 
@@ -3,9 +3,33 @@ import sys
 
 (_, csv_file, output_prefix) = sys.argv
 FUNCTION_TEMPLATE = '''NV_STATUS %(name)s(%(param_list)s) {
-  static %(pointer_decl)s  = 0;
-  if(!pointer) {pointer = (%(pointer_type)s)nvidia_handle->query(0x%(ID)s); }
-  return (*pointer)(%(param_names)s);
+  const auto function = reinterpret_cast<%(pointer_type)s>(nvidia_dispatch_table[%(enum_name)s].load(std::memory_order_acquire));
+  if (nvidia_call_stats_enabled.load(std::memory_order_relaxed)) {
+    return nvidia_counted_call(%(enum_name)s, [&] { return function(%(param_names)s); });
+  }
+  return function(%(param_names)s);
+}
+
+'''
+
+CAPTURE_FUNCTION_TEMPLATE = '''static NV_STATUS %(capture_name)s(%(param_list)s) {
+  std::array<NvidiaCallArgument, %(param_count)d> args = { { %(call_arguments)s } };
+  return nvidia_capture_call(0x%(ID)s, args.data(), args.size(), [&] {
+    return reinterpret_cast<%(pointer_type)s>(nvidia_capture_targets[%(enum_name)s].load(std::memory_order_relaxed))(%(param_names)s);
+  });
+}
+
+'''
+
+REPLAY_FUNCTION_TEMPLATE = '''static NV_STATUS %(replay_name)s(%(param_list)s) {
+  std::array<NvidiaCallArgument, %(param_count)d> args = { { %(call_arguments)s } };
+  return nvidia_replay_call(0x%(ID)s, args.data(), args.size());
+}
+
+'''
+
+MISSING_FUNCTION_TEMPLATE = '''static NV_STATUS %(missing_name)s(%(param_types)s) {
+  return NVAPI_NO_IMPLEMENTATION;
 }
 
 '''
@@ -14,6 +38,27 @@ FUNCTION_DECLARATION_TEMPLATE = '''NVLIB_EXPORTED NV_STATUS %(name)s(%(param_lis
 
 '''
 
+functions = []
+
+def call_argument(param_type, param_name):
+  """Describe a parameter for call capture and replay.
+
+  Pointer parameters are buffers the driver may write to, everything else is
+  passed by value and only captured as input.
+  """
+  param_type = param_type.strip()
+  if not param_type.endswith('*'):
+    return 'NvidiaCallArgument::input(&%s, sizeof(%s))' % (param_name, param_name)
+
+  pointee = param_type[:-1].strip()
+  if pointee == 'char':
+    size = 'NVIDIA_SHORT_STRING_SIZE'
+  elif pointee == 'NV_PHYSICAL_GPU_HANDLE':
+    size = 'NVIDIA_MAX_PHYSICAL_GPUS * sizeof(NV_PHYSICAL_GPU_HANDLE)'
+  else:
+    size = 'sizeof(%s)' % pointee
+  return 'NvidiaCallArgument::output(%s, %s)' % (param_name, size)
+
 with open(csv_file, 'rb') as file:
   output_file = '%s_gen.cpp' % (output_prefix)
   output_header = '%s_gen.h' % (output_prefix)
@@ -35,7 +80,7 @@ with open(csv_file, 'rb') as file:
 
         ID = row[0]
         function_name = 'NVIDIA_RAW_%s' % row[1]
-        params = row[2:]
+        params = [p for p in row[2:] if p.strip()]
         param_types = []
         param_names = []
         for p in params:
@@ -47,21 +92,82 @@ with open(csv_file, 'rb') as file:
         param_name_str = ', '.join(param_names)
         param_list_str = ', '.join(params)
         pointer_type = 'NV_STATUS (*)(%s)' % param_type_str
-        pointer_decl = 'NV_STATUS (*pointer)(%s)' % param_type_str
 
         template_args = {
           'name': function_name,
+          'enum_name': 'NVIDIA_FUNCTION_%s' % row[1],
+          'missing_name': 'nvidia_missing_%s' % row[1],
+          'capture_name': 'nvidia_capture_%s' % row[1],
+          'replay_name': 'nvidia_replay_%s' % row[1],
+          'param_count': len(params),
+          'call_arguments': ', '.join(call_argument(t, n) for (t, n) in zip(param_types, param_names)),
           'ID': ID,
           'param_list': param_list_str,
           'param_names': param_name_str,
+          'param_types': param_type_str,
           'pointer_type': pointer_type,
-          'pointer_decl': pointer_decl
         }
+        functions.append(template_args)
 
-        bodyfile.write(FUNCTION_TEMPLATE % template_args)
         if len(comment) > 0:
           comment_str = '/**\n' + '\n'.join(comment) + '\n */\n'
           headerfile.write(comment_str)
           comment = []
         headerfile.write(FUNCTION_DECLARATION_TEMPLATE % template_args)
 
+      # Every entry point gets a slot in the dispatch table, indexed by this enum
+      headerfile.write('typedef enum\n{\n')
+      for f in functions:
+        headerfile.write('    %(enum_name)s,\n' % f)
+      headerfile.write('    NVIDIA_FUNCTION_COUNT\n} NVIDIA_FUNCTION;\n')
+
+      bodyfile.write('static const UINT32 nvidia_function_ids[NVIDIA_FUNCTION_COUNT] = {\n')
+      for f in functions:
+        bodyfile.write('  0x%(ID)s,\n' % f)
+      bodyfile.write('};\n\n')
+
+      bodyfile.write('static const char* const nvidia_function_names[NVIDIA_FUNCTION_COUNT] = {\n')
+      for f in functions:
+        bodyfile.write('  "%(name)s",\n' % f)
+      bodyfile.write('};\n\n')
+
+      # Stand-ins for entry points the driver doesn't provide, so a missing
+      # function fails with a status instead of a null pointer call.
+      for f in functions:
+        bodyfile.write(MISSING_FUNCTION_TEMPLATE % f)
+
+      bodyfile.write('static void* const nvidia_missing_functions[NVIDIA_FUNCTION_COUNT] = {\n')
+      for f in functions:
+        bodyfile.write('  reinterpret_cast<void*>(&%(missing_name)s),\n' % f)
+      bodyfile.write('};\n\n')
+
+      bodyfile.write('static std::atomic<void*> nvidia_dispatch_table[NVIDIA_FUNCTION_COUNT] = {\n')
+      for f in functions:
+        bodyfile.write('  { reinterpret_cast<void*>(&%(missing_name)s) },\n' % f)
+      bodyfile.write('};\n\n')
+
+      # While capturing, the dispatch table points at the capture functions,
+      # which record the call and forward it to the function saved here. The
+      # targets are stored before the table entries are released, and the
+      # wrappers acquire the table, so a capture function always sees its
+      # target. They're atomic as a call from an earlier capture may still be
+      # reading them when the next capture starts.
+      bodyfile.write('static std::atomic<void*> nvidia_capture_targets[NVIDIA_FUNCTION_COUNT];\n\n')
+      for f in functions:
+        bodyfile.write(CAPTURE_FUNCTION_TEMPLATE % f)
+
+      bodyfile.write('static void* const nvidia_capture_functions[NVIDIA_FUNCTION_COUNT] = {\n')
+      for f in functions:
+        bodyfile.write('  reinterpret_cast<void*>(&%(capture_name)s),\n' % f)
+      bodyfile.write('};\n\n')
+
+      for f in functions:
+        bodyfile.write(REPLAY_FUNCTION_TEMPLATE % f)
+
+      bodyfile.write('static void* const nvidia_replay_functions[NVIDIA_FUNCTION_COUNT] = {\n')
+      for f in functions:
+        bodyfile.write('  reinterpret_cast<void*>(&%(replay_name)s),\n' % f)
+      bodyfile.write('};\n\n')
+
+      for f in functions:
+        bodyfile.write(FUNCTION_TEMPLATE % f)
@@ -0,0 +1,189 @@
+#include "pch.h"
+#include "nvidia_call_stats.h"
+#include <array>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace lib_gpu {
+
+std::atomic<bool> nvidia_call_stats_enabled(false);
+
+#pragma region Helpers
+
+/**
+ * The counters for every function, owned by a single thread.
+ *
+ * Only the owning thread writes to the counters, so an increment is a plain
+ * load and store without any locked instruction. Other threads only read
+ * them, and the atomics just make sure they never see a torn value.
+ */
+struct NvidiaThreadCallStats
+{
+    struct Counters
+    {
+        std::atomic<UINT64> calls;
+        std::atomic<UINT64> errors;
+        std::atomic<UINT64> statuses[NVIDIA_CALL_STATUS_BUCKETS];
+        std::atomic<UINT64> latencyHistogram[NVIDIA_CALL_LATENCY_BUCKETS];
+        std::atomic<UINT64> totalLatencyNs;
+    };
+
+    std::array<Counters, NVIDIA_FUNCTION_COUNT> functions;
+    // Cleared when the owning thread exits, so a new thread can take over the
+    // counters instead of allocating its own.
+    std::atomic<bool> inUse;
+
+    NvidiaThreadCallStats()
+    {
+        for (auto& counters : this->functions) {
+            counters.calls = 0;
+            counters.errors = 0;
+            counters.totalLatencyNs = 0;
+            for (auto& count : counters.statuses) {
+                count = 0;
+            }
+            for (auto& count : counters.latencyHistogram) {
+                count = 0;
+            }
+        }
+        this->inUse = true;
+    }
+};
+
+// Registering a thread is the only time the counters need a lock. Readers
+// take the same lock to walk the list, which is never shrunk.
+static std::vector<std::unique_ptr<NvidiaThreadCallStats>> thread_call_stats;
+static std::array<NvidiaCallStats, NVIDIA_FUNCTION_COUNT> call_stats_baseline;
+static std::mutex thread_call_stats_mutex;
+
+class ThreadCallStatsOwner
+{
+public:
+    ~ThreadCallStatsOwner()
+    {
+        if (this->stats) {
+            this->stats->inUse.store(false, std::memory_order_release);
+        }
+    }
+
+    NvidiaThreadCallStats& get()
+    {
+        if (!this->stats) {
+            this->stats = acquire();
+        }
+        return *this->stats;
+    }
+
+private:
+    NvidiaThreadCallStats* stats = nullptr;
+
+    static NvidiaThreadCallStats* acquire()
+    {
+        std::lock_guard<std::mutex> lock(thread_call_stats_mutex);
+        for (const auto& stats : thread_call_stats) {
+            auto expected = false;
+            if (stats->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                return stats.get();
+            }
+        }
+
+        thread_call_stats.push_back(std::make_unique<NvidiaThreadCallStats>());
+        return thread_call_stats.back().get();
+    }
+};
+
+static thread_local ThreadCallStatsOwner thread_call_stats_owner;
+
+void increment(std::atomic<UINT64>& counter, UINT64 amount = 1)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+unsigned statusBucket(NV_STATUS status)
+{
+    const auto index = -static_cast<INT64>(status);
+    return (index >= 0 && index < NVIDIA_CALL_STATUS_BUCKETS - 1) ? static_cast<unsigned>(index) : NVIDIA_CALL_STATUS_BUCKETS - 1;
+}
+
+unsigned latencyBucket(UINT64 nanoseconds)
+{
+    auto bucket = 0u;
+    while (nanoseconds > 1 && bucket < NVIDIA_CALL_LATENCY_BUCKETS - 1) {
+        nanoseconds >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// The sum of every thread's counters since the library was loaded
+NvidiaCallStats sumCallStats(NVIDIA_FUNCTION function)
+{
+    NvidiaCallStats total = {};
+    for (const auto& stats : thread_call_stats) {
+        const auto& counters = stats->functions[function];
+        total.calls += counters.calls.load(std::memory_order_relaxed);
+        total.errors += counters.errors.load(std::memory_order_relaxed);
+        total.totalLatencyNs += counters.totalLatencyNs.load(std::memory_order_relaxed);
+        for (auto i = 0u; i < NVIDIA_CALL_STATUS_BUCKETS; i++) {
+            total.statuses[i] += counters.statuses[i].load(std::memory_order_relaxed);
+        }
+        for (auto i = 0u; i < NVIDIA_CALL_LATENCY_BUCKETS; i++) {
+            total.latencyHistogram[i] += counters.latencyHistogram[i].load(std::memory_order_relaxed);
+        }
+    }
+    return total;
+}
+
+#pragma endregion
+
+void nvidia_record_call(NVIDIA_FUNCTION function, NV_STATUS status, std::chrono::nanoseconds latency)
+{
+    const auto nanoseconds = latency.count() > 0 ? static_cast<UINT64>(latency.count()) : 0;
+    auto& counters = thread_call_stats_owner.get().functions[function];
+
+    increment(counters.calls);
+    if (status != NVAPI_OK) {
+        increment(counters.errors);
+    }
+    increment(counters.statuses[statusBucket(status)]);
+    increment(counters.latencyHistogram[latencyBucket(nanoseconds)]);
+    increment(counters.totalLatencyNs, nanoseconds);
+}
+
+void nvidia_enable_call_stats(bool enable)
+{
+    nvidia_call_stats_enabled.store(enable, std::memory_order_relaxed);
+}
+
+bool nvidia_get_call_stats(NVIDIA_FUNCTION function, NvidiaCallStats& stats)
+{
+    if (function >= NVIDIA_FUNCTION_COUNT) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(thread_call_stats_mutex);
+    const auto total = sumCallStats(function);
+    const auto& baseline = call_stats_baseline[function];
+
+    stats.calls = total.calls - baseline.calls;
+    stats.errors = total.errors - baseline.errors;
+    stats.totalLatencyNs = total.totalLatencyNs - baseline.totalLatencyNs;
+    for (auto i = 0u; i < NVIDIA_CALL_STATUS_BUCKETS; i++) {
+        stats.statuses[i] = total.statuses[i] - baseline.statuses[i];
+    }
+    for (auto i = 0u; i < NVIDIA_CALL_LATENCY_BUCKETS; i++) {
+        stats.latencyHistogram[i] = total.latencyHistogram[i] - baseline.latencyHistogram[i];
+    }
+    return true;
+}
+
+void nvidia_reset_call_stats()
+{
+    std::lock_guard<std::mutex> lock(thread_call_stats_mutex);
+    for (auto i = 0u; i < NVIDIA_FUNCTION_COUNT; i++) {
+        call_stats_baseline[i] = sumCallStats(static_cast<NVIDIA_FUNCTION>(i));
+    }
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include "helpers.h"
+#include "nvidia_interface.h"
+
+/**
+ * Per-function statistics for NVIDIA_RAW_* calls.
+ *
+ * The generated wrappers check nvidia_call_stats_enabled before every call,
+ * and only time and count the call when it's set. Counters are kept per
+ * thread, so recording a call never takes a lock or contends with other
+ * threads; reading the statistics sums up the counters of every thread.
+ */
+
+namespace lib_gpu {
+
+extern std::atomic<bool> nvidia_call_stats_enabled;
+
+void nvidia_record_call(NVIDIA_FUNCTION function, NV_STATUS status, std::chrono::nanoseconds latency);
+
+template <typename F>
+NV_STATUS nvidia_counted_call(NVIDIA_FUNCTION function, F call)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const auto status = call();
+    nvidia_record_call(function, status, std::chrono::steady_clock::now() - start);
+    return status;
+}
+
+void nvidia_enable_call_stats(bool enable);
+bool nvidia_get_call_stats(NVIDIA_FUNCTION function, NvidiaCallStats& stats);
+// Start counting from zero again, without touching other threads' counters
+void nvidia_reset_call_stats();
+
+}
\ No newline at end of file
@@ -0,0 +1,365 @@
+#include "pch.h"
+#include "nvidia_call_trace.h"
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lib_gpu {
+
+const char TRACE_MAGIC[4] = { 'N', 'V', 'C', 'T' };
+const UINT32 TRACE_FORMAT_VERSION = 1;
+
+#pragma region Helpers
+
+template <typename T>
+void appendValue(std::vector<char>& buffer, const T& value)
+{
+    const auto bytes = reinterpret_cast<const char*>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+void appendBytes(std::vector<char>& buffer, const void* data, UINT32 size)
+{
+    if (data) {
+        const auto bytes = static_cast<const char*>(data);
+        buffer.insert(buffer.end(), bytes, bytes + size);
+    } else {
+        buffer.insert(buffer.end(), size, 0);
+    }
+}
+
+template <typename T>
+bool readValue(std::istream& stream, T& value)
+{
+    return static_cast<bool>(stream.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+// The version and the flags word after it, see loadNvidiaStruct()
+const UINT32 STRUCT_HEADER_SIZE = 2 * sizeof(UINT32);
+
+/**
+ * Add the bytes of an argument that go into a call to the replay key of the
+ * call. Arguments passed by value are all input. Of the output buffers only
+ * the versioned NVIDIA structs are read, and only their header, which the
+ * caller sets up before every call. The rest of them is whatever an earlier
+ * call left behind.
+ */
+void appendKeyArgument(std::string& key, const void* data, UINT32 size, bool isOutput)
+{
+    key.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    if (!isOutput) {
+        if (data) {
+            key.append(static_cast<const char*>(data), size);
+        } else {
+            key.append(size, 0);
+        }
+        return;
+    }
+
+    // The version of a struct carries its size in the low 16 bits, see NVIDIA_STRUCT_VERSION
+    UINT32 version;
+    if (data && size >= STRUCT_HEADER_SIZE) {
+        memcpy(&version, data, sizeof(version));
+        if ((version & 0xFFFF) == (size & 0xFFFF)) {
+            key.append(static_cast<const char*>(data), STRUCT_HEADER_SIZE);
+        }
+    }
+}
+
+#pragma endregion
+
+NvidiaCallArgument NvidiaCallArgument::input(const void* data, size_t size)
+{
+    return NvidiaCallArgument{ const_cast<void*>(data), static_cast<UINT32>(size), false };
+}
+
+NvidiaCallArgument NvidiaCallArgument::output(void* data, size_t size)
+{
+    // A null buffer has nothing to capture or replay into
+    return NvidiaCallArgument{ data, data ? static_cast<UINT32>(size) : 0, true };
+}
+
+#pragma region Capture
+
+class NvidiaTraceWriter
+{
+public:
+    explicit NvidiaTraceWriter(const char* path) : file(path, std::ofstream::binary | std::ofstream::trunc)
+    {
+        this->file.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        this->file.write(reinterpret_cast<const char*>(&TRACE_FORMAT_VERSION), sizeof(TRACE_FORMAT_VERSION));
+    }
+
+    bool isOpen() const
+    {
+        return this->file.good();
+    }
+
+    void write(const std::vector<char>& record)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->file.write(record.data(), record.size());
+    }
+
+private:
+    std::ofstream file;
+    std::mutex mutex;
+};
+
+static std::shared_ptr<NvidiaTraceWriter> capture_writer;
+// Each thread builds its record here while its call is running, so the
+// writer only has to be locked for the final write.
+static thread_local std::vector<char> capture_record;
+
+bool nvidia_open_capture(const char* path)
+{
+    auto writer = std::make_shared<NvidiaTraceWriter>(path);
+    if (!writer->isOpen()) {
+        return false;
+    }
+
+    std::atomic_store(&capture_writer, writer);
+    return true;
+}
+
+void nvidia_close_capture()
+{
+    std::atomic_store(&capture_writer, std::shared_ptr<NvidiaTraceWriter>());
+}
+
+bool nvidia_is_capturing()
+{
+    return std::atomic_load(&capture_writer) != nullptr;
+}
+
+void nvidia_begin_capture(UINT32 functionId, const NvidiaCallArgument* args, size_t count)
+{
+    auto& record = capture_record;
+    record.clear();
+    appendValue(record, functionId);
+    appendValue(record, static_cast<INT32>(NVAPI_OK));
+    appendValue(record, static_cast<UINT64>(0));
+    appendValue(record, static_cast<UINT32>(count));
+
+    for (auto i = 0u; i < count; i++) {
+        appendValue(record, args[i].size);
+        appendValue(record, static_cast<UINT8>(args[i].isOutput));
+        appendBytes(record, args[i].data, args[i].size);
+    }
+}
+
+void nvidia_end_capture(NV_STATUS status, std::chrono::nanoseconds latency, const NvidiaCallArgument* args, size_t count)
+{
+    auto& record = capture_record;
+    const auto statusValue = static_cast<INT32>(status);
+    const auto latencyValue = static_cast<UINT64>(latency.count());
+    memcpy(record.data() + sizeof(UINT32), &statusValue, sizeof(statusValue));
+    memcpy(record.data() + sizeof(UINT32) + sizeof(INT32), &latencyValue, sizeof(latencyValue));
+
+    for (auto i = 0u; i < count; i++) {
+        if (args[i].isOutput) {
+            appendBytes(record, args[i].data, args[i].size);
+        }
+    }
+
+    const auto writer = std::atomic_load(&capture_writer);
+    if (writer) {
+        writer->write(record);
+    }
+}
+
+#pragma endregion
+
+#pragma region Replay
+
+// The key of the call being replayed on this thread, kept around to reuse its memory
+static thread_local std::string replay_key;
+
+class NvidiaTraceReplay
+{
+public:
+    explicit NvidiaTraceReplay(bool reproduceLatency) : reproduceLatency(reproduceLatency)
+    {
+    }
+
+    bool load(const char* path)
+    {
+        std::ifstream file(path, std::ifstream::binary);
+        char magic[sizeof(TRACE_MAGIC)];
+        UINT32 version = 0;
+        if (!file.read(magic, sizeof(magic)) || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 ||
+            !readValue(file, version) || version != TRACE_FORMAT_VERSION) {
+            return false;
+        }
+
+        UINT32 functionId;
+        std::string key;
+        std::vector<char> input;
+        while (readValue(file, functionId)) {
+            Record record;
+            INT32 status;
+            UINT64 latency;
+            UINT32 count;
+            if (!readValue(file, status) || !readValue(file, latency) || !readValue(file, count)) {
+                return false;
+            }
+            record.status = static_cast<NV_STATUS>(status);
+            record.latency = std::chrono::nanoseconds(latency);
+
+            // The record is keyed by what went into the call, the same way
+            // replay() builds the key from its arguments
+            key.clear();
+            for (auto i = 0u; i < count; i++) {
+                UINT32 size;
+                UINT8 isOutput;
+                if (!readValue(file, size) || !readValue(file, isOutput)) {
+                    return false;
+                }
+                input.resize(size);
+                if (!file.read(input.data(), size)) {
+                    return false;
+                }
+                appendKeyArgument(key, input.data(), size, isOutput != 0);
+                if (isOutput) {
+                    record.outputSizes.push_back(size);
+                }
+            }
+
+            for (auto size : record.outputSizes) {
+                const auto offset = record.outputs.size();
+                record.outputs.resize(offset + size);
+                if (!file.read(record.outputs.data() + offset, size)) {
+                    return false;
+                }
+            }
+
+            auto& function = this->functions[functionId];
+            function.sequences[key].records.push_back(function.sequence.records.size());
+            function.sequence.records.push_back(function.records.size());
+            function.records.push_back(std::move(record));
+        }
+
+        return true;
+    }
+
+    bool hasFunction(UINT32 functionId) const
+    {
+        return this->functions.find(functionId) != this->functions.end();
+    }
+
+    NV_STATUS replay(UINT32 functionId, const NvidiaCallArgument* args, size_t count)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const auto function = this->functions.find(functionId);
+        if (function == this->functions.end()) {
+            return NVAPI_NO_IMPLEMENTATION;
+        }
+
+        // Each call gets the records captured with the same inputs, so the
+        // results for one GPU or clock type never end up with another. Calls
+        // with inputs that were never captured fall back to all of the
+        // function's records.
+        auto& key = replay_key;
+        key.clear();
+        for (auto i = 0u; i < count; i++) {
+            appendKeyArgument(key, args[i].data, args[i].size, args[i].isOutput);
+        }
+
+        auto& replayFunction = function->second;
+        const auto keySequence = replayFunction.sequences.find(key);
+        auto& sequence = keySequence != replayFunction.sequences.end() ? keySequence->second : replayFunction.sequence;
+
+        // Records are served in the order they were captured. When we run out
+        // we start over, so a short capture can drive a long benchmark.
+        const Record* record;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            record = &replayFunction.records[sequence.records[sequence.next]];
+            sequence.next = (sequence.next + 1) % sequence.records.size();
+        }
+
+        auto output = 0u;
+        auto offset = 0u;
+        for (auto i = 0u; i < count; i++) {
+            if (!args[i].isOutput || output >= record->outputSizes.size()) {
+                continue;
+            }
+
+            const auto size = record->outputSizes[output++];
+            if (args[i].data && args[i].size == size) {
+                memcpy(args[i].data, record->outputs.data() + offset, size);
+            }
+            offset += size;
+        }
+
+        // Sleeping is far too coarse for driver call latencies, so we spin
+        if (this->reproduceLatency) {
+            while (std::chrono::steady_clock::now() - start < record->latency) {
+            }
+        }
+
+        return record->status;
+    }
+
+private:
+    struct Record
+    {
+        NV_STATUS status;
+        std::chrono::nanoseconds latency;
+        std::vector<UINT32> outputSizes;
+        std::vector<char> outputs;
+    };
+
+    // The records to serve to a set of calls, by their index in the
+    // function's records, and which one is next
+    struct Sequence
+    {
+        std::vector<size_t> records;
+        size_t next = 0;
+    };
+
+    struct Function
+    {
+        std::vector<Record> records;
+        // Every record of the function
+        Sequence sequence;
+        // The records of the calls with the same input bytes, keyed by them
+        std::unordered_map<std::string, Sequence> sequences;
+    };
+
+    const bool reproduceLatency;
+    std::unordered_map<UINT32, Function> functions;
+    std::mutex mutex;
+};
+
+static std::shared_ptr<NvidiaTraceReplay> replay;
+
+bool nvidia_load_replay(const char* path, bool reproduceLatency)
+{
+    auto newReplay = std::make_shared<NvidiaTraceReplay>(reproduceLatency);
+    if (!newReplay->load(path)) {
+        return false;
+    }
+
+    std::atomic_store(&replay, newReplay);
+    return true;
+}
+
+bool nvidia_has_replay(UINT32 functionId)
+{
+    const auto current = std::atomic_load(&replay);
+    return current && current->hasFunction(functionId);
+}
+
+NV_STATUS nvidia_replay_call(UINT32 functionId, const NvidiaCallArgument* args, size_t count)
+{
+    const auto current = std::atomic_load(&replay);
+    return current ? current->replay(functionId, args, count) : NVAPI_API_NOT_INITIALIZED;
+}
+
+#pragma endregion
+
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include "helpers.h"
+#include "nvidia_interface_datatypes.h"
+
+/**
+ * Capture and replay of NVIDIA_RAW_* calls.
+ *
+ * A capture records every call to a binary trace file, with the function ID,
+ * the contents of every argument before and after the call, the returned
+ * status and the time the call took. Replaying serves the recorded results
+ * back without a driver: each call gets the results of the calls captured
+ * with the same function and the same input bytes, such as the GPU handle,
+ * the selector arguments and the selectors set in the output structs, in
+ * the order they were captured. Calls with inputs that were never captured
+ * get the function's results in capture order instead.
+ *
+ * The trace file starts with the magic "NVCT" and a UINT32 format version,
+ * followed by one record per call:
+ *
+ *   UINT32 function ID, INT32 status, UINT64 latency in nanoseconds,
+ *   UINT32 argument count,
+ *   per argument: UINT32 size, UINT8 output flag, `size` bytes of input,
+ *   per output argument: `size` bytes of output.
+ */
+
+namespace lib_gpu {
+
+struct NvidiaCallArgument
+{
+    void* data;
+    UINT32 size;
+    // Output arguments point to buffers the driver might write to, the rest
+    // are passed by value and only read.
+    bool isOutput;
+
+    static NvidiaCallArgument input(const void* data, size_t size);
+    static NvidiaCallArgument output(void* data, size_t size);
+};
+
+bool nvidia_open_capture(const char* path);
+void nvidia_close_capture();
+bool nvidia_is_capturing();
+void nvidia_begin_capture(UINT32 functionId, const NvidiaCallArgument* args, size_t count);
+void nvidia_end_capture(NV_STATUS status, std::chrono::nanoseconds latency, const NvidiaCallArgument* args, size_t count);
+
+template <typename F>
+NV_STATUS nvidia_capture_call(UINT32 functionId, const NvidiaCallArgument* args, size_t count, F call)
+{
+    nvidia_begin_capture(functionId, args, count);
+    const auto start = std::chrono::steady_clock::now();
+    const auto status = call();
+    nvidia_end_capture(status, std::chrono::steady_clock::now() - start, args, count);
+    return status;
+}
+
+bool nvidia_load_replay(const char* path, bool reproduceLatency);
+bool nvidia_has_replay(UINT32 functionId);
+NV_STATUS nvidia_replay_call(UINT32 functionId, const NvidiaCallArgument* args, size_t count);
+
+}
@@ -1,52 +1,85 @@
 ﻿#include <windows.h>
 #include "pch.h"
 #include "nvidia_interface.h"
+#include <array>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include "nvidia_call_stats.h"
+#include "nvidia_call_trace.h"
 
 namespace lib_gpu {
 
+// Defines the dispatch table and the NVIDIA_RAW_* wrappers calling through it
+#include "nvidia_interface_gen.cpp"
+
+static bool nvidia_function_available[NVIDIA_FUNCTION_COUNT];
+
 class NvidiaLibraryHandle
 {
-    typedef void *(*QueryPtr)(UINT32);
-    const UINT32 NVIDIA_INIT_ID = 0x0150E828;
 public:
-    NvidiaLibraryHandle()
+    NvidiaLibraryHandle() : library(LoadLibrary("nvapi.dll"))
     {
-        bool success = false;
-        library = LoadLibrary("nvapi.dll");
         if (library != nullptr) {
-            nvidia_query = reinterpret_cast<QueryPtr>(GetProcAddress(library, "nvapi_QueryInterface"));
-            if (nvidia_query != nullptr) {
-                auto init = static_cast<NV_STATUS(*)()>(nvidia_query(NVIDIA_INIT_ID));
-                success = init() == NVAPI_OK;
-            }        
+            nvidia_query = reinterpret_cast<NvidiaQueryFunction>(GetProcAddress(library, "nvapi_QueryInterface"));
         }
 
-        if (!success) {
-            throw std::runtime_error("Unable to locate NVIDIA library!");
-        }
+        initialize();
     }
 
-    ~NvidiaLibraryHandle()
+    explicit NvidiaLibraryHandle(NvidiaQueryFunction query) : nvidia_query(query), library(nullptr)
     {
-        NVIDIA_RAW_NvidiaUnload();
-        FreeLibrary(library);
+        initialize();
     }
 
-    void *query(UINT32 ID)
+    ~NvidiaLibraryHandle()
     {
-        return nvidia_query(ID);
+        NVIDIA_RAW_NvidiaUnload();
+        resolveFunctions(nullptr);
+        if (library != nullptr) {
+            FreeLibrary(library);
+        }
     }
 
 private:
-    QueryPtr nvidia_query;
+    NvidiaQueryFunction nvidia_query = nullptr;
     HMODULE library;
+
+    void initialize()
+    {
+        resolveFunctions(nvidia_query);
+
+        if (nvidia_query == nullptr || NVIDIA_RAW_NvidiaInit() != NVAPI_OK) {
+            resolveFunctions(nullptr);
+            if (library != nullptr) {
+                FreeLibrary(library);
+            }
+            throw std::runtime_error("Unable to locate NVIDIA library!");
+        }
+    }
+
+    // Resolve every entry point up front, so the wrappers are just an
+    // indirect call and never have to check or resolve anything themselves.
+    static void resolveFunctions(NvidiaQueryFunction query)
+    {
+        // Replacing the table ends any capture, since it's the table that
+        // routes calls through the capture functions
+        nvidia_close_capture();
+
+        for (auto i = 0u; i < NVIDIA_FUNCTION_COUNT; i++) {
+            void* function = query ? query(nvidia_function_ids[i]) : nullptr;
+            nvidia_function_available[i] = (function != nullptr);
+            nvidia_dispatch_table[i] = function ? function : nvidia_missing_functions[i];
+        }
+    }
 };
 
 static std::unique_ptr<NvidiaLibraryHandle> nvidia_handle;
+static std::mutex nvidia_handle_mutex;
 
 int init_library()
 {
+    std::lock_guard<std::mutex> lock(nvidia_handle_mutex);
     try {
         if (!nvidia_handle) {
             nvidia_handle = std::make_unique<NvidiaLibraryHandle>();
@@ -58,5 +91,88 @@ int init_library()
     }
 }
 
-#include "nvidia_interface_gen.cpp"
+int init_library_with_backend(NvidiaQueryFunction query)
+{
+    std::lock_guard<std::mutex> lock(nvidia_handle_mutex);
+    try {
+        nvidia_handle.reset();
+        nvidia_handle = std::make_unique<NvidiaLibraryHandle>(query);
+        return true;
+    }
+    catch (std::runtime_error) {
+        return false;
+    }
+}
+
+bool start_call_capture(const char* path)
+{
+    std::lock_guard<std::mutex> lock(nvidia_handle_mutex);
+    if (!nvidia_handle || !path || nvidia_is_capturing() || !nvidia_open_capture(path)) {
+        return false;
+    }
+
+    for (auto i = 0u; i < NVIDIA_FUNCTION_COUNT; i++) {
+        nvidia_capture_targets[i].store(nvidia_dispatch_table[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        // Releases the target to the wrappers, which acquire the table entry
+        nvidia_dispatch_table[i].store(nvidia_capture_functions[i], std::memory_order_release);
+    }
+    return true;
+}
+
+void stop_call_capture()
+{
+    std::lock_guard<std::mutex> lock(nvidia_handle_mutex);
+    if (!nvidia_is_capturing()) {
+        return;
+    }
+
+    for (auto i = 0u; i < NVIDIA_FUNCTION_COUNT; i++) {
+        nvidia_dispatch_table[i].store(nvidia_capture_targets[i].load(std::memory_order_relaxed), std::memory_order_release);
+    }
+    nvidia_close_capture();
+}
+
+// The library handle needs to initialize and unload whatever backend it's
+// given, but a capture never contains those calls.
+static NV_STATUS nvidia_replay_lifecycle()
+{
+    return NVAPI_OK;
+}
+
+static void* nvidia_replay_query(UINT32 id)
+{
+    for (auto i = 0u; i < NVIDIA_FUNCTION_COUNT; i++) {
+        if (nvidia_function_ids[i] != id) {
+            continue;
+        }
+
+        if (i == NVIDIA_FUNCTION_NvidiaInit || i == NVIDIA_FUNCTION_NvidiaUnload) {
+            return reinterpret_cast<void*>(&nvidia_replay_lifecycle);
+        }
+        return nvidia_has_replay(id) ? nvidia_replay_functions[i] : nullptr;
+    }
+
+    return nullptr;
+}
+
+int init_library_with_replay(const char* path, bool reproduce_latency)
+{
+    return path && nvidia_load_replay(path, reproduce_latency) && init_library_with_backend(nvidia_replay_query);
+}
+
+bool is_function_available(NVIDIA_FUNCTION function)
+{
+    return function < NVIDIA_FUNCTION_COUNT && nvidia_function_available[function];
+}
+
+const char* get_function_name(NVIDIA_FUNCTION function)
+{
+    return function < NVIDIA_FUNCTION_COUNT ? nvidia_function_names[function] : nullptr;
+}
+
+UINT32 get_function_id(NVIDIA_FUNCTION function)
+{
+    return function < NVIDIA_FUNCTION_COUNT ? nvidia_function_ids[function] : 0;
+}
+
 }
\ No newline at end of file
@@ -20,8 +20,51 @@
 namespace lib_gpu {
 extern "C" {
 #endif
+    typedef void *(*NvidiaQueryFunction)(UINT32 id);
+
     NVLIB_EXPORTED int init_library();
+    /**
+     * Initialize the library against a different backend than nvapi.dll.
+     *
+     * `query` is called once for every entry point ID, and should return the
+     * implementation for that ID or null if it has none. This replaces any
+     * backend that's already loaded, so it's mostly useful for testing.
+     */
+    NVLIB_EXPORTED int init_library_with_backend(NvidiaQueryFunction query);
 #include "nvidia_interface_gen.h"
+    /**
+     * Whether the loaded backend provides the given entry point. Calling a
+     * function that isn't available returns NVAPI_NO_IMPLEMENTATION.
+     */
+    NVLIB_EXPORTED bool is_function_available(NVIDIA_FUNCTION function);
+    NVLIB_EXPORTED const char* get_function_name(NVIDIA_FUNCTION function);
+    /**
+     * The ID the driver knows the function as, as passed to the query
+     * function given to init_library_with_backend().
+     */
+    NVLIB_EXPORTED UINT32 get_function_id(NVIDIA_FUNCTION function);
+
+    /**
+     * Record every NVIDIA_RAW_* call to a binary trace file at `path` until
+     * stop_call_capture() is called. The library must be initialized first.
+     */
+    NVLIB_EXPORTED bool start_call_capture(const char* path);
+    NVLIB_EXPORTED void stop_call_capture();
+    /**
+     * Initialize the library against a captured trace instead of a driver.
+     *
+     * Each call returns the next recorded result for that function, starting
+     * over when the recorded calls run out. With `reproduce_latency` set,
+     * each call also takes as long as it did when it was recorded.
+     */
+    NVLIB_EXPORTED int init_library_with_replay(const char* path, bool reproduce_latency);
+    /**
+     * Initialize the library against a simulated driver with `gpu_count`
+     * identical GPUs, where every call takes at least `call_latency_us`
+     * microseconds. Meant for benchmarking without any hardware.
+     */
+    NVLIB_EXPORTED int init_library_with_simulation(unsigned gpu_count, unsigned call_latency_us);
+    NVLIB_EXPORTED void set_simulation_latency(unsigned call_latency_us);
 #ifdef __cplusplus
 }
 }
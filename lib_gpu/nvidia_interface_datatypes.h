@@ -20,6 +20,7 @@ typedef NV_HANDLE NV_UNATTACHED_DISPLAY_HANDLE;
 typedef NV_HANDLE NV_DISPLAY_HANDLE;
 
 #define NVIDIA_SHORT_STRING_SIZE 64
+#define NVIDIA_MAX_PHYSICAL_GPUS 64
 
 typedef enum
 {
@@ -407,5 +408,32 @@ struct
 } entries[4];
 NVIDIA_STRUCT_END
 
+#pragma endregion
+
+#pragma region Call statistics
+
+// NV_STATUS values go from 0 down to -198, the last bucket counts any other value
+#define NVIDIA_CALL_STATUS_BUCKETS 200
+#define NVIDIA_CALL_LATENCY_BUCKETS 32
+
+/**
+ * Statistics for calls to one NVIDIA_RAW_* function.
+ */
+struct NvidiaCallStats
+{
+    UINT64 calls;
+    /// Calls that returned anything but NVAPI_OK
+    UINT64 errors;
+    /// Calls per returned status, indexed by `-status`
+    UINT64 statuses[NVIDIA_CALL_STATUS_BUCKETS];
+    /**
+     * Calls per latency, where bucket N counts calls that took from 2^N up to
+     * 2^(N+1) nanoseconds. Bucket 0 includes zero, and the last bucket
+     * includes anything longer.
+     */
+    UINT64 latencyHistogram[NVIDIA_CALL_LATENCY_BUCKETS];
+    UINT64 totalLatencyNs;
+};
+
 #pragma endregion
 }
\ No newline at end of file
@@ -2,87 +2,314 @@
 #include "nvidia_simple_api.h"
 #include "lib_gpu_nvidia.h"
 #include "nvidia_interface.h"
+#include "GpuSharedTelemetry.h"
+#include "GpuBroker.h"
 #include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
 
 namespace lib_gpu {
 namespace nvidia_simple_api {
 
 static std::unique_ptr<NvidiaApi> api{};
-static std::vector<ULONGLONG> last_poll;
 static std::mutex api_mutex;
+// Set once the API and the GPU entries below are in place, which they then
+// stay, so the getters only take api_mutex until then
+static std::atomic<bool> api_ready(false);
+// Guarded by api_mutex
+static std::shared_ptr<GpuColumnLogWriter> column_log;
+static std::unique_ptr<GpuSharedTelemetryPublisher> publisher;
+// Set while in client mode, and swapped atomically so the getters don't have
+// to take api_mutex
+static std::shared_ptr<GpuBrokerClient> broker;
+// Whether `broker` might be set. std::atomic_load takes a lock of its own for
+// shared_ptrs, which the getters only need in client mode.
+static std::atomic<bool> broker_connected(false);
+// Whether the scheduler is keeping the data up to date, so the getters can
+// take whatever it last polled
+static std::atomic<bool> scheduler_running(false);
+
+// Without the scheduler, the getters poll whenever the data is older than
+// this, so calling them in a loop polls at most 4 times a second
+const std::chrono::milliseconds DEFAULT_MAX_AGE(250);
+
+/**
+ * What the getters need of one GPU. How fresh its data is comes from the GPU
+ * itself, which keeps a poll time for each part of the data that it reads
+ * without taking any locks.
+ */
+struct GpuEntry
+{
+    // Owned by the API, which is never destroyed
+    NvidiaGPU* gpu = nullptr;
+};
+
+// Filled in before api_ready is set and only read after that, so the entries
+// can share cache lines. What polls write lives in NvidiaGPU.
+static GpuEntry gpu_entries[NVIDIA_MAX_PHYSICAL_GPUS];
+static unsigned gpu_entry_count = 0;
+
+std::shared_ptr<GpuBrokerClient> loadBroker()
+{
+    return broker_connected ? std::atomic_load(&broker) : nullptr;
+}
+
+/**
+ * A GPU as the broker last sent it, with the getters of NvidiaGPU the
+ * getters below use, so they work the same in client mode.
+ */
+class BrokerGPU
+{
+public:
+    BrokerGPU(std::shared_ptr<GpuBrokerClient> client, unsigned index) : client(std::move(client)), index(index)
+    {
+    }
+
+    /**
+     * Fetch the broker's latest data, and have it poll if that's older than
+     * `max_age`. The broker's timestamps are on the same machine-wide clock
+     * as ours.
+     */
+    bool update(std::chrono::nanoseconds max_age)
+    {
+        if (!this->client->getSnapshot(this->index, this->record)) {
+            return false;
+        }
+        return std::chrono::steady_clock::now() - this->getPollTime() <= max_age ||
+            this->client->poll(this->index, this->record);
+    }
+
+    std::chrono::steady_clock::time_point getPollTime() const
+    {
+        return std::chrono::steady_clock::time_point(
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(this->record.sample.timestamp)));
+    }
+
+    unsigned long getGPUID() const { return this->record.snapshot.GPUID; }
+    float getVoltage() const { return this->record.snapshot.voltage; }
+    float getTemperature() const { return this->record.snapshot.temperature; }
+    std::string getName() const { return this->record.name; }
+    std::string getSerialNumber() const { return this->record.serialNumber; }
+
+    bool getClocks(GpuClocks& clocks) const { clocks = this->record.snapshot.clocks; return true; }
+    bool getDefaultClocks(GpuClocks& clocks) const { clocks = this->record.snapshot.defaultClocks; return true; }
+    bool getBaseClocks(GpuClocks& clocks) const { clocks = this->record.snapshot.baseClocks; return true; }
+    bool getBoostClocks(GpuClocks& clocks) const { clocks = this->record.snapshot.boostClocks; return true; }
+    bool getOverclockProfile(GpuOverclockProfile& profile) const { profile = this->record.snapshot.overclockProfile; return true; }
+    bool getUsage(GpuUsage& usage) const { usage = this->record.snapshot.usage; return true; }
+    bool getSample(GpuSample& sample) const { sample = this->record.sample; return true; }
+    bool getValues(GpuSnapshot& values) const { values = this->record.snapshot; return values.valid; }
+
+    bool setOverclock(const GpuOverclockDefinitionMap& overclockDefinitions)
+    {
+        return this->client->setOverclock(this->index, overclockDefinitions);
+    }
 
-// To avoid unnecessary polling with the simple API, we enforce a max pollrate
-const int MAX_POLLS_PER_SEC = 4;
-const ULONGLONG MIN_POLL_INTERVAL = 1000 / MAX_POLLS_PER_SEC;
+private:
+    std::shared_ptr<GpuBrokerClient> client;
+    unsigned index;
+    GpuSharedTelemetryRecord record;
+};
 
 bool ensureApi()
 {
+    if (api_ready) {
+        return true;
+    }
+
     std::lock_guard<std::mutex> lock(api_mutex);
     if (!api) {
         api.reset(new NvidiaApi());
         
-        last_poll.clear();
         auto count = api->getGPUCount();
 
         if (count <= 0) {
             api.reset(nullptr);
         } else {
-            last_poll.resize(count, 0);
+            gpu_entry_count = (std::min)(count, static_cast<unsigned>(NVIDIA_MAX_PHYSICAL_GPUS));
+            for (auto i = 0u; i < gpu_entry_count; i++) {
+                gpu_entries[i].gpu = api->getGPU(i).get();
+            }
+            api_ready = true;
         }
     }
 
     return api != nullptr;
 }
 
-std::shared_ptr<NvidiaGPU> getUpdatedGPU(unsigned num = 0)
+// How old the data a getter returns may be, and where to report how old it was
+struct Freshness
 {
-    if (ensureApi()) {
-        std::lock_guard<std::mutex> lock(api_mutex);
-        const auto gpu = api->getGPU(num);
+    std::chrono::nanoseconds max_age;
+    // The GPU_DATASET_FIELD flags of the data the getter reads
+    unsigned fields;
+    // Left alone if null
+    unsigned* age_us;
+};
+
+// For the getters without a max age: any data will do while the scheduler
+// is running, or else data up to DEFAULT_MAX_AGE old
+const Freshness DEFAULT_AGE = { (std::chrono::nanoseconds::max)(), GPU_DATASET_FIELD_ALL, nullptr };
+
+Freshness max_age(unsigned max_age_us, unsigned fields, unsigned* age_us)
+{
+    return Freshness{ std::chrono::microseconds(max_age_us), fields, age_us };
+}
 
-        if (gpu) {
-            const auto now = GetTickCount64();
-            const auto last = last_poll[num];
-            auto poll_success = true;
+void report_age(const Freshness& freshness, std::chrono::steady_clock::time_point poll_time)
+{
+    if (freshness.age_us) {
+        const auto age = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - poll_time);
+        const auto clamped = (std::min)((std::max)(age, std::chrono::microseconds::zero()), std::chrono::microseconds(UINT_MAX));
+        *freshness.age_us = static_cast<unsigned>(clamped.count());
+    }
+}
 
-            if (now - last > MIN_POLL_INTERVAL) {
-                poll_success = gpu->poll();
-                last_poll[num] = now;
-            }
+void report_age(const Freshness& freshness, const NvidiaGPU* gpu)
+{
+    // Only read the poll time when someone asked for it
+    if (freshness.age_us) {
+        report_age(freshness, gpu->getPollTime(freshness.fields));
+    }
+}
 
-            if (poll_success) {
-                return gpu;
-            }
-        }
+void report_no_data(const Freshness& freshness)
+{
+    if (freshness.age_us) {
+        *freshness.age_us = UINT_MAX;
+    }
+}
+
+/**
+ * The GPU, with the data given by `freshness` no older than it allows.
+ */
+NvidiaGPU* getUpdatedGPU(unsigned num = 0, const Freshness& freshness = DEFAULT_AGE)
+{
+    if (!ensureApi() || num >= gpu_entry_count) {
+        return nullptr;
+    }
+
+    auto max_age = freshness.max_age;
+    if (max_age == DEFAULT_AGE.max_age && !scheduler_running) {
+        max_age = DEFAULT_MAX_AGE;
     }
 
-    return nullptr;
+    // The GPU compares the poll times of just the fields asked for, without
+    // taking any locks, so data fresh enough returns right away. Only the
+    // GPU's own data is touched, so getters for different GPUs never wait
+    // for each other, and threads that do have to poll the same GPU share a
+    // single poll rather than queueing up to make one each.
+    const auto gpu = gpu_entries[num].gpu;
+    return gpu->poll(max_age, freshness.fields) ? gpu : nullptr;
+}
+
+bool fill_snapshot(const NvidiaGPU* gpu, GpuSnapshot& snapshot)
+{
+    snapshot = GpuSnapshot{};
+    if (gpu && gpu->getValues(snapshot)) {
+        snapshot.GPUID = gpu->getGPUID();
+        return true;
+    }
+
+    return false;
+}
+
+bool fill_snapshot(const BrokerGPU* gpu, GpuSnapshot& snapshot)
+{
+    return gpu->getValues(snapshot);
 }
 
 unsigned get_gpu_count()
 {
+    if (const auto client = loadBroker()) {
+        return client->getGPUCount();
+    }
     return ensureApi() ? api->getGPUCount() : 0;
 }
 
-unsigned get_index_for_GPUID(unsigned long GPUID)
+// `fetcher` is called with either an NvidiaGPU or, in client mode, a
+// BrokerGPU, both through a pointer. The age is read before the value, so
+// the value is never older than reported.
+template <typename T, typename F>
+T fetch_with_gpu(unsigned gpu_index, const Freshness& freshness, F fetcher)
 {
-    return ensureApi() ? api->getIndexForGPUID(GPUID) : 0;
+    if (const auto client = loadBroker()) {
+        BrokerGPU gpu(client, gpu_index);
+        if (gpu.update(freshness.max_age)) {
+            report_age(freshness, gpu.getPollTime());
+            return fetcher(&gpu);
+        }
+    } else if (const auto gpu = getUpdatedGPU(gpu_index, freshness)) {
+        report_age(freshness, gpu);
+        return fetcher(gpu);
+    }
+
+    report_no_data(freshness);
+    return T{};
 }
 
 template <typename T, typename F>
 T fetch_with_gpu(unsigned gpu_index, F fetcher)
 {
-    const auto gpu = getUpdatedGPU(gpu_index);
+    return fetch_with_gpu<T>(gpu_index, DEFAULT_AGE, fetcher);
+}
+
+template <typename T>
+T fetch_with_gpu(unsigned gpu_index, const Freshness& freshness, bool (NvidiaGPU::*getter)(T&) const, bool (BrokerGPU::*brokerGetter)(T&) const)
+{
+    T value{};
+    if (const auto client = loadBroker()) {
+        BrokerGPU gpu(client, gpu_index);
+        if (gpu.update(freshness.max_age)) {
+            report_age(freshness, gpu.getPollTime());
+            (gpu.*brokerGetter)(value);
+            return value;
+        }
+    } else if (const auto gpu = getUpdatedGPU(gpu_index, freshness)) {
+        report_age(freshness, gpu);
+        ((*gpu).*getter)(value);
+        return value;
+    }
 
-    return gpu ? fetcher(gpu) : T{};
+    report_no_data(freshness);
+    return value;
 }
 
-template <typename T, typename P = std::unique_ptr<T>>
-T fetch_with_gpu(unsigned gpu_index, P(*fetcher)(std::shared_ptr<NvidiaGPU>))
+template <typename T>
+T fetch_with_gpu(unsigned gpu_index, bool (NvidiaGPU::*getter)(T&) const, bool (BrokerGPU::*brokerGetter)(T&) const)
 {
-    P ptr = fetch_with_gpu<P, decltype(fetcher)>(gpu_index, fetcher);
+    return fetch_with_gpu<T>(gpu_index, DEFAULT_AGE, getter, brokerGetter);
+}
+
+bool fetch_snapshot(unsigned gpu_index, const Freshness& freshness, GpuSnapshot* snapshot)
+{
+    if (!snapshot) {
+        return false;
+    }
+
+    *snapshot = GpuSnapshot{};
+    return fetch_with_gpu<bool>(gpu_index, freshness, [&](auto gpu) {
+        return fill_snapshot(gpu, *snapshot);
+    });
+}
 
-    return ptr ? *ptr : T{};
+unsigned get_index_for_GPUID(unsigned long GPUID)
+{
+    if (const auto client = loadBroker()) {
+        // One round trip for all the GPUs, rather than one per GPU
+        std::vector<GpuSharedTelemetryRecord> records;
+        if (client->getSnapshots(records)) {
+            for (auto i = 0u; i < records.size(); i++) {
+                if (records[i].snapshot.valid && records[i].snapshot.GPUID == GPUID) {
+                    return i;
+                }
+            }
+        }
+        return UINT_MAX;
+    }
+    return ensureApi() ? api->getIndexForGPUID(GPUID) : UINT_MAX;
 }
 
 
@@ -109,46 +336,230 @@ float get_temperature(unsigned gpu_index)
 
 struct GpuClocks get_clocks(unsigned gpu_index)
 {
-    return fetch_with_gpu<GpuClocks, std::unique_ptr<GpuClocks>>(gpu_index, [](auto gpu) {
-        return gpu->getClocks();
-    });
+    return fetch_with_gpu<GpuClocks>(gpu_index, &NvidiaGPU::getClocks, &BrokerGPU::getClocks);
 }
 
 struct GpuClocks get_default_clocks(unsigned gpu_index)
 {
-    return fetch_with_gpu<GpuClocks, std::unique_ptr<GpuClocks>>(gpu_index, [](auto gpu) {
-        return gpu->getDefaultClocks();
-    });
+    return fetch_with_gpu<GpuClocks>(gpu_index, &NvidiaGPU::getDefaultClocks, &BrokerGPU::getDefaultClocks);
 }
 
 struct GpuClocks get_base_clocks(unsigned gpu_index)
 {
-    return fetch_with_gpu<GpuClocks, std::unique_ptr<GpuClocks>>(gpu_index, [](auto gpu) {
-        return gpu->getBaseClocks();
-    });
+    return fetch_with_gpu<GpuClocks>(gpu_index, &NvidiaGPU::getBaseClocks, &BrokerGPU::getBaseClocks);
 }
 
 struct GpuClocks get_boost_clocks(unsigned gpu_index)
 {
-    return fetch_with_gpu<GpuClocks, std::unique_ptr<GpuClocks>>(gpu_index, [](auto gpu) {
-        return gpu->getBoostClocks();
-    });
+    return fetch_with_gpu<GpuClocks>(gpu_index, &NvidiaGPU::getBoostClocks, &BrokerGPU::getBoostClocks);
 }
 
 struct GpuUsage get_usages(unsigned gpu_index)
 {
-    return fetch_with_gpu<GpuUsage, std::unique_ptr<GpuUsage>>(gpu_index, [](auto gpu) {
-        return gpu->getUsage();
-    });
+    return fetch_with_gpu<GpuUsage>(gpu_index, &NvidiaGPU::getUsage, &BrokerGPU::getUsage);
 }
 
 struct GpuOverclockProfile get_overclock_profile(unsigned gpu_index)
 {
-    return fetch_with_gpu<GpuOverclockProfile, std::unique_ptr<GpuOverclockProfile>>(gpu_index, [](auto gpu) {
-        return gpu->getOverclockProfile();
+    return fetch_with_gpu<GpuOverclockProfile>(gpu_index, &NvidiaGPU::getOverclockProfile, &BrokerGPU::getOverclockProfile);
+}
+
+bool get_snapshot(unsigned gpu_index, struct GpuSnapshot* snapshot)
+{
+    return fetch_snapshot(gpu_index, DEFAULT_AGE, snapshot);
+}
+
+unsigned get_all_snapshots(struct GpuSnapshot* snapshots, unsigned capacity)
+{
+    if (const auto client = loadBroker()) {
+        std::vector<GpuSharedTelemetryRecord> records;
+        if (!snapshots || !client->getSnapshots(records)) {
+            return 0;
+        }
+
+        const auto count = (std::min)(static_cast<unsigned>(records.size()), capacity);
+        for (auto i = 0u; i < count; i++) {
+            snapshots[i] = records[i].snapshot;
+        }
+        return count;
+    }
+
+    if (!snapshots || !ensureApi()) {
+        return 0;
+    }
+
+    const auto count = (std::min)(gpu_entry_count, capacity);
+
+    // One stale GPU has them all polled together, so the snapshots come from
+    // the same round of polls rather than from whenever each GPU went stale
+    auto stale = false;
+    if (!scheduler_running) {
+        const auto cutoff = std::chrono::steady_clock::now() - DEFAULT_MAX_AGE;
+        for (auto i = 0u; i < count && !stale; i++) {
+            stale = gpu_entries[i].gpu->getPollTime() < cutoff;
+        }
+    }
+
+    GpuPollResult result;
+    if (stale) {
+        result = api->pollAll();
+    }
+    for (auto i = 0u; i < count; i++) {
+        const auto failed = i < result.success.size() && !result.success[i];
+        fill_snapshot(failed ? nullptr : gpu_entries[i].gpu, snapshots[i]);
+    }
+
+    return count;
+}
+
+bool get_sample(unsigned gpu_index, struct GpuSample* sample)
+{
+    return sample && fetch_with_gpu<bool>(gpu_index, [&](auto gpu) {
+        return gpu->getSample(*sample);
+    });
+}
+
+float get_voltage_max_age(unsigned gpu_index, unsigned max_age_us, unsigned* age_us)
+{
+    return fetch_with_gpu<float>(gpu_index, max_age(max_age_us, GPU_DATASET_FIELD_VOLTAGE, age_us), [](auto gpu) {
+        return gpu->getVoltage();
+    });
+}
+
+float get_temperature_max_age(unsigned gpu_index, unsigned max_age_us, unsigned* age_us)
+{
+    return fetch_with_gpu<float>(gpu_index, max_age(max_age_us, GPU_DATASET_FIELD_TEMPERATURE, age_us), [](auto gpu) {
+        return gpu->getTemperature();
+    });
+}
+
+struct GpuClocks get_clocks_max_age(unsigned gpu_index, unsigned max_age_us, unsigned* age_us)
+{
+    return fetch_with_gpu<GpuClocks>(gpu_index, max_age(max_age_us, GPU_DATASET_FIELD_CURRENT_CLOCKS, age_us),
+        &NvidiaGPU::getClocks, &BrokerGPU::getClocks);
+}
+
+struct GpuUsage get_usages_max_age(unsigned gpu_index, unsigned max_age_us, unsigned* age_us)
+{
+    return fetch_with_gpu<GpuUsage>(gpu_index, max_age(max_age_us, GPU_DATASET_FIELD_USAGE, age_us),
+        &NvidiaGPU::getUsage, &BrokerGPU::getUsage);
+}
+
+struct GpuOverclockProfile get_overclock_profile_max_age(unsigned gpu_index, unsigned max_age_us, unsigned* age_us)
+{
+    // The profile is made from the pstates along with the power and thermal limits
+    const auto fields = GPU_DATASET_FIELD_PSTATES20 | GPU_DATASET_FIELD_POWER_POLICIES | GPU_DATASET_FIELD_THERMAL_POLICIES;
+    return fetch_with_gpu<GpuOverclockProfile>(gpu_index, max_age(max_age_us, fields, age_us),
+        &NvidiaGPU::getOverclockProfile, &BrokerGPU::getOverclockProfile);
+}
+
+bool get_snapshot_max_age(unsigned gpu_index, unsigned max_age_us, struct GpuSnapshot* snapshot, unsigned* age_us)
+{
+    return fetch_snapshot(gpu_index, max_age(max_age_us, GPU_DATASET_FIELD_ALL, age_us), snapshot);
+}
+
+bool get_sample_max_age(unsigned gpu_index, unsigned max_age_us, struct GpuSample* sample, unsigned* age_us)
+{
+    return sample && fetch_with_gpu<bool>(gpu_index, max_age(max_age_us, GPU_DATASET_FIELD_ALL, age_us), [&](auto gpu) {
+        return gpu->getSample(*sample);
     });
 }
 
+// The start of a window ending now on the clock of the sample timestamps
+unsigned long long window_start(unsigned window_ms)
+{
+    const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch());
+    const auto window = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::milliseconds(window_ms));
+    return now > window ? static_cast<unsigned long long>((now - window).count()) : 0;
+}
+
+bool enable_history(const unsigned capacity[GPU_HISTORY_RESOLUTION_COUNT], unsigned archive_kb)
+{
+    GpuHistoryConfig config;
+    if (capacity) {
+        std::copy(capacity, capacity + GPU_HISTORY_RESOLUTION_COUNT, config.capacity.begin());
+    }
+    config.archiveBytes = static_cast<size_t>(archive_kb) * 1024;
+    return ensureApi() && api->enableHistory(config);
+}
+
+unsigned get_history_samples(unsigned gpu_index, unsigned window_ms, struct GpuSample* samples, unsigned capacity)
+{
+    const auto gpu = ensureApi() ? api->getGPU(gpu_index) : nullptr;
+    const auto history = gpu ? gpu->getHistory() : nullptr;
+    if (!samples || !history) {
+        return 0;
+    }
+
+    std::vector<GpuSample> found;
+    history->getSamples(window_start(window_ms), ULLONG_MAX, found);
+    const auto count = (std::min)(static_cast<unsigned>(found.size()), capacity);
+    std::copy(found.end() - count, found.end(), samples);
+    return count;
+}
+
+unsigned get_archived_samples(unsigned gpu_index, unsigned window_ms, struct GpuSample* samples, unsigned capacity)
+{
+    const auto gpu = ensureApi() ? api->getGPU(gpu_index) : nullptr;
+    const auto history = gpu ? gpu->getHistory() : nullptr;
+    const auto archive = history ? history->getArchive() : nullptr;
+    if (!samples || !archive) {
+        return 0;
+    }
+
+    std::vector<GpuSample> found;
+    archive->getSamples(window_start(window_ms), ULLONG_MAX, found);
+    const auto count = (std::min)(static_cast<unsigned>(found.size()), capacity);
+    std::copy(found.end() - count, found.end(), samples);
+    return count;
+}
+
+bool get_history_aggregate(unsigned gpu_index, unsigned resolution, unsigned window_ms, struct GpuSampleAggregate* aggregate)
+{
+    const auto gpu = ensureApi() ? api->getGPU(gpu_index) : nullptr;
+    const auto history = gpu ? gpu->getHistory() : nullptr;
+    return aggregate && history && resolution < GPU_HISTORY_RESOLUTION_COUNT &&
+        history->aggregate(static_cast<GPU_HISTORY_RESOLUTION>(resolution), window_start(window_ms), ULLONG_MAX, *aggregate);
+}
+
+bool start_column_log(const char* path)
+{
+    if (!path || !ensureApi()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(api_mutex);
+    if (column_log) {
+        return false;
+    }
+
+    auto log = std::make_shared<GpuColumnLogWriter>();
+    if (!log->open(path) || !api->setColumnLog(log)) {
+        return false;
+    }
+    column_log = std::move(log);
+    return true;
+}
+
+bool stop_column_log()
+{
+    if (!ensureApi()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(api_mutex);
+    if (!column_log) {
+        return false;
+    }
+
+    // A poll that already picked up the log may still append to it, which
+    // either makes it into the file or is dropped once it's closed.
+    api->setColumnLog(nullptr);
+    const auto success = column_log->close();
+    column_log.reset();
+    return success;
+}
+
 bool overclock(unsigned gpu_index, unsigned area, float new_delta)
 {
     return fetch_with_gpu<bool>(gpu_index, [&](auto gpu) -> bool {
@@ -160,11 +571,132 @@ bool overclock(unsigned gpu_index, unsigned area, float new_delta)
     });
 }
 
+bool set_change_threshold(unsigned gpu_index, unsigned metric, float threshold)
+{
+    if (!ensureApi() || metric >= GPU_METRIC_COUNT) {
+        return false;
+    }
+
+    const auto gpu = api->getGPU(gpu_index);
+    return gpu && gpu->setChangeThreshold(static_cast<GPU_METRIC>(metric), threshold);
+}
+
+unsigned subscribe(unsigned gpu_index, unsigned metric, unsigned condition, float threshold, gpu_metric_callback callback, void* user_data)
+{
+    if (!ensureApi() || metric >= GPU_METRIC_COUNT || !callback) {
+        return 0;
+    }
+
+    return api->subscribe(gpu_index, static_cast<GPU_METRIC>(metric), static_cast<GPU_METRIC_CONDITION>(condition), threshold,
+        [callback, user_data](unsigned gpuIndex, GPU_METRIC metric, float value) {
+        callback(gpuIndex, metric, value, user_data);
+    });
+}
+
+bool unsubscribe(unsigned subscription)
+{
+    return ensureApi() && api->unsubscribe(subscription);
+}
+
+bool start_sampler(unsigned interval_ms)
+{
+    return ensureApi() && api->startSampler(std::chrono::milliseconds(interval_ms));
+}
+
+void stop_sampler()
+{
+    if (ensureApi()) {
+        api->stopSampler();
+    }
+}
+
+bool start_scheduler()
+{
+    if (!ensureApi() || !api->startScheduler()) {
+        return false;
+    }
+
+    scheduler_running = true;
+    return true;
+}
+
+void stop_scheduler()
+{
+    if (ensureApi()) {
+        scheduler_running = false;
+        api->stopScheduler();
+    }
+}
+
+bool start_publisher(unsigned interval_ms, const char* name)
+{
+    if (!ensureApi()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(api_mutex);
+    if (!publisher) {
+        publisher = std::make_unique<GpuSharedTelemetryPublisher>();
+    }
+    return publisher->start(*api, std::chrono::milliseconds(interval_ms), name ? name : GPU_SHARED_TELEMETRY_NAME);
+}
+
+void stop_publisher()
+{
+    std::lock_guard<std::mutex> lock(api_mutex);
+    if (publisher) {
+        publisher->stop();
+    }
+}
+
+bool connect_broker(const char* pipe_name)
+{
+    auto client = std::make_shared<GpuBrokerClient>();
+    if (!client->connect(pipe_name ? pipe_name : GPU_BROKER_PIPE_NAME)) {
+        return false;
+    }
+
+    std::atomic_store(&broker, client);
+    broker_connected = true;
+    return true;
+}
+
+void disconnect_broker()
+{
+    broker_connected = false;
+    std::atomic_store(&broker, std::shared_ptr<GpuBrokerClient>());
+}
+
 bool init_simple_api()
 {
     return ensureApi();
 }
 
+void set_call_stats_enabled(bool enabled)
+{
+    NvidiaApi::setCallStatsEnabled(enabled);
+}
+
+bool get_call_stats(unsigned function, NvidiaCallStats* stats)
+{
+    return stats && function < NVIDIA_FUNCTION_COUNT && NvidiaApi::getCallStats(static_cast<NVIDIA_FUNCTION>(function), *stats);
+}
+
+void reset_call_stats()
+{
+    NvidiaApi::resetCallStats();
+}
+
+bool get_scheduler_stats(GpuSchedulerStats* stats)
+{
+    if (!stats || !ensureApi()) {
+        return false;
+    }
+
+    *stats = api->getSchedulerStats();
+    return true;
+}
+
 bool get_name(unsigned gpu_index, char name[NVIDIA_SHORT_STRING_SIZE])
 {
     if (name) {
@@ -12,6 +12,9 @@ extern "C" {
 
     NVLIB_EXPORTED bool init_simple_api();
     NVLIB_EXPORTED unsigned get_gpu_count();
+    /**
+     * The index of the GPU with the given ID, or UINT_MAX if there's none.
+     */
     NVLIB_EXPORTED unsigned get_index_for_GPUID(unsigned long GPUID);
 
     NVLIB_EXPORTED bool get_name(unsigned gpu_index, char name[NVIDIA_SHORT_STRING_SIZE]);
@@ -27,7 +30,139 @@ extern "C" {
     NVLIB_EXPORTED struct GpuUsage get_usages(unsigned gpu_index);
     NVLIB_EXPORTED struct GpuOverclockProfile get_overclock_profile(unsigned gpu_index);
 
+    /**
+     * Get every value for a GPU from the same poll in a single call.
+     */
+    NVLIB_EXPORTED bool get_snapshot(unsigned gpu_index, struct GpuSnapshot* snapshot);
+    /**
+     * Get snapshots for the first `capacity` GPUs, entry N being GPU index N.
+     * Returns the number of entries filled in. GPUs that couldn't be polled
+     * have their entry's `valid` flag cleared. If any GPU's data is stale,
+     * they're all polled together, see NvidiaApi::pollAll.
+     */
+    NVLIB_EXPORTED unsigned get_all_snapshots(struct GpuSnapshot* snapshots, unsigned capacity);
+    /**
+     * Get the compact record of the latest poll of a GPU, see GpuSample.
+     */
+    NVLIB_EXPORTED bool get_sample(unsigned gpu_index, struct GpuSample* sample);
+
+    /**
+     * Versions of the getters for callers that need data no older than
+     * `max_age_us` microseconds. The GPU is only polled if the values asked
+     * for are older than that, and then only for those values, with threads
+     * asking at the same time sharing the poll. Unless `age_us` is null, it
+     * receives how old the returned data is, or UINT_MAX if there is none.
+     *
+     * In client mode the broker is asked to poll instead, and the age is that
+     * of its latest poll.
+     */
+    NVLIB_EXPORTED float get_voltage_max_age(unsigned gpu_index, unsigned max_age_us, unsigned* age_us);
+    NVLIB_EXPORTED float get_temperature_max_age(unsigned gpu_index, unsigned max_age_us, unsigned* age_us);
+    NVLIB_EXPORTED struct GpuClocks get_clocks_max_age(unsigned gpu_index, unsigned max_age_us, unsigned* age_us);
+    NVLIB_EXPORTED struct GpuUsage get_usages_max_age(unsigned gpu_index, unsigned max_age_us, unsigned* age_us);
+    NVLIB_EXPORTED struct GpuOverclockProfile get_overclock_profile_max_age(unsigned gpu_index, unsigned max_age_us, unsigned* age_us);
+    NVLIB_EXPORTED bool get_snapshot_max_age(unsigned gpu_index, unsigned max_age_us, struct GpuSnapshot* snapshot, unsigned* age_us);
+    NVLIB_EXPORTED bool get_sample_max_age(unsigned gpu_index, unsigned max_age_us, struct GpuSample* sample, unsigned* age_us);
+
+    /**
+     * Start keeping a history for every GPU. `capacity` gives the number of
+     * records to keep for each GPU_HISTORY_RESOLUTION, or null for defaults.
+     * With a non-zero `archive_kb`, every sample is also kept in a compressed
+     * archive of up to that many kilobytes per GPU.
+     */
+    NVLIB_EXPORTED bool enable_history(const unsigned capacity[GPU_HISTORY_RESOLUTION_COUNT], unsigned archive_kb);
+    /**
+     * Get up to `capacity` raw samples from the last `window_ms` milliseconds,
+     * the newest ones if there are more. Returns the number of samples.
+     */
+    NVLIB_EXPORTED unsigned get_history_samples(unsigned gpu_index, unsigned window_ms, struct GpuSample* samples, unsigned capacity);
+    /**
+     * Like get_history_samples, but decoded from the compressed archive.
+     * Timestamps are rounded down to the millisecond.
+     */
+    NVLIB_EXPORTED unsigned get_archived_samples(unsigned gpu_index, unsigned window_ms, struct GpuSample* samples, unsigned capacity);
+    /**
+     * Get statistics for the last `window_ms` milliseconds, computed from the
+     * records at the given GPU_HISTORY_RESOLUTION.
+     */
+    NVLIB_EXPORTED bool get_history_aggregate(unsigned gpu_index, unsigned resolution, unsigned window_ms, struct GpuSampleAggregate* aggregate);
+
+    /**
+     * Log every sample of every GPU to a columnar binary file, see
+     * GpuColumnLogWriter. The file is only indexed once the log is stopped,
+     * before that GpuColumnLogReader finds the blocks by following them.
+     */
+    NVLIB_EXPORTED bool start_column_log(const char* path);
+    NVLIB_EXPORTED bool stop_column_log();
+
     NVLIB_EXPORTED bool overclock(unsigned gpu_index, unsigned clock, float new_delta);
+    /**
+     * Only report a GPU_METRIC in `GpuSnapshot::changedMetrics` once it has
+     * moved by at least `threshold` since it was last reported.
+     */
+    NVLIB_EXPORTED bool set_change_threshold(unsigned gpu_index, unsigned metric, float threshold);
+
+    typedef void (*gpu_metric_callback)(unsigned gpu_index, unsigned metric, float value, void* user_data);
+    /**
+     * Call `callback` whenever the GPU_METRIC `metric` goes above or below
+     * `threshold`, as given by the GPU_METRIC_CONDITION `condition`. The
+     * callback runs on a separate thread, see NvidiaApi::subscribe. Returns
+     * an ID for unsubscribe, or 0 on failure.
+     *
+     * Subscriptions are only evaluated when the GPU is polled, by the
+     * getters, the sampler or the scheduler.
+     */
+    NVLIB_EXPORTED unsigned subscribe(unsigned gpu_index, unsigned metric, unsigned condition, float threshold, gpu_metric_callback callback, void* user_data);
+    NVLIB_EXPORTED bool unsubscribe(unsigned subscription);
+    /**
+     * Poll every GPU in the background every `interval_ms` milliseconds.
+     */
+    NVLIB_EXPORTED bool start_sampler(unsigned interval_ms);
+    NVLIB_EXPORTED void stop_sampler();
+    /**
+     * Refresh each part of every GPU's data in the background, only as often
+     * as it changes, see NvidiaApi::startScheduler. While it runs, the getters
+     * without a max age return whatever it last polled instead of polling
+     * data older than 250ms themselves.
+     */
+    NVLIB_EXPORTED bool start_scheduler();
+    NVLIB_EXPORTED void stop_scheduler();
+    /**
+     * Publish the latest data of every GPU to shared memory, checking for new
+     * polls every `interval_ms` milliseconds, so other processes can read it
+     * through shared_telemetry_api.h without polling the driver themselves.
+     * `name` is the segment name, or null for the default.
+     */
+    NVLIB_EXPORTED bool start_publisher(unsigned interval_ms, const char* name);
+    NVLIB_EXPORTED void stop_publisher();
+
+    /**
+     * Switch to client mode, where the GPU getters, the snapshots and
+     * overclock() go through a broker process instead of the driver, see
+     * GpuBrokerServer. `pipe_name` is the broker's pipe, or null for the
+     * default. Everything else still uses this process' own NvidiaApi.
+     */
+    NVLIB_EXPORTED bool connect_broker(const char* pipe_name);
+    NVLIB_EXPORTED void disconnect_broker();
+
+    /**
+     * Turn collecting statistics for driver calls on or off. It's off by
+     * default.
+     */
+    NVLIB_EXPORTED void set_call_stats_enabled(bool enabled);
+    /**
+     * Get the statistics for one driver entry point, `function` being a value
+     * from the NVIDIA_FUNCTION enum.
+     */
+    NVLIB_EXPORTED bool get_call_stats(unsigned function, struct NvidiaCallStats* stats);
+    NVLIB_EXPORTED void reset_call_stats();
+
+    /**
+     * How many driver calls the background poll scheduler has made since
+     * start_scheduler, next to what polling everything at a fixed rate would
+     * have made.
+     */
+    NVLIB_EXPORTED bool get_scheduler_stats(struct GpuSchedulerStats* stats);
 
 #ifdef __cplusplus
 }
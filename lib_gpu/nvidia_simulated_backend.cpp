@@ -0,0 +1,469 @@
+#include "pch.h"
+#include "nvidia_interface.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+
+/**
+ * A simulated driver for benchmarking and testing without a GPU.
+ *
+ * Every GPU reports the same plausible card, with clocks, usage, voltage and
+ * temperature that move a little on every call so that consecutive polls
+ * don't return identical data. Overclocks, power limits and thermal limits
+ * can be set and are reported back. Every call takes at least the configured
+ * latency, which is spent busy-waiting since the real driver calls are
+ * synchronous too.
+ */
+
+namespace lib_gpu {
+
+struct SimulatedGPU
+{
+    std::mutex mutex;
+    unsigned long gpuId;
+    // Frequency deltas in kHz, indexed by NVIDIA_CLOCK_SYSTEM
+    INT32 clockDeltas[NVIDIA_CLOCK_SYSTEM_SHADER + 1];
+    // Voltage delta in µV
+    INT32 overvoltDelta;
+    // Power limit in thousandths of a percent
+    UINT32 powerLimit;
+    // Thermal limit in 256ths of a degree
+    UINT32 thermalLimit;
+    UINT32 thermalFlags;
+    std::atomic<UINT32> tick;
+};
+
+static SimulatedGPU simulated_gpus[NVIDIA_MAX_PHYSICAL_GPUS];
+static std::atomic<unsigned> simulated_gpu_count(0);
+static std::atomic<unsigned> simulated_latency_us(0);
+
+const UINT32 SIMULATED_CORE_BASE = 1'500'000;
+const UINT32 SIMULATED_CORE_BOOST = 1'800'000;
+const UINT32 SIMULATED_MEMORY_BASE = 3'500'000;
+const UINT32 SIMULATED_VOLTAGE = 1'000'000;
+const UINT32 SIMULATED_POWER_DEFAULT = 100'000;
+const UINT32 SIMULATED_THERMAL_DEFAULT = 83 * 256;
+
+#pragma region Helpers
+
+void simulateLatency()
+{
+    const auto latency = std::chrono::microseconds(simulated_latency_us.load(std::memory_order_relaxed));
+    if (latency.count() == 0) {
+        return;
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + latency;
+    while (std::chrono::steady_clock::now() < deadline) {
+    }
+}
+
+SimulatedGPU* findGPU(NV_PHYSICAL_GPU_HANDLE handle)
+{
+    const auto gpu = reinterpret_cast<SimulatedGPU*>(handle);
+    const auto count = simulated_gpu_count.load(std::memory_order_relaxed);
+    if (gpu < simulated_gpus || gpu >= simulated_gpus + count) {
+        return nullptr;
+    }
+    return gpu;
+}
+
+NV_PHYSICAL_GPU_HANDLE handleFor(SimulatedGPU& gpu)
+{
+    return reinterpret_cast<NV_PHYSICAL_GPU_HANDLE>(&gpu);
+}
+
+// A value in [0, 16) that changes on every call, to make readings fluctuate
+UINT32 nextWobble(SimulatedGPU& gpu)
+{
+    return gpu.tick.fetch_add(1, std::memory_order_relaxed) % 16;
+}
+
+void copyString(char* destination, const char* source)
+{
+    strncpy_s(destination, NVIDIA_SHORT_STRING_SIZE, source, _TRUNCATE);
+}
+
+void resetGPU(SimulatedGPU& gpu, unsigned index)
+{
+    std::lock_guard<std::mutex> lock(gpu.mutex);
+    gpu.gpuId = 0x100 + index;
+    memset(gpu.clockDeltas, 0, sizeof(gpu.clockDeltas));
+    gpu.overvoltDelta = 0;
+    gpu.powerLimit = SIMULATED_POWER_DEFAULT;
+    gpu.thermalLimit = SIMULATED_THERMAL_DEFAULT;
+    gpu.thermalFlags = 0;
+    gpu.tick = 0;
+}
+
+#pragma endregion
+
+#pragma region Simulated functions
+
+#define SIMULATED_GPU_OR_FAIL(_handle, _name) \
+    simulateLatency(); \
+    auto _name = findGPU(_handle); \
+    if (_name == nullptr) { return NVAPI_EXPECTED_PHYSICAL_GPU_HANDLE; }
+
+static NV_STATUS simulated_NvidiaInit()
+{
+    simulateLatency();
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_NvidiaUnload()
+{
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_GetPhysicalGPUHandles(NV_PHYSICAL_GPU_HANDLE* handle_buf, unsigned long* handle_count)
+{
+    simulateLatency();
+    if (!handle_buf || !handle_count) {
+        return NVAPI_INVALID_ARGUMENT;
+    }
+
+    const auto count = simulated_gpu_count.load(std::memory_order_relaxed);
+    if (count == 0) {
+        return NVAPI_NVIDIA_DEVICE_NOT_FOUND;
+    }
+
+    for (auto i = 0u; i < count; i++) {
+        handle_buf[i] = handleFor(simulated_gpus[i]);
+    }
+    *handle_count = count;
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_GetVersionString(char* string)
+{
+    simulateLatency();
+    copyString(string, "Simulated NVAPI");
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_GetPhysicalGPUfromGPUID(unsigned long gpu_id, NV_PHYSICAL_GPU_HANDLE* handle)
+{
+    simulateLatency();
+    const auto count = simulated_gpu_count.load(std::memory_order_relaxed);
+    for (auto i = 0u; i < count; i++) {
+        if (simulated_gpus[i].gpuId == gpu_id) {
+            *handle = handleFor(simulated_gpus[i]);
+            return NVAPI_OK;
+        }
+    }
+    return NVAPI_INVALID_ARGUMENT;
+}
+
+static NV_STATUS simulated_GetGPUIDFromPhysicalGPU(NV_PHYSICAL_GPU_HANDLE handle, unsigned long* gpu_id)
+{
+    SIMULATED_GPU_OR_FAIL(handle, gpu);
+    *gpu_id = gpu->gpuId;
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_GetPstates20(NV_PHYSICAL_GPU_HANDLE handle, NVIDIA_GPU_PSTATES20_V2* pstates)
+{
+    SIMULATED_GPU_OR_FAIL(handle, gpu);
+    std::lock_guard<std::mutex> lock(gpu->mutex);
+
+    REINIT_NVIDIA_STRUCT((*pstates));
+    pstates->state_count = 1;
+    pstates->clock_count = 2;
+    pstates->voltage_count = 0;
+
+    auto& state = pstates->states[0];
+    state.state_num = 0;
+    state.flags = 1;
+
+    auto& core = state.clocks[0];
+    core.domain = NVIDIA_CLOCK_SYSTEM_GPU;
+    core.type = 1;
+    core.freq_delta = NVIDIA_DELTA_ENTRY{ gpu->clockDeltas[NVIDIA_CLOCK_SYSTEM_GPU], -200'000, 200'000 };
+    core.min_or_single_freq = 300'000;
+    core.max_freq = SIMULATED_CORE_BOOST;
+    core.voltage_domain = 0;
+    core.min_volt = 800'000;
+    core.max_volt = 1'100'000;
+
+    auto& memory = state.clocks[1];
+    memory.domain = NVIDIA_CLOCK_SYSTEM_MEMORY;
+    memory.type = 0;
+    memory.freq_delta = NVIDIA_DELTA_ENTRY{ gpu->clockDeltas[NVIDIA_CLOCK_SYSTEM_MEMORY], -500'000, 1'000'000 };
+    memory.min_or_single_freq = SIMULATED_MEMORY_BASE;
+
+    pstates->over_volt.voltage_count = 1;
+    auto& overvolt = pstates->over_volt.voltages[0];
+    overvolt.domain = 0;
+    overvolt.flags = 1;
+    overvolt.voltage = SIMULATED_VOLTAGE;
+    overvolt.volt_delta = NVIDIA_DELTA_ENTRY{ gpu->overvoltDelta, 0, 100'000 };
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_SetPstates20(NV_PHYSICAL_GPU_HANDLE handle, NVIDIA_GPU_PSTATES20_V2* pstates)
+{
+    SIMULATED_GPU_OR_FAIL(handle, gpu);
+    if (pstates->state_count > 1 || pstates->clock_count > 8 || pstates->over_volt.voltage_count > 4) {
+        return NVAPI_INVALID_ARGUMENT;
+    }
+
+    std::lock_guard<std::mutex> lock(gpu->mutex);
+    for (auto i = 0u; i < pstates->clock_count; i++) {
+        const auto& clock = pstates->states[0].clocks[i];
+        if (clock.domain > NVIDIA_CLOCK_SYSTEM_SHADER) {
+            return NVAPI_INVALID_ARGUMENT;
+        }
+        gpu->clockDeltas[clock.domain] = clock.freq_delta.value;
+    }
+    for (auto i = 0u; i < pstates->over_volt.voltage_count; i++) {
+        gpu->overvoltDelta = pstates->over_volt.voltages[i].volt_delta.value;
+    }
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_GetAllClockFrequencies(NV_PHYSICAL_GPU_HANDLE handle, NVIDIA_CLOCK_FREQUENCIES* frequencies)
+{
+    SIMULATED_GPU_OR_FAIL(handle, gpu);
+    const auto type = frequencies->clock_type;
+    if (type >= NVIDIA_CLOCK_FREQUENCY_TYPE_LAST) {
+        return NVAPI_INVALID_ARGUMENT;
+    }
+
+    std::lock_guard<std::mutex> lock(gpu->mutex);
+    REINIT_NVIDIA_STRUCT((*frequencies));
+    frequencies->clock_type = type;
+
+    auto& core = frequencies->entries[NVIDIA_CLOCK_SYSTEM_GPU];
+    auto& memory = frequencies->entries[NVIDIA_CLOCK_SYSTEM_MEMORY];
+    core.present = 1;
+    memory.present = 1;
+
+    switch (type) {
+    case NVIDIA_CLOCK_FREQUENCY_TYPE_CURRENT:
+        core.freq = SIMULATED_CORE_BOOST + gpu->clockDeltas[NVIDIA_CLOCK_SYSTEM_GPU] + nextWobble(*gpu) * 13'000;
+        memory.freq = SIMULATED_MEMORY_BASE + gpu->clockDeltas[NVIDIA_CLOCK_SYSTEM_MEMORY];
+        break;
+    case NVIDIA_CLOCK_FREQUENCY_TYPE_BASE:
+        core.freq = SIMULATED_CORE_BASE + gpu->clockDeltas[NVIDIA_CLOCK_SYSTEM_GPU];
+        memory.freq = SIMULATED_MEMORY_BASE + gpu->clockDeltas[NVIDIA_CLOCK_SYSTEM_MEMORY];
+        break;
+    default:
+        core.freq = SIMULATED_CORE_BOOST + gpu->clockDeltas[NVIDIA_CLOCK_SYSTEM_GPU];
+        memory.freq = SIMULATED_MEMORY_BASE + gpu->clockDeltas[NVIDIA_CLOCK_SYSTEM_MEMORY];
+        break;
+    }
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_GetDynamicPStates(NV_PHYSICAL_GPU_HANDLE handle, NVIDIA_DYNAMIC_PSTATES* dynamic_pstates)
+{
+    SIMULATED_GPU_OR_FAIL(handle, gpu);
+    const auto wobble = nextWobble(*gpu);
+
+    REINIT_NVIDIA_STRUCT((*dynamic_pstates));
+    dynamic_pstates->flags = 1;
+    dynamic_pstates->pstates[NVIDIA_DYNAMIC_PSTATES_SYSTEM_GPU] = { 1, 80 + wobble };
+    dynamic_pstates->pstates[NVIDIA_DYNAMIC_PSTATES_SYSTEM_FB] = { 1, 40 + wobble / 2 };
+    dynamic_pstates->pstates[NVIDIA_DYNAMIC_PSTATES_SYSTEM_VID] = { 1, 0 };
+    dynamic_pstates->pstates[NVIDIA_DYNAMIC_PSTATES_SYSTEM_BUS] = { 1, 10 + wobble / 4 };
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_GetPerfClocks(NV_PHYSICAL_GPU_HANDLE handle, unsigned long entry, NVIDIA_GPU_PERF_TABLE* perf_table)
+{
+    SIMULATED_GPU_OR_FAIL(handle, gpu);
+    REINIT_NVIDIA_STRUCT((*perf_table));
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_GpuClientPowerPoliciesGetInfo(NV_PHYSICAL_GPU_HANDLE handle, NVIDIA_GPU_POWER_POLICIES_INFO* policies_info)
+{
+    SIMULATED_GPU_OR_FAIL(handle, gpu);
+    REINIT_NVIDIA_STRUCT((*policies_info));
+    policies_info->flags = 1 | (1 << 8);
+    auto& entry = policies_info->entries[0];
+    entry.pstate = 0;
+    entry.min_power = 50'000;
+    entry.default_power = SIMULATED_POWER_DEFAULT;
+    entry.max_power = 120'000;
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_GpuClientPowerPoliciesGetStatus(NV_PHYSICAL_GPU_HANDLE handle, NVIDIA_GPU_POWER_POLICIES_STATUS* policies_status)
+{
+    SIMULATED_GPU_OR_FAIL(handle, gpu);
+    std::lock_guard<std::mutex> lock(gpu->mutex);
+    REINIT_NVIDIA_STRUCT((*policies_status));
+    policies_status->count = 1;
+    policies_status->entries[0].pstate = 0;
+    policies_status->entries[0].power = gpu->powerLimit;
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_GpuClientPowerPoliciesSetStatus(NV_PHYSICAL_GPU_HANDLE handle, NVIDIA_GPU_POWER_POLICIES_STATUS* policies_status)
+{
+    SIMULATED_GPU_OR_FAIL(handle, gpu);
+    std::lock_guard<std::mutex> lock(gpu->mutex);
+    for (auto i = 0u; i < policies_status->count && i < 4; i++) {
+        if (policies_status->entries[i].pstate == 0) {
+            gpu->powerLimit = policies_status->entries[i].power;
+        }
+    }
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_GetFullName(NV_PHYSICAL_GPU_HANDLE handle, char* name_buf)
+{
+    SIMULATED_GPU_OR_FAIL(handle, gpu);
+    copyString(name_buf, "Simulated GeForce GPU");
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_GpuGetVoltageDomainsStatus(NV_PHYSICAL_GPU_HANDLE handle, NVIDIA_GPU_VOLTAGE_DOMAINS_STATUS* domains_status)
+{
+    SIMULATED_GPU_OR_FAIL(handle, gpu);
+    std::lock_guard<std::mutex> lock(gpu->mutex);
+    REINIT_NVIDIA_STRUCT((*domains_status));
+    domains_status->count = 1;
+    domains_status->entries[0].voltage_domain = 0;
+    domains_status->entries[0].current_voltage = SIMULATED_VOLTAGE + gpu->overvoltDelta + nextWobble(*gpu) * 6'250;
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_GpuGetThermalSettings(NV_PHYSICAL_GPU_HANDLE handle, NVIDIA_THERMAL_TARGET sensor_index, NVIDIA_GPU_THERMAL_SETTINGS_V2* thermal_settings)
+{
+    SIMULATED_GPU_OR_FAIL(handle, gpu);
+    if (sensor_index != NVIDIA_THERMAL_TARGET_ALL && sensor_index != NVIDIA_THERMAL_TARGET_GPU) {
+        return NVAPI_INVALID_ARGUMENT;
+    }
+
+    REINIT_NVIDIA_STRUCT((*thermal_settings));
+    thermal_settings->count = 1;
+    auto& sensor = thermal_settings->sensor[0];
+    sensor.controller = NVIDIA_THERMAL_CONTROLLER_GPU_INTERNAL;
+    sensor.default_minimum = 0;
+    sensor.default_max = 127;
+    sensor.current_temp = 60 + static_cast<INT32>(nextWobble(*gpu) / 2);
+    sensor.target = NVIDIA_THERMAL_TARGET_GPU;
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_GpuGetSerialNumber(NV_PHYSICAL_GPU_HANDLE handle, char* serial_buf)
+{
+    SIMULATED_GPU_OR_FAIL(handle, gpu);
+    // Serial numbers are raw bytes, which the library hex-encodes
+    memset(serial_buf, 0, NVIDIA_SHORT_STRING_SIZE);
+    for (auto i = 0u; i < 8; i++) {
+        serial_buf[i] = static_cast<char>(0x10 + i + gpu->gpuId);
+    }
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_GpuClientThermalPoliciesGetInfo(NV_PHYSICAL_GPU_HANDLE handle, NVIDIA_GPU_THERMAL_POLICIES_INFO_V2* thermal_info)
+{
+    SIMULATED_GPU_OR_FAIL(handle, gpu);
+    REINIT_NVIDIA_STRUCT((*thermal_info));
+    thermal_info->flags = 1 | (1 << 8);
+    auto& entry = thermal_info->entries[0];
+    entry.controller = NVIDIA_THERMAL_CONTROLLER_GPU_INTERNAL;
+    entry.min = 65 * 256;
+    entry.default = SIMULATED_THERMAL_DEFAULT;
+    entry.max = 90 * 256;
+    entry.defaultFlags = 0;
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_GpuClientThermalPoliciesGetStatus(NV_PHYSICAL_GPU_HANDLE handle, NVIDIA_GPU_THERMAL_POLICIES_STATUS_V2* thermal_status)
+{
+    SIMULATED_GPU_OR_FAIL(handle, gpu);
+    std::lock_guard<std::mutex> lock(gpu->mutex);
+    REINIT_NVIDIA_STRUCT((*thermal_status));
+    thermal_status->count = 1;
+    auto& entry = thermal_status->entries[0];
+    entry.controller = NVIDIA_THERMAL_CONTROLLER_GPU_INTERNAL;
+    entry.value = gpu->thermalLimit;
+    entry.flags = gpu->thermalFlags;
+    return NVAPI_OK;
+}
+
+static NV_STATUS simulated_GpuClientThermalPoliciesSetStatus(NV_PHYSICAL_GPU_HANDLE handle, NVIDIA_GPU_THERMAL_POLICIES_STATUS_V2* thermal_status)
+{
+    SIMULATED_GPU_OR_FAIL(handle, gpu);
+    std::lock_guard<std::mutex> lock(gpu->mutex);
+    for (auto i = 0u; i < thermal_status->count && i < 4; i++) {
+        const auto& entry = thermal_status->entries[i];
+        if (entry.controller == NVIDIA_THERMAL_CONTROLLER_GPU_INTERNAL) {
+            gpu->thermalLimit = entry.value;
+            gpu->thermalFlags = entry.flags;
+        }
+    }
+    return NVAPI_OK;
+}
+
+#undef SIMULATED_GPU_OR_FAIL
+
+#pragma endregion
+
+static void* simulated_query(UINT32 id)
+{
+#define SIMULATED_FUNCTION(_name) case NVIDIA_FUNCTION_##_name: return reinterpret_cast<void*>(&simulated_##_name)
+    for (auto i = 0u; i < NVIDIA_FUNCTION_COUNT; i++) {
+        const auto function = static_cast<NVIDIA_FUNCTION>(i);
+        if (get_function_id(function) != id) {
+            continue;
+        }
+
+        switch (function) {
+            SIMULATED_FUNCTION(NvidiaInit);
+            SIMULATED_FUNCTION(NvidiaUnload);
+            SIMULATED_FUNCTION(GetPhysicalGPUHandles);
+            SIMULATED_FUNCTION(GetVersionString);
+            SIMULATED_FUNCTION(GetPhysicalGPUfromGPUID);
+            SIMULATED_FUNCTION(GetGPUIDFromPhysicalGPU);
+            SIMULATED_FUNCTION(GetPstates20);
+            SIMULATED_FUNCTION(SetPstates20);
+            SIMULATED_FUNCTION(GetAllClockFrequencies);
+            SIMULATED_FUNCTION(GetDynamicPStates);
+            SIMULATED_FUNCTION(GetPerfClocks);
+            SIMULATED_FUNCTION(GpuClientPowerPoliciesGetInfo);
+            SIMULATED_FUNCTION(GpuClientPowerPoliciesGetStatus);
+            SIMULATED_FUNCTION(GetFullName);
+            SIMULATED_FUNCTION(GpuGetVoltageDomainsStatus);
+            SIMULATED_FUNCTION(GpuGetThermalSettings);
+            SIMULATED_FUNCTION(GpuGetSerialNumber);
+            SIMULATED_FUNCTION(GpuClientPowerPoliciesSetStatus);
+            SIMULATED_FUNCTION(GpuClientThermalPoliciesGetInfo);
+            SIMULATED_FUNCTION(GpuClientThermalPoliciesGetStatus);
+            SIMULATED_FUNCTION(GpuClientThermalPoliciesSetStatus);
+        default:
+            return nullptr;
+        }
+    }
+#undef SIMULATED_FUNCTION
+
+    return nullptr;
+}
+
+int init_library_with_simulation(unsigned gpu_count, unsigned call_latency_us)
+{
+    if (gpu_count == 0 || gpu_count > NVIDIA_MAX_PHYSICAL_GPUS) {
+        return false;
+    }
+
+    for (auto i = 0u; i < gpu_count; i++) {
+        resetGPU(simulated_gpus[i], i);
+    }
+    simulated_gpu_count = gpu_count;
+    simulated_latency_us = call_latency_us;
+
+    return init_library_with_backend(simulated_query);
+}
+
+void set_simulation_latency(unsigned call_latency_us)
+{
+    simulated_latency_us = call_latency_us;
+}
+
+}
\ No newline at end of file
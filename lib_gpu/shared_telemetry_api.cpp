@@ -0,0 +1,183 @@
+#include "pch.h"
+#include "shared_telemetry_api.h"
+#include "GpuSharedTelemetry.h"
+#include <climits>
+#include <mutex>
+
+namespace lib_gpu {
+namespace shared_telemetry_api {
+
+// Swapped atomically so the getters don't have to take the mutex, which only
+// serializes opening and closing.
+static std::shared_ptr<GpuSharedTelemetryReader> reader;
+static std::mutex reader_mutex;
+
+std::shared_ptr<GpuSharedTelemetryReader> openReaderLocked(const char* name)
+{
+    auto opened = std::make_shared<GpuSharedTelemetryReader>();
+    if (!opened->open(name ? name : GPU_SHARED_TELEMETRY_NAME)) {
+        return nullptr;
+    }
+
+    std::atomic_store(&reader, opened);
+    return opened;
+}
+
+std::shared_ptr<GpuSharedTelemetryReader> ensureReader()
+{
+    auto current = std::atomic_load(&reader);
+    if (!current) {
+        std::lock_guard<std::mutex> lock(reader_mutex);
+        current = std::atomic_load(&reader);
+        if (!current) {
+            current = openReaderLocked(nullptr);
+        }
+    }
+    return current;
+}
+
+template <typename T, typename F>
+T fetch_with_record(unsigned gpu_index, F fetcher)
+{
+    const auto current = ensureReader();
+    GpuSharedTelemetryRecord record;
+    return current && current->read(gpu_index, record) ? fetcher(record) : T{};
+}
+
+bool telemetry_open(const char* name)
+{
+    std::lock_guard<std::mutex> lock(reader_mutex);
+    return openReaderLocked(name) != nullptr;
+}
+
+void telemetry_close()
+{
+    std::lock_guard<std::mutex> lock(reader_mutex);
+    std::atomic_store(&reader, std::shared_ptr<GpuSharedTelemetryReader>());
+}
+
+unsigned telemetry_get_publisher_age_ms()
+{
+    const auto current = ensureReader();
+    if (!current) {
+        return UINT_MAX;
+    }
+
+    const auto age = current->getPublisherAge().count();
+    return age < UINT_MAX ? static_cast<unsigned>(age) : UINT_MAX;
+}
+
+unsigned telemetry_get_gpu_count()
+{
+    const auto current = ensureReader();
+    return current ? current->getGPUCount() : 0;
+}
+
+unsigned telemetry_get_index_for_GPUID(unsigned long GPUID)
+{
+    const auto count = telemetry_get_gpu_count();
+    for (auto i = 0u; i < count; i++) {
+        if (telemetry_getGPUID(i) == GPUID) {
+            return i;
+        }
+    }
+    return UINT_MAX;
+}
+
+bool telemetry_get_name(unsigned gpu_index, char name[NVIDIA_SHORT_STRING_SIZE])
+{
+    return name && fetch_with_record<bool>(gpu_index, [name](const GpuSharedTelemetryRecord& record) {
+        memcpy(name, record.name, NVIDIA_SHORT_STRING_SIZE);
+        return name[0] != '\0';
+    });
+}
+
+bool telemetry_get_serial_number(unsigned gpu_index, char serial[NVIDIA_SHORT_STRING_SIZE])
+{
+    return serial && fetch_with_record<bool>(gpu_index, [serial](const GpuSharedTelemetryRecord& record) {
+        memcpy(serial, record.serialNumber, NVIDIA_SHORT_STRING_SIZE);
+        return serial[0] != '\0';
+    });
+}
+
+unsigned long telemetry_getGPUID(unsigned gpu_index)
+{
+    return fetch_with_record<unsigned long>(gpu_index, [](const GpuSharedTelemetryRecord& record) {
+        return record.snapshot.GPUID;
+    });
+}
+
+float telemetry_get_voltage(unsigned gpu_index)
+{
+    return fetch_with_record<float>(gpu_index, [](const GpuSharedTelemetryRecord& record) {
+        return record.snapshot.voltage;
+    });
+}
+
+float telemetry_get_temperature(unsigned gpu_index)
+{
+    return fetch_with_record<float>(gpu_index, [](const GpuSharedTelemetryRecord& record) {
+        return record.snapshot.temperature;
+    });
+}
+
+struct GpuClocks telemetry_get_clocks(unsigned gpu_index)
+{
+    return fetch_with_record<GpuClocks>(gpu_index, [](const GpuSharedTelemetryRecord& record) {
+        return record.snapshot.clocks;
+    });
+}
+
+struct GpuClocks telemetry_get_default_clocks(unsigned gpu_index)
+{
+    return fetch_with_record<GpuClocks>(gpu_index, [](const GpuSharedTelemetryRecord& record) {
+        return record.snapshot.defaultClocks;
+    });
+}
+
+struct GpuClocks telemetry_get_base_clocks(unsigned gpu_index)
+{
+    return fetch_with_record<GpuClocks>(gpu_index, [](const GpuSharedTelemetryRecord& record) {
+        return record.snapshot.baseClocks;
+    });
+}
+
+struct GpuClocks telemetry_get_boost_clocks(unsigned gpu_index)
+{
+    return fetch_with_record<GpuClocks>(gpu_index, [](const GpuSharedTelemetryRecord& record) {
+        return record.snapshot.boostClocks;
+    });
+}
+
+struct GpuUsage telemetry_get_usages(unsigned gpu_index)
+{
+    return fetch_with_record<GpuUsage>(gpu_index, [](const GpuSharedTelemetryRecord& record) {
+        return record.snapshot.usage;
+    });
+}
+
+struct GpuOverclockProfile telemetry_get_overclock_profile(unsigned gpu_index)
+{
+    return fetch_with_record<GpuOverclockProfile>(gpu_index, [](const GpuSharedTelemetryRecord& record) {
+        return record.snapshot.overclockProfile;
+    });
+}
+
+bool telemetry_get_snapshot(unsigned gpu_index, struct GpuSnapshot* snapshot)
+{
+    return snapshot && fetch_with_record<bool>(gpu_index, [snapshot](const GpuSharedTelemetryRecord& record) {
+        *snapshot = record.snapshot;
+        return true;
+    });
+}
+
+bool telemetry_get_sample(unsigned gpu_index, struct GpuSample* sample)
+{
+    return sample && fetch_with_record<bool>(gpu_index, [sample](const GpuSharedTelemetryRecord& record) {
+        *sample = record.sample;
+        return true;
+    });
+}
+
+}
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "helpers.h"
+#include "nvidia_interface_datatypes.h"
+#include "GpuDatatypes.h"
+
+/**
+ * The simple API's getters, reading what a GpuSharedTelemetryPublisher in
+ * another process published instead of polling the driver. The segment is
+ * opened on first use, under its default name unless telemetry_open says
+ * otherwise. Getters return zeroed values if there's no publisher.
+ */
+#ifdef __cplusplus
+namespace lib_gpu {
+namespace shared_telemetry_api {
+extern "C" {
+#endif
+
+    /**
+     * Open the segment with the given name, or the default one for null.
+     */
+    NVLIB_EXPORTED bool telemetry_open(const char* name);
+    NVLIB_EXPORTED void telemetry_close();
+    /**
+     * How long ago the publisher last checked for new data, to tell whether
+     * it's still running. UINT_MAX if there's no publisher.
+     */
+    NVLIB_EXPORTED unsigned telemetry_get_publisher_age_ms();
+
+    NVLIB_EXPORTED unsigned telemetry_get_gpu_count();
+    /**
+     * The index of the GPU with the given ID, or UINT_MAX if there's none.
+     */
+    NVLIB_EXPORTED unsigned telemetry_get_index_for_GPUID(unsigned long GPUID);
+
+    NVLIB_EXPORTED bool telemetry_get_name(unsigned gpu_index, char name[NVIDIA_SHORT_STRING_SIZE]);
+    NVLIB_EXPORTED bool telemetry_get_serial_number(unsigned gpu_index, char serial[NVIDIA_SHORT_STRING_SIZE]);
+
+    NVLIB_EXPORTED unsigned long telemetry_getGPUID(unsigned gpu_index);
+    NVLIB_EXPORTED float telemetry_get_voltage(unsigned gpu_index);
+    NVLIB_EXPORTED float telemetry_get_temperature(unsigned gpu_index);
+    NVLIB_EXPORTED struct GpuClocks telemetry_get_clocks(unsigned gpu_index);
+    NVLIB_EXPORTED struct GpuClocks telemetry_get_default_clocks(unsigned gpu_index);
+    NVLIB_EXPORTED struct GpuClocks telemetry_get_base_clocks(unsigned gpu_index);
+    NVLIB_EXPORTED struct GpuClocks telemetry_get_boost_clocks(unsigned gpu_index);
+    NVLIB_EXPORTED struct GpuUsage telemetry_get_usages(unsigned gpu_index);
+    NVLIB_EXPORTED struct GpuOverclockProfile telemetry_get_overclock_profile(unsigned gpu_index);
+
+    NVLIB_EXPORTED bool telemetry_get_snapshot(unsigned gpu_index, struct GpuSnapshot* snapshot);
+    NVLIB_EXPORTED bool telemetry_get_sample(unsigned gpu_index, struct GpuSample* sample);
+
+#ifdef __cplusplus
+}
+}
+}
+#endif
\ No newline at end of file